@@ -1,21 +1,110 @@
 #include "pchray.h"
 
 #include "CLBackend.hpp"
+#include "Distributed.hpp"
+#include "MeshIO.hpp"
 
 #include <chrono>
 
 
 void setup_scene(Scene& scene);
 
-int main() {
+int main(int argc, char** argv) {
 
     try {
+        // Options, in any order: `cpu` for the native backend (default: OpenCL GPU), `lbvh` to build the
+        // BVH on the GPU, `compressed` for 8-byte quantized spheres, `frames=N` for an N-frame orbit
+        // written as images/orbit_NNNN, `timeline` for a phase trace in timeline.json, `raystats` for
+        // in-kernel ray counters, `format=ppm|png|qoi` for the image format, `hdr=pfm|exr` to also write
+        // the linear accumulation, `out=DIR` for the image directory, `multi` to split the image into tiles
+        // over every OpenCL device of the platform (`numa`: one sub-device per NUMA node), `serve=PORT` to
+        // coordinate a render over `workers=N` worker processes, `worker=HOST:PORT` to be one of them (with
+        // the backend chosen as usual), `sampler=random|sobol` for the sample sequence and `seed=N` for the
+        // frame seed; any .obj/.ply path is loaded as a mesh
+        compute::BackendType backend_type = compute::BackendType::OpenCL;
+        bool device_lbvh = false, compressed = false, timeline = false, ray_stats = false, multi = false, numa = false;
+        int frames = 0, serve_port = -1, workers = 1;
+        uint32_t seed = 0;
+        compute::SamplerType sampler = compute::SamplerType::Random;
+        std::string coordinator;
+        compute::Config::Output output;
+        std::vector<std::filesystem::path> mesh_files;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const std::string ext = std::filesystem::path(arg).extension().string();
+            if (arg == "cpu")             backend_type = compute::BackendType::CPU;
+            else if (arg == "lbvh")       device_lbvh = true;
+            else if (arg == "compressed") compressed = true;
+            else if (arg == "timeline")   timeline = true;
+            else if (arg == "raystats")   ray_stats = true;
+            else if (arg == "multi")      multi = true;
+            else if (arg == "numa")       multi = numa = true;
+            else if (arg.rfind("frames=", 0) == 0) frames = std::stoi(arg.substr(7));
+            else if (arg.rfind("format=", 0) == 0) output.format = compute::image::parse_format(arg.substr(7));
+            else if (arg.rfind("hdr=", 0) == 0)    output.hdr_format = compute::image::parse_format(arg.substr(4));
+            else if (arg.rfind("out=", 0) == 0)    output.directory = arg.substr(4);
+            else if (arg.rfind("serve=", 0) == 0)   serve_port = std::stoi(arg.substr(6));
+            else if (arg.rfind("workers=", 0) == 0) workers = std::stoi(arg.substr(8));
+            else if (arg.rfind("worker=", 0) == 0)  coordinator = arg.substr(7);
+            else if (arg.rfind("seed=", 0) == 0)    seed = (uint32_t)std::stoul(arg.substr(5));
+            else if (arg == "sampler=random")       sampler = compute::SamplerType::Random;
+            else if (arg == "sampler=sobol")        sampler = compute::SamplerType::Sobol;
+            else if (arg.rfind("sampler=", 0) == 0) throw std::runtime_error("Unknown sampler: " + arg.substr(8));
+            else if (ext == ".obj" || ext == ".ply" || ext == ".OBJ" || ext == ".PLY") mesh_files.push_back(arg);
+        }
+
+        // Configure the backend
+        compute::Config config;
+        config.cl.platform_index = 0;
+        config.cl.device_index = 0;
+        config.cl.build_options = "-cl-std=CL1.2 -cl-fast-relaxed-math";
+        config.cpu.thread_count = 0; // all cores
+        config.cpu.tile_size = 16;
+        config.bvh.builder = device_lbvh ? compute::BvhBuilder::DeviceLBVH : compute::BvhBuilder::HostSAH;
+        config.geometry.compressed_spheres = compressed;
+        config.cl.multi_device = multi;
+        config.cl.partition = numa ? compute::DevicePartition::NumaNode : compute::DevicePartition::None;
+        config.profile.timeline = timeline;
+        config.render.ray_stats = ray_stats;
+        config.render.sampler = sampler;
+        config.render.seed = seed;
+        config.output = output;
+
+        // A worker needs no scene of its own: it renders whatever the coordinator ships
+        if (!coordinator.empty()) {
+            const size_t colon = coordinator.rfind(':');
+            if (colon == std::string::npos) throw std::runtime_error("worker= needs HOST:PORT");
+            std::unique_ptr<compute::Backend> backend = compute::CreateBackend(backend_type);
+            backend->initialize(config);
+            const size_t tasks = compute::RenderWorker(*backend).serve(coordinator.substr(0, colon),
+                                                                       (uint16_t)std::stoi(coordinator.substr(colon + 1)));
+            std::cout << "Worker rendered " << tasks << " tasks\n";
+            return 0;
+        }
+
+        // Create and initialize the backend first: the OpenCL program builds in the background
+        // while the scene below is set up and loaded. The coordinator of a distributed render has none
+        std::unique_ptr<compute::Backend> backend;
+        compute::RenderCoordinator distributed;
+        if (serve_port >= 0) {
+            distributed.initialize(config, (uint16_t)serve_port);
+        } else {
+            backend = compute::CreateBackend(backend_type);
+            backend->initialize(config);
+        }
 
         // Setting up a simple scene and camera for testing
         // Create a scene with some spheres and materials
         Scene scene;
 
         setup_scene(scene);
+
+        auto mesh_material = std::make_shared<Lambertian>(vec3(0.7f, 0.7f, 0.75f));
+        for (const auto& file : mesh_files) {
+            meshio::MeshData data = meshio::load_mesh(file);
+            scene.add_mesh(std::make_shared<const Mesh>(std::move(data.positions), std::move(data.indices),
+                                                        vec3{ 0.0f, 0.0f, 0.0f }, mesh_material));
+        }
         
 
         // Create a camera
@@ -28,18 +117,31 @@ int main() {
         cam.initialize();
     
 
-        // Configure the backend
-        compute::Config config;
-        config.cl.platform_index = 0;
-        config.cl.device_index = 0;
-        config.cl.build_options = "-cl-std=CL1.2 -cl-fast-relaxed-math";
-        
-        // Create and initialize the backend
-        std::unique_ptr<compute::Backend> backend = compute::CreateBackend(compute::BackendType::OpenCL);
-        backend->initialize(config);
         // Render the scene using the backend
         auto start = std::chrono::high_resolution_clock::now();
-        backend->render(cam, scene);
+        if (serve_port >= 0) {
+            std::cout << "Waiting for " << workers << " workers\n";
+            distributed.wait_for_workers((size_t)std::max(1, workers));
+            start = std::chrono::high_resolution_clock::now();
+            distributed.render(cam, scene, "rednerer4_dist");
+            distributed.shutdown();
+        } else if (frames > 0) {
+            // one turn around the look-at point at the starting height and distance
+            std::vector<point3> from, at;
+            const point3 center = cam.get_look_at();
+            const vec3 offset = cam.get_look_from() - center;
+            const float radius = std::sqrt(offset.x * offset.x + offset.z * offset.z);
+            const float angle0 = std::atan2(offset.z, offset.x);
+            constexpr int KEYS = 16;
+            for (int k = 0; k <= KEYS; ++k) {
+                const float a = angle0 + float(2.0 * pi) * k / KEYS;
+                from.push_back(center + vec3(radius * std::cos(a), offset.y, radius * std::sin(a)));
+                at.push_back(center);
+            }
+            backend->render_sequence(camera_path(cam, from, at, frames), scene, "orbit");
+        } else {
+            backend->render(cam, scene);
+        }
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> elapsed = end - start;
         std::cout << "Rendering completed in " << elapsed.count() << " seconds.\n";
@@ -136,8 +238,7 @@ void setup_scene(Scene& scene) {
 
 
     auto mat5 = std::make_shared<Lambertian>(vec3(0.5, 0.5f, 0.5f));
-    Sphere Ground(1000, point3(0,-1000,0),  vec3{ 0.0f, 0.0f, 0.0f }, mat5);
-    spheres.push_back(Ground);
+    scene.add_plane(Plane(point3(0, 0, 0), vec3(0, 1, 0), vec3{ 0.0f, 0.0f, 0.0f }, mat5));
 
 
 
@@ -0,0 +1,50 @@
+#ifndef BENCHOPTIONS_HPP
+#define BENCHOPTIONS_HPP
+
+#include <sstream>
+
+namespace bench {
+
+    // the items of a `sep` separated option value; empty items are skipped, an empty list is an error
+    inline std::vector<std::string> split(const std::string& list, char sep = ',') {
+        std::vector<std::string> items;
+        std::stringstream ss(list);
+        for (std::string item; std::getline(ss, item, sep);) {
+            if (!item.empty()) items.push_back(item);
+        }
+        if (items.empty()) throw std::runtime_error("Empty list: " + list);
+        return items;
+    }
+
+    template <typename T, typename F>
+    std::vector<T> parse_list(const std::string& list, F parse) {
+        std::vector<T> values;
+        for (const auto& item : split(list)) values.push_back(parse(item));
+        return values;
+    }
+
+    inline std::pair<int, int> parse_resolution(const std::string& s) {
+        const size_t x = s.find('x');
+        if (x == std::string::npos) throw std::runtime_error("Resolution must be WxH: " + s);
+        return std::make_pair(std::stoi(s.substr(0, x)), std::stoi(s.substr(x + 1)));
+    }
+
+    /*
+    *   Walks the command line as "--name value" pairs and hands each to `option(name, value)`,
+    *   which returns false for a name it does not know. The names in `flags` take no value and
+    *   arrive with an empty one.
+    */
+    template <typename F>
+    void parse_args(int argc, char** argv, F&& option, std::initializer_list<const char*> flags = {}) {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            const bool flag = std::find(flags.begin(), flags.end(), arg) != flags.end();
+            if (!flag && i + 1 >= argc) throw std::runtime_error("Missing value for " + arg);
+            const std::string value = flag ? std::string() : std::string(argv[++i]);
+            if (!option(arg, value)) throw std::runtime_error("Unknown option: " + arg);
+        }
+    }
+
+}
+
+#endif // BENCHOPTIONS_HPP
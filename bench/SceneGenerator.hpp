@@ -0,0 +1,88 @@
+#ifndef SCENEGENERATOR_HPP
+#define SCENEGENERATOR_HPP
+
+namespace bench {
+
+    enum class MaterialMix {
+        Diffuse,  // Lambertian only
+        Mixed,    // the demo scene's split: 65% diffuse, 20% metal, 15% glass
+        Specular  // metal and glass only
+    };
+
+    inline const char* to_string(MaterialMix mix) {
+        switch (mix) {
+            case MaterialMix::Diffuse:  return "diffuse";
+            case MaterialMix::Mixed:    return "mixed";
+            case MaterialMix::Specular: return "specular";
+        }
+        return "unknown";
+    }
+
+    inline MaterialMix parse_material_mix(const std::string& s) {
+        if (s == "diffuse")  return MaterialMix::Diffuse;
+        if (s == "mixed")    return MaterialMix::Mixed;
+        if (s == "specular") return MaterialMix::Specular;
+        throw std::runtime_error("Unknown material mix: " + s);
+    }
+
+    /*
+    *   Deterministic benchmark scene: `sphere_count` small spheres jittered inside the cells of a
+    *   square grid on a ground plane, lit by one emissive sphere overhead. The grid side grows
+    *   with sqrt(sphere_count), so the view stays equally dense at every size. Spheres share a
+    *   small palette per material type, as large scenes do, and the same seed always gives the
+    *   same scene. The camera frames the whole grid from above.
+    */
+    inline void generate_scene(Scene& scene, Camera& cam, size_t sphere_count, MaterialMix mix, uint32_t seed = 1) {
+        constexpr int PALETTE = 8; // materials per type
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        std::vector<std::shared_ptr<Material>> diffuse, metal, glass;
+        for (int i = 0; i < PALETTE; ++i) {
+            diffuse.push_back(std::make_shared<Lambertian>(vec3(unit(rng), unit(rng), unit(rng))));
+            metal.push_back(std::make_shared<Metal>(vec3(0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng), 0.5f + 0.5f * unit(rng)),
+                                                    0.5f * unit(rng)));
+            glass.push_back(std::make_shared<Dielectric>(1.3f + 0.4f * unit(rng)));
+        }
+        auto ground = std::make_shared<Lambertian>(vec3(0.5f, 0.5f, 0.5f));
+
+        auto pick = [&]() -> const std::shared_ptr<Material>& {
+            const float r = unit(rng);
+            const auto& from = mix == MaterialMix::Diffuse ? diffuse
+                             : mix == MaterialMix::Mixed   ? (r < 0.65f ? diffuse : r < 0.85f ? metal : glass)
+                             :                               (r < 0.6f ? metal : glass);
+            return from[rng() % PALETTE];
+        };
+
+        // one sphere per unit cell, jittered so it never crosses into a neighbour
+        const int side = std::max(1, (int)std::ceil(std::sqrt(double(sphere_count))));
+        const float half = 0.5f * float(side);
+        constexpr float RADIUS = 0.3f;
+
+        std::vector<Sphere> spheres;
+        spheres.reserve(sphere_count + 1);
+        for (size_t i = 0; i < sphere_count; ++i) {
+            const int cx = int(i % size_t(side)), cz = int(i / size_t(side));
+            const point3 center(float(cx) - half + RADIUS + (1.0f - 2.0f * RADIUS) * unit(rng), RADIUS,
+                                float(cz) - half + RADIUS + (1.0f - 2.0f * RADIUS) * unit(rng));
+            spheres.emplace_back(RADIUS, center, vec3(0.0f), pick());
+        }
+        spheres.emplace_back(0.25f * half + 1.0f, point3(0.0f, 2.0f * half + 4.0f, 0.0f), vec3(8.0f), diffuse[0]);
+
+        std::vector<std::shared_ptr<Material>> materials;
+        for (const auto* set : { &diffuse, &metal, &glass })
+            materials.insert(materials.end(), set->begin(), set->end());
+        materials.push_back(ground);
+
+        scene.add_plane(Plane(point3(0.0f), vec3(0, 1, 0), vec3(0.0f), ground));
+        scene.set_spheres_vec(spheres);
+        scene.set_materials_vec(materials);
+
+        cam.set_look_from(point3(0.0f, 0.6f * half + 2.0f, 1.1f * half + 3.0f));
+        cam.set_look_at(point3(0.0f, 0.0f, 0.0f));
+        cam.initialize();
+    }
+
+}
+
+#endif // SCENEGENERATOR_HPP
@@ -0,0 +1,246 @@
+#include "pchray.h"
+
+#include "CLBackend.hpp"
+#include "SceneGenerator.hpp"
+#include "BenchOptions.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+/*
+*   Benchmark sweep: renders generated scenes over every combination of sphere count, material
+*   mix, resolution, spp and depth on each backend and trace mode, and reports the median of
+*   `repeat` timed renders split into pack / upload / kernel / readback, with Msamples/s and
+*   Mrays/s. One untimed render per combination absorbs the program build and kernel variant
+*   compile. Results go to a table on stdout and, with --out, to a JSON file.
+*
+*   Every option takes a comma separated list:
+*       --spheres 10,1000,100000,1000000   --materials diffuse,mixed,specular
+*       --res 640x360,1280x720             --spp 4        --depth 8
+*       --backend cpu,opencl               --modes megakernel,wavefront,persistent (OpenCL only)
+*       --repeat 3                         --out results.json    --verbose (keep backend output)
+*/
+
+namespace {
+
+    struct Options {
+        std::vector<size_t> spheres = { 10, 1000, 100000, 1000000 };
+        std::vector<bench::MaterialMix> materials = { bench::MaterialMix::Mixed };
+        std::vector<std::pair<int, int>> resolutions = { { 640, 360 } };
+        std::vector<int> spp = { 4 };
+        std::vector<int> depth = { 8 };
+        std::vector<std::string> backends = { "cpu", "opencl" };
+        std::vector<std::string> modes = { "megakernel" };
+        int repeat = 3;
+        std::string out;
+        bool verbose = false;
+    };
+
+    struct Result {
+        std::string backend, mode;
+        size_t spheres = 0;
+        bench::MaterialMix materials = bench::MaterialMix::Mixed;
+        int width = 0, height = 0, spp = 0, depth = 0;
+        compute::FrameStats stats;
+        double total_ms = 0.0;
+    };
+
+    Options parse_options(int argc, char** argv) {
+        Options opt;
+        bench::parse_args(argc, argv, [&](const std::string& arg, const std::string& value) {
+            if (arg == "--verbose") {
+                opt.verbose = true;
+            } else if (arg == "--spheres") {
+                opt.spheres = bench::parse_list<size_t>(value, [](const std::string& s) { return (size_t)std::stoull(s); });
+            } else if (arg == "--materials") {
+                opt.materials = bench::parse_list<bench::MaterialMix>(value, bench::parse_material_mix);
+            } else if (arg == "--res") {
+                opt.resolutions = bench::parse_list<std::pair<int, int>>(value, bench::parse_resolution);
+            } else if (arg == "--spp") {
+                opt.spp = bench::parse_list<int>(value, [](const std::string& s) { return std::stoi(s); });
+            } else if (arg == "--depth") {
+                opt.depth = bench::parse_list<int>(value, [](const std::string& s) { return std::stoi(s); });
+            } else if (arg == "--backend") {
+                opt.backends = bench::split(value);
+            } else if (arg == "--modes") {
+                opt.modes = bench::split(value);
+            } else if (arg == "--repeat") {
+                opt.repeat = std::max(1, std::stoi(value));
+            } else if (arg == "--out") {
+                opt.out = value;
+            } else {
+                return false;
+            }
+            return true;
+        }, { "--verbose" });
+        return opt;
+    }
+
+    compute::TraceMode parse_mode(const std::string& s) {
+        if (s == "megakernel") return compute::TraceMode::Megakernel;
+        if (s == "wavefront")  return compute::TraceMode::Wavefront;
+        if (s == "persistent") return compute::TraceMode::Persistent;
+        throw std::runtime_error("Unknown trace mode: " + s);
+    }
+
+    double total_ms(const compute::FrameStats& s) {
+        return s.pack_ms + s.upload_ms + s.kernel_ms + s.readback_ms;
+    }
+
+    // throughput over the kernel time only, so pack and upload do not dilute it
+    double mega_per_second(uint64_t count, double ms) {
+        return ms > 0.0 ? double(count) / (ms * 1e3) : 0.0;
+    }
+
+    void write_json(const std::string& path, const std::vector<Result>& results) {
+        std::ofstream ofs(path);
+        if (!ofs) throw std::runtime_error("Cannot write " + path);
+
+        ofs << std::fixed << std::setprecision(3);
+        ofs << "{\n  \"version\": 1,\n  \"results\": [";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            const compute::FrameStats& s = r.stats;
+            ofs << (i ? ",\n" : "\n")
+                << "    {\"backend\": \"" << r.backend << "\", \"mode\": \"" << r.mode << "\""
+                << ", \"spheres\": " << r.spheres << ", \"materials\": \"" << bench::to_string(r.materials) << "\""
+                << ", \"width\": " << r.width << ", \"height\": " << r.height
+                << ", \"spp\": " << r.spp << ", \"depth\": " << r.depth
+                << ", \"pack_ms\": " << s.pack_ms << ", \"upload_ms\": " << s.upload_ms
+                << ", \"kernel_ms\": " << s.kernel_ms << ", \"readback_ms\": " << s.readback_ms
+                << ", \"total_ms\": " << r.total_ms
+                << ", \"samples\": " << s.samples << ", \"rays\": ";
+            if (s.rays > 0) ofs << s.rays; else ofs << "null";
+            ofs << ", \"msamples_per_s\": " << mega_per_second(s.samples, s.kernel_ms) << ", \"mrays_per_s\": ";
+            if (s.rays > 0) ofs << mega_per_second(s.rays, s.kernel_ms); else ofs << "null";
+            ofs << "}";
+        }
+        ofs << "\n  ]\n}\n";
+    }
+
+    void print_row(std::ostream& os, const Result& r) {
+        const compute::FrameStats& s = r.stats;
+        std::ostringstream res;
+        res << r.width << "x" << r.height;
+        os << std::left << std::setw(8) << r.backend << std::setw(11) << r.mode << std::right
+           << std::setw(8) << r.spheres << " " << std::left << std::setw(9) << bench::to_string(r.materials) << std::right
+           << std::setw(10) << res.str() << std::setw(5) << r.spp << std::setw(6) << r.depth
+           << std::fixed << std::setprecision(1)
+           << std::setw(9) << s.pack_ms << std::setw(9) << s.upload_ms << std::setw(10) << s.kernel_ms
+           << std::setw(9) << s.readback_ms << std::setw(10) << mega_per_second(s.samples, s.kernel_ms);
+        if (s.rays > 0) os << std::setw(9) << mega_per_second(s.rays, s.kernel_ms) << "\n";
+        else            os << std::setw(9) << "-" << "\n";
+    }
+
+    // discards everything the backends print while a render is timed
+    class NullBuffer : public std::streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+    };
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        const Options opt = parse_options(argc, argv);
+
+        // the table goes to the real stdout even while backend output is muted
+        std::ostream out(std::cout.rdbuf());
+        NullBuffer null_buffer;
+        if (!opt.verbose) std::cout.rdbuf(&null_buffer);
+
+        out << std::left << std::setw(8) << "backend" << std::setw(11) << "mode" << std::right
+            << std::setw(8) << "spheres" << " " << std::left << std::setw(9) << "material" << std::right
+            << std::setw(10) << "res" << std::setw(5) << "spp" << std::setw(6) << "depth"
+            << std::setw(9) << "pack ms" << std::setw(9) << "upld ms" << std::setw(10) << "kernel ms"
+            << std::setw(9) << "read ms" << std::setw(10) << "Msmp/s" << std::setw(9) << "Mray/s" << "\n";
+
+        std::vector<Result> results;
+        for (const auto& backend_name : opt.backends) {
+            compute::BackendType type;
+            if (backend_name == "cpu")         type = compute::BackendType::CPU;
+            else if (backend_name == "opencl") type = compute::BackendType::OpenCL;
+            else throw std::runtime_error("Unknown backend: " + backend_name);
+
+            // the CPU backend always traces whole paths
+            const std::vector<std::string> modes = type == compute::BackendType::CPU
+                ? std::vector<std::string>{ "megakernel" } : opt.modes;
+
+            for (const auto& mode : modes) {
+                compute::Config config;
+                config.cl.build_options = "-cl-std=CL1.2 -cl-fast-relaxed-math";
+                config.cpu.thread_count = 0;
+                config.cpu.tile_size = 16;
+                config.render.trace_mode = parse_mode(mode);
+                config.render.ray_stats = true;    // the OpenCL ray count comes from the in-kernel counters
+                config.render.stage_timing = true;
+
+                std::unique_ptr<compute::Backend> backend;
+                try {
+                    backend = compute::CreateBackend(type);
+                    backend->initialize(config);
+                } catch (const std::exception& e) {
+                    // a machine without the backend still benchmarks the others
+                    out << backend_name << " (" << mode << ") skipped: " << e.what() << "\n";
+                    continue;
+                }
+
+                for (size_t spheres : opt.spheres)
+                for (auto mix : opt.materials)
+                for (const auto& [width, height] : opt.resolutions)
+                for (int spp : opt.spp)
+                for (int depth : opt.depth) {
+                    Scene scene;
+                    Camera cam(width, double(width) / double(height));
+                    cam.set_samples_per_pixel(spp);
+                    cam.set_max_depth(depth);
+                    bench::generate_scene(scene, cam, spheres, mix);
+
+                    backend->render(cam, scene); // warm-up
+
+                    std::vector<compute::FrameStats> runs;
+                    for (int r = 0; r < opt.repeat; ++r) {
+                        scene.mark_changed(); // time the full pack and upload, not an incremental update
+                        backend->render(cam, scene);
+                        runs.push_back(backend->last_frame_stats());
+                    }
+                    // the run with the median total, so its stages add up
+                    std::sort(runs.begin(), runs.end(), [](const compute::FrameStats& a, const compute::FrameStats& b) {
+                        return total_ms(a) < total_ms(b);
+                    });
+
+                    Result result;
+                    result.backend   = backend_name;
+                    result.mode      = mode;
+                    result.spheres   = spheres;
+                    result.materials = mix;
+                    result.width     = cam.get_image_width();
+                    result.height    = cam.get_image_height();
+                    result.spp       = spp;
+                    result.depth     = depth;
+                    result.stats     = runs[runs.size() / 2];
+                    result.total_ms  = total_ms(result.stats);
+                    print_row(out, result);
+                    results.push_back(result);
+                }
+            }
+        }
+
+        std::cout.rdbuf(out.rdbuf());
+        if (!opt.out.empty()) {
+            write_json(opt.out, results);
+            std::cout << "Wrote " << results.size() << " results to " << opt.out << "\n";
+        }
+    }
+    catch(const cl::Error& e) {
+        std::cerr << "OpenCL error: " << e.what() << " (" << e.err() << ")\n";
+        return 1;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+#include "pchray.h"
+
+#include "CLHeaders.hpp"
+#include "Serialize.hpp"
+#include "CPUTrace.hpp"
+#include "SceneGenerator.hpp"
+#include "BenchOptions.hpp"
+
+#include <cmath>
+#include <iomanip>
+
+/*
+*   Convergence of the two samplers (Config::render.sampler): RMSE of the pixel averages against a
+*   high-spp reference, as a function of samples per pixel. Traces with the scalar CPU port of the
+*   kernels (cpu::accumulate_pixel) on one thread, so the numbers hold for every backend; the
+*   OpenCL kernels draw the same samples. Each trial renders with its own frame seed and is
+*   accumulated progressively through the checkpoints, like the passes of a render. The reference
+*   uses the random sampler with a seed no trial uses; its own noise sets the floor of the table.
+*   "equal quality" is (rmse random / rmse sobol)^2, the factor of random samples Sobol saves.
+*
+*       --spheres 64   --materials mixed   --res 96x54   --depth 8
+*       --spp 1,2,4,8,16,32,64,128   --reference 4096   --trials 4
+*/
+
+namespace {
+
+    using namespace compute;
+
+    struct Options {
+        size_t spheres = 64;
+        bench::MaterialMix mix = bench::MaterialMix::Mixed;
+        int width = 96, height = 54;
+        int depth = 8;
+        std::vector<int> spp = { 1, 2, 4, 8, 16, 32, 64, 128 };
+        int reference = 4096;
+        int trials = 4;
+    };
+
+    Options parse_options(int argc, char** argv) {
+        Options opt;
+        bench::parse_args(argc, argv, [&](const std::string& arg, const std::string& value) {
+            if (arg == "--spheres") {
+                opt.spheres = (size_t)std::stoull(value);
+            } else if (arg == "--materials") {
+                opt.mix = bench::parse_material_mix(value);
+            } else if (arg == "--res") {
+                std::tie(opt.width, opt.height) = bench::parse_resolution(value);
+            } else if (arg == "--depth") {
+                opt.depth = std::max(1, std::stoi(value));
+            } else if (arg == "--spp") {
+                opt.spp = bench::parse_list<int>(value, [](const std::string& s) { return std::max(1, std::stoi(s)); });
+                std::sort(opt.spp.begin(), opt.spp.end());
+            } else if (arg == "--reference") {
+                opt.reference = std::max(1, std::stoi(value));
+            } else if (arg == "--trials") {
+                opt.trials = std::max(1, std::stoi(value));
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return opt;
+    }
+
+    // adds samples [first, first + count) of every pixel to `sums` (rgb: radiance sum)
+    void accumulate(const cpu::SceneView& view, int width, int height, int first, int count, std::vector<glm::vec3>& sums) {
+        float lum_sq = 0.0f;
+        uint32_t steps = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                sums[size_t(y) * size_t(width) + size_t(x)] +=
+                    cpu::accumulate_pixel(view, x, y, width, uint32_t(first), count, &lum_sq, &steps);
+            }
+        }
+    }
+
+    double rmse(const std::vector<glm::vec3>& sums, int spp, const std::vector<glm::vec3>& reference) {
+        double sq = 0.0;
+        for (size_t i = 0; i < sums.size(); ++i) {
+            const glm::vec3 d = sums[i] * (1.0f / float(spp)) - reference[i];
+            sq += double(d.x) * d.x + double(d.y) * d.y + double(d.z) * d.z;
+        }
+        return std::sqrt(sq / double(3 * sums.size()));
+    }
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        const Options opt = parse_options(argc, argv);
+
+        Scene scene;
+        Camera cam(opt.width, double(opt.width) / double(opt.height));
+        cam.set_max_depth(opt.depth);
+        bench::generate_scene(scene, cam, opt.spheres, opt.mix);
+        const serialize::PackedScene ps = serialize::pack_scene(scene, cam);
+        const int W = cam.get_image_width(), H = cam.get_image_height();
+        const size_t N = size_t(W) * size_t(H);
+
+        cpu::SceneView view = cpu::make_scene_view(ps, opt.depth);
+
+        std::cout << "Reference: " << opt.reference << " spp at " << W << "x" << H << ", " << opt.spheres << " "
+                  << bench::to_string(opt.mix) << " spheres, depth " << opt.depth << "\n";
+        std::vector<glm::vec3> reference(N, glm::vec3(0.0f));
+        view.frame_seed = 0xFFFFFFFFu;
+        view.sobol = false;
+        accumulate(view, W, H, 0, opt.reference, reference);
+        for (auto& r : reference) r *= 1.0f / float(opt.reference);
+
+        // rmse[sampler][checkpoint], averaged over the trials
+        std::vector<double> err[2] = { std::vector<double>(opt.spp.size(), 0.0), std::vector<double>(opt.spp.size(), 0.0) };
+        for (int sobol = 0; sobol < 2; ++sobol) {
+            view.sobol = sobol != 0;
+            for (int trial = 0; trial < opt.trials; ++trial) {
+                view.frame_seed = uint32_t(trial + 1);
+                std::vector<glm::vec3> sums(N, glm::vec3(0.0f));
+                int done = 0;
+                for (size_t c = 0; c < opt.spp.size(); ++c) {
+                    accumulate(view, W, H, done, opt.spp[c] - done, sums);
+                    done = opt.spp[c];
+                    err[sobol][c] += rmse(sums, done, reference) / double(opt.trials);
+                }
+            }
+        }
+
+        std::cout << std::right << std::setw(8) << "spp" << std::setw(14) << "rmse random" << std::setw(14) << "rmse sobol"
+                  << std::setw(15) << "equal quality\n";
+        for (size_t c = 0; c < opt.spp.size(); ++c) {
+            const double ratio = err[1][c] > 0.0 ? err[0][c] / err[1][c] : 0.0;
+            std::cout << std::setw(8) << opt.spp[c] << std::fixed << std::setprecision(5)
+                      << std::setw(14) << err[0][c] << std::setw(14) << err[1][c]
+                      << std::setprecision(2) << std::setw(13) << ratio * ratio << "x\n";
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "pchray.h"
+
+#include "CLHeaders.hpp"
+#include "Serialize.hpp"
+#include "CPUTrace.hpp"
+#include "SpherePackets.hpp"
+#include "BenchOptions.hpp"
+
+#include <chrono>
+#include <iomanip>
+
+/*
+*   Microbenchmark for the ray-stream sphere kernels (cpu::intersect_stream): closest-hit queries
+*   of a fan of camera rays against a random sphere field, on one thread. Each ISA is compared
+*   with the scalar loop intersect_scene() would run over the same spheres without a BVH
+*   (intersect_sphere on SphereGpu records), and the sphere BVH is timed alongside for reference.
+*   Every kernel's hits and distances are checked against the scalar loop. Reports the median
+*   of `repeat` runs in Mrays/s.
+*
+*       --spheres 16,64,256,1024   --rays 262144   --repeat 5
+*       --isa scalar,sse2,avx2,avx512 (unsupported ones are skipped)
+*/
+
+namespace {
+
+    using namespace compute;
+
+    struct Options {
+        std::vector<size_t> spheres = { 16, 64, 256, 1024 };
+        size_t rays = 262144;
+        int repeat = 5;
+        std::vector<cpu::SimdIsa> isas = { cpu::SimdIsa::Scalar, cpu::SimdIsa::SSE2, cpu::SimdIsa::AVX2, cpu::SimdIsa::AVX512 };
+    };
+
+    cpu::SimdIsa parse_isa(const std::string& s) {
+        for (cpu::SimdIsa isa : { cpu::SimdIsa::Scalar, cpu::SimdIsa::SSE2, cpu::SimdIsa::AVX2, cpu::SimdIsa::AVX512 }) {
+            if (s == cpu::isa_name(isa)) return isa;
+        }
+        throw std::runtime_error("Unknown ISA: " + s);
+    }
+
+    Options parse_options(int argc, char** argv) {
+        Options opt;
+        bench::parse_args(argc, argv, [&](const std::string& arg, const std::string& value) {
+            if (arg == "--spheres") {
+                opt.spheres = bench::parse_list<size_t>(value, [](const std::string& s) { return (size_t)std::stoull(s); });
+            } else if (arg == "--rays") {
+                opt.rays = (size_t)std::stoull(value);
+            } else if (arg == "--repeat") {
+                opt.repeat = std::max(1, std::stoi(value));
+            } else if (arg == "--isa") {
+                opt.isas = bench::parse_list<cpu::SimdIsa>(value, parse_isa);
+            } else {
+                return false;
+            }
+            return true;
+        });
+        return opt;
+    }
+
+    // spheres of radius 0.2..0.7 scattered over a 20 x 4 x 20 box in front of the rays
+    std::vector<serialize::SphereGpu> make_spheres(size_t count, std::mt19937& rng) {
+        std::uniform_real_distribution<float> u(0.0f, 1.0f);
+        std::vector<serialize::SphereGpu> spheres(count);
+        for (size_t i = 0; i < count; ++i) {
+            serialize::SphereGpu& s = spheres[i];
+            s = {};
+            s.center_r = {{ 20.0f * u(rng) - 10.0f, 4.0f * u(rng), -20.0f * u(rng) - 2.0f, 0.2f + 0.5f * u(rng) }};
+            s.material_index = cl_int(i % 8);
+        }
+        return spheres;
+    }
+
+    // a 90 degree fan from above the origin, like the primary rays of a frame
+    std::vector<cpu::Ray> make_rays(size_t count, std::mt19937& rng) {
+        std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+        std::vector<cpu::Ray> rays(count);
+        for (auto& r : rays) {
+            r.origin = glm::vec3(0.0f, 2.0f, 0.0f);
+            r.direction = glm::normalize(glm::vec3(u(rng), 0.5f * u(rng), -1.0f));
+        }
+        return rays;
+    }
+
+    template <typename F>
+    double median_ms(int repeat, F&& run) {
+        std::vector<double> ms;
+        for (int i = 0; i < repeat; ++i) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            run();
+            ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+        }
+        std::sort(ms.begin(), ms.end());
+        return ms[ms.size() / 2];
+    }
+
+    double mrays_per_second(size_t rays, double ms) {
+        return ms > 0.0 ? double(rays) / (ms * 1e3) : 0.0;
+    }
+
+    void print_row(const std::string& kernel, int width, size_t spheres, double mrays, double baseline, const std::string& check) {
+        std::cout << std::left << std::setw(10) << kernel << std::right << std::setw(6) << width << std::setw(9) << spheres
+                  << std::fixed << std::setprecision(2) << std::setw(10) << mrays
+                  << std::setw(9) << (baseline > 0.0 ? mrays / baseline : 0.0) << "x  " << check << "\n";
+    }
+
+}
+
+int main(int argc, char** argv) {
+    try {
+        const Options opt = parse_options(argc, argv);
+        std::cout << "Best ISA on this CPU: " << cpu::isa_name(cpu::best_isa()) << "\n";
+        std::cout << std::left << std::setw(10) << "kernel" << std::right << std::setw(6) << "width" << std::setw(9) << "spheres"
+                  << std::setw(10) << "Mray/s" << std::setw(10) << "speedup" << "  check\n";
+
+        std::mt19937 rng(1234);
+        const std::vector<cpu::Ray> rays = make_rays(opt.rays, rng);
+
+        for (size_t count : opt.spheres) {
+            serialize::PackedScene ps;
+            ps.spheres = make_spheres(count, rng);
+            ps.world_sphere_count = cl_int(count);
+            serialize::build_sphere_bvh(ps);
+
+            // baseline: the loop intersect_scene() runs over spheres, minus the BVH
+            std::vector<float> ref_t(rays.size());
+            std::vector<cl_int> ref_hit(rays.size());
+            const double scalar_ms = median_ms(opt.repeat, [&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    float best = 1e20f;
+                    cl_int id = -1;
+                    for (size_t j = 0; j < count; ++j) {
+                        const float t = cpu::intersect_sphere(ps.spheres[j], rays[i]);
+                        if (t != 0.0f && t < best) { best = t; id = cl_int(j); }
+                    }
+                    ref_t[i] = best;
+                    ref_hit[i] = id;
+                }
+            });
+            const double baseline = mrays_per_second(rays.size(), scalar_ms);
+            print_row("loop", 1, count, baseline, baseline, "reference");
+
+            const double bvh_ms = median_ms(opt.repeat, [&] {
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    float t = 1e20f;
+                    int id = -1;
+                    cpu::intersect_bvh(ps.spheres.data(), ps.bvh_nodes.data(), ps.bvh_prims.data(), 0, rays[i], &t, &id);
+                }
+            });
+            print_row("bvh", 1, count, mrays_per_second(rays.size(), bvh_ms), baseline, "-");
+
+            const cpu::SphereSoA soa = cpu::SphereSoA::from(ps.spheres.data(), count);
+            cpu::RayStream stream;
+            stream.resize(rays.size());
+            for (size_t i = 0; i < rays.size(); ++i) stream.set(i, rays[i]);
+
+            for (cpu::SimdIsa isa : opt.isas) {
+                if (!cpu::isa_supported(isa)) {
+                    std::cout << std::left << std::setw(10) << cpu::isa_name(isa) << " not supported by this CPU\n";
+                    continue;
+                }
+                const double ms = median_ms(opt.repeat, [&] {
+                    std::fill(stream.t.begin(), stream.t.end(), 1e20f);
+                    std::fill(stream.hit.begin(), stream.hit.end(), -1);
+                    cpu::intersect_stream(soa, stream, isa);
+                });
+
+                size_t mismatches = 0;
+                for (size_t i = 0; i < rays.size(); ++i) {
+                    mismatches += stream.hit[i] != ref_hit[i] || (ref_hit[i] >= 0 && stream.t[i] != ref_t[i]);
+                }
+                print_row(cpu::isa_name(isa), cpu::packet_width(isa), count, mrays_per_second(rays.size(), ms), baseline,
+                          mismatches == 0 ? "exact" : std::to_string(mismatches) + " rays differ");
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,208 @@
+/* Shared constants and types. The host concatenates every kernels/*.cl file in filename
+   order into one program (clutils::read_kernel_sources_from_dir), so this file comes first. */
+
+__constant float EPSILON = 1e-3f; /* required to compensate for limited float precision */
+__constant float PI = 3.14159265359f;
+
+#define MAT_LAMBERTIAN 0
+#define MAT_METAL 1
+#define MAT_DIELECTRIC 2
+#define MAT_TYPE_COUNT 3
+
+/* Specialization constants. The host compiles per-scene variants with some of these passed as -D
+   (CLBackend::specialization_defines); without them the program stays generic and reads the
+   runtime arguments instead. */
+#ifdef MAX_BOUNCES      /* path length: Camera::get_max_depth() */
+#define BOUNCE_LIMIT(runtime) MAX_BOUNCES
+#else
+#define BOUNCE_LIMIT(runtime) (runtime)
+#endif
+
+#ifdef PASS_SPP         /* samples per pixel in every pass of the render */
+#define PASS_SAMPLES(runtime) PASS_SPP
+#else
+#define PASS_SAMPLES(runtime) (runtime)
+#endif
+
+#ifndef MATERIAL_MASK   /* bit (1 << MAT_*) per material type in the scene; absent types drop out of scatter() */
+#define MATERIAL_MASK ((1 << MAT_TYPE_COUNT) - 1)
+#endif
+
+/* SMALL_SCENE_SPHERES: world sphere count when it is small enough to test every sphere instead of the BVH;
+   each work-group then stages their sphere_geom entries in local memory */
+#ifdef SMALL_SCENE_SPHERES
+#define SMALL_SCENE_LOCAL (SMALL_SCENE_SPHERES > 0 ? SMALL_SCENE_SPHERES : 1) /* local arrays need a length */
+#endif
+
+/* Camera and materials are read by every ray and bounce at a uniform-ish index, which the constant
+   cache serves; MATERIALS_IN_GLOBAL (set by the host) is the way out for tables that do not fit. */
+#ifdef MATERIALS_IN_GLOBAL
+#define MATERIAL_SPACE __global
+#else
+#define MATERIAL_SPACE __constant
+#endif
+
+/* Ray statistics (-D RAY_STATS): each work-item counts into a private RayStats, the work-group sums
+   them in local memory and one lane adds the sums to 64-bit counters in the ray_stats buffer.
+   Index layout must match clutils::RayStatsCounters. */
+#define RS_PATHS          0  /* camera rays */
+#define RS_SEGMENTS       1  /* intersect_scene calls: every ray, primary or bounced */
+#define RS_SKY            2  /* paths that escaped to the sky */
+#define RS_NODE_TESTS     3  /* BVH box tests, all trees */
+#define RS_SPHERE_TESTS   4
+#define RS_TRIANGLE_TESTS 5
+#define RS_FLAT_TESTS     6  /* planes and boxes, tested against every ray */
+#define RS_MATERIAL_HITS  7  /* + MAT_* type */
+#define RS_ESCAPE_DEPTH   (RS_MATERIAL_HITS + MAT_TYPE_COUNT) /* + surface hits before the sky, last bin open */
+#define RS_DEPTH_BINS     16
+#define RS_COUNT          (RS_ESCAPE_DEPTH + RS_DEPTH_BINS)
+
+typedef struct RayStats{
+	uint c[RS_COUNT];
+} RayStats;
+
+#ifdef RAY_STATS
+#define RAY_STAT(stats, counter, n) ((stats)->c[counter] += (uint)(n))
+#define RAY_STAT_ESCAPE(stats, bounce) \
+	(RAY_STAT(stats, RS_SKY, 1), RAY_STAT(stats, RS_ESCAPE_DEPTH + min((int)(bounce), RS_DEPTH_BINS - 1), 1))
+#define RAY_STAT_MATERIAL(stats, type) \
+	RAY_STAT(stats, RS_MATERIAL_HITS + clamp((int)(type), 0, MAT_TYPE_COUNT - 1), (type) >= 0 && (type) < MAT_TYPE_COUNT)
+#else
+#define RAY_STAT(stats, counter, n) ((void)0)
+#define RAY_STAT_ESCAPE(stats, bounce) ((void)0)
+#define RAY_STAT_MATERIAL(stats, type) ((void)0)
+#endif
+
+
+typedef struct Camera {
+    // Camera settings
+    float4 origin; // float4(origin.x, origin.y, origin.z, focal_length) the 4th argument is focal_length
+   
+    // Calculate the horizontal and vertical delta vectors from pixel to pixel.
+    float4 pixel_delta_x;
+    float4 pixel_delta_y;
+
+    float4 pixel00_pos;
+} Camera;
+
+typedef struct Material{
+	float4 albedo_fuzz; // (float4)(albedo.x, albedo.y, albedo.z, fuzz)
+	int    type; 
+	float  ref_idx;
+	float _pad0,_pad1;
+} Material;
+
+
+typedef struct Sphere{
+	float4 center_r; // position + radius (float4)(pos.x, pos.y, pos.z, radius)
+	float4 emission;
+	int material_index; 
+	int _pad0,_pad1,_pad2;
+} Sphere;
+
+typedef struct Plane{
+	float4 normal_d; /* xyz unit normal, w = dot(normal, point on plane) */
+	float4 emission;
+	int material_index;
+	int _pad0,_pad1,_pad2;
+} Plane;
+
+typedef struct Box{
+	float4 bmin;
+	float4 bmax;
+	float4 emission;
+	int material_index;
+	int _pad0,_pad1,_pad2;
+} Box;
+
+/* shared radius/material/emission of compressed spheres (ushort4: xyz quantized center, w palette entry) */
+typedef struct SpherePalette{
+	float4 emission;
+	float radius;
+	int material_index;
+	int _pad0,_pad1;
+} SpherePalette;
+
+typedef struct BvhNode{
+	float4 bbox_min;
+	float4 bbox_max;
+	int left_first; /* inner: left child; leaf: first entry in bvh_prims */
+	int count;      /* leaf: primitive count; inner: 0 */
+	int right;      /* inner: right child; leaf: -1 */
+	int parent;
+} BvhNode;
+
+#define BVH_MAX_DEPTH 64 /* must match serialize::BVH_MAX_DEPTH */
+
+typedef struct Instance{
+	float4 world_to_object[3]; /* rows of the inverse affine transform (xyz linear, w translation) */
+	int blas_root;             /* root of the group's BVH in inst_nodes */
+	int _pad0,_pad1,_pad2;
+} Instance;
+
+/* triangle of a mesh; corners index mesh_positions */
+typedef struct Triangle{
+	uint i0, i1, i2;
+	int mesh;
+} Triangle;
+
+typedef struct Mesh{
+	float4 emission;
+	int bvh_root;  /* in mesh_nodes; leaves index triangles directly */
+	int material_index;
+	int _pad0,_pad1;
+} Mesh;
+
+/* every scene buffer the tracer reads, so geometry can grow without touching each signature */
+typedef struct SceneView{
+	__global const Sphere*   spheres;     /* shading records, fetched once per hit */
+	__global const float4*   sphere_geom; /* center_r of each record: all a ray test reads */
+#ifdef SMALL_SCENE_SPHERES
+	__local const float4*    small_spheres; /* world part of sphere_geom, staged by the kernel */
+#endif
+	__global const BvhNode*  bvh_nodes;  /* world spheres */
+	__global const int*      bvh_prims;
+	__global const ushort4*  spheres_q;  /* world spheres when built with -D COMPRESSED_SPHERES */
+	__global const SpherePalette* sphere_palette;
+	__global const Plane*    planes;     /* planes and boxes: flat lists outside the BVHs */
+	int plane_count;
+	__global const Box*      boxes;
+	int box_count;
+	__global const Mesh*     meshes;     /* tested one after the other, each through its own BVH */
+	int mesh_count;
+	__global const BvhNode*  mesh_nodes;
+	__global const Triangle* triangles;
+	__global const float4*   mesh_positions;
+	__global const Instance* instances;
+	int instance_count;
+	__global const BvhNode*  inst_nodes; /* top level at 0, then each group's bottom level */
+	__global const int*      inst_prims;
+	MATERIAL_SPACE const Material* materials;
+	RayStats* stats;                     /* this work-item's counters; only touched with RAY_STATS */
+} SceneView;
+
+#define PRIM_SPHERE 0
+#define PRIM_PLANE 1
+#define PRIM_BOX 2
+#define PRIM_TRIANGLE 3
+
+typedef struct Hit{
+	float t;
+	int type;     /* PRIM_* */
+	int prim;     /* index into the list of that type */
+	int instance; /* -1 for world geometry */
+	int node;     /* leaf that decodes a compressed prim */
+} Hit;
+
+/* shading inputs at the closest hit, all in world space */
+typedef struct SurfaceHit{
+	float3 point;
+	float3 normal; /* outward, unit length */
+	float3 emission;
+	int material_index;
+} SurfaceHit;
+
+typedef struct Ray{
+	float4 origin;
+	float4 direction;
+} Ray;
@@ -0,0 +1,302 @@
+/* Device-side linear BVH (Karras 2012) over the resident sphere_geom stream (center_r per sphere).
+
+   build: lbvh_bounds_reduce -> lbvh_bounds_final -> lbvh_morton
+          -> 8 x (radix_histogram -> radix_scan -> radix_scatter)    (4 bits per pass)
+          -> lbvh_init_leaves -> lbvh_build_internal -> lbvh_refit
+   refit: lbvh_refit only; the hierarchy is kept and bounds are recomputed from the spheres
+
+   The layout matches BvhNode: internal nodes [0, n-2] with the root at 0, leaves [n-1, 2n-2],
+   leaf k covering bvh_prims[k], so the render kernel traverses it like the host SAH tree. */
+
+#define LBVH_GROUP_SIZE 256 /* must match LbvhBuilder::GROUP_SIZE */
+#define RADIX_BITS 4
+#define RADIX_BUCKETS 16
+
+
+__kernel void lbvh_bounds_reduce(__global const float4* sphere_geom, const int n, __global float4* partial)
+{
+	__local float4 lmin[LBVH_GROUP_SIZE];
+	__local float4 lmax[LBVH_GROUP_SIZE];
+	int lid = get_local_id(0);
+
+	/* bounds of the sphere centers: Morton codes only need to order the centers */
+	float4 bmin = (float4)(1e30f), bmax = (float4)(-1e30f);
+	for (int i = get_global_id(0); i < n; i += get_global_size(0)) {
+		float4 c = (float4)(sphere_geom[i].xyz, 0.0f);
+		bmin = fmin(bmin, c);
+		bmax = fmax(bmax, c);
+	}
+	lmin[lid] = bmin;
+	lmax[lid] = bmax;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = LBVH_GROUP_SIZE / 2; s > 0; s >>= 1) {
+		if (lid < s) {
+			lmin[lid] = fmin(lmin[lid], lmin[lid + s]);
+			lmax[lid] = fmax(lmax[lid], lmax[lid + s]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) {
+		partial[2 * get_group_id(0)]     = lmin[0];
+		partial[2 * get_group_id(0) + 1] = lmax[0];
+	}
+}
+
+/* launched as a single work-group */
+__kernel void lbvh_bounds_final(__global const float4* partial, const int count, __global float4* bounds)
+{
+	__local float4 lmin[LBVH_GROUP_SIZE];
+	__local float4 lmax[LBVH_GROUP_SIZE];
+	int lid = get_local_id(0);
+
+	float4 bmin = (float4)(1e30f), bmax = (float4)(-1e30f);
+	for (int i = lid; i < count; i += LBVH_GROUP_SIZE) {
+		bmin = fmin(bmin, partial[2 * i]);
+		bmax = fmax(bmax, partial[2 * i + 1]);
+	}
+	lmin[lid] = bmin;
+	lmax[lid] = bmax;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (int s = LBVH_GROUP_SIZE / 2; s > 0; s >>= 1) {
+		if (lid < s) {
+			lmin[lid] = fmin(lmin[lid], lmin[lid + s]);
+			lmax[lid] = fmax(lmax[lid], lmax[lid + s]);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lid == 0) {
+		bounds[0] = lmin[0];
+		bounds[1] = lmax[0];
+	}
+}
+
+
+/* spreads the low 10 bits of v so there are two zero bits between each */
+inline uint expand_bits(uint v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+__kernel void lbvh_morton(__global const float4* sphere_geom, const int n, __global const float4* bounds,
+						  __global uint* keys, __global int* values)
+{
+	int i = get_global_id(0);
+	if (i >= n) return;
+
+	float3 lo  = bounds[0].xyz;
+	float3 ext = fmax(bounds[1].xyz - lo, (float3)(1e-20f));
+	float3 p   = clamp((sphere_geom[i].xyz - lo) / ext * 1024.0f, 0.0f, 1023.0f);
+
+	keys[i]   = (expand_bits((uint)p.x) << 2) | (expand_bits((uint)p.y) << 1) | expand_bits((uint)p.z);
+	values[i] = i;
+}
+
+
+/* ---- LSD radix sort, one LBVH_GROUP_SIZE block of keys per work-group ---- */
+
+/* per-block digit counts, stored digit-major so one exclusive scan yields the scatter offsets */
+__kernel void radix_histogram(__global const uint* keys, const int n, const int shift, __global uint* hist)
+{
+	__local uint counts[RADIX_BUCKETS];
+	int lid = get_local_id(0);
+	int i = get_global_id(0);
+
+	if (lid < RADIX_BUCKETS) counts[lid] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (i < n) atomic_inc(&counts[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]);
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (lid < RADIX_BUCKETS) hist[lid * get_num_groups(0) + get_group_id(0)] = counts[lid];
+}
+
+/* in-place exclusive scan of `count` entries, launched as a single work-group */
+__kernel void radix_scan(__global uint* hist, const int count)
+{
+	__local uint sums[LBVH_GROUP_SIZE];
+	int lid = get_local_id(0);
+
+	int per   = (count + LBVH_GROUP_SIZE - 1) / LBVH_GROUP_SIZE;
+	int begin = min(lid * per, count);
+	int end   = min(begin + per, count);
+
+	uint sum = 0;
+	for (int i = begin; i < end; i++) sum += hist[i];
+	sums[lid] = sum;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	/* inclusive Hillis-Steele scan over the per-lane chunk sums */
+	for (int off = 1; off < LBVH_GROUP_SIZE; off <<= 1) {
+		uint v = lid >= off ? sums[lid - off] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		sums[lid] += v;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	uint running = sums[lid] - sum;
+	for (int i = begin; i < end; i++) {
+		uint h = hist[i];
+		hist[i] = running;
+		running += h;
+	}
+}
+
+/* inclusive scan of one value per lane; every lane must call it */
+inline uint local_inclusive_scan(__local uint* scratch, uint value)
+{
+	int lid = get_local_id(0);
+	scratch[lid] = value;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int off = 1; off < LBVH_GROUP_SIZE; off <<= 1) {
+		uint v = lid >= off ? scratch[lid - off] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		scratch[lid] += v;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	return scratch[lid];
+}
+
+__kernel void radix_scatter(__global const uint* keys_in, __global const int* values_in, const int n, const int shift,
+							__global const uint* hist, __global uint* keys_out, __global int* values_out)
+{
+	__local uint lkeys[LBVH_GROUP_SIZE];
+	__local int  lvals[LBVH_GROUP_SIZE];
+	__local uint scratch[LBVH_GROUP_SIZE];
+	__local int  digit_start[RADIX_BUCKETS];
+
+	int lid = get_local_id(0);
+	int i = get_global_id(0);
+
+	/* padding keys have digit 15 in every pass, so they stay behind the real keys */
+	uint key = i < n ? keys_in[i] : 0xFFFFFFFFu;
+	int  val = i < n ? values_in[i] : -1;
+
+	/* stable local sort of the block by the current digit, one bit at a time */
+	for (int b = 0; b < RADIX_BITS; b++) {
+		uint bit = (key >> (shift + b)) & 1u;
+		uint ones_incl  = local_inclusive_scan(scratch, bit);
+		uint ones_total = scratch[LBVH_GROUP_SIZE - 1];
+		uint ones_before = ones_incl - bit;
+		int dst = bit ? (int)(LBVH_GROUP_SIZE - ones_total + ones_before) : (int)(lid - ones_before);
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		lkeys[dst] = key;
+		lvals[dst] = val;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		key = lkeys[lid];
+		val = lvals[lid];
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	uint digit = (key >> shift) & (RADIX_BUCKETS - 1);
+	if (lid == 0 || digit != ((lkeys[lid - 1] >> shift) & (RADIX_BUCKETS - 1))) digit_start[digit] = lid;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (val >= 0) {
+		uint dst = hist[digit * get_num_groups(0) + get_group_id(0)] + (uint)(lid - digit_start[digit]);
+		keys_out[dst]   = key;
+		values_out[dst] = val;
+	}
+}
+
+
+/* ---- hierarchy emission ---- */
+
+__kernel void lbvh_init_leaves(__global const int* sorted_values, const int n,
+							   __global BvhNode* nodes, __global int* bvh_prims)
+{
+	int k = get_global_id(0);
+	if (k >= n) return;
+
+	bvh_prims[k] = sorted_values[k];
+
+	__global BvhNode* leaf = &nodes[n - 1 + k];
+	leaf->left_first = k;
+	leaf->count      = 1;
+	leaf->right      = -1;
+	leaf->parent     = -1;
+}
+
+/* length of the common key prefix, with the index as tie-breaker for duplicate keys */
+inline int lbvh_delta(__global const uint* keys, const int n, const int i, const int j)
+{
+	if (j < 0 || j >= n) return -1;
+	uint ki = keys[i], kj = keys[j];
+	if (ki == kj) return 32 + (int)clz((uint)(i ^ j));
+	return (int)clz(ki ^ kj);
+}
+
+__kernel void lbvh_build_internal(__global const uint* keys, const int n, __global BvhNode* nodes)
+{
+	int i = get_global_id(0);
+	if (i >= n - 1) return;
+
+	/* direction of the range covered by node i */
+	int d = (lbvh_delta(keys, n, i, i + 1) - lbvh_delta(keys, n, i, i - 1)) >= 0 ? 1 : -1;
+	int delta_min = lbvh_delta(keys, n, i, i - d);
+
+	/* upper bound of the range length, then binary search for the other end */
+	int l_max = 2;
+	while (lbvh_delta(keys, n, i, i + l_max * d) > delta_min) l_max <<= 1;
+	int l = 0;
+	for (int t = l_max >> 1; t >= 1; t >>= 1) {
+		if (lbvh_delta(keys, n, i, i + (l + t) * d) > delta_min) l += t;
+	}
+	int j = i + l * d;
+
+	/* split position: the highest differing bit inside the range */
+	int delta_node = lbvh_delta(keys, n, i, j);
+	int s = 0;
+	int t = l;
+	do {
+		t = (t + 1) >> 1;
+		if (lbvh_delta(keys, n, i, i + (s + t) * d) > delta_node) s += t;
+	} while (t > 1);
+	int gamma = i + s * d + min(d, 0);
+
+	int left  = (min(i, j) == gamma)     ? (n - 1 + gamma)     : gamma;
+	int right = (max(i, j) == gamma + 1) ? (n - 1 + gamma + 1) : gamma + 1;
+
+	nodes[i].left_first = left;
+	nodes[i].right      = right;
+	nodes[i].count      = 0;
+	nodes[left].parent  = i;
+	nodes[right].parent = i;
+	if (i == 0) nodes[0].parent = -1;
+}
+
+/* Bottom-up bounds: every leaf re-reads its sphere, then walks towards the root. The first
+   child to reach a node stops there; the second one sees both children finished and merges.
+   `flags` must be zeroed (n - 1 entries) before the launch. */
+__kernel void lbvh_refit(__global const float4* sphere_geom, __global const int* bvh_prims, const int n,
+						 __global volatile BvhNode* nodes, __global volatile int* flags)
+{
+	int k = get_global_id(0);
+	if (k >= n) return;
+
+	int node = n - 1 + k;
+	float4 c = sphere_geom[bvh_prims[k]];
+	float r = fabs(c.w);
+	nodes[node].bbox_min = (float4)(c.xyz - r, 0.0f);
+	nodes[node].bbox_max = (float4)(c.xyz + r, 0.0f);
+	mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+	int parent = nodes[node].parent;
+	while (parent >= 0) {
+		if (atomic_inc(&flags[parent]) == 0) return;
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+		int l = nodes[parent].left_first, rr = nodes[parent].right;
+		nodes[parent].bbox_min = fmin(nodes[l].bbox_min, nodes[rr].bbox_min);
+		nodes[parent].bbox_max = fmax(nodes[l].bbox_max, nodes[rr].bbox_max);
+		mem_fence(CLK_GLOBAL_MEM_FENCE);
+
+		parent = nodes[parent].parent;
+	}
+}
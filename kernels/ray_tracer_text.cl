@@ -1,103 +1,98 @@
-__constant float EPSILON = 1e-3f; /* required to compensate for limited float precision */
-__constant float PI = 3.14159265359f;
-__constant int SAMPLES = 100;
-__constant int SAMPLES_PER_PIXEL =  50;
-
-#define MAT_LAMBERTIAN 0
-#define MAT_METAL 1
-#define MAT_DIELECTRIC 2
-
-
-typedef struct Camera {
-    // Camera settings
-    float4 origin; // float4(origin.x, origin.y, origin.z, focal_length) the 4th argument is focal_length
-   
-    // Calculate the horizontal and vertical delta vectors from pixel to pixel.
-    float4 pixel_delta_x;
-    float4 pixel_delta_y;
-
-    float4 pixel00_pos;
-} Camera;
-
-typedef struct Material{
-	float4 albedo_fuzz; // (float4)(albedo.x, albedo.y, albedo.z, fuzz)
-	int    type; 
-	float  ref_idx;
-	float _pad0,_pad1;
-} Material;
-
-
-typedef struct Sphere{
-	float4 center_r; // position + radius (float4)(pos.x, pos.y, pos.z, radius)
-	float4 emission;
-	int material_index; 
-	int _pad0,_pad1,_pad2;
-} Sphere;
-
-typedef struct Ray{
-	float4 origin;
-	float4 direction;
-} Ray;
-
-
-
-
-static float get_random(unsigned int *seed0, unsigned int *seed1) {
-
-	/* hash the seeds using bitwise AND operations and bitshifts */
-	*seed0 = 36969 * ((*seed0) & 65535) + ((*seed0) >> 16);  
-	*seed1 = 18000 * ((*seed1) & 65535) + ((*seed1) >> 16);
-
-	unsigned int ires = ((*seed0) << 16) + (*seed1);
-
-	/* use union struct to convert int to float */
-	union {
-		float f;
-		unsigned int ui;
-	} res;
-
-	res.ui = (ires & 0x007fffff) | 0x40000000;  /* bitwise AND, bitwise OR */
-	return (res.f - 2.0f) / 2.0f;
+/* Counter-based sampling: every random number of a path is a hash of (frame, pixel, sample, bounce,
+   dimension), so nothing carries over between samples and any pass, tile or device that traces a
+   given sample gets the same numbers. Samples come in 2D pairs: SAMPLE_CAMERA for the pixel jitter,
+   then two per bounce. With -D SAMPLER_SOBOL a pair is a point of the Owen-scrambled Sobol (0,2)
+   sequence, shuffled and scrambled per pixel and pair (Burley 2020); otherwise PCG white noise. */
+#define SAMPLE_CAMERA 0u
+#define SAMPLE_SCATTER(bounce) (1u + 2u * (uint)(bounce))
+#define SAMPLE_SCATTER_AUX(bounce) (2u + 2u * (uint)(bounce))
+
+typedef struct Sampler {
+	uint pixel;  /* hash of the pixel index and the frame seed */
+	uint sample; /* sample number of the pixel, counted over the whole render */
+} Sampler;
+
+/* PCG output permutation of one LCG step (Jarzynski & Olano 2020) */
+inline uint pcg_hash(uint v)
+{
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
 }
 
+/* top 24 bits as a float in [0, 1) */
+inline float uint_to_unit(uint v)
+{
+	return (float)(v >> 8) * (1.0f / 16777216.0f);
+}
 
-static float3 get_random_unit_vector(){
+inline Sampler make_sampler(uint pixel, uint sample, uint frame_seed)
+{
+	Sampler s;
+	s.pixel = pcg_hash(pixel ^ pcg_hash(frame_seed));
+	s.sample = sample;
+	return s;
+}
 
-    return (float3)(0.0f, 0.0f, 0.0f);
+#ifdef SAMPLER_SOBOL
+inline uint reverse_bits32(uint x)
+{
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+	x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+	return (x >> 16) | (x << 16);
 }
 
-static inline float2 sample_square(const __private float* fseed,
-                                   uint* seed0, uint* seed1) // <— NEW
+/* Owen scrambling of the bits of x from the top down, as a hash (Laine-Karras permutation) */
+inline uint nested_uniform_scramble(uint x, uint seed)
 {
-    float jx = get_random(seed0,
-               (*seed1)*0x27d4eb2du ^ ((*seed1)*2u+0u)*0x165667b1u ^ (*seed0)*0x9E3779B9u) - 0.5f;
-    float jy = get_random(seed1,
-               (*seed0)*0x9E3779B9u ^ ((*seed0)*2u+1u)*0x85EBCA6Bu ^ (*seed1)*0x27d4eb2du) - 0.5f;
-    return (float2)(jx, jy);
+	x = reverse_bits32(x);
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return reverse_bits32(x);
 }
 
-// static inline float2 sample_square(const __private float* fseed,
-//                                    uint* seed0, uint* seed1)
-// {
-//     // decorrelate to get jx
-//     uint a0 = (*seed0) ^ 0x9E3779B9u;
-//     uint a1 = (*seed1) ^ 0x85EBCA6Bu;
-//     float jx = get_random(&a0, &a1) - 0.5f;
+/* second Sobol dimension; the first is reverse_bits32(index) */
+inline uint sobol_dim1(uint index)
+{
+	uint v = 1u << 31, r = 0;
+	for (; index != 0; index >>= 1, v ^= v >> 1) {
+		if (index & 1u) r ^= v;
+	}
+	return r;
+}
+#endif
 
-//     // decorrelate differently to get jy
-//     a0 ^= 0xC2B2AE35u; 
-//     a1 ^= 0x27D4EB2Fu;
-//     float jy = get_random(&a0, &a1) - 0.5f;
+inline float2 sample_2d(const Sampler* s, uint pair)
+{
+	uint key = pcg_hash(s->pixel ^ pcg_hash(pair));
+#ifdef SAMPLER_SOBOL
+	uint index = nested_uniform_scramble(s->sample, key);
+	uint x = nested_uniform_scramble(reverse_bits32(index), pcg_hash(key ^ 0x68bc21ebu));
+	uint y = nested_uniform_scramble(sobol_dim1(index), pcg_hash(key ^ 0x02e5be93u));
+	return (float2)(uint_to_unit(x), uint_to_unit(y));
+#else
+	uint h = pcg_hash(key ^ pcg_hash(s->sample));
+	return (float2)(uint_to_unit(h), uint_to_unit(pcg_hash(h)));
+#endif
+}
 
-//     return (float2)(jx, jy);
-// }
+/* pixel-footprint jitter in [-0.5, 0.5)^2 */
+static inline float2 sample_square(const Sampler* s)
+{
+	return sample_2d(s, SAMPLE_CAMERA) - 0.5f;
+}
 
 inline float3 offset_along_normal(float3 p, float3 n, float3 newdir) {
     float s = (dot(newdir, n) >= 0.0f) ? 1.0f : -1.0f;
     return p + n * (s * EPSILON);
 }
 
-static inline Ray create_ray(int x, int y, __global const Camera* cam, float2 jitter)
+static inline Ray create_ray(int x, int y, __constant Camera* cam, float2 jitter)
 {
     Ray r; 
     r.origin = cam->origin;
@@ -110,12 +105,12 @@ static inline Ray create_ray(int x, int y, __global const Camera* cam, float2 ji
     return r;
 }
 
-				/* (__global Sphere* sphere, const Ray* ray) */
-float intersect_sphere(const Sphere* sphere, const Ray* ray) /* version using local copy of sphere */
+/* takes only center_r (xyz center, w radius): ray tests read the sphere_geom stream, not whole Spheres */
+float intersect_sphere(const float4 center_r, const Ray* ray)
 {
-	float3 rayToCenter = (float3)((sphere->center_r.xyz - ray->origin.xyz));
+	float3 rayToCenter = (float3)((center_r.xyz - ray->origin.xyz));
 	float b = dot(rayToCenter, (float3)(ray->direction.xyz ));
-	float c = dot(rayToCenter, rayToCenter) - (sphere->center_r.w)*(sphere->center_r.w);
+	float c = dot(rayToCenter, rayToCenter) - (center_r.w)*(center_r.w);
 	float disc = b * b - c;
 
 	if (disc < 0.0f) return 0.0f;
@@ -127,38 +122,453 @@ float intersect_sphere(const Sphere* sphere, const Ray* ray) /* version using lo
 	return 0.0f;
 }
 
-bool intersect_scene(__global const Sphere* spheres, const Ray* ray, float* t, int* sphere_id, const int sphere_count)
+/* same conventions as intersect_sphere: 0 on a miss, the exit distance when starting inside */
+float intersect_plane(const Plane* plane, const Ray* ray)
+{
+	float denom = dot(plane->normal_d.xyz, ray->direction.xyz);
+	if (fabs(denom) < 1e-8f) return 0.0f;
+	float t = (plane->normal_d.w - dot(plane->normal_d.xyz, ray->origin.xyz)) / denom;
+	return t > EPSILON ? t : 0.0f;
+}
+
+float intersect_box(const Box* box, const Ray* ray, const float3 inv_dir)
+{
+	float3 t0 = (box->bmin.xyz - ray->origin.xyz) * inv_dir;
+	float3 t1 = (box->bmax.xyz - ray->origin.xyz) * inv_dir;
+	float3 tmin = fmin(t0, t1);
+	float3 tmax = fmax(t0, t1);
+	float tnear = fmax(fmax(tmin.x, tmin.y), tmin.z);
+	float tfar  = fmin(fmin(tmax.x, tmax.y), tmax.z);
+	if (tnear > tfar) return 0.0f;
+	if (tnear > EPSILON) return tnear;
+	if (tfar > EPSILON) return tfar;
+	return 0.0f;
+}
+
+/* slab test; returns the entry distance, or 1e20f when the box is missed or lies beyond t_max */
+inline float intersect_aabb(const float4 bmin, const float4 bmax, const Ray* ray, const float3 inv_dir, const float t_max)
+{
+	float3 t0 = (bmin.xyz - ray->origin.xyz) * inv_dir;
+	float3 t1 = (bmax.xyz - ray->origin.xyz) * inv_dir;
+	float3 tmin = fmin(t0, t1);
+	float3 tmax = fmax(t0, t1);
+	float tnear = fmax(fmax(tmin.x, tmin.y), fmax(tmin.z, 0.0f));
+	float tfar  = fmin(fmin(tmax.x, tmax.y), fmin(tmax.z, t_max));
+	return tnear <= tfar ? tnear : 1e20f;
+}
+
+/* reciprocal direction without infinities (-cl-fast-relaxed-math assumes finite math) */
+inline float3 safe_inverse(const float3 d)
+{
+	const float tiny = 1e-20f;
+	return (float3)(1.0f / (fabs(d.x) > tiny ? d.x : copysign(tiny, d.x)),
+	                1.0f / (fabs(d.y) > tiny ? d.y : copysign(tiny, d.y)),
+	                1.0f / (fabs(d.z) > tiny ? d.z : copysign(tiny, d.z)));
+}
+
+/* tests both children of an inner node and pushes the ones the ray enters below t_max, the nearer
+   last so it is visited first and the hit distance shrinks early; returns the new stack size */
+inline int push_children(__global const BvhNode* nodes, __global const BvhNode* node, const Ray* ray,
+                         const float3 inv_dir, const float t_max, int* stack, int sp, RayStats* stats)
+{
+	int left = node->left_first, right = node->right;
+	RAY_STAT(stats, RS_NODE_TESTS, 2);
+	float tl = intersect_aabb(nodes[left].bbox_min,  nodes[left].bbox_max,  ray, inv_dir, t_max);
+	float tr = intersect_aabb(nodes[right].bbox_min, nodes[right].bbox_max, ray, inv_dir, t_max);
+	if (tl > tr) {
+		float tt = tl; tl = tr; tr = tt;
+		int ti = left; left = right; right = ti;
+	}
+	if (tr < 1e20f) stack[sp++] = right;
+	if (tl < 1e20f) stack[sp++] = left;
+	return sp;
+}
+
+/* closest sphere hit below *t in the BVH rooted at `root`; shrinks *t and returns true when one is found */
+bool intersect_bvh(__global const float4* sphere_geom, __global const BvhNode* nodes, __global const int* prims,
+				   const int root, const Ray* ray, float* t, int* sphere_id, RayStats* stats)
+{
+	float inf = 1e20f;
+	float t_start = *t;
+
+	float3 inv_dir = safe_inverse(ray->direction.xyz);
+	RAY_STAT(stats, RS_NODE_TESTS, 1);
+	if (intersect_aabb(nodes[root].bbox_min, nodes[root].bbox_max, ray, inv_dir, *t) >= inf) return false;
+
+	/* nodes on the stack have already passed their box test */
+	int stack[BVH_MAX_DEPTH];
+	int sp = 0;
+	stack[sp++] = root;
+
+	while (sp > 0) {
+		__global const BvhNode* node = &nodes[stack[--sp]];
+
+		if (node->right < 0) {
+			RAY_STAT(stats, RS_SPHERE_TESTS, node->count);
+			for (int i = node->left_first; i < node->left_first + node->count; i++) {
+				int id = prims[i];
+				float hitdistance = intersect_sphere(sphere_geom[id], ray);
+				/* keep track of the closest intersection and hitobject found so far */
+				if (hitdistance != 0.0f && hitdistance < *t) {
+					*t = hitdistance;
+					*sphere_id = id;
+				}
+			}
+			continue;
+		}
+
+		sp = push_children(nodes, node, ray, inv_dir, *t, stack, sp, stats);
+	}
+	return *t < t_start;
+}
+
+/* Watertight ray/triangle test (Woop, Benthin, Wald 2013). Per ray, the axes are permuted so the
+   dominant direction component becomes z and the ray is sheared onto +z; per triangle, the 2D edge
+   functions then decide the hit, so rays through a shared edge or vertex never slip between triangles. */
+typedef struct TriRay{
+	int kx, ky, kz;
+	float3 shear; /* x, y: shear of the permuted axes; z: 1 / direction along kz */
+} TriRay;
+
+inline float axis_of(const float3 v, const int k)
+{
+	return k == 0 ? v.x : (k == 1 ? v.y : v.z);
+}
+
+TriRay setup_tri_ray(const Ray* ray)
+{
+	float3 d = ray->direction.xyz;
+	float3 a = fabs(d);
+	TriRay tr;
+	tr.kz = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+	tr.kx = tr.kz == 2 ? 0 : tr.kz + 1;
+	tr.ky = tr.kx == 2 ? 0 : tr.kx + 1;
+	float dz = axis_of(d, tr.kz);
+	if (dz < 0.0f) { int k = tr.kx; tr.kx = tr.ky; tr.ky = k; } /* keep the winding */
+	tr.shear = (float3)(axis_of(d, tr.kx) / dz, axis_of(d, tr.ky) / dz, 1.0f / dz);
+	return tr;
+}
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+/* same conventions as intersect_sphere: the hit distance, or 0 on a miss */
+float intersect_triangle(const float3 p0, const float3 p1, const float3 p2, const Ray* ray, const TriRay* tr)
+{
+	float3 a = p0 - ray->origin.xyz;
+	float3 b = p1 - ray->origin.xyz;
+	float3 c = p2 - ray->origin.xyz;
+
+	float az = axis_of(a, tr->kz), bz = axis_of(b, tr->kz), cz = axis_of(c, tr->kz);
+	float ax = axis_of(a, tr->kx) - tr->shear.x * az, ay = axis_of(a, tr->ky) - tr->shear.y * az;
+	float bx = axis_of(b, tr->kx) - tr->shear.x * bz, by = axis_of(b, tr->ky) - tr->shear.y * bz;
+	float cx = axis_of(c, tr->kx) - tr->shear.x * cz, cy = axis_of(c, tr->ky) - tr->shear.y * cz;
+
+	/* scaled barycentrics; all of one sign (zero allowed) means the sheared ray passes inside */
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+#ifdef cl_khr_fp64
+	/* an exact zero may be a rounding artefact on a shared edge; double precision settles it.
+	   Devices without doubles keep the float result, so edge hits may differ from the CPU port there */
+	if (u == 0.0f || v == 0.0f || w == 0.0f) {
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+#endif
+	if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return 0.0f;
+
+	float det = u + v + w;
+	if (det == 0.0f) return 0.0f;
+
+	float t = (u * az + v * bz + w * cz) * tr->shear.z / det;
+	return t > EPSILON ? t : 0.0f;
+}
+
+/* closest triangle hit below *t in the mesh BVH rooted at `root`; shrinks *t and returns true when one is found */
+bool intersect_mesh(const SceneView* scene, const int root, const Ray* ray, const float3 inv_dir,
+                    const TriRay* tri_ray, float* t, int* tri_id)
+{
+	float inf = 1e20f;
+	float t_start = *t;
+	__global const BvhNode* nodes = scene->mesh_nodes;
+	RayStats* stats = scene->stats;
+
+	RAY_STAT(stats, RS_NODE_TESTS, 1);
+	if (intersect_aabb(nodes[root].bbox_min, nodes[root].bbox_max, ray, inv_dir, *t) >= inf) return false;
+
+	int stack[BVH_MAX_DEPTH];
+	int sp = 0;
+	stack[sp++] = root;
+
+	while (sp > 0) {
+		__global const BvhNode* node = &nodes[stack[--sp]];
+
+		if (node->right < 0) {
+			RAY_STAT(stats, RS_TRIANGLE_TESTS, node->count);
+			for (int i = node->left_first; i < node->left_first + node->count; i++) {
+				Triangle tri = scene->triangles[i];
+				float hitdistance = intersect_triangle(scene->mesh_positions[tri.i0].xyz, scene->mesh_positions[tri.i1].xyz,
+				                                       scene->mesh_positions[tri.i2].xyz, ray, tri_ray);
+				if (hitdistance != 0.0f && hitdistance < *t) {
+					*t = hitdistance;
+					*tri_id = i;
+				}
+			}
+			continue;
+		}
+
+		sp = push_children(nodes, node, ray, inv_dir, *t, stack, sp, stats);
+	}
+	return *t < t_start;
+}
+
+#ifdef COMPRESSED_SPHERES
+/* a compressed sphere's center is quantized inside the box of the leaf that holds it */
+inline Sphere decode_sphere(__global const BvhNode* leaf, const ushort4 q, __global const SpherePalette* palette)
+{
+	float3 origin = leaf->bbox_min.xyz;
+	float3 step = (leaf->bbox_max.xyz - origin) * (1.0f / 65535.0f);
+	SpherePalette entry = palette[q.w];
+
+	Sphere s;
+	s.center_r = (float4)(origin + convert_float3(q.xyz) * step, entry.radius);
+	s.emission = entry.emission;
+	s.material_index = entry.material_index;
+	return s;
+}
+
+/* world BVH over compressed spheres: leaves index spheres_q directly (leaf order), no bvh_prims */
+void intersect_compressed(const SceneView* scene, const Ray* ray, Hit* hit)
+{
+	float inf = 1e20f;
+	__global const BvhNode* nodes = scene->bvh_nodes;
+
+	float3 inv_dir = safe_inverse(ray->direction.xyz);
+	RAY_STAT(scene->stats, RS_NODE_TESTS, 1);
+	if (intersect_aabb(nodes[0].bbox_min, nodes[0].bbox_max, ray, inv_dir, hit->t) >= inf) return;
+
+	int stack[BVH_MAX_DEPTH];
+	int sp = 0;
+	stack[sp++] = 0;
+
+	while (sp > 0) {
+		int node_id = stack[--sp];
+		__global const BvhNode* node = &nodes[node_id];
+
+		if (node->right < 0) {
+			RAY_STAT(scene->stats, RS_SPHERE_TESTS, node->count);
+			for (int i = node->left_first; i < node->left_first + node->count; i++) {
+				Sphere sphere = decode_sphere(node, scene->spheres_q[i], scene->sphere_palette);
+				float hitdistance = intersect_sphere(sphere.center_r, ray);
+				if (hitdistance != 0.0f && hitdistance < hit->t) {
+					hit->t = hitdistance;
+					hit->type = PRIM_SPHERE;
+					hit->prim = i;
+					hit->node = node_id;
+				}
+			}
+			continue;
+		}
+
+		sp = push_children(nodes, node, ray, inv_dir, hit->t, stack, sp, scene->stats);
+	}
+}
+#endif
+
+inline float3 transform_point(const float4* m, const float3 p)
+{
+	return (float3)(dot(m[0].xyz, p) + m[0].w, dot(m[1].xyz, p) + m[1].w, dot(m[2].xyz, p) + m[2].w);
+}
+
+inline float3 transform_vector(const float4* m, const float3 v)
+{
+	return (float3)(dot(m[0].xyz, v), dot(m[1].xyz, v), dot(m[2].xyz, v));
+}
+
+/* top-level walk over instances; each instance leaf re-enters its group's BVH with an object-space ray */
+void intersect_instances(const SceneView* scene, const Ray* ray, Hit* hit)
+{
+	float inf = 1e20f;
+	__global const BvhNode* nodes = scene->inst_nodes;
+
+	float3 inv_dir = safe_inverse(ray->direction.xyz);
+	RAY_STAT(scene->stats, RS_NODE_TESTS, 1);
+	if (intersect_aabb(nodes[0].bbox_min, nodes[0].bbox_max, ray, inv_dir, hit->t) >= inf) return;
+
+	int stack[BVH_MAX_DEPTH];
+	int sp = 0;
+	stack[sp++] = 0;
+
+	while (sp > 0) {
+		__global const BvhNode* node = &nodes[stack[--sp]];
+
+		if (node->right < 0) {
+			for (int i = node->left_first; i < node->left_first + node->count; i++) {
+				int inst_id = scene->inst_prims[i];
+				Instance inst = scene->instances[inst_id];
+
+				/* unit-length object-space direction; distances scale by |d| between the spaces */
+				float3 d = transform_vector(inst.world_to_object, ray->direction.xyz);
+				float scale = length(d);
+				Ray local;
+				local.origin    = (float4)(transform_point(inst.world_to_object, ray->origin.xyz), 0.0f);
+				local.direction = (float4)(d / scale, 0.0f);
+
+				float t_local = hit->t * scale;
+				int id;
+				if (intersect_bvh(scene->sphere_geom, nodes, scene->inst_prims, inst.blas_root, &local, &t_local, &id, scene->stats)) {
+					hit->t = t_local / scale;
+					hit->type = PRIM_SPHERE;
+					hit->prim = id;
+					hit->instance = inst_id;
+				}
+			}
+			continue;
+		}
+
+		sp = push_children(nodes, node, ray, inv_dir, hit->t, stack, sp, scene->stats);
+	}
+}
+
+bool intersect_scene(const SceneView* scene, const Ray* ray, Hit* hit)
 {
 	/* initialise t to a very large number, 
 	so t will be guaranteed to be smaller
 	when a hit with the scene occurs */
 
 	float inf = 1e20f;
-	*t = inf;
-
-	/* check if the ray intersects each sphere in the scene */
-	for (int i = 0; i < sphere_count; i++)  {
-		
-		Sphere sphere = spheres[i]; /* create local copy of sphere */
-		
-		/* float hitdistance = intersect_sphere(&spheres[i], ray); */
-		float hitdistance = intersect_sphere(&sphere, ray);
-		/* keep track of the closest intersection and hitobject found so far */
-		if (hitdistance != 0.0f && hitdistance < *t) {
-			*t = hitdistance;
-			*sphere_id = i;
+	hit->t = inf;
+	hit->prim = 0;
+	hit->type = PRIM_SPHERE;
+	hit->instance = -1;
+	hit->node = 0;
+	RAY_STAT(scene->stats, RS_SEGMENTS, 1);
+	RAY_STAT(scene->stats, RS_FLAT_TESTS, scene->plane_count + scene->box_count);
+
+	/* unbounded and few: planes and boxes are tested against every ray */
+	for (int i = 0; i < scene->plane_count; i++) {
+		Plane plane = scene->planes[i];
+		float hitdistance = intersect_plane(&plane, ray);
+		if (hitdistance != 0.0f && hitdistance < hit->t) {
+			hit->t = hitdistance;
+			hit->type = PRIM_PLANE;
+			hit->prim = i;
 		}
 	}
-	return *t < inf; /* true when ray interesects the scene */
+	if (scene->box_count > 0) {
+		float3 inv_dir = safe_inverse(ray->direction.xyz);
+		for (int i = 0; i < scene->box_count; i++) {
+			Box box = scene->boxes[i];
+			float hitdistance = intersect_box(&box, ray, inv_dir);
+			if (hitdistance != 0.0f && hitdistance < hit->t) {
+				hit->t = hitdistance;
+				hit->type = PRIM_BOX;
+				hit->prim = i;
+			}
+		}
+	}
+
+#ifdef COMPRESSED_SPHERES
+	intersect_compressed(scene, ray, hit);
+#elif defined(SMALL_SCENE_SPHERES)
+	/* a fixed handful of spheres: an unrolled test of each beats walking the BVH */
+	RAY_STAT(scene->stats, RS_SPHERE_TESTS, SMALL_SCENE_SPHERES);
+	for (int i = 0; i < SMALL_SCENE_SPHERES; i++) {
+		float hitdistance = intersect_sphere(scene->small_spheres[i], ray);
+		if (hitdistance != 0.0f && hitdistance < hit->t) {
+			hit->t = hitdistance;
+			hit->type = PRIM_SPHERE;
+			hit->prim = i;
+		}
+	}
+#else
+	if (intersect_bvh(scene->sphere_geom, scene->bvh_nodes, scene->bvh_prims, 0, ray, &hit->t, &hit->prim, scene->stats))
+		hit->type = PRIM_SPHERE;
+#endif
+	if (scene->instance_count > 0) intersect_instances(scene, ray, hit);
+
+	if (scene->mesh_count > 0) {
+		float3 inv_dir = safe_inverse(ray->direction.xyz);
+		TriRay tr = setup_tri_ray(ray);
+		for (int m = 0; m < scene->mesh_count; m++) {
+			if (intersect_mesh(scene, scene->meshes[m].bvh_root, ray, inv_dir, &tr, &hit->t, &hit->prim))
+				hit->type = PRIM_TRIANGLE;
+		}
+	}
+
+	return hit->t < inf; /* true when ray interesects the scene */
+}
+
+/* world-space point, normal and emission at a hit; instanced normals go through the inverse transpose */
+SurfaceHit surface_at(const SceneView* scene, const Ray* ray, const Hit* hit)
+{
+	SurfaceHit s;
+	s.point = ray->origin.xyz + ray->direction.xyz * hit->t;
+
+	if (hit->type == PRIM_PLANE) {
+		Plane plane = scene->planes[hit->prim];
+		s.normal = plane.normal_d.xyz;
+		s.emission = plane.emission.xyz;
+		s.material_index = plane.material_index;
+		return s;
+	}
+	if (hit->type == PRIM_BOX) {
+		/* the face hit is the axis along which the point sits farthest out, relative to the half extent */
+		Box box = scene->boxes[hit->prim];
+		float3 half = (box.bmax.xyz - box.bmin.xyz) * 0.5f;
+		float3 p = (s.point - (box.bmin.xyz + half)) * safe_inverse(half);
+		float3 a = fabs(p);
+		s.normal = (a.x >= a.y && a.x >= a.z) ? (float3)(copysign(1.0f, p.x), 0.0f, 0.0f)
+		         : (a.y >= a.z)               ? (float3)(0.0f, copysign(1.0f, p.y), 0.0f)
+		         :                              (float3)(0.0f, 0.0f, copysign(1.0f, p.z));
+		s.emission = box.emission.xyz;
+		s.material_index = box.material_index;
+		return s;
+	}
+	if (hit->type == PRIM_TRIANGLE) {
+		/* flat shading; the winding decides which side is outside */
+		Triangle tri = scene->triangles[hit->prim];
+		float3 p0 = scene->mesh_positions[tri.i0].xyz;
+		float3 p1 = scene->mesh_positions[tri.i1].xyz;
+		float3 p2 = scene->mesh_positions[tri.i2].xyz;
+		Mesh mesh = scene->meshes[tri.mesh];
+		s.normal = normalize(cross(p1 - p0, p2 - p0));
+		s.emission = mesh.emission.xyz;
+		s.material_index = mesh.material_index;
+		return s;
+	}
+
+#ifdef COMPRESSED_SPHERES
+	Sphere sphere = hit->instance < 0
+		? decode_sphere(&scene->bvh_nodes[hit->node], scene->spheres_q[hit->prim], scene->sphere_palette)
+		: scene->spheres[hit->prim];
+#else
+	Sphere sphere = scene->spheres[hit->prim];
+#endif
+
+	s.emission = sphere.emission.xyz;
+	s.material_index = sphere.material_index;
+
+	if (hit->instance < 0) {
+		s.normal = normalize(s.point - sphere.center_r.xyz);
+	} else {
+		Instance inst = scene->instances[hit->instance];
+		float3 n = transform_point(inst.world_to_object, s.point) - sphere.center_r.xyz;
+		s.normal = normalize(inst.world_to_object[0].xyz * n.x + inst.world_to_object[1].xyz * n.y +
+		                     inst.world_to_object[2].xyz * n.z);
+	}
+	return s;
 }
 
 
-void lambert_scatter(const Sphere* hitsphere, Ray* ray, const Material* mat, float* t, float* xi1, float* xi2, float3* accum_color, float3* mask ) {
-	/* compute the hitpoint using the ray equation */
-	float3 hitpoint = ray->origin.xyz + ray->direction.xyz * (*t);
+void lambert_scatter(const SurfaceHit* hit, Ray* ray, const Material* mat, float* xi1, float* xi2, float3* accum_color, float3* mask ) {
+	float3 hitpoint = hit->point;
 	
-	/* compute the surface normal and flip it if necessary to face the incoming ray */
-	float3 normal = normalize(hitpoint - hitsphere->center_r.xyz); 
+	/* flip the surface normal if necessary to face the incoming ray */
+	float3 normal = hit->normal; 
 	float3 w = dot(normal, ray->direction.xyz) < 0.0f ? normal : normal * (-1.0f);
 
 	
@@ -179,7 +589,7 @@ void lambert_scatter(const Sphere* hitsphere, Ray* ray, const Material* mat, flo
 	ray->origin = (float4)(hitpoint + w * EPSILON, 0.0f);
 	ray->direction = (float4)(newdir, 0.0f);
 
-	(*accum_color) += (*mask) * hitsphere->emission.xyz; // keep if you actually use emission
+	(*accum_color) += (*mask) * hit->emission; // keep if you actually use emission
 	(*mask) *= (float3)(mat->albedo_fuzz.x, mat->albedo_fuzz.y, mat->albedo_fuzz.z);
 	// cosine-weighted term belongs to lambert:
 	(*mask) *= fmax(dot(newdir, w), 0.0f);
@@ -194,32 +604,25 @@ inline float3 reflect(const float3* direction, const float3* normal) {
 
 
 
-void metal_scatter(const Sphere* hitsphere, Ray* ray, const Material* mat, float* t,
-                   float3* accum_color, float3* mask, const float3* _unused) {
+/* `jitter`: a point of the [-0.5, 0.5)^3 cube, scaled by the fuzz */
+void metal_scatter(const SurfaceHit* hit, Ray* ray, const Material* mat,
+                   float3* accum_color, float3* mask, const float3* jitter) {
 
-    float3 hitpoint = ray->origin.xyz + ray->direction.xyz * (*t);
-    float3 n        = normalize(hitpoint - hitsphere->center_r.xyz);
+    float3 hitpoint = hit->point;
+    float3 n        = hit->normal;
     float3 w        = dot(n, ray->direction.xyz) < 0.0f ? n : -n;
 
     float3 dir = ray->direction.xyz;
     float3 reflected = reflect(&dir, &w);
 
     // jitter WITHOUT normalization; scale by fuzz (already in mat->albedo_fuzz.w)
-    uint a = as_uint(hitpoint.x) ^ 0xC2B2AE35u;
-    uint b = as_uint(hitpoint.y) ^ 0x27D4EB2Fu;
-    float3 jitter = (float3)(
-        get_random(&a,&b) - 0.5f,
-        get_random(&a,&b) - 0.5f,
-        get_random(&a,&b) - 0.5f
-    );
-
-    float3 newdir = normalize(reflected + mat->albedo_fuzz.w * jitter);
+    float3 newdir = normalize(reflected + mat->albedo_fuzz.w * (*jitter));
 
     float3 neworig = offset_along_normal(hitpoint, w, newdir);
     ray->origin    = (float4)(neworig, 0.0f);
     ray->direction = (float4)(newdir, 0.0f);
 
-    (*accum_color) += (*mask) * hitsphere->emission.xyz;
+    (*accum_color) += (*mask) * hit->emission;
     (*mask) *= (float3)(mat->albedo_fuzz.x, mat->albedo_fuzz.y, mat->albedo_fuzz.z);
 }
 
@@ -277,11 +680,11 @@ inline float3 refract_dir(const float3 in, const float3 n, float eta) {
 //     ray->direction = (float4)(normalize(dir), 0.0f);
 // }
 
-void dielectric_scatter(const Sphere* hitsphere, Ray* ray, const Material* mat,
-                        float* t, float3* accum_color, float3* mask, float* xi)
+void dielectric_scatter(const SurfaceHit* surface, Ray* ray, const Material* mat,
+                        float3* accum_color, float3* mask, float* xi)
 {
-    float3 hit = ray->origin.xyz + ray->direction.xyz * (*t);
-    float3 n   = normalize(hit - hitsphere->center_r.xyz);
+    float3 hit = surface->point;
+    float3 n   = surface->normal;
     bool front = dot(ray->direction.xyz, n) < 0.0f;
     float3 w   = front ? n : -n;
 
@@ -319,117 +722,421 @@ void dielectric_scatter(const Sphere* hitsphere, Ray* ray, const Material* mat,
     ray->direction = (float4)(normalize(dir), 0.0f);
 
     // dielectric typically doesn't attenuate (no change to mask)
-    (*accum_color) += (*mask) * hitsphere->emission.xyz;
+    (*accum_color) += (*mask) * surface->emission;
 }
 
 
 
 
 
+/* background colour for rays that leave the scene */
+inline float3 sky_color(const Ray* ray)
+{
+	float3 d = normalize((float3)(ray->direction.xyz));
+	float tbg = 0.5f*(d.y + 1.0f);
+	return mix((float3)(0.0f,0.0f,1.0f), (float3)(0.8f,0.8f,1.0f), tbg);
+}
+
+/* one bounce of shading: adds the surface emission and picks the next ray for the hit's material */
+void scatter(const SurfaceHit* surface, Ray* ray, const Material* material, const int bounces,
+             const Sampler* sampler, float3* accum_color, float3* mask)
+{
+	switch(material->type) {
+#if MATERIAL_MASK & (1 << MAT_LAMBERTIAN)
+		case MAT_LAMBERTIAN : {
+			/* a 2D sample picks a cosine-weighted point on the hemisphere above the hitpoint */
+			float2 xi = sample_2d(sampler, SAMPLE_SCATTER(bounces)); // in [0,1)^2
+			float xi1 = xi.x, xi2 = xi.y;
+
+			lambert_scatter(surface, ray, material, &xi1, &xi2, accum_color, mask);
+			/* perform cosine-weighted importance sampling for diffuse surfaces*/
+			// mask *= dot(newdir, normal_facing); 
+			break;
+		}
+#endif
+#if MATERIAL_MASK & (1 << MAT_METAL)
+		case MAT_METAL : {
+			float2 xy = sample_2d(sampler, SAMPLE_SCATTER(bounces));
+			float z = sample_2d(sampler, SAMPLE_SCATTER_AUX(bounces)).x;
+			float3 jitter = (float3)(xy, z) - 0.5f;
+			metal_scatter(surface, ray, material, accum_color, mask, &jitter);
+
+			break;
+		}
+#endif
+#if MATERIAL_MASK & (1 << MAT_DIELECTRIC)
+		case MAT_DIELECTRIC : {
+			float xi1 = sample_2d(sampler, SAMPLE_SCATTER(bounces)).x; // in [0,1)
+			dielectric_scatter(surface, ray, material, accum_color, mask, &xi1);
+			break;
+		}
+#endif
+
+		// default : {
+		// 	return (float3)(1.0f, 0.0f, 1.0f);
+		// }
+	}
+}
+
 /* the path tracing function */
 /* computes a path (starting from the camera) with a defined number of bounces, accumulates light/color at each bounce */
 /* each ray hitting a surface will be reflected in a random direction (by randomly sampling the hemisphere above the hitpoint) */
 /* small optimisation: diffuse ray directions are calculated using cosine weighted importance sampling */
 
-float3 trace( __global const Sphere* spheres, 
-			  __global const Material* materials, 
+float3 trace( const SceneView* scene,
 			  const Ray* camray,  
-			  const int sphere_count, 
 			  const int material_count, 
-			  unsigned int* seed0,
-			  unsigned int* seed1 ) 
+			  const Sampler* sampler,
+			  uint* steps, /* bounces traced, for lane statistics */
+			  const int max_bounces )
 {
     Ray ray = *camray;
 
 	float3 accum_color = (float3)(0.0f, 0.0f, 0.0f);
 	float3 mask = (float3)(1.0f, 1.0f, 1.0f);
+	RAY_STAT(scene->stats, RS_PATHS, 1);
 
-	for (int bounces = 0; bounces < 10; bounces++){
+	for (int bounces = 0; bounces < BOUNCE_LIMIT(max_bounces); bounces++){
+		++(*steps);
 
-		float t;   /* distance to intersection */
-		int hitsphere_id = 0; /* index of intersected sphere */
+		Hit hit; /* distance to, and sphere/instance of, the closest intersection */
 
 		/* if ray misses scene, return background colour */
-		if (!intersect_scene(spheres, &ray, &t, &hitsphere_id, sphere_count))
+		if (!intersect_scene(scene, &ray, &hit))
 		{
-            float3 d = normalize((float3)(ray.direction.xyz));
-            float tbg = 0.5f*(d.y + 1.0f);
-            float3 sky = mix((float3)(0.0f,0.0f,1.0f), (float3)(0.8f,0.8f,1.0f), tbg);
-            return accum_color + mask * sky;
+			RAY_STAT_ESCAPE(scene->stats, bounces);
+            return accum_color + mask * sky_color(&ray);
         }
 
-		/* else, we've got a hit! Fetch the closest hit sphere */
-		Sphere hitsphere = spheres[hitsphere_id]; /* version with local copy of sphere */
-		int mat_idx = (int)hitsphere.material_index;
+		/* else, we've got a hit! Resolve it to world space */
+		SurfaceHit surface = surface_at(scene, &ray, &hit);
+		int mat_idx = surface.material_index;
 
-		Material material = materials[mat_idx];
+		Material material = scene->materials[mat_idx];
+		RAY_STAT_MATERIAL(scene->stats, material.type);
 
-		switch(material.type) {
-			case MAT_LAMBERTIAN : {
-				/* compute two random numbers to pick a random point on the hemisphere above the hitpoint*/
-				uint salt0 = (uint)*seed0 ^ (uint)(bounces*2+0) * 0x9E3779B9u;
-				uint salt1 = (uint)*seed1 ^ (uint)(bounces*2+1) * 0x85EBCA6Bu;
+		scatter(&surface, &ray, &material, bounces, sampler, &accum_color, &mask);
+	}
 
-				float xi1 = get_random(&salt0, &salt1); // in [0,1)
-				float xi2 = get_random(&salt0, &salt1); // in [0,1)
+	return accum_color;
+}
 
-				lambert_scatter(&hitsphere, &ray, &material, &t, &xi1, &xi2, &accum_color, &mask);
-				/* perform cosine-weighted importance sampling for diffuse surfaces*/
-				// mask *= dot(newdir, normal_facing); 
-				break;
-			}
-			case MAT_METAL : {
-				uint salt0 = (uint)*seed0 ^ 0xC2B2AE35u;
-				uint salt1 = (uint)*seed1 ^ 0x27D4EB2Fu;
-				float3 jitter = normalize((float3)(
-					get_random(&salt0,&salt1) - 0.5f,
-					get_random(&salt0,&salt1) - 0.5f,
-					get_random(&salt0,&salt1) - 0.5f));
-				metal_scatter(&hitsphere, &ray, &material, &t, &accum_color, &mask, &jitter);
-
-				break;
-			}
+/* gathers the scene arguments shared by the render and wf_extend kernels */
+SceneView make_scene_view(__global const Sphere* spheres, __global const float4* sphere_geom,
+                          __global const BvhNode* bvh_nodes, __global const int* bvh_prims,
+                          __global const ushort4* spheres_q, __global const SpherePalette* sphere_palette,
+                          __global const Plane* planes, const int plane_count,
+                          __global const Box* boxes, const int box_count,
+                          __global const Mesh* meshes, const int mesh_count,
+                          __global const BvhNode* mesh_nodes, __global const Triangle* triangles,
+                          __global const float4* mesh_positions,
+                          __global const Instance* instances, const int instance_count,
+                          __global const BvhNode* inst_nodes, __global const int* inst_prims,
+                          MATERIAL_SPACE const Material* materials)
+{
+    SceneView scene;
+    scene.spheres        = spheres;
+    scene.sphere_geom    = sphere_geom;
+    scene.bvh_nodes      = bvh_nodes;
+    scene.bvh_prims      = bvh_prims;
+    scene.spheres_q      = spheres_q;
+    scene.sphere_palette = sphere_palette;
+    scene.planes         = planes;
+    scene.plane_count    = plane_count;
+    scene.boxes          = boxes;
+    scene.box_count      = box_count;
+    scene.meshes         = meshes;
+    scene.mesh_count     = mesh_count;
+    scene.mesh_nodes     = mesh_nodes;
+    scene.triangles      = triangles;
+    scene.mesh_positions = mesh_positions;
+    scene.instances      = instances;
+    scene.instance_count = instance_count;
+    scene.inst_nodes     = inst_nodes;
+    scene.inst_prims     = inst_prims;
+    scene.materials      = materials;
+    scene.stats          = 0; /* kernels built with RAY_STATS point it at their counters */
+    return scene;
+}
 
-			case MAT_DIELECTRIC : {
-				uint salt0 = (uint)*seed0 ^ (uint)(bounces*2+0) * 0x9E3779B9u;
-				uint salt1 = (uint)*seed1 ^ (uint)(bounces*2+1) * 0x85EBCA6Bu;
+#ifdef SMALL_SCENE_SPHERES
+/* Copies the world spheres' sphere_geom entries to `staged`, a share per work-item, so every ray
+   test of the group reads local memory. Every work-item of the group must call it. */
+void stage_small_spheres(__global const float4* sphere_geom, __local float4* staged)
+{
+    for (int i = (int)get_local_id(0); i < SMALL_SCENE_SPHERES; i += (int)get_local_size(0)) staged[i] = sphere_geom[i];
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+#endif
 
-				float xi1 = get_random(&salt0, &salt1); // in [0,1)
-				dielectric_scatter(&hitsphere, &ray, &material, &t, &accum_color, &mask, &xi1);
-				break;
-			}
+/* Rec. 709 luminance; adaptive sampling measures noise on this single channel */
+float luminance(float3 c)
+{
+    return dot(c, (float3)(0.2126f, 0.7152f, 0.0722f));
+}
 
-			// default : {
-			// 	return (float3)(1.0f, 0.0f, 1.0f);
-			// }
-		}
-	}
+/* A pixel is done once the standard error of its mean luminance drops below `threshold`
+   relative to that mean. The 0.01 floor stops near-black pixels from needing an exact zero. */
+bool pixel_converged(float4 acc, float lum_sq, float threshold, int min_spp)
+{
+    float n = acc.w;
+    if (n < (float)min_spp) return false;
+    float mean = luminance(acc.xyz) / n;
+    float var  = fmax(lum_sq / n - mean * mean, 0.0f);
+    return sqrt(var / n) <= threshold * fmax(mean, 0.01f);
+}
 
-	return accum_color;
+#ifdef RAY_STATS
+/* 64-bit counter as two uints (low, high) from 32-bit atomics: whoever wraps the low word carries */
+void add_counter64(__global uint* counter, const uint n)
+{
+    uint old = atomic_add(&counter[0], n);
+    if (old + n < old) atomic_inc(&counter[1]);
+}
+
+/* Sums the work-group's RayStats in local memory, then one lane per counter adds the group total
+   to ray_stats (RS_COUNT 64-bit counters). Every work-item of the group must call it. */
+void report_ray_stats(const RayStats* stats, __local uint* group, __global uint* ray_stats)
+{
+    const int lid = (int)get_local_id(0), size = (int)get_local_size(0);
+    for (int i = lid; i < RS_COUNT; i += size) group[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int i = 0; i < RS_COUNT; i++) {
+        if (stats->c[i] != 0) atomic_add(&group[i], stats->c[i]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int i = lid; i < RS_COUNT; i += size) {
+        if (group[i] != 0) add_counter64(&ray_stats[2 * i], group[i]);
+    }
+}
+
+RayStats zero_ray_stats()
+{
+    RayStats stats;
+    for (int i = 0; i < RS_COUNT; i++) stats.c[i] = 0;
+    return stats;
+}
+#endif
+
+#ifdef LANE_STATS
+/* Adds this work-group's bounce steps and its lane slots (group size x longest lane) to
+   lane_stats[0..1]. Lanes never wait for more than their group's slowest lane, so the ratio is
+   a lower bound on SIMD utilization. Every work-item of the group must call it. */
+void report_lane_steps(const uint steps, __local uint* group, __global uint* lane_stats)
+{
+    if (get_local_id(0) == 0) { group[0] = 0; group[1] = 0; }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    atomic_add(&group[0], steps);
+    atomic_max(&group[1], steps);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (get_local_id(0) == 0) {
+        atomic_add(&lane_stats[0], group[0]);
+        atomic_add(&lane_stats[1], group[1] * (uint)get_local_size(0));
+    }
 }
+#endif
 
 __kernel void render(int width, int height, 
-					 __global const Camera* camera,
-                     __global const Sphere* spheres, const int sphere_count,
-					 __global const Material* materials, const int material_count,
-                     float random_seed, __global uchar4* output)
+					 __constant Camera* camera,
+                     __global const Sphere* spheres, __global const float4* sphere_geom, const int sphere_count,
+                     __global const BvhNode* bvh_nodes, __global const int* bvh_prims,
+                     __global const ushort4* spheres_q, __global const SpherePalette* sphere_palette,
+                     __global const Plane* planes, const int plane_count,
+                     __global const Box* boxes, const int box_count,
+                     __global const Mesh* meshes, const int mesh_count,
+                     __global const BvhNode* mesh_nodes, __global const Triangle* triangles,
+                     __global const float4* mesh_positions,
+                     __global const Instance* instances, const int instance_count,
+                     __global const BvhNode* inst_nodes, __global const int* inst_prims,
+					 MATERIAL_SPACE const Material* materials, const int material_count,
+                     const uint frame_seed, const uint sample_index, const int pass_spp,
+                     __global float4* accum, __global float* lum_sq,
+                     __global const uint* active_pixels, const int active_count,
+                     __global uint* lane_stats, const int max_bounces, __global uint* ray_stats)
+{
+    /* one work-item per pixel still in the active list; retired pixels are not launched at all */
+    int gid = get_global_id(0);
+    uint steps = 0;
+#ifdef RAY_STATS
+    RayStats stats = zero_ray_stats();
+#endif
+#ifdef SMALL_SCENE_SPHERES
+    __local float4 small_spheres[SMALL_SCENE_LOCAL];
+    stage_small_spheres(sphere_geom, small_spheres);
+#endif
+    if (gid < active_count) {
+        int idx = (int)active_pixels[gid];
+        int x = idx % width, y = idx / width;
+
+        SceneView scene = make_scene_view(spheres, sphere_geom, bvh_nodes, bvh_prims, spheres_q, sphere_palette,
+                                          planes, plane_count, boxes, box_count,
+                                          meshes, mesh_count, mesh_nodes, triangles, mesh_positions,
+                                          instances, instance_count, inst_nodes, inst_prims, materials);
+#ifdef SMALL_SCENE_SPHERES
+        scene.small_spheres = small_spheres;
+#endif
+#ifdef RAY_STATS
+        scene.stats = &stats;
+#endif
+
+        float3 sum = (float3)(0);
+        float sq = 0.0f;
+        for (int s = 0; s < PASS_SAMPLES(pass_spp); ++s) {
+            /* this pass holds samples sample_index .. sample_index + pass_spp - 1 of the pixel */
+            Sampler sampler = make_sampler((uint)idx, sample_index + (uint)s, frame_seed);
+            Ray camray = create_ray(x, y, camera, sample_square(&sampler));
+            float3 c = trace(&scene, &camray, material_count, &sampler, &steps, max_bounces);
+            float l = luminance(c);
+            sum += c;
+            sq  += l * l;
+        }
+
+        /* rgb: radiance sum, w: sample count; the host clears both before the first pass */
+        accum[idx] += (float4)(sum, (float)pass_spp);
+        lum_sq[idx] += sq;
+    }
+
+#ifdef LANE_STATS
+    __local uint group_steps[2];
+    report_lane_steps(steps, group_steps, lane_stats);
+#endif
+#ifdef RAY_STATS
+    __local uint group_stats[RS_COUNT];
+    report_ray_stats(&stats, group_stats, ray_stats);
+#endif
+}
+
+/* Persistent-thread variant of render: the host launches only enough work-items to fill the
+   device, and each one runs trace() a bounce at a time. When its path ends the lane starts the
+   pixel's next sample, or takes the next active pixel from work_counter, instead of idling until
+   the longest path of its SIMD group is done. A pixel's samples stay on one lane in order, so the
+   image matches render's. */
+__kernel void render_persistent(int width, int height,
+                                __constant Camera* camera,
+                                __global const Sphere* spheres, __global const float4* sphere_geom, const int sphere_count,
+                                __global const BvhNode* bvh_nodes, __global const int* bvh_prims,
+                                __global const ushort4* spheres_q, __global const SpherePalette* sphere_palette,
+                                __global const Plane* planes, const int plane_count,
+                                __global const Box* boxes, const int box_count,
+                                __global const Mesh* meshes, const int mesh_count,
+                                __global const BvhNode* mesh_nodes, __global const Triangle* triangles,
+                                __global const float4* mesh_positions,
+                                __global const Instance* instances, const int instance_count,
+                                __global const BvhNode* inst_nodes, __global const int* inst_prims,
+                                MATERIAL_SPACE const Material* materials, const int material_count,
+                                const uint frame_seed, const uint sample_index, const int pass_spp,
+                                __global float4* accum, __global float* lum_sq,
+                                __global const uint* active_pixels, const int active_count,
+                                __global uint* lane_stats, __global uint* work_counter,
+                                const int max_bounces, __global uint* ray_stats)
+{
+    SceneView scene = make_scene_view(spheres, sphere_geom, bvh_nodes, bvh_prims, spheres_q, sphere_palette,
+                                      planes, plane_count, boxes, box_count,
+                                      meshes, mesh_count, mesh_nodes, triangles, mesh_positions,
+                                      instances, instance_count, inst_nodes, inst_prims, materials);
+#ifdef SMALL_SCENE_SPHERES
+    __local float4 small_spheres[SMALL_SCENE_LOCAL];
+    stage_small_spheres(sphere_geom, small_spheres);
+    scene.small_spheres = small_spheres;
+#endif
+#ifdef RAY_STATS
+    RayStats stats = zero_ray_stats();
+    scene.stats = &stats;
+#endif
+
+    int idx = -1, x = 0, y = 0;   /* pixel owned by this lane, -1 = none */
+    int sample = 0, bounce = 0;
+    bool path = false;            /* a path is in flight */
+    Sampler sampler;
+    Ray ray;
+    float3 accum_color = (float3)(0.0f), mask = (float3)(1.0f);
+    float3 sum = (float3)(0.0f);
+    float sq = 0.0f;
+    uint steps = 0;
+
+    while (true) {
+        if (!path) {
+            if (idx < 0) {
+                uint work = atomic_inc(work_counter);
+                if (work >= (uint)active_count) break;
+                idx = (int)active_pixels[work];
+                x = idx % width;
+                y = idx / width;
+                sample = 0;
+                sum = (float3)(0.0f);
+                sq = 0.0f;
+            }
+            /* regenerate: the next camera ray of the same pixel */
+            sampler = make_sampler((uint)idx, sample_index + (uint)sample, frame_seed);
+            ray = create_ray(x, y, camera, sample_square(&sampler));
+            accum_color = (float3)(0.0f);
+            mask = (float3)(1.0f);
+            bounce = 0;
+            path = true;
+            RAY_STAT(scene.stats, RS_PATHS, 1);
+        }
+
+        /* one bounce of trace() */
+        ++steps;
+        Hit hit;
+        if (!intersect_scene(&scene, &ray, &hit)) {
+            RAY_STAT_ESCAPE(scene.stats, bounce);
+            accum_color += mask * sky_color(&ray);
+            path = false;
+        } else {
+            SurfaceHit surface = surface_at(&scene, &ray, &hit);
+            Material material = scene.materials[surface.material_index];
+            RAY_STAT_MATERIAL(scene.stats, material.type);
+            scatter(&surface, &ray, &material, bounce, &sampler, &accum_color, &mask);
+            path = ++bounce < BOUNCE_LIMIT(max_bounces);
+        }
+
+        if (!path) {
+            float l = luminance(accum_color);
+            sum += accum_color;
+            sq  += l * l;
+            if (++sample == pass_spp) {
+                accum[idx] += (float4)(sum, (float)pass_spp);
+                lum_sq[idx] += sq;
+                idx = -1;
+            }
+        }
+    }
+
+#ifdef LANE_STATS
+    __local uint group_steps[2];
+    report_lane_steps(steps, group_steps, lane_stats);
+#endif
+#ifdef RAY_STATS
+    __local uint group_stats[RS_COUNT];
+    report_ray_stats(&stats, group_stats, ray_stats);
+#endif
+}
+
+/* Drops converged pixels from the active list. Survivors are appended through an atomic
+   counter, so their order changes between passes; every pixel's samples depend only on its
+   position and sample index, so the image does not. */
+__kernel void compact_active(__global const float4* accum, __global const float* lum_sq,
+                             __global const uint* active_in, const int active_count,
+                             const float threshold, const int min_spp,
+                             __global uint* active_out, __global uint* out_count)
+{
+    int gid = get_global_id(0);
+    if (gid >= active_count) return;
+    uint idx = active_in[gid];
+    if (!pixel_converged(accum[idx], lum_sq[idx], threshold, min_spp))
+        active_out[atomic_inc(out_count)] = idx;
+}
+
+/* averages the accumulated samples and writes the gamma-corrected display image */
+__kernel void tonemap(int width, int height, __global const float4* accum, __global uchar4* output)
 {
     int x = get_global_id(0), y = get_global_id(1);
     if (x >= width || y >= height) return;
     int idx = y*width + x;
-    uint seed0 = x;
-    uint seed1 = y;
-
-    float3 sum = (float3)(0);
-    for(int j = 0; j != SAMPLES; j++) {
-        for (int s = 0; s < SAMPLES_PER_PIXEL; ++s) {
-            float2 jitter = sample_square(&random_seed, &seed0, &seed1);
-            Ray camray = create_ray(x, y, camera, jitter);
-            sum += trace(spheres, materials, &camray, sphere_count, material_count, &seed0, &seed1);
-        }
-    }
 
-    float3 avg = sum / ((float)SAMPLES_PER_PIXEL * (float)SAMPLES);
+    float4 acc = accum[idx];
+    float3 avg = acc.w > 0.0f ? acc.xyz / acc.w : (float3)(0.0f);
 
     float3 mapped = avg ;/// (1.0f + avg);
     mapped = (float3)(pow(mapped.x, 1.0f/2.2f),
@@ -442,4 +1149,3 @@ __kernel void render(int width, int height,
         (uchar)(clamp(mapped.z, 0.0f, 1.0f) * 255.0f),
         (uchar)255);
 }
-
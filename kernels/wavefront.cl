@@ -0,0 +1,172 @@
+/* Wavefront path tracer: trace() split into stage kernels so each launch runs one kind of work
+   and the material switch never diverges inside a launch.
+
+   Path state lives in SoA buffers indexed by path id, which is the pixel's position in the
+   active list. For every sample of a pass the host enqueues
+       wf_generate -> (wf_extend -> wf_shade per material) x camera max depth -> wf_accumulate
+   Queue lengths stay on the device in `counts` (WF_EXTEND_QUEUE, then one shade queue per
+   MAT_* type), so every stage is launched over all paths and the surplus work-items return
+   at once; the host never waits between stages. */
+
+#define WF_EXTEND_QUEUE 0
+#define WF_SHADE_QUEUE(type) (1 + (type))
+
+/* camera rays for one sample of every active pixel; seeds keep the path's sampler for wf_shade */
+__kernel void wf_generate(int width, __constant Camera* camera, const uint frame_seed,
+                          __global const uint* active_pixels, const int path_count,
+                          const uint sample,
+                          __global uint2* seeds,
+                          __global float4* ray_o, __global float4* ray_d,
+                          __global float4* throughput, __global float4* radiance,
+                          __global uint* ray_queue)
+{
+    int p = get_global_id(0);
+    if (p >= path_count) return;
+    int idx = (int)active_pixels[p];
+    int x = idx % width, y = idx / width;
+
+    /* same samples as the render kernel */
+    Sampler sampler = make_sampler((uint)idx, sample, frame_seed);
+    Ray ray = create_ray(x, y, camera, sample_square(&sampler));
+
+    seeds[p]      = (uint2)(sampler.pixel, sampler.sample);
+    ray_o[p]      = ray.origin;
+    ray_d[p]      = ray.direction;
+    throughput[p] = (float4)(1.0f, 1.0f, 1.0f, 0.0f);
+    radiance[p]   = (float4)(0.0f);
+    ray_queue[p]  = p; /* the host sets the queue length to path_count */
+}
+
+/* closest hit for every queued ray: misses pick up the sky and end, hits are binned by material */
+__kernel void wf_extend(int width, int height,
+                        __constant Camera* camera,
+                        __global const Sphere* spheres, __global const float4* sphere_geom, const int sphere_count,
+                        __global const BvhNode* bvh_nodes, __global const int* bvh_prims,
+                        __global const ushort4* spheres_q, __global const SpherePalette* sphere_palette,
+                        __global const Plane* planes, const int plane_count,
+                        __global const Box* boxes, const int box_count,
+                        __global const Mesh* meshes, const int mesh_count,
+                        __global const BvhNode* mesh_nodes, __global const Triangle* triangles,
+                        __global const float4* mesh_positions,
+                        __global const Instance* instances, const int instance_count,
+                        __global const BvhNode* inst_nodes, __global const int* inst_prims,
+                        MATERIAL_SPACE const Material* materials, const int material_count,
+                        __global const uint* ray_queue, __global uint* counts, const int path_capacity,
+                        __global const float4* ray_o, __global const float4* ray_d,
+                        __global const float4* throughput, __global float4* radiance,
+                        __global float4* hit_point, __global float4* hit_normal,
+                        __global float4* hit_emission, __global int* hit_material,
+                        __global uint* shade_queue, const int bounce, __global uint* ray_stats)
+{
+    int i = get_global_id(0);
+    SceneView scene = make_scene_view(spheres, sphere_geom, bvh_nodes, bvh_prims, spheres_q, sphere_palette,
+                                      planes, plane_count, boxes, box_count,
+                                      meshes, mesh_count, mesh_nodes, triangles, mesh_positions,
+                                      instances, instance_count, inst_nodes, inst_prims, materials);
+#ifdef SMALL_SCENE_SPHERES
+    __local float4 small_spheres[SMALL_SCENE_LOCAL];
+    stage_small_spheres(sphere_geom, small_spheres);
+    scene.small_spheres = small_spheres;
+#endif
+#ifdef RAY_STATS
+    RayStats stats = zero_ray_stats();
+    scene.stats = &stats;
+#endif
+
+    /* no early return: with RAY_STATS every work-item reaches the group reduction below */
+    if (i < (int)counts[WF_EXTEND_QUEUE]) {
+        uint p = ray_queue[i];
+        if (bounce == 0) RAY_STAT(scene.stats, RS_PATHS, 1);
+
+        Ray ray;
+        ray.origin    = ray_o[p];
+        ray.direction = ray_d[p];
+
+        Hit hit;
+        if (!intersect_scene(&scene, &ray, &hit)) {
+            RAY_STAT_ESCAPE(scene.stats, bounce);
+            radiance[p] += throughput[p] * (float4)(sky_color(&ray), 0.0f);
+        } else {
+            SurfaceHit surface = surface_at(&scene, &ray, &hit);
+            hit_point[p]    = (float4)(surface.point, 0.0f);
+            hit_normal[p]   = (float4)(surface.normal, 0.0f);
+            hit_emission[p] = (float4)(surface.emission, 0.0f);
+            hit_material[p] = surface.material_index;
+
+            int type = materials[surface.material_index].type;
+            RAY_STAT_MATERIAL(scene.stats, type);
+            /* trace() leaves paths with an unknown material unshaded as well */
+            if (type >= 0 && type < MAT_TYPE_COUNT) {
+                uint slot = atomic_inc(&counts[WF_SHADE_QUEUE(type)]);
+                shade_queue[type * path_capacity + slot] = p;
+            }
+        }
+    }
+
+#ifdef RAY_STATS
+    __local uint group_stats[RS_COUNT];
+    report_ray_stats(&stats, group_stats, ray_stats);
+#endif
+}
+
+/* one material's shade queue: every work-item of a launch runs the same scatter branch */
+__kernel void wf_shade(const int material_type, const int bounce,
+                       MATERIAL_SPACE const Material* materials,
+                       __global uint* counts, const int path_capacity,
+                       __global const uint* shade_queue, __global uint* ray_queue,
+                       __global const uint2* seeds,
+                       __global float4* ray_o, __global float4* ray_d,
+                       __global float4* throughput, __global float4* radiance,
+                       __global const float4* hit_point, __global const float4* hit_normal,
+                       __global const float4* hit_emission, __global const int* hit_material)
+{
+    int i = get_global_id(0);
+    if (i >= (int)counts[WF_SHADE_QUEUE(material_type)]) return;
+    uint p = shade_queue[material_type * path_capacity + i];
+
+    Ray ray;
+    ray.origin    = ray_o[p];
+    ray.direction = ray_d[p];
+
+    SurfaceHit surface;
+    surface.point          = hit_point[p].xyz;
+    surface.normal         = hit_normal[p].xyz;
+    surface.emission       = hit_emission[p].xyz;
+    surface.material_index = hit_material[p];
+    Material material = materials[surface.material_index];
+
+    float3 accum_color = radiance[p].xyz;
+    float3 mask        = throughput[p].xyz;
+    uint2 seed = seeds[p];
+    Sampler sampler = { seed.x, seed.y };
+    scatter(&surface, &ray, &material, bounce, &sampler, &accum_color, &mask);
+
+    ray_o[p]      = ray.origin;
+    ray_d[p]      = ray.direction;
+    throughput[p] = (float4)(mask, 0.0f);
+    radiance[p]   = (float4)(accum_color, 0.0f);
+    ray_queue[atomic_inc(&counts[WF_EXTEND_QUEUE])] = p;
+}
+
+/* sums the samples of a pass per path and adds them to the pixel once, like the render kernel */
+__kernel void wf_accumulate(__global const uint* active_pixels, const int path_count,
+                            const int first_sample, const int last_sample, const int pass_spp,
+                            __global const float4* radiance, __global float4* path_sum,
+                            __global float4* accum, __global float* lum_sq)
+{
+    int p = get_global_id(0);
+    if (p >= path_count) return;
+
+    float3 c = radiance[p].xyz;
+    float l = luminance(c);
+    float4 sum = (float4)(c, l * l);
+    if (!first_sample) sum += path_sum[p];
+
+    if (last_sample) {
+        uint idx = active_pixels[p];
+        accum[idx]  += (float4)(sum.xyz, (float)pass_spp);
+        lum_sq[idx] += sum.w;
+    } else {
+        path_sum[p] = sum;
+    }
+}
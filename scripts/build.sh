@@ -31,6 +31,10 @@ CANDIDATES=(
   "$BUILD_DIR/$TARGET_NAME.exe"
   "$BUILD_DIR/$BUILD_TYPE/$TARGET_NAME"
   "$BUILD_DIR/$BUILD_TYPE/$TARGET_NAME.exe"
+  "$BUILD_DIR/${TARGET_NAME}Bench"
+  "$BUILD_DIR/${TARGET_NAME}Bench.exe"
+  "$BUILD_DIR/$BUILD_TYPE/${TARGET_NAME}Bench"
+  "$BUILD_DIR/$BUILD_TYPE/${TARGET_NAME}Bench.exe"
 )
 
 COPIED=0
@@ -129,5 +129,30 @@ public:
 
 };
 
+// `frames` cameras moving through the key poses at an even rate, linearly between keys; every
+// other setting (resolution, samples, depth, fov) is copied from `base`
+inline std::vector<Camera> camera_path(const Camera& base, const std::vector<point3>& look_from_keys,
+                                       const std::vector<point3>& look_at_keys, int frames) {
+    if (look_from_keys.empty() || look_from_keys.size() != look_at_keys.size()) {
+        throw std::runtime_error("camera_path: need matching, non-empty key lists");
+    }
+    std::vector<Camera> cameras;
+    cameras.reserve(frames > 0 ? frames : 0);
+    const size_t segments = look_from_keys.size() - 1;
+    for (int f = 0; f < frames; ++f) {
+        const double t = frames > 1 ? double(f) / (frames - 1) * segments : 0.0;
+        const size_t k = std::min(size_t(t), segments > 0 ? segments - 1 : 0);
+        const float  a = segments > 0 ? float(t - double(k)) : 0.0f;
+        const size_t next = std::min(k + 1, segments);
+
+        Camera cam = base;
+        cam.set_look_from(glm::mix(look_from_keys[k], look_from_keys[next], a));
+        cam.set_look_at(glm::mix(look_at_keys[k], look_at_keys[next], a));
+        cam.initialize();
+        cameras.push_back(cam);
+    }
+    return cameras;
+}
+
 
 #endif // CAMERA_HPP
\ No newline at end of file
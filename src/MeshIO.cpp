@@ -0,0 +1,583 @@
+#include "pchray.h"
+
+#include "MeshIO.hpp"
+#include "WorkStealing.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace meshio {
+
+    namespace {
+
+        constexpr size_t MIN_CHUNK_BYTES = size_t(1) << 20; // smaller chunks cost more in merging than they save
+
+        std::string read_file(const std::filesystem::path& path) {
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if (!in) throw std::runtime_error("Failed to open mesh: " + path.string());
+            std::string data((size_t)in.tellg(), '\0');
+            in.seekg(0);
+            in.read(data.data(), (std::streamsize)data.size());
+            if (!in) throw std::runtime_error("Failed to read mesh: " + path.string());
+            return data;
+        }
+
+        // Runs fn(chunk) for every chunk on the work-stealing pool; the first error is rethrown here,
+        // since an exception must not escape a worker thread
+        template <class Fn>
+        void parallel_chunks(size_t chunks, unsigned threads, Fn&& fn) {
+            compute::cpu::WorkStealingScheduler scheduler(threads);
+            std::vector<std::string> errors(chunks);
+            scheduler.run(chunks, [&](size_t c, unsigned) {
+                try { fn(c); }
+                catch (const std::exception& e) { errors[c] = e.what(); }
+            });
+            for (const auto& e : errors) {
+                if (!e.empty()) throw std::runtime_error(e);
+            }
+        }
+
+        size_t chunk_count(size_t bytes, unsigned threads) {
+            const size_t workers = threads ? threads : compute::cpu::WorkStealingScheduler::default_worker_count();
+            return std::clamp<size_t>(bytes / MIN_CHUNK_BYTES, 1, workers * 8);
+        }
+
+        // Cuts [begin, end) into `count` ranges that all start at the beginning of a line
+        std::vector<size_t> line_aligned_cuts(const std::string& data, size_t begin, size_t end, size_t count) {
+            std::vector<size_t> cuts{begin};
+            for (size_t c = 1; c < count; ++c) {
+                size_t at = std::max(cuts.back(), begin + (end - begin) * c / count);
+                const void* nl = at < end ? std::memchr(data.data() + at, '\n', end - at) : nullptr;
+                cuts.push_back(nl ? size_t((const char*)nl - data.data()) + 1 : end);
+            }
+            cuts.push_back(end);
+            return cuts;
+        }
+
+        inline const char* line_end(const char* p, const char* end) {
+            const void* nl = std::memchr(p, '\n', end - p);
+            return nl ? (const char*)nl : end;
+        }
+
+        inline void skip_blanks(const char*& p, const char* end) {
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        }
+
+        // strtod skips newlines on its own, so the token is checked to sit on this line first
+        inline bool parse_number(const char*& p, const char* end, double& value) {
+            skip_blanks(p, end);
+            if (p >= end || *p == '\n') return false;
+            char* after = nullptr;
+            value = std::strtod(p, &after);
+            if (after == p) return false;
+            p = after;
+            return true;
+        }
+
+        inline bool parse_integer(const char*& p, const char* end, int64_t& value) {
+            skip_blanks(p, end);
+            bool negative = false;
+            if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+            if (p >= end || *p < '0' || *p > '9') return false;
+            value = 0;
+            while (p < end && *p >= '0' && *p <= '9') value = value * 10 + (*p++ - '0');
+            if (negative) value = -value;
+            return true;
+        }
+
+        // appends the fan (v0, vi, vi+1) of one polygon
+        template <class Index>
+        inline void triangulate_fan(const Index* poly, size_t n, std::vector<Index>& out) {
+            for (size_t i = 1; i + 1 < n; ++i) {
+                out.push_back(poly[0]);
+                out.push_back(poly[i]);
+                out.push_back(poly[i + 1]);
+            }
+        }
+
+        void check_vertex_count(size_t count) {
+            if (count > std::numeric_limits<uint32_t>::max()) {
+                throw std::runtime_error("Mesh has more vertices than 32-bit indices can address");
+            }
+        }
+
+        // ----------------------------------------------------------------- OBJ
+
+        struct ObjChunk {
+            std::vector<glm::vec3> positions;
+            std::vector<int64_t>   corners;   // 3 per triangle, 0-based
+            std::vector<size_t>    relative;  // corners written as negative indices: still relative to this chunk
+        };
+
+        struct ObjCorner {
+            int64_t index;
+            bool    relative;
+        };
+
+        void parse_obj_chunk(const char* p, const char* end, ObjChunk& chunk) {
+            std::vector<ObjCorner> poly, fan;
+            while (p < end) {
+                const char* eol = line_end(p, end);
+                skip_blanks(p, eol);
+
+                if (eol - p > 1 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+                    p += 1;
+                    double x, y, z;
+                    if (!parse_number(p, eol, x) || !parse_number(p, eol, y) || !parse_number(p, eol, z)) {
+                        throw std::runtime_error("OBJ: malformed vertex line");
+                    }
+                    chunk.positions.emplace_back((float)x, (float)y, (float)z);
+                } else if (eol - p > 1 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+                    p += 1;
+                    poly.clear();
+                    int64_t index;
+                    while (parse_integer(p, eol, index)) {
+                        if (index == 0) throw std::runtime_error("OBJ: face index 0 (indices start at 1)");
+                        // positive: absolute and 1-based; negative: counted back from the latest vertex,
+                        // which may sit in an earlier chunk, so it stays relative to this one until the merge
+                        if (index > 0) poly.push_back({index - 1, false});
+                        else           poly.push_back({(int64_t)chunk.positions.size() + index, true});
+                        while (p < eol && *p != ' ' && *p != '\t' && *p != '\r') ++p; // skip /vt/vn
+                    }
+                    if (poly.size() < 3) throw std::runtime_error("OBJ: face with fewer than 3 vertices");
+                    fan.clear();
+                    triangulate_fan(poly.data(), poly.size(), fan);
+                    for (const ObjCorner& corner : fan) {
+                        if (corner.relative) chunk.relative.push_back(chunk.corners.size());
+                        chunk.corners.push_back(corner.index);
+                    }
+                }
+                // anything else (vn, vt, o, g, usemtl, comments, ...) is ignored
+                p = eol + 1;
+            }
+        }
+
+        // ----------------------------------------------------------------- PLY
+
+        enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+        struct PlyProperty {
+            std::string name;
+            PlyType     type       = PlyType::Float32;
+            bool        list       = false;
+            PlyType     count_type = PlyType::UInt8;
+        };
+
+        struct PlyElement {
+            std::string name;
+            size_t      count = 0;
+            std::vector<PlyProperty> properties;
+        };
+
+        size_t ply_size(PlyType t) {
+            switch (t) {
+                case PlyType::Int8:   case PlyType::UInt8:   return 1;
+                case PlyType::Int16:  case PlyType::UInt16:  return 2;
+                case PlyType::Int32:  case PlyType::UInt32:  case PlyType::Float32: return 4;
+                case PlyType::Float64: return 8;
+            }
+            return 0;
+        }
+
+        PlyType ply_type(const std::string& name) {
+            if (name == "char"   || name == "int8")    return PlyType::Int8;
+            if (name == "uchar"  || name == "uint8")   return PlyType::UInt8;
+            if (name == "short"  || name == "int16")   return PlyType::Int16;
+            if (name == "ushort" || name == "uint16")  return PlyType::UInt16;
+            if (name == "int"    || name == "int32")   return PlyType::Int32;
+            if (name == "uint"   || name == "uint32")  return PlyType::UInt32;
+            if (name == "float"  || name == "float32") return PlyType::Float32;
+            if (name == "double" || name == "float64") return PlyType::Float64;
+            throw std::runtime_error("PLY: unknown property type '" + name + "'");
+        }
+
+        template <class T>
+        inline T load_as(const char* p, bool swap) {
+            unsigned char bytes[sizeof(T)];
+            std::memcpy(bytes, p, sizeof(T));
+            if (swap) std::reverse(bytes, bytes + sizeof(T));
+            T v;
+            std::memcpy(&v, bytes, sizeof(T));
+            return v;
+        }
+
+        inline double read_binary(const char* p, PlyType t, bool swap) {
+            switch (t) {
+                case PlyType::Int8:    return load_as<int8_t>(p, swap);
+                case PlyType::UInt8:   return load_as<uint8_t>(p, swap);
+                case PlyType::Int16:   return load_as<int16_t>(p, swap);
+                case PlyType::UInt16:  return load_as<uint16_t>(p, swap);
+                case PlyType::Int32:   return load_as<int32_t>(p, swap);
+                case PlyType::UInt32:  return load_as<uint32_t>(p, swap);
+                case PlyType::Float32: return load_as<float>(p, swap);
+                case PlyType::Float64: return load_as<double>(p, swap);
+            }
+            return 0.0;
+        }
+
+        struct PlyHeader {
+            enum class Format { Ascii, BinaryLE, BinaryBE } format = Format::Ascii;
+            std::vector<PlyElement> elements;
+            size_t body = 0; // byte offset of the first element row
+        };
+
+        PlyHeader parse_ply_header(const std::string& data) {
+            if (data.compare(0, 3, "ply") != 0) throw std::runtime_error("PLY: missing magic number");
+            const size_t end = data.find("end_header");
+            if (end == std::string::npos) throw std::runtime_error("PLY: missing end_header");
+
+            PlyHeader header;
+            const size_t nl = data.find('\n', end);
+            header.body = nl == std::string::npos ? data.size() : nl + 1;
+
+            std::istringstream lines(data.substr(0, end));
+            std::string line;
+            bool has_format = false;
+            while (std::getline(lines, line)) {
+                std::istringstream words(line);
+                std::string keyword;
+                words >> keyword;
+                if (keyword == "format") {
+                    std::string format;
+                    words >> format;
+                    if      (format == "ascii")                header.format = PlyHeader::Format::Ascii;
+                    else if (format == "binary_little_endian") header.format = PlyHeader::Format::BinaryLE;
+                    else if (format == "binary_big_endian")    header.format = PlyHeader::Format::BinaryBE;
+                    else throw std::runtime_error("PLY: unknown format '" + format + "'");
+                    has_format = true;
+                } else if (keyword == "element") {
+                    PlyElement element;
+                    words >> element.name >> element.count;
+                    header.elements.push_back(element);
+                } else if (keyword == "property") {
+                    if (header.elements.empty()) throw std::runtime_error("PLY: property outside an element");
+                    PlyProperty prop;
+                    std::string type;
+                    words >> type;
+                    if (type == "list") {
+                        std::string count_type, item_type;
+                        words >> count_type >> item_type;
+                        prop.list = true;
+                        prop.count_type = ply_type(count_type);
+                        prop.type = ply_type(item_type);
+                    } else {
+                        prop.type = ply_type(type);
+                    }
+                    words >> prop.name;
+                    header.elements.back().properties.push_back(prop);
+                }
+                // ply, comment, obj_info: nothing to do
+            }
+            if (!has_format) throw std::runtime_error("PLY: missing format line");
+            return header;
+        }
+
+        int find_property(const PlyElement& e, std::initializer_list<const char*> names) {
+            for (size_t i = 0; i < e.properties.size(); ++i) {
+                for (const char* n : names) {
+                    if (e.properties[i].name == n) return (int)i;
+                }
+            }
+            return -1;
+        }
+
+        // Where vertex and face data live and how to pick them out of a row
+        struct PlyLayout {
+            int vertex_element = -1, face_element = -1;
+            int x = -1, y = -1, z = -1;
+            int face_indices = -1;
+        };
+
+        PlyLayout ply_layout(const PlyHeader& header) {
+            PlyLayout l;
+            for (size_t i = 0; i < header.elements.size(); ++i) {
+                if (header.elements[i].name == "vertex") l.vertex_element = (int)i;
+                if (header.elements[i].name == "face")   l.face_element   = (int)i;
+            }
+            if (l.vertex_element < 0) throw std::runtime_error("PLY: no vertex element");
+            if (l.face_element < 0 || header.elements[l.face_element].count == 0) {
+                throw std::runtime_error("PLY: no faces (point clouds are not meshes)");
+            }
+            const PlyElement& v = header.elements[l.vertex_element];
+            l.x = find_property(v, {"x"});
+            l.y = find_property(v, {"y"});
+            l.z = find_property(v, {"z"});
+            if (l.x < 0 || l.y < 0 || l.z < 0) throw std::runtime_error("PLY: vertex element lacks x/y/z");
+            l.face_indices = find_property(header.elements[l.face_element], {"vertex_indices", "vertex_index"});
+            if (l.face_indices < 0 || !header.elements[l.face_element].properties[l.face_indices].list) {
+                throw std::runtime_error("PLY: face element lacks a vertex_indices list");
+            }
+            return l;
+        }
+
+        // Ascii body: one row per line, elements in header order
+        MeshData load_ply_ascii(const std::string& data, const PlyHeader& header, const PlyLayout& layout,
+                                unsigned threads) {
+            size_t total_rows = 0;
+            for (const auto& e : header.elements) total_rows += e.count;
+
+            // one sequential memchr pass gives every row start; parsing the rows is what gets parallel
+            std::vector<size_t> row_start;
+            row_start.reserve(total_rows + 1);
+            size_t at = header.body;
+            while (row_start.size() < total_rows && at < data.size()) {
+                row_start.push_back(at);
+                const void* nl = std::memchr(data.data() + at, '\n', data.size() - at);
+                at = nl ? size_t((const char*)nl - data.data()) + 1 : data.size();
+            }
+            if (row_start.size() < total_rows) throw std::runtime_error("PLY: file truncated");
+            row_start.push_back(at);
+
+            size_t first_row = 0, vertex_row = 0, face_row = 0;
+            for (int i = 0; i < (int)header.elements.size(); ++i) {
+                if (i == layout.vertex_element) vertex_row = first_row;
+                if (i == layout.face_element)   face_row   = first_row;
+                first_row += header.elements[i].count;
+            }
+            const PlyElement& ve = header.elements[layout.vertex_element];
+            const PlyElement& fe = header.elements[layout.face_element];
+
+            // reads one row of `e` and hands every scalar (list items included) to visit(property, item, value)
+            auto read_row = [&](const PlyElement& e, size_t row, auto&& visit) {
+                const char* p = data.data() + row_start[row];
+                const char* end = data.data() + row_start[row + 1];
+                for (int k = 0; k < (int)e.properties.size(); ++k) {
+                    double value;
+                    if (!parse_number(p, end, value)) throw std::runtime_error("PLY: malformed row in element " + e.name);
+                    if (!e.properties[k].list) { visit(k, 0, value); continue; }
+                    const size_t n = (size_t)value;
+                    for (size_t item = 0; item < n; ++item) {
+                        if (!parse_number(p, end, value)) throw std::runtime_error("PLY: short list in element " + e.name);
+                        visit(k, item + 1, value);
+                    }
+                }
+            };
+
+            MeshData mesh;
+            check_vertex_count(ve.count);
+            mesh.positions.resize(ve.count);
+            const size_t chunks = std::max<size_t>(1, std::min(chunk_count(data.size(), threads), ve.count / 1024 + 1));
+
+            parallel_chunks(chunks, threads, [&](size_t c) {
+                for (size_t r = ve.count * c / chunks; r < ve.count * (c + 1) / chunks; ++r) {
+                    glm::vec3& out = mesh.positions[r];
+                    read_row(ve, vertex_row + r, [&](int k, size_t, double v) {
+                        if (k == layout.x) out.x = (float)v;
+                        else if (k == layout.y) out.y = (float)v;
+                        else if (k == layout.z) out.z = (float)v;
+                    });
+                }
+            });
+
+            std::vector<std::vector<uint32_t>> tris(chunks);
+            parallel_chunks(chunks, threads, [&](size_t c) {
+                std::vector<uint32_t> poly;
+                for (size_t r = fe.count * c / chunks; r < fe.count * (c + 1) / chunks; ++r) {
+                    poly.clear();
+                    read_row(fe, face_row + r, [&](int k, size_t item, double v) {
+                        if (k != layout.face_indices || item == 0) return;
+                        if (v < 0.0 || v >= (double)ve.count) throw std::runtime_error("PLY: face index out of range");
+                        poly.push_back((uint32_t)v);
+                    });
+                    if (poly.size() < 3) throw std::runtime_error("PLY: face with fewer than 3 vertices");
+                    triangulate_fan(poly.data(), poly.size(), tris[c]);
+                }
+            });
+
+            size_t count = 0;
+            for (const auto& t : tris) count += t.size();
+            mesh.indices.reserve(count);
+            for (const auto& t : tris) mesh.indices.insert(mesh.indices.end(), t.begin(), t.end());
+            return mesh;
+        }
+
+        // Binary body: fixed-size rows are addressed directly, rows with lists are located by one scan
+        MeshData load_ply_binary(const std::string& data, const PlyHeader& header, const PlyLayout& layout,
+                                 unsigned threads) {
+            const uint16_t probe = 1;
+            const bool host_little = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+            const bool swap = (header.format == PlyHeader::Format::BinaryLE) != host_little;
+            const char* base = data.data();
+            const size_t size = data.size();
+
+            auto row_bytes = [&](const PlyElement& e, size_t at) {
+                size_t bytes = 0;
+                for (const auto& prop : e.properties) {
+                    if (!prop.list) { bytes += ply_size(prop.type); continue; }
+                    if (at + bytes + ply_size(prop.count_type) > size) throw std::runtime_error("PLY: file truncated");
+                    const size_t n = (size_t)read_binary(base + at + bytes, prop.count_type, swap);
+                    bytes += ply_size(prop.count_type) + n * ply_size(prop.type);
+                }
+                return bytes;
+            };
+            auto has_lists = [](const PlyElement& e) {
+                return std::any_of(e.properties.begin(), e.properties.end(), [](const PlyProperty& p) { return p.list; });
+            };
+
+            // byte offset of every element
+            std::vector<size_t> element_start(header.elements.size());
+            size_t at = header.body;
+            for (size_t i = 0; i < header.elements.size(); ++i) {
+                element_start[i] = at;
+                const PlyElement& e = header.elements[i];
+                // faces are scanned below; past them only a vertex element stored after the faces matters
+                if ((int)i == layout.face_element && layout.vertex_element < layout.face_element) break;
+                if (!has_lists(e)) at += e.count * row_bytes(e, at);
+                else for (size_t r = 0; r < e.count; ++r) at += row_bytes(e, at);
+                if (at > size) throw std::runtime_error("PLY: file truncated");
+            }
+
+            const PlyElement& ve = header.elements[layout.vertex_element];
+            const PlyElement& fe = header.elements[layout.face_element];
+            if (has_lists(ve)) throw std::runtime_error("PLY: list properties on vertices are not supported");
+
+            size_t stride = 0;
+            std::vector<size_t> offset(ve.properties.size());
+            for (size_t k = 0; k < ve.properties.size(); ++k) {
+                offset[k] = stride;
+                stride += ply_size(ve.properties[k].type);
+            }
+            if (element_start[layout.vertex_element] + ve.count * stride > size) throw std::runtime_error("PLY: file truncated");
+
+            MeshData mesh;
+            check_vertex_count(ve.count);
+            mesh.positions.resize(ve.count);
+            const size_t chunks = std::max<size_t>(1, std::min(chunk_count(size, threads), ve.count / 1024 + 1));
+            parallel_chunks(chunks, threads, [&](size_t c) {
+                for (size_t r = ve.count * c / chunks; r < ve.count * (c + 1) / chunks; ++r) {
+                    const char* row = base + element_start[layout.vertex_element] + r * stride;
+                    mesh.positions[r] = glm::vec3((float)read_binary(row + offset[layout.x], ve.properties[layout.x].type, swap),
+                                                  (float)read_binary(row + offset[layout.y], ve.properties[layout.y].type, swap),
+                                                  (float)read_binary(row + offset[layout.z], ve.properties[layout.z].type, swap));
+                }
+            });
+
+            // face rows vary in size: one scan records where each chunk starts and how many triangles precede it
+            const size_t face_chunks = std::max<size_t>(1, std::min(chunk_count(size, threads), fe.count / 1024 + 1));
+            std::vector<size_t> chunk_at(face_chunks), chunk_tri(face_chunks + 1, 0);
+            at = element_start[layout.face_element];
+            size_t tri_count = 0;
+            for (size_t c = 0, r = 0; c < face_chunks; ++c) {
+                chunk_at[c] = at;
+                chunk_tri[c] = tri_count;
+                for (; r < fe.count * (c + 1) / face_chunks; ++r) {
+                    size_t bytes = 0;
+                    for (size_t k = 0; k < fe.properties.size(); ++k) {
+                        const PlyProperty& prop = fe.properties[k];
+                        if (!prop.list) { bytes += ply_size(prop.type); continue; }
+                        if (at + bytes + ply_size(prop.count_type) > size) throw std::runtime_error("PLY: file truncated");
+                        const size_t n = (size_t)read_binary(base + at + bytes, prop.count_type, swap);
+                        if ((int)k == layout.face_indices) {
+                            if (n < 3) throw std::runtime_error("PLY: face with fewer than 3 vertices");
+                            tri_count += n - 2;
+                        }
+                        bytes += ply_size(prop.count_type) + n * ply_size(prop.type);
+                    }
+                    at += bytes;
+                }
+            }
+            if (at > size) throw std::runtime_error("PLY: file truncated");
+            chunk_tri[face_chunks] = tri_count;
+
+            mesh.indices.resize(tri_count * 3);
+            parallel_chunks(face_chunks, threads, [&](size_t c) {
+                size_t p = chunk_at[c];
+                uint32_t* out = mesh.indices.data() + chunk_tri[c] * 3;
+                std::vector<uint32_t> poly, fan;
+                for (size_t r = fe.count * c / face_chunks; r < fe.count * (c + 1) / face_chunks; ++r) {
+                    for (size_t k = 0; k < fe.properties.size(); ++k) {
+                        const PlyProperty& prop = fe.properties[k];
+                        if (!prop.list) { p += ply_size(prop.type); continue; }
+                        const size_t n = (size_t)read_binary(base + p, prop.count_type, swap);
+                        p += ply_size(prop.count_type);
+                        if ((int)k == layout.face_indices) {
+                            poly.clear();
+                            for (size_t i = 0; i < n; ++i) {
+                                const double v = read_binary(base + p + i * ply_size(prop.type), prop.type, swap);
+                                if (v < 0.0 || v >= (double)ve.count) throw std::runtime_error("PLY: face index out of range");
+                                poly.push_back((uint32_t)v);
+                            }
+                            fan.clear();
+                            triangulate_fan(poly.data(), poly.size(), fan);
+                            out = std::copy(fan.begin(), fan.end(), out);
+                        }
+                        p += n * ply_size(prop.type);
+                    }
+                }
+            });
+            return mesh;
+        }
+
+    }
+
+    MeshData load_obj(const std::filesystem::path& path, unsigned threads) {
+        const std::string data = read_file(path);
+        const size_t chunks = chunk_count(data.size(), threads);
+        const std::vector<size_t> cuts = line_aligned_cuts(data, 0, data.size(), chunks);
+
+        std::vector<ObjChunk> parsed(chunks);
+        parallel_chunks(chunks, threads, [&](size_t c) {
+            parse_obj_chunk(data.data() + cuts[c], data.data() + cuts[c + 1], parsed[c]);
+        });
+
+        // prefix sums place every chunk's vertices and corners in the merged arrays
+        std::vector<size_t> vertex_base(chunks), corner_base(chunks);
+        size_t vertex_count = 0, corner_count = 0;
+        for (size_t c = 0; c < chunks; ++c) {
+            vertex_base[c] = vertex_count;
+            corner_base[c] = corner_count;
+            vertex_count += parsed[c].positions.size();
+            corner_count += parsed[c].corners.size();
+        }
+        check_vertex_count(vertex_count);
+
+        MeshData mesh;
+        mesh.positions.resize(vertex_count);
+        mesh.indices.resize(corner_count);
+        parallel_chunks(chunks, threads, [&](size_t c) {
+            ObjChunk& chunk = parsed[c];
+            std::copy(chunk.positions.begin(), chunk.positions.end(), mesh.positions.begin() + vertex_base[c]);
+            for (size_t k : chunk.relative) chunk.corners[k] += (int64_t)vertex_base[c];
+            for (size_t k = 0; k < chunk.corners.size(); ++k) {
+                const int64_t v = chunk.corners[k];
+                if (v < 0 || v >= (int64_t)vertex_count) {
+                    throw std::runtime_error("OBJ: face references vertex " + std::to_string(v + 1) + " of " +
+                                             std::to_string(vertex_count));
+                }
+                mesh.indices[corner_base[c] + k] = (uint32_t)v;
+            }
+        });
+        return mesh;
+    }
+
+    MeshData load_ply(const std::filesystem::path& path, unsigned threads) {
+        const std::string data = read_file(path);
+        const PlyHeader header = parse_ply_header(data);
+        const PlyLayout layout = ply_layout(header);
+        return header.format == PlyHeader::Format::Ascii ? load_ply_ascii(data, header, layout, threads)
+                                                         : load_ply_binary(data, header, layout, threads);
+    }
+
+    MeshData load_mesh(const std::filesystem::path& path, unsigned threads) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        std::string ext = path.extension().string();
+        std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+
+        MeshData mesh;
+        if (ext == ".obj")      mesh = load_obj(path, threads);
+        else if (ext == ".ply") mesh = load_ply(path, threads);
+        else throw std::runtime_error("Unsupported mesh format: " + path.string());
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Loaded " << path.filename().string() << ": " << mesh.positions.size() << " vertices, "
+                  << mesh.indices.size() / 3 << " triangles in "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+        return mesh;
+    }
+
+}
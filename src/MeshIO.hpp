@@ -0,0 +1,27 @@
+#ifndef MESHIO_HPP
+#define MESHIO_HPP
+
+namespace meshio {
+
+    // Triangle soup as read from disk: 3 indices per triangle into positions
+    struct MeshData {
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t>  indices;
+    };
+
+    /*
+    *   Loaders for Wavefront OBJ and PLY (ascii, binary little/big endian).
+    *   The file is read in one go and parsed in parallel: OBJ and ascii PLY are split into
+    *   line-aligned chunks, binary PLY rows are decoded by range. Polygons are fan-triangulated;
+    *   normals, texture coordinates and any other attributes are skipped.
+    *   `threads` = 0 uses every core. Malformed input throws std::runtime_error.
+    */
+    MeshData load_obj(const std::filesystem::path& path, unsigned threads = 0);
+    MeshData load_ply(const std::filesystem::path& path, unsigned threads = 0);
+
+    // Picks the loader from the file extension (.obj / .ply)
+    MeshData load_mesh(const std::filesystem::path& path, unsigned threads = 0);
+
+}
+
+#endif // MESHIO_HPP
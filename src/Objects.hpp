@@ -2,12 +2,29 @@
 #define OBJECTS_HPP
 
 
+// Indexed triangle mesh with one material; flat shaded from the geometric normal.
+// Geometry is fixed after construction so packed copies can stay resident on the device.
 class Mesh {
-    std::vector<glm::vec3> positions;     // size = numVerts
-    std::vector<glm::vec3> normals;       // optional
-    std::vector<glm::vec2> uvs;           // optional
-    std::vector<uint32_t>  indices;       // 3*triangleCount
-    int32_t material_index{0};
+    public:
+        Mesh(std::vector<glm::vec3> pos, std::vector<uint32_t> idx, vec3 emi, std::shared_ptr<Material> m) :
+            positions(std::move(pos)), indices(std::move(idx)), emission(emi), mat(std::move(m)) {
+            if (indices.size() % 3 != 0) throw std::runtime_error("Mesh index count is not a multiple of 3");
+            for (uint32_t i : indices) {
+                if (i >= positions.size()) throw std::runtime_error("Mesh index out of range");
+            }
+        }
+
+        const std::vector<glm::vec3>& get_positions() const { return positions; }
+        const std::vector<uint32_t>&  get_indices()   const { return indices;   }
+        const glm::vec3& get_emission() const { return emission; }
+        const std::shared_ptr<Material>& get_material_ptr() const { return mat; }
+        size_t get_triangle_count() const { return indices.size() / 3; }
+
+    private:
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t>  indices;   // 3 per triangle, counter-clockwise seen from outside
+        glm::vec3 emission;
+        std::shared_ptr<Material> mat;
 };
 
 class Sphere {
@@ -36,15 +53,86 @@ class Sphere {
         std::shared_ptr<Material> mat;
 };
 
+// Infinite plane through `point`; unbounded, so it is tested outside the BVH
+class Plane {
+    public:
+        Plane(point3 p, vec3 n, vec3 emi, std::shared_ptr<Material> m) :
+            point(p), normal(glm::normalize(n)), emission(emi), mat(std::move(m)) {}
+
+        const glm::vec3& get_point()    const { return point;    }
+        const glm::vec3& get_normal()   const { return normal;   }
+        const glm::vec3& get_emission() const { return emission; }
+        const std::shared_ptr<Material>& get_material_ptr() const { return mat; }
+
+    private:
+        glm::vec3 point;
+        glm::vec3 normal; // unit length
+        glm::vec3 emission;
+        std::shared_ptr<Material> mat;
+};
+
+// Axis-aligned box
+class Box {
+    public:
+        Box(point3 lo, point3 hi, vec3 emi, std::shared_ptr<Material> m) :
+            min(glm::min(lo, hi)), max(glm::max(lo, hi)), emission(emi), mat(std::move(m)) {}
+
+        const glm::vec3& get_min()      const { return min;      }
+        const glm::vec3& get_max()      const { return max;      }
+        const glm::vec3& get_emission() const { return emission; }
+        const std::shared_ptr<Material>& get_material_ptr() const { return mat; }
+
+    private:
+        glm::vec3 min, max;
+        glm::vec3 emission;
+        std::shared_ptr<Material> mat;
+};
+
+// A cluster of spheres defined once in its own object space and placed any number of
+// times through Instance; the spheres are uploaded once no matter how many copies exist.
+class SphereGroup {
+    public:
+        std::vector<Sphere> spheres;
+
+        void add_sphere(const Sphere& sphere) { spheres.push_back(sphere); }
+        int get_spheres_count() const { return spheres.size(); }
+};
+
+class Instance {
+    public:
+        Instance(std::shared_ptr<const SphereGroup> g, const glm::mat4& object_to_world) :
+            group(std::move(g)), transform(object_to_world) {}
+
+        const std::shared_ptr<const SphereGroup>& get_group() const { return group; }
+        const glm::mat4& get_transform() const { return transform; }
+
+        void set_transform(const glm::mat4& object_to_world) { transform = object_to_world; }
+
+    private:
+        std::shared_ptr<const SphereGroup> group;
+        glm::mat4 transform; // object space -> world space, affine
+};
+
+/*
+*   Change tracking: every edit is stamped with a revision drawn from one process-wide counter, so a
+*   backend that remembers the revision it last packed can tell exactly which spheres and materials
+*   changed since. Structural edits (adding objects, replacing vectors, swapping a material pointer)
+*   bump structure_revision() and force a full repack. Code that writes the public vectors directly
+*   must report it through mark_changed() / mark_sphere_changed() / mark_material_changed().
+*/
 class Scene {
 
 public:
     std::vector<Sphere> spheres;
     std::vector<std::shared_ptr<Material>> materials;
-    std::vector<Mesh> meshes;
+    std::vector<std::shared_ptr<const Mesh>> meshes;
+    std::vector<Instance> instances;
+    std::vector<Plane> planes;
+    std::vector<Box> boxes;
 public:
     void add_sphere(Sphere& sphere) {
         spheres.push_back(sphere);
+        mark_changed();
     }
 
     void define_sphere_vec_size(size_t size) {
@@ -53,15 +141,80 @@ public:
 
     void set_spheres_vec(const std::vector<Sphere>& vec) {
         spheres = vec;
+        mark_changed();
     }
 
     void set_materials_vec(const std::vector<std::shared_ptr<Material>>& vec) {
         materials = vec;
+        mark_changed();
+    }
+
+    void add_instance(const Instance& instance) {
+        instances.push_back(instance);
+        mark_changed();
+    }
+
+    void add_mesh(std::shared_ptr<const Mesh> mesh) {
+        meshes.push_back(std::move(mesh));
+        mark_changed();
+    }
+
+    void add_plane(const Plane& plane) {
+        planes.push_back(plane);
+        mark_changed();
+    }
+
+    void add_box(const Box& box) {
+        boxes.push_back(box);
+        mark_changed();
     }
 
+    // Replaces one sphere; only a different material pointer makes it a structural change
+    void update_sphere(size_t index, const Sphere& sphere) {
+        const bool same_material = spheres.at(index).get_material_ptr() == sphere.get_material_ptr();
+        spheres[index] = sphere;
+        if (same_material) mark_sphere_changed(index);
+        else               mark_changed();
+    }
+
+    void mark_changed() { structure_revision_ = revision_ = next_revision(); }
+
+    void mark_sphere_changed(size_t index) {
+        stamp(sphere_revisions_, index, spheres.size());
+    }
+
+    // For a material edited in place (albedo, fuzz, ref_idx); its dynamic type must stay the same
+    void mark_material_changed(size_t index) {
+        stamp(material_revisions_, index, materials.size());
+    }
+
+    uint64_t revision()           const { return revision_; }
+    uint64_t structure_revision() const { return structure_revision_; }
+
+    // Revision of the last edit of each element; may be shorter than the vector (missing = never edited)
+    const std::vector<uint64_t>& sphere_revisions()   const { return sphere_revisions_; }
+    const std::vector<uint64_t>& material_revisions() const { return material_revisions_; }
+
     int get_spheres_count() const {return spheres.size();} 
+    int get_instances_count() const {return instances.size();}
     int get_materials_count() const {return materials.size();}
 
+private:
+    uint64_t revision_ = next_revision();
+    uint64_t structure_revision_ = revision_;
+    std::vector<uint64_t> sphere_revisions_;
+    std::vector<uint64_t> material_revisions_;
+
+    static uint64_t next_revision() {
+        static std::atomic<uint64_t> counter{0};
+        return ++counter;
+    }
+
+    void stamp(std::vector<uint64_t>& revisions, size_t index, size_t count) {
+        if (index >= count) throw std::out_of_range("Scene: change marked past the end");
+        if (revisions.size() < count) revisions.resize(count, 0);
+        revisions[index] = revision_ = next_revision();
+    }
 };
 
 
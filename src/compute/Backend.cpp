@@ -1,5 +1,6 @@
 #include "pchray.h"
 #include "CLBackend.hpp"
+#include "CPUBackend.hpp"
 
 
 namespace compute {
@@ -8,6 +9,8 @@ namespace compute {
         switch (type) {
             case BackendType::OpenCL:
                 return std::make_unique<CLBackend>();
+            case BackendType::CPU:
+                return std::make_unique<CPUBackend>();
             // Adding other backends in the future
             // case BackendType::Metal:
             //     throw std::runtime_error("Metal backend not implemented.");
@@ -1,24 +1,146 @@
 #ifndef BACKEND_HPP
 #define BACKEND_HPP
 
+#include <atomic>
+#include "CLHeaders.hpp" // cl_float4 accumulation tiles
+#include "Timeline.hpp"
+
 namespace compute {
 
+    namespace serialize { struct PackedScene; }
+
     enum class BackendType {
         OpenCL,
+        CPU,
         Metal,
         Vulkan,
         CUDA
     };
 
+    enum class BvhBuilder {
+        HostSAH,    // binned SAH on the CPU, uploaded with the scene
+        DeviceLBVH  // Morton-order LBVH built and refit on the device
+    };
+
+    enum class TraceMode {
+        Megakernel, // one kernel traces whole paths, one work-item per pixel
+        Wavefront,  // generate / extend / shade-per-material / accumulate stage kernels (OpenCL only)
+        Persistent  // device-filling work-items pull pixels from an atomic counter and regenerate paths (OpenCL only)
+    };
+
+    enum class SamplerType {
+        Random, // hashed uniform numbers per (pixel, sample, bounce)
+        Sobol   // Owen-scrambled Sobol (0,2) points per bounce, decorrelated per pixel
+    };
+
+    enum class DevicePartition {
+        None,     // each multi-device entry renders as one device
+        NumaNode, // one sub-device per NUMA node (clCreateSubDevices by affinity domain)
+        Equally   // sub-devices of Config::cl.partition_units compute units each
+    };
+
+    enum class ImageFormat {
+        None, // no file (HDR output off)
+        PPM,  // 8-bit binary PPM, uncompressed
+        PNG,  // 8-bit RGB, deflated in parallel row bands
+        QOI,  // 8-bit RGB, fast lossless
+        PFM,  // linear float RGB of the accumulation (HDR)
+        EXR   // linear float RGB of the accumulation, uncompressed OpenEXR (HDR)
+    };
+
     struct Config {
         struct OpenCl {
         int platform_index = 0;
         int device_index   = 0;
         std::string build_options = ""; // e.g. "-cl-std=CL1.2 -cl-fast-relaxed-math"
+        std::string program_cache_dir = "kernel_cache"; // built program binaries; empty = compile from source every start
+        bool specialize_kernels = true; // compile render kernels per scene with depth, materials etc. as constants
+
+        // Multi-device tiles: row bands of the image go to several devices, each with its own queue and
+        // scene copy, from a shared work queue (megakernel, fixed spp, host BVH; see MultiDeviceTracer)
+        bool multi_device = false;
+        std::vector<int> device_indices = {}; // devices of the platform to use, any type; empty = all
+        DevicePartition partition = DevicePartition::None;
+        int partition_units = 0;  // compute units per sub-device with DevicePartition::Equally
+        int tile_rows = 32;       // rows per tile; smaller balances better, larger launches fewer kernels
         } cl;
+
+        struct Cpu {
+        unsigned thread_count = 0;  // 0 = std::thread::hardware_concurrency()
+        int      tile_size    = 16; // square tile edge in pixels
+        } cpu;
+
+        struct Bvh {
+        int sah_bins      = 16; // build time vs. quality: more bins find cheaper splits
+        int max_leaf_size = 4;
+        BvhBuilder builder = BvhBuilder::HostSAH; // CPU backend always uses the host builder
+        int lbvh_refit_frames = 16; // refit-only renders before a full device rebuild, 0 = always rebuild
+        } bvh;
+
+        // Progressive rendering: Camera::get_samples_per_pixel() samples are accumulated in passes
+        struct Render {
+        int samples_per_pass = 4; // spp per launch; small passes keep each launch short and stoppable
+        int preview_interval = 0; // passes between intermediate tone-mapped images, 0 = final image only
+        float adaptive_threshold = 0.0f; // relative standard error at which a pixel stops sampling, 0 = fixed spp
+        int adaptive_min_spp = 16; // samples before a pixel may retire; fewer give unreliable variance estimates
+        TraceMode trace_mode = TraceMode::Megakernel; // the CPU backend always traces whole paths
+        int persistent_groups_per_cu = 4; // resident work-groups per compute unit in Persistent mode
+        bool lane_stats = false; // count bounce steps per lane and report SIMD utilization (Megakernel, Persistent)
+        bool ray_stats = false; // in-kernel counters: rays, BVH/primitive tests, material hits, escape depths (OpenCL)
+        bool stage_timing = false; // drain the queue after the upload so FrameStats separates it from the kernels
+        SamplerType sampler = SamplerType::Random;
+        uint32_t seed = 0; // frame seed; render_sequence() uses seed + frame, a different seed gives independent noise
+        } render;
+
+        struct Geometry {
+        bool compressed_spheres = false; // 8-byte quantized world spheres + palette; needs the host BVH
+        } geometry;
+
+        // Encoding and writing run on a background thread, so the next render does not wait for them
+        struct Output {
+        std::string directory = ""; // empty = the images/ directory found above the working directory
+        ImageFormat format = ImageFormat::PPM; // display image: PPM, PNG or QOI
+        ImageFormat hdr_format = ImageFormat::None; // PFM or EXR: also write the linear accumulation
+        size_t queue_depth = 2; // images waiting for the writer before a render blocks on it
+        unsigned encode_threads = 0; // threads per PNG/QOI image, 0 = std::thread::hardware_concurrency()
+        } output;
+
+        // Coordinator/worker rendering over TCP (see RenderCoordinator, RenderWorker)
+        struct Distributed {
+        int tile_rows = 64;     // rows per task
+        int sample_ranges = 1;  // tasks per tile along the samples; more gives finer balancing at the end
+        double straggler_factor = 3.0; // an idle worker duplicates a task running this many times the mean task time
+        } distributed;
+
+        struct Profile {
+        bool timeline = false; // host phase timers and OpenCL event profiling; off costs nothing measurable
+        std::string trace_file = "timeline.json"; // Chrome trace-event JSON, rewritten after every render
+        } profile;
     };
 
 
+    // Where the time of one render() went, and how much work it did
+    struct FrameStats {
+        double pack_ms     = 0.0; // Scene -> PackedScene (full or incremental)
+        double upload_ms   = 0.0; // device buffer updates and BVH builds; enqueue time only unless stage_timing
+        double kernel_ms   = 0.0; // the progressive passes
+        double readback_ms = 0.0; // tone map and readback, until the image is queued for writing
+        uint64_t samples   = 0;   // pixel samples traced
+        uint64_t rays      = 0;   // path segments traced; 0 when not counted (OpenCL needs ray_stats or lane_stats)
+    };
+
+    // A band of rows and a range of samples of one image, rendered on its own (distributed tasks)
+    struct RegionTask {
+        int width = 0, height = 0;           // the whole image
+        int y0 = 0, y1 = 0;                  // rows [y0, y1)
+        int first_sample = 0, sample_count = 0;
+        int pass_spp = 4;                    // samples per launch; sample ranges start on pass boundaries
+        int max_bounces = 8;
+        uint32_t scene_id = 0;               // tasks with the same nonzero id share one scene; 0 = not cached
+        uint32_t frame_seed = 0;             // Config::render.seed of the job
+        SamplerType sampler = SamplerType::Random;
+    };
+
     class Backend {
     public: 
         virtual ~Backend() = default;
@@ -26,8 +148,42 @@ namespace compute {
 
         virtual void initialize(const Config& config) = 0;
         virtual void render(const Camera& cam, const Scene& scene) = 0;
+
+        // Renders one frame per camera into <name>_0000, <name>_0001, ... (Config::output); kernels, buffers
+        // and the packed scene carry over between frames, and writing frame N overlaps rendering N+1.
+        // A stop request ends the sequence after the current frame.
+        virtual void render_sequence(const std::vector<Camera>& cameras, const Scene& scene, const std::string& name) = 0;
         // virtual void shutdown() = 0;
 
+        // Traces `task` from an already packed scene (host BVH, uncompressed spheres) into `accum`:
+        // (y1 - y0) * width entries of rgb: radiance sum, w: sample count. Pixel sequences depend only on
+        // the pixel, the sample index and task.frame_seed, so a tile comes out the same on any worker of
+        // the same backend type, and as the matching part of a render() with the same passes. A backend may
+        // keep its device copy of `ps` for the next task with the same task.scene_id.
+        virtual void render_region(const serialize::PackedScene& ps, const RegionTask& task, std::vector<cl_float4>& accum) = 0;
+
+        // Asks a render in progress to stop after its current pass and write what it has (any thread)
+        void request_stop() { stop_requested_ = true; }
+
+        // Of the last render(), or the last frame of render_sequence() (whose readback is not timed)
+        const FrameStats& last_frame_stats() const { return frame_stats_; }
+
+        // Every phase since initialize(), when Config::profile.timeline is on
+        const Timeline& timeline() const { return timeline_; }
+
+    protected:
+        // Writes the trace file and prints the summary; no-op with the timeline off
+        void export_timeline(const std::string& trace_file) const {
+            if (!timeline_.enabled()) return;
+            timeline_.write_chrome_trace(trace_file);
+            timeline_.print_summary(std::cout);
+            std::cout << "Timeline written to " << trace_file << "\n";
+        }
+
+        std::atomic<bool> stop_requested_{false};
+        FrameStats frame_stats_;
+        Timeline timeline_;
+
     };
 
     std::unique_ptr<Backend> CreateBackend(BackendType type);
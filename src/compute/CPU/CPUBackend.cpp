@@ -0,0 +1,250 @@
+#include "pchray.h"
+
+#include "CPUBackend.hpp"
+
+#include <chrono>
+#include <future>
+
+namespace compute {
+
+    void CPUBackend::initialize(const Config& config) {
+        config_ = config;
+        if (config_.cpu.tile_size <= 0) {
+            throw std::runtime_error("Invalid CPU tile size.");
+        }
+        scheduler_ = std::make_unique<cpu::WorkStealingScheduler>(config_.cpu.thread_count);
+        timeline_.enable(config_.profile.timeline);
+        writer_.configure(config_.output, timeline_);
+        print_device_info();
+    }
+
+    void CPUBackend::render(const Camera& cam, const Scene& scene) {
+        stop_requested_ = false;
+        std::vector<glm::vec4> accum;
+        auto packed = std::async(std::launch::deferred, [&]() { return pack(cam, scene); });
+        if (trace_frame(cam, packed, config_.render.seed, accum, "rednerer4_cpu")) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            resolve_image(accum, cam.get_image_width(), cam.get_image_height(), "rednerer4_cpu");
+            frame_stats_.readback_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        export_timeline(config_.profile.trace_file);
+    }
+
+    void CPUBackend::render_sequence(const std::vector<Camera>& cameras, const Scene& scene, const std::string& name) {
+        stop_requested_ = false;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // Three frames in flight: frame N+1 is packed on one worker thread while N traces, and N-1's
+        // accumulation buffer is tone mapped and queued on writer_ by another
+        std::future<void> writer;
+        std::future<serialize::PackedScene> next;
+        size_t frames = 0;
+        for (size_t i = 0; i < cameras.size() && !stop_requested_; ++i) {
+            const std::string filename = image::frame_filename(name, i);
+            std::future<serialize::PackedScene> packed = next.valid() ? std::move(next)
+                : std::async(std::launch::deferred, [&, i]() { return pack(cameras[i], scene); });
+            if (i + 1 < cameras.size()) {
+                next = std::async(std::launch::async, [&, i]() { return pack(cameras[i + 1], scene); });
+            }
+            std::vector<glm::vec4> accum;
+            if (!trace_frame(cameras[i], packed, config_.render.seed + uint32_t(i), accum, filename)) continue;
+
+            if (writer.valid()) writer.get();
+            writer = std::async(std::launch::async, [this, accum = std::move(accum), filename,
+                                                     W = cameras[i].get_image_width(), H = cameras[i].get_image_height()]() {
+                resolve_image(accum, W, H, filename);
+            });
+            ++frames;
+        }
+        if (writer.valid()) writer.get();
+        writer_.flush(); // the frame rate includes getting every frame to disk
+
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Sequence: " << frames << " of " << cameras.size() << " frames in " << seconds << " s, "
+                  << (seconds > 0.0 ? double(frames) / seconds : 0.0) << " frames/s\n";
+        export_timeline(config_.profile.trace_file);
+    }
+
+    serialize::PackedScene CPUBackend::pack(const Camera& cam, const Scene& scene) {
+        serialize::BvhBuildOptions bvh_opt;
+        bvh_opt.sah_bins      = config_.bvh.sah_bins;
+        bvh_opt.max_leaf_size = config_.bvh.max_leaf_size;
+
+        ScopedPhase phase(timeline_, "pack_scene");
+        return serialize::pack_scene(scene, cam, bvh_opt, config_.geometry.compressed_spheres);
+    }
+
+    bool CPUBackend::trace_frame(const Camera& cam, std::future<serialize::PackedScene>& packed, uint32_t frame_seed,
+                                 std::vector<glm::vec4>& accum, const std::string& image_name) {
+        if (!scheduler_) {
+            throw std::runtime_error("CPU backend not initialized.");
+        }
+
+        const int W = cam.get_image_width();
+        const int H = cam.get_image_height();
+        if (W <= 0 || H <= 0) return false;
+
+        // the whole pack when it runs here (deferred), only the remainder when it ran ahead on a worker
+        frame_stats_ = FrameStats{};
+        const auto pack_start = std::chrono::high_resolution_clock::now();
+        serialize::PackedScene pscene = packed.get();
+        frame_stats_.pack_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pack_start).count();
+        serialize::print_bvh_stats("Sphere BVH", pscene.bvh_stats);
+        serialize::print_compression_stats(pscene);
+        serialize::print_instance_stats(pscene);
+        serialize::print_mesh_stats(pscene);
+
+        cpu::SceneView view = cpu::make_scene_view(pscene, cam.get_max_depth());
+        view.frame_seed = frame_seed;
+        view.sobol      = config_.render.sampler == SamplerType::Sobol;
+
+        const size_t N = size_t(W) * size_t(H);
+        accum.assign(N, glm::vec4(0.0f));
+        std::vector<float> lum_sq(N, 0.0f);
+
+        std::vector<uint32_t> active = tile_order(W, 0, H);
+
+        // Progressive passes, as on the GPU: the render can be stopped between passes
+        const int total_spp = std::max(1, cam.get_samples_per_pixel());
+        const int pass_spp  = std::max(1, config_.render.samples_per_pass);
+        const bool adaptive = config_.render.adaptive_threshold > 0.0f;
+        auto start = std::chrono::high_resolution_clock::now();
+        double converged_ms = -1.0;
+
+        int done = 0, passes = 0;
+        size_t steals = 0, tiles = 0, traced = 0;
+        uint64_t rays = 0;
+        const size_t tile_pixels = size_t(config_.cpu.tile_size) * size_t(config_.cpu.tile_size);
+        while (done < total_spp && !active.empty() && !stop_requested_) {
+            const int spp = std::min(pass_spp, total_spp - done);
+            ScopedPhase phase(timeline_, "pass");
+            steals += render_tiles(view, W, (uint32_t)done, spp, active, 0, accum, lum_sq, rays);
+            tiles  += (active.size() + tile_pixels - 1) / tile_pixels;
+            traced += active.size() * size_t(spp);
+            done += spp;
+            ++passes;
+
+            if (adaptive && done >= config_.render.adaptive_min_spp) {
+                // stable compaction keeps the surviving pixels in tile order
+                active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t p) {
+                    return cpu::pixel_converged(accum[p], lum_sq[p], config_.render.adaptive_threshold,
+                                                config_.render.adaptive_min_spp);
+                }), active.end());
+                if (active.empty()) {
+                    converged_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                }
+            }
+
+            if (config_.render.preview_interval > 0 && passes % config_.render.preview_interval == 0 && done < total_spp && !active.empty()) {
+                resolve_image(accum, W, H, image_name);
+            }
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        frame_stats_.kernel_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        frame_stats_.samples   = traced;
+        frame_stats_.rays      = rays;
+        std::cout << "CPU backend: " << tiles << " tiles in " << passes << " passes, " << steals << " stolen\n";
+        std::cout << "Progressive render: " << done << " of " << total_spp << " spp in " << passes << " passes, "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+        if (adaptive) {
+            const size_t budget = N * size_t(total_spp);
+            std::cout << "Adaptive sampling: " << traced << " of " << budget << " samples traced ("
+                      << 100.0 * double(budget - traced) / double(budget) << "% saved), ";
+            if (converged_ms >= 0.0) std::cout << "all pixels below threshold after " << converged_ms << " ms\n";
+            else                     std::cout << active.size() << " pixels still above threshold\n";
+        }
+        return true;
+    }
+
+    void CPUBackend::render_region(const serialize::PackedScene& ps, const RegionTask& task, std::vector<cl_float4>& accum) {
+        if (!scheduler_) {
+            throw std::runtime_error("CPU backend not initialized.");
+        }
+        if (task.width <= 0 || task.y0 < 0 || task.y1 > task.height || task.y0 >= task.y1) {
+            throw std::runtime_error("Invalid render region.");
+        }
+
+        cpu::SceneView view = cpu::make_scene_view(ps, task.max_bounces);
+        view.frame_seed = task.frame_seed;
+        view.sobol      = task.sampler == SamplerType::Sobol;
+        const uint32_t first_pixel = uint32_t(task.y0) * uint32_t(task.width);
+        const size_t N = size_t(task.y1 - task.y0) * size_t(task.width);
+        std::vector<glm::vec4> sums(N, glm::vec4(0.0f));
+        std::vector<float> lum_sq(N, 0.0f);
+        const std::vector<uint32_t> active = tile_order(task.width, task.y0, task.y1);
+
+        // the passes a full render would make, so tiles match it sample for sample
+        const int pass_spp = std::max(1, task.pass_spp);
+        uint64_t rays = 0;
+        for (int done = 0; done < task.sample_count; ) {
+            const int spp = std::min(pass_spp, task.sample_count - done);
+            ScopedPhase phase(timeline_, "pass");
+            render_tiles(view, task.width, uint32_t(task.first_sample + done), spp, active, first_pixel, sums, lum_sq, rays);
+            done += spp;
+        }
+
+        accum.resize(N);
+        for (size_t i = 0; i < N; ++i) accum[i] = cl_float4{{sums[i].x, sums[i].y, sums[i].z, sums[i].w}};
+    }
+
+    std::vector<uint32_t> CPUBackend::tile_order(int width, int y0, int y1) const {
+        const int tile = config_.cpu.tile_size;
+        std::vector<uint32_t> pixels;
+        pixels.reserve(size_t(y1 - y0) * size_t(width));
+        for (int ty = y0; ty < y1; ty += tile)
+            for (int tx = 0; tx < width; tx += tile)
+                for (int y = ty; y < std::min(ty + tile, y1); ++y)
+                    for (int x = tx; x < std::min(tx + tile, width); ++x)
+                        pixels.push_back(uint32_t(y) * uint32_t(width) + uint32_t(x));
+        return pixels;
+    }
+
+    size_t CPUBackend::render_tiles(const cpu::SceneView& view, int width, uint32_t sample_index, int spp,
+                                    const std::vector<uint32_t>& active, uint32_t first_pixel, std::vector<glm::vec4>& accum,
+                                    std::vector<float>& lum_sq, uint64_t& rays) {
+        const size_t tile_pixels = size_t(config_.cpu.tile_size) * size_t(config_.cpu.tile_size);
+        const size_t tiles = (active.size() + tile_pixels - 1) / tile_pixels;
+
+        // Tiles are numbered in list order, so each worker's initial block is a horizontal band
+        std::atomic<uint64_t> steps{0};
+        scheduler_->run(tiles, [&](size_t task, unsigned) {
+            const size_t begin = task * tile_pixels;
+            const size_t end   = std::min(begin + tile_pixels, active.size());
+
+            uint64_t tile_steps = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const uint32_t p = active[i];
+                const int x = int(p % uint32_t(width));
+                const int y = int(p / uint32_t(width));
+                const uint32_t slot = p - first_pixel;
+                uint32_t pixel_steps = 0;
+                accum[slot] += glm::vec4(cpu::accumulate_pixel(view, x, y, width, sample_index, spp, &lum_sq[slot], &pixel_steps), (float)spp);
+                tile_steps += pixel_steps;
+            }
+            steps.fetch_add(tile_steps, std::memory_order_relaxed);
+        });
+        rays += steps.load();
+        return scheduler_->steal_count();
+    }
+
+    void CPUBackend::resolve_image(const std::vector<glm::vec4>& accum, int width, int height, const std::string& filename) {
+        image::ImageJob job{ filename, width, height, std::vector<cl_uchar4>(accum.size()), {} };
+        {
+            ScopedPhase phase(timeline_, "tonemap");
+            for (size_t i = 0; i < accum.size(); ++i) job.ldr[i] = cpu::tonemap(accum[i]);
+        }
+        if (writer_.wants_hdr()) {
+            job.hdr.resize(accum.size());
+            for (size_t i = 0; i < accum.size(); ++i) job.hdr[i] = cl_float4{{accum[i].x, accum[i].y, accum[i].z, accum[i].w}};
+        }
+        writer_.submit(std::move(job));
+    }
+
+    void CPUBackend::print_device_info() {
+        std::cout << "//=========== CPU Backend Info ===============\n";
+        std::cout << "|| Worker threads: " << scheduler_->worker_count() << "\n";
+        std::cout << "|| Tile size: " << config_.cpu.tile_size << "x" << config_.cpu.tile_size << "\n";
+        std::cout << "//============================================\n" << std::endl;
+    }
+}
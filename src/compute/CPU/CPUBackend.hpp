@@ -0,0 +1,68 @@
+#ifndef CPUBACKEND_HPP
+#define CPUBACKEND_HPP
+
+
+#include "CLHeaders.hpp" // cl_* vector types used by the packed scene DTOs
+#include <fstream>
+#include <future>
+#include "CLUtils.hpp"
+#include "Backend.hpp"
+#include "Serialize.hpp"
+#include "ImageIO.hpp"
+#include "WorkStealing.hpp"
+#include "CPUTrace.hpp"
+
+
+
+namespace compute {
+
+    // Native multithreaded backend for hosts without an OpenCL GPU.
+    // Renders the same PackedScene as CLBackend with a C++ port of the kernel.
+    class CPUBackend final : public Backend {
+    public:
+
+        void initialize(const Config& config) override;
+        void render(const Camera& cam, const Scene& scene) override;
+        void render_sequence(const std::vector<Camera>& cameras, const Scene& scene, const std::string& name) override;
+        void render_region(const serialize::PackedScene& ps, const RegionTask& task, std::vector<cl_float4>& accum) override;
+
+    private:
+        // Configuration parameters
+        Config config_;
+
+        // Tile scheduler shared by all renders
+        std::unique_ptr<cpu::WorkStealingScheduler> scheduler_;
+
+        // Background encoder and writer for every image a render produces
+        image::ImageWriter writer_;
+
+        // Pixels of rows [y0, y1) in tile order, so consecutive runs of the list stay spatially coherent
+        std::vector<uint32_t> tile_order(int width, int y0, int y1) const;
+
+        // Adds `spp` samples, starting at sample `sample_index`, to every pixel in `active`. The list is in
+        // tile order and split into runs of tile_size^2 pixels, so each task stays spatially coherent.
+        // Pixel p lands in accum[p - first_pixel]. Adds the bounces traced to `rays`. Returns tiles stolen.
+        size_t render_tiles(const cpu::SceneView& view, int width, uint32_t sample_index, int spp,
+                            const std::vector<uint32_t>& active, uint32_t first_pixel, std::vector<glm::vec4>& accum,
+                            std::vector<float>& lum_sq, uint64_t& rays);
+
+        // Packs `scene` as seen from `cam`; only reads both, so a sequence runs it ahead on a worker thread
+        serialize::PackedScene pack(const Camera& cam, const Scene& scene);
+
+        // Waits for the frame's scene in `packed` and runs the progressive passes into `accum`; previews
+        // are saved as `image_name`. False for an empty image.
+        bool trace_frame(const Camera& cam, std::future<serialize::PackedScene>& packed, uint32_t frame_seed,
+                         std::vector<glm::vec4>& accum, const std::string& image_name);
+
+        // Tone maps `accum` and queues it on writer_
+        void resolve_image(const std::vector<glm::vec4>& accum, int width, int height, const std::string& filename);
+
+        void print_device_info();
+
+    public:
+        BackendType type() const override { return BackendType::CPU; }
+    };
+
+}
+
+#endif // CPUBACKEND_HPP
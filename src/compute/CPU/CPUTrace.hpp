@@ -0,0 +1,772 @@
+#ifndef CPUTRACE_HPP
+#define CPUTRACE_HPP
+
+namespace compute::cpu {
+
+    // Scalar C++ port of kernels/ray_tracer_text.cl. Every function below mirrors
+    // the kernel function of the same name, including the seed handling, so a
+    // CPU render matches the OpenCL one up to float rounding. Keep both in sync.
+
+    constexpr float EPSILON = 1e-3f;
+    constexpr float PI      = 3.14159265359f;
+    constexpr int   MAX_BOUNCES = 10; // default path length; SceneView::max_bounces carries the camera's
+
+    constexpr int   PRIM_SPHERE = 0;
+    constexpr int   PRIM_PLANE  = 1;
+    constexpr int   PRIM_BOX    = 2;
+    constexpr int   PRIM_TRIANGLE = 3;
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+    };
+
+    // Scene view over a PackedScene, so the tracer never touches host objects
+    struct SceneView {
+        const serialize::CameraGpu*   camera    = nullptr;
+        const serialize::SphereGpu*   spheres   = nullptr;
+        int                           sphere_count = 0;
+        const serialize::MaterialGpu* materials = nullptr;
+        int                           material_count = 0;
+        const serialize::BvhNodeGpu*  bvh_nodes = nullptr;
+        const cl_int*                 bvh_prims = nullptr;
+        const serialize::SphereQGpu*  spheres_q = nullptr;      // compressed world spheres when set
+        const serialize::SpherePaletteGpu* sphere_palette = nullptr;
+        const serialize::PlaneGpu*    planes    = nullptr;     // planes and boxes: flat lists outside the BVHs
+        int                           plane_count = 0;
+        const serialize::BoxGpu*      boxes     = nullptr;
+        int                           box_count = 0;
+        const serialize::MeshGpu*     meshes    = nullptr;     // tested one after the other, each through its own BVH
+        int                           mesh_count = 0;
+        const serialize::BvhNodeGpu*  mesh_nodes = nullptr;
+        const serialize::TriGpu*      triangles = nullptr;
+        const cl_float4*              mesh_positions = nullptr;
+        const serialize::InstanceGpu* instances = nullptr;
+        int                           instance_count = 0;
+        const serialize::BvhNodeGpu*  inst_nodes = nullptr;
+        const cl_int*                 inst_prims = nullptr;
+        int                           max_bounces = MAX_BOUNCES; // Camera::get_max_depth()
+        uint32_t                      frame_seed = 0;  // Config::render.seed, the kernels' frame_seed
+        bool                          sobol = false;   // SamplerType::Sobol, the kernels' SAMPLER_SOBOL
+    };
+
+    inline SceneView make_scene_view(const serialize::PackedScene& ps, int max_bounces) {
+        SceneView view;
+        view.camera         = &ps.camera;
+        view.spheres        = ps.spheres.data();
+        view.sphere_count   = ps.world_sphere_count;
+        view.materials      = ps.materials.data();
+        view.material_count = (int)ps.materials.size();
+        view.bvh_nodes      = ps.bvh_nodes.data();
+        view.bvh_prims      = ps.bvh_prims.data();
+        view.spheres_q      = ps.spheres_q.empty() ? nullptr : ps.spheres_q.data();
+        view.sphere_palette = ps.sphere_palette.data();
+        view.planes         = ps.planes.data();
+        view.plane_count    = (int)ps.planes.size();
+        view.boxes          = ps.boxes.data();
+        view.box_count      = (int)ps.boxes.size();
+        view.meshes         = ps.meshes.data();
+        view.mesh_count     = (int)ps.meshes.size();
+        view.mesh_nodes     = ps.mesh_nodes.data();
+        view.triangles      = ps.triangles.data();
+        view.mesh_positions = ps.mesh_positions.data();
+        view.instances      = ps.instances.data();
+        view.instance_count = (int)ps.instances.size();
+        view.inst_nodes     = ps.inst_nodes.data();
+        view.inst_prims     = ps.inst_prims.data();
+        view.max_bounces    = std::max(0, max_bounces);
+        return view;
+    }
+
+    struct Hit {
+        float t;
+        int   type;      // PRIM_*
+        int   prim;      // index into the list of that type
+        int   instance;  // -1 for world geometry
+        int   node;      // leaf that decodes a compressed prim
+    };
+
+    // shading inputs at the closest hit, all in world space
+    struct SurfaceHit {
+        glm::vec3 point;
+        glm::vec3 normal;  // outward, unit length
+        glm::vec3 emission;
+        int       material_index;
+    };
+
+    inline glm::vec3 xyz(const cl_float4& v) { return glm::vec3(v.s[0], v.s[1], v.s[2]); }
+
+    // OpenCL clamp() semantics: min(max(x, lo), hi), NaN collapses to lo
+    inline float clampf(float x, float lo, float hi) { return std::fmin(std::fmax(x, lo), hi); }
+
+
+    // pairs of sample dimensions, as in the kernel: the camera jitter, then two per bounce
+    constexpr uint32_t SAMPLE_CAMERA = 0u;
+    inline uint32_t sample_scatter(int bounce)     { return 1u + 2u * (uint32_t)bounce; }
+    inline uint32_t sample_scatter_aux(int bounce) { return 2u + 2u * (uint32_t)bounce; }
+
+    struct Sampler {
+        uint32_t pixel;  // hash of the pixel index and the frame seed
+        uint32_t sample; // sample number of the pixel, counted over the whole render
+        bool sobol;
+    };
+
+    inline uint32_t pcg_hash(uint32_t v) {
+        uint32_t state = v * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    inline float uint_to_unit(uint32_t v) {
+        return (float)(v >> 8) * (1.0f / 16777216.0f);
+    }
+
+    inline Sampler make_sampler(uint32_t pixel, uint32_t sample, uint32_t frame_seed, bool sobol) {
+        return Sampler{ pcg_hash(pixel ^ pcg_hash(frame_seed)), sample, sobol };
+    }
+
+    inline uint32_t reverse_bits32(uint32_t x) {
+        x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+        x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+        x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+        x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+        return (x >> 16) | (x << 16);
+    }
+
+    inline uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+        x = reverse_bits32(x);
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return reverse_bits32(x);
+    }
+
+    inline uint32_t sobol_dim1(uint32_t index) {
+        uint32_t v = 1u << 31, r = 0;
+        for (; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1u) r ^= v;
+        }
+        return r;
+    }
+
+    inline glm::vec2 sample_2d(const Sampler& s, uint32_t pair) {
+        uint32_t key = pcg_hash(s.pixel ^ pcg_hash(pair));
+        if (s.sobol) {
+            uint32_t index = nested_uniform_scramble(s.sample, key);
+            uint32_t x = nested_uniform_scramble(reverse_bits32(index), pcg_hash(key ^ 0x68bc21ebu));
+            uint32_t y = nested_uniform_scramble(sobol_dim1(index), pcg_hash(key ^ 0x02e5be93u));
+            return glm::vec2(uint_to_unit(x), uint_to_unit(y));
+        }
+        uint32_t h = pcg_hash(key ^ pcg_hash(s.sample));
+        return glm::vec2(uint_to_unit(h), uint_to_unit(pcg_hash(h)));
+    }
+
+    inline glm::vec2 sample_square(const Sampler& s) {
+        glm::vec2 xi = sample_2d(s, SAMPLE_CAMERA);
+        return glm::vec2(xi.x - 0.5f, xi.y - 0.5f);
+    }
+
+    inline glm::vec3 offset_along_normal(glm::vec3 p, glm::vec3 n, glm::vec3 newdir) {
+        float s = (glm::dot(newdir, n) >= 0.0f) ? 1.0f : -1.0f;
+        return p + n * (s * EPSILON);
+    }
+
+    inline Ray create_ray(int x, int y, const serialize::CameraGpu& cam, glm::vec2 jitter) {
+        Ray r;
+        r.origin = xyz(cam.origin);
+        glm::vec3 pixel_sample = xyz(cam.pixel00_pos) +
+            ((float)x + 0.5f + jitter.x) * xyz(cam.pixel_delta_x) +
+            ((float)y + 0.5f + jitter.y) * xyz(cam.pixel_delta_y);
+
+        r.direction = glm::normalize(pixel_sample - r.origin);
+        return r;
+    }
+
+    inline float intersect_sphere(const serialize::SphereGpu& sphere, const Ray& ray) {
+        glm::vec3 ray_to_center = xyz(sphere.center_r) - ray.origin;
+        float b = glm::dot(ray_to_center, ray.direction);
+        float c = glm::dot(ray_to_center, ray_to_center) - sphere.center_r.s[3] * sphere.center_r.s[3];
+        float disc = b * b - c;
+
+        if (disc < 0.0f) return 0.0f;
+        else disc = std::sqrt(disc);
+
+        if ((b - disc) > EPSILON) return b - disc;
+        if ((b + disc) > EPSILON) return b + disc;
+
+        return 0.0f;
+    }
+
+    // same conventions as intersect_sphere: 0 on a miss, the exit distance when starting inside
+    inline float intersect_plane(const serialize::PlaneGpu& plane, const Ray& ray) {
+        const glm::vec3 n = xyz(plane.normal_d);
+        float denom = glm::dot(n, ray.direction);
+        if (std::fabs(denom) < 1e-8f) return 0.0f;
+        float t = (plane.normal_d.s[3] - glm::dot(n, ray.origin)) / denom;
+        return t > EPSILON ? t : 0.0f;
+    }
+
+    inline float intersect_box(const serialize::BoxGpu& box, const Ray& ray, const glm::vec3& inv_dir) {
+        float tx0 = (box.bmin.s[0] - ray.origin.x) * inv_dir.x, tx1 = (box.bmax.s[0] - ray.origin.x) * inv_dir.x;
+        float ty0 = (box.bmin.s[1] - ray.origin.y) * inv_dir.y, ty1 = (box.bmax.s[1] - ray.origin.y) * inv_dir.y;
+        float tz0 = (box.bmin.s[2] - ray.origin.z) * inv_dir.z, tz1 = (box.bmax.s[2] - ray.origin.z) * inv_dir.z;
+        float tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::min(tz0, tz1));
+        float tfar  = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+        if (tnear > tfar) return 0.0f;
+        if (tnear > EPSILON) return tnear;
+        if (tfar > EPSILON) return tfar;
+        return 0.0f;
+    }
+
+    // slab test; returns the entry distance, or 1e20f when the box is missed or lies beyond t_max
+    inline float intersect_aabb(const cl_float4& bmin, const cl_float4& bmax, const Ray& ray,
+                                const glm::vec3& inv_dir, float t_max) {
+        // std::min/max rather than fmin/fmax: inv_dir is finite, so no NaNs to care about,
+        // and they compile to single min/max instructions
+        float tx0 = (bmin.s[0] - ray.origin.x) * inv_dir.x, tx1 = (bmax.s[0] - ray.origin.x) * inv_dir.x;
+        float ty0 = (bmin.s[1] - ray.origin.y) * inv_dir.y, ty1 = (bmax.s[1] - ray.origin.y) * inv_dir.y;
+        float tz0 = (bmin.s[2] - ray.origin.z) * inv_dir.z, tz1 = (bmax.s[2] - ray.origin.z) * inv_dir.z;
+        float tnear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float tfar  = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), t_max));
+        return tnear <= tfar ? tnear : 1e20f;
+    }
+
+    inline glm::vec3 safe_inverse(const glm::vec3& d) {
+        const float tiny = 1e-20f;
+        return glm::vec3(1.0f / (std::fabs(d.x) > tiny ? d.x : std::copysign(tiny, d.x)),
+                         1.0f / (std::fabs(d.y) > tiny ? d.y : std::copysign(tiny, d.y)),
+                         1.0f / (std::fabs(d.z) > tiny ? d.z : std::copysign(tiny, d.z)));
+    }
+
+    // tests both children of an inner node and pushes the ones the ray enters below t_max, the nearer
+    // last so it is visited first and the hit distance shrinks early; returns the new stack size
+    inline int push_children(const serialize::BvhNodeGpu* nodes, const serialize::BvhNodeGpu& node, const Ray& ray,
+                             const glm::vec3& inv_dir, float t_max, int* stack, int sp) {
+        int left = node.left_first, right = node.right;
+        float tl = intersect_aabb(nodes[left].bbox_min,  nodes[left].bbox_max,  ray, inv_dir, t_max);
+        float tr = intersect_aabb(nodes[right].bbox_min, nodes[right].bbox_max, ray, inv_dir, t_max);
+        if (tl > tr) {
+            std::swap(tl, tr);
+            std::swap(left, right);
+        }
+        if (tr < 1e20f) stack[sp++] = right;
+        if (tl < 1e20f) stack[sp++] = left;
+        return sp;
+    }
+
+    // closest sphere hit below *t in the BVH rooted at `root`; shrinks *t and returns true when one is found
+    inline bool intersect_bvh(const serialize::SphereGpu* spheres, const serialize::BvhNodeGpu* nodes, const cl_int* prims,
+                              int root, const Ray& ray, float* t, int* sphere_id) {
+        const float inf = 1e20f;
+        const float t_start = *t;
+
+        glm::vec3 inv_dir = safe_inverse(ray.direction);
+        if (intersect_aabb(nodes[root].bbox_min, nodes[root].bbox_max, ray, inv_dir, *t) >= inf) return false;
+
+        // nodes on the stack have already passed their box test
+        int stack[serialize::BVH_MAX_DEPTH];
+        int sp = 0;
+        stack[sp++] = root;
+
+        while (sp > 0) {
+            const serialize::BvhNodeGpu& node = nodes[stack[--sp]];
+
+            if (node.right < 0) {
+                for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+                    int id = prims[i];
+                    float hitdistance = intersect_sphere(spheres[id], ray);
+                    if (hitdistance != 0.0f && hitdistance < *t) {
+                        *t = hitdistance;
+                        *sphere_id = id;
+                    }
+                }
+                continue;
+            }
+
+            sp = push_children(nodes, node, ray, inv_dir, *t, stack, sp);
+        }
+        return *t < t_start;
+    }
+
+    // Watertight ray/triangle test (Woop, Benthin, Wald 2013): the axes are permuted so the dominant
+    // direction component is z and the ray is sheared onto +z; see the kernel for details
+    struct TriRay {
+        int kx, ky, kz;
+        glm::vec3 shear;  // x, y: shear of the permuted axes; z: 1 / direction along kz
+    };
+
+    inline TriRay setup_tri_ray(const Ray& ray) {
+        const glm::vec3& d = ray.direction;
+        glm::vec3 a(std::fabs(d.x), std::fabs(d.y), std::fabs(d.z));
+        TriRay tr;
+        tr.kz = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+        tr.kx = tr.kz == 2 ? 0 : tr.kz + 1;
+        tr.ky = tr.kx == 2 ? 0 : tr.kx + 1;
+        if (d[tr.kz] < 0.0f) std::swap(tr.kx, tr.ky); // keep the winding
+        tr.shear = glm::vec3(d[tr.kx] / d[tr.kz], d[tr.ky] / d[tr.kz], 1.0f / d[tr.kz]);
+        return tr;
+    }
+
+    inline float intersect_triangle(const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2,
+                                    const Ray& ray, const TriRay& tr) {
+        const glm::vec3 a = p0 - ray.origin, b = p1 - ray.origin, c = p2 - ray.origin;
+
+        const float az = a[tr.kz], bz = b[tr.kz], cz = c[tr.kz];
+        const float ax = a[tr.kx] - tr.shear.x * az, ay = a[tr.ky] - tr.shear.y * az;
+        const float bx = b[tr.kx] - tr.shear.x * bz, by = b[tr.ky] - tr.shear.y * bz;
+        const float cx = c[tr.kx] - tr.shear.x * cz, cy = c[tr.ky] - tr.shear.y * cz;
+
+        float u = cx * by - cy * bx;
+        float v = ax * cy - ay * cx;
+        float w = bx * ay - by * ax;
+        // an exact zero may be a rounding artefact on a shared edge; double precision settles it
+        // (the kernel does the same on devices with cl_khr_fp64)
+        if (u == 0.0f || v == 0.0f || w == 0.0f) {
+            u = (float)((double)cx * by - (double)cy * bx);
+            v = (float)((double)ax * cy - (double)ay * cx);
+            w = (float)((double)bx * ay - (double)by * ax);
+        }
+        if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) return 0.0f;
+
+        const float det = u + v + w;
+        if (det == 0.0f) return 0.0f;
+
+        const float t = (u * az + v * bz + w * cz) * tr.shear.z / det;
+        return t > EPSILON ? t : 0.0f;
+    }
+
+    inline glm::vec3 mesh_vertex(const SceneView& scene, cl_uint i) { return xyz(scene.mesh_positions[i]); }
+
+    // closest triangle hit below *t in the mesh BVH rooted at `root`; shrinks *t and returns true when one is found
+    inline bool intersect_mesh(const SceneView& scene, int root, const Ray& ray, const glm::vec3& inv_dir,
+                               const TriRay& tri_ray, float* t, int* tri_id) {
+        const float inf = 1e20f;
+        const float t_start = *t;
+        const serialize::BvhNodeGpu* nodes = scene.mesh_nodes;
+
+        if (intersect_aabb(nodes[root].bbox_min, nodes[root].bbox_max, ray, inv_dir, *t) >= inf) return false;
+
+        int stack[serialize::BVH_MAX_DEPTH];
+        int sp = 0;
+        stack[sp++] = root;
+
+        while (sp > 0) {
+            const serialize::BvhNodeGpu& node = nodes[stack[--sp]];
+
+            if (node.right < 0) {
+                for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const serialize::TriGpu& tri = scene.triangles[i];
+                    float hitdistance = intersect_triangle(mesh_vertex(scene, tri.i0), mesh_vertex(scene, tri.i1),
+                                                           mesh_vertex(scene, tri.i2), ray, tri_ray);
+                    if (hitdistance != 0.0f && hitdistance < *t) {
+                        *t = hitdistance;
+                        *tri_id = i;
+                    }
+                }
+                continue;
+            }
+
+            sp = push_children(nodes, node, ray, inv_dir, *t, stack, sp);
+        }
+        return *t < t_start;
+    }
+
+    // a compressed sphere's center is quantized inside the box of the leaf that holds it
+    inline serialize::SphereGpu decode_sphere(const serialize::BvhNodeGpu& leaf, const cl_ushort4& q,
+                                              const serialize::SpherePaletteGpu* palette) {
+        const glm::vec3 origin = xyz(leaf.bbox_min);
+        const glm::vec3 step = (xyz(leaf.bbox_max) - origin) * (1.0f / 65535.0f);
+        const serialize::SpherePaletteGpu& entry = palette[q.s[3]];
+
+        serialize::SphereGpu s{};
+        glm::vec3 c = origin + glm::vec3((float)q.s[0], (float)q.s[1], (float)q.s[2]) * step;
+        s.center_r = cl_float4{{c.x, c.y, c.z, entry.radius}};
+        s.emission = entry.emission;
+        s.material_index = entry.material_index;
+        return s;
+    }
+
+    // world BVH over compressed spheres: leaves index spheres_q directly (leaf order), no bvh_prims
+    inline void intersect_compressed(const SceneView& scene, const Ray& ray, Hit& hit) {
+        const float inf = 1e20f;
+        const serialize::BvhNodeGpu* nodes = scene.bvh_nodes;
+
+        glm::vec3 inv_dir = safe_inverse(ray.direction);
+        if (intersect_aabb(nodes[0].bbox_min, nodes[0].bbox_max, ray, inv_dir, hit.t) >= inf) return;
+
+        int stack[serialize::BVH_MAX_DEPTH];
+        int sp = 0;
+        stack[sp++] = 0;
+
+        while (sp > 0) {
+            const int node_id = stack[--sp];
+            const serialize::BvhNodeGpu& node = nodes[node_id];
+
+            if (node.right < 0) {
+                for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+                    serialize::SphereGpu sphere = decode_sphere(node, scene.spheres_q[i].qpos_palette, scene.sphere_palette);
+                    float hitdistance = intersect_sphere(sphere, ray);
+                    if (hitdistance != 0.0f && hitdistance < hit.t) {
+                        hit.t = hitdistance;
+                        hit.type = PRIM_SPHERE;
+                        hit.prim = i;
+                        hit.node = node_id;
+                    }
+                }
+                continue;
+            }
+
+            sp = push_children(nodes, node, ray, inv_dir, hit.t, stack, sp);
+        }
+    }
+
+    inline glm::vec3 transform_point(const cl_float4* m, const glm::vec3& p) {
+        return glm::vec3(glm::dot(xyz(m[0]), p) + m[0].s[3], glm::dot(xyz(m[1]), p) + m[1].s[3], glm::dot(xyz(m[2]), p) + m[2].s[3]);
+    }
+
+    inline glm::vec3 transform_vector(const cl_float4* m, const glm::vec3& v) {
+        return glm::vec3(glm::dot(xyz(m[0]), v), glm::dot(xyz(m[1]), v), glm::dot(xyz(m[2]), v));
+    }
+
+    // top-level walk over instances; each instance leaf re-enters its group's BVH with an object-space ray
+    inline void intersect_instances(const SceneView& scene, const Ray& ray, Hit& hit) {
+        const float inf = 1e20f;
+        const serialize::BvhNodeGpu* nodes = scene.inst_nodes;
+
+        glm::vec3 inv_dir = safe_inverse(ray.direction);
+        if (intersect_aabb(nodes[0].bbox_min, nodes[0].bbox_max, ray, inv_dir, hit.t) >= inf) return;
+
+        int stack[serialize::BVH_MAX_DEPTH];
+        int sp = 0;
+        stack[sp++] = 0;
+
+        while (sp > 0) {
+            const serialize::BvhNodeGpu& node = nodes[stack[--sp]];
+
+            if (node.right < 0) {
+                for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+                    const int inst_id = scene.inst_prims[i];
+                    const serialize::InstanceGpu& inst = scene.instances[inst_id];
+
+                    // unit-length object-space direction; distances scale by |d| between the spaces
+                    glm::vec3 d = transform_vector(inst.world_to_object, ray.direction);
+                    float scale = glm::length(d);
+                    Ray local;
+                    local.origin    = transform_point(inst.world_to_object, ray.origin);
+                    local.direction = d / scale;
+
+                    float t_local = hit.t * scale;
+                    int id;
+                    if (intersect_bvh(scene.spheres, nodes, scene.inst_prims, inst.blas_root, local, &t_local, &id)) {
+                        hit.t = t_local / scale;
+                        hit.type = PRIM_SPHERE;
+                        hit.prim = id;
+                        hit.instance = inst_id;
+                    }
+                }
+                continue;
+            }
+
+            sp = push_children(nodes, node, ray, inv_dir, hit.t, stack, sp);
+        }
+    }
+
+    inline bool intersect_scene(const SceneView& scene, const Ray& ray, Hit& hit) {
+        const float inf = 1e20f;
+        hit.t = inf;
+        hit.prim = 0;
+        hit.type = PRIM_SPHERE;
+        hit.instance = -1;
+        hit.node = 0;
+
+        // unbounded and few: planes and boxes are tested against every ray
+        for (int i = 0; i < scene.plane_count; ++i) {
+            float hitdistance = intersect_plane(scene.planes[i], ray);
+            if (hitdistance != 0.0f && hitdistance < hit.t) {
+                hit.t = hitdistance;
+                hit.type = PRIM_PLANE;
+                hit.prim = i;
+            }
+        }
+        if (scene.box_count > 0) {
+            glm::vec3 inv_dir = safe_inverse(ray.direction);
+            for (int i = 0; i < scene.box_count; ++i) {
+                float hitdistance = intersect_box(scene.boxes[i], ray, inv_dir);
+                if (hitdistance != 0.0f && hitdistance < hit.t) {
+                    hit.t = hitdistance;
+                    hit.type = PRIM_BOX;
+                    hit.prim = i;
+                }
+            }
+        }
+
+        if (scene.spheres_q) {
+            intersect_compressed(scene, ray, hit);
+        } else if (intersect_bvh(scene.spheres, scene.bvh_nodes, scene.bvh_prims, 0, ray, &hit.t, &hit.prim)) {
+            hit.type = PRIM_SPHERE;
+        }
+        if (scene.instance_count > 0) intersect_instances(scene, ray, hit);
+
+        if (scene.mesh_count > 0) {
+            glm::vec3 inv_dir = safe_inverse(ray.direction);
+            TriRay tri_ray = setup_tri_ray(ray);
+            for (int m = 0; m < scene.mesh_count; ++m) {
+                if (intersect_mesh(scene, scene.meshes[m].bvh_root, ray, inv_dir, tri_ray, &hit.t, &hit.prim))
+                    hit.type = PRIM_TRIANGLE;
+            }
+        }
+
+        return hit.t < inf;
+    }
+
+    // world-space point, normal and emission at a hit; instanced normals go through the inverse transpose
+    inline SurfaceHit surface_at(const SceneView& scene, const Ray& ray, const Hit& hit) {
+        SurfaceHit s;
+        s.point = ray.origin + ray.direction * hit.t;
+
+        if (hit.type == PRIM_PLANE) {
+            const serialize::PlaneGpu& plane = scene.planes[hit.prim];
+            s.normal = xyz(plane.normal_d);
+            s.emission = xyz(plane.emission);
+            s.material_index = plane.material_index;
+            return s;
+        }
+        if (hit.type == PRIM_BOX) {
+            // the face hit is the axis along which the point sits farthest out, relative to the half extent
+            const serialize::BoxGpu& box = scene.boxes[hit.prim];
+            glm::vec3 half = (xyz(box.bmax) - xyz(box.bmin)) * 0.5f;
+            glm::vec3 p = (s.point - (xyz(box.bmin) + half)) * safe_inverse(half);
+            glm::vec3 a(std::fabs(p.x), std::fabs(p.y), std::fabs(p.z));
+            s.normal = (a.x >= a.y && a.x >= a.z) ? glm::vec3(std::copysign(1.0f, p.x), 0.0f, 0.0f)
+                     : (a.y >= a.z)               ? glm::vec3(0.0f, std::copysign(1.0f, p.y), 0.0f)
+                     :                              glm::vec3(0.0f, 0.0f, std::copysign(1.0f, p.z));
+            s.emission = xyz(box.emission);
+            s.material_index = box.material_index;
+            return s;
+        }
+        if (hit.type == PRIM_TRIANGLE) {
+            // flat shading; the winding decides which side is outside
+            const serialize::TriGpu& tri = scene.triangles[hit.prim];
+            const glm::vec3 p0 = mesh_vertex(scene, tri.i0);
+            const serialize::MeshGpu& mesh = scene.meshes[tri.mesh];
+            s.normal = glm::normalize(glm::cross(mesh_vertex(scene, tri.i1) - p0, mesh_vertex(scene, tri.i2) - p0));
+            s.emission = xyz(mesh.emission);
+            s.material_index = mesh.material_index;
+            return s;
+        }
+
+        const serialize::SphereGpu sphere = (scene.spheres_q && hit.instance < 0)
+            ? decode_sphere(scene.bvh_nodes[hit.node], scene.spheres_q[hit.prim].qpos_palette, scene.sphere_palette)
+            : scene.spheres[hit.prim];
+
+        s.emission = xyz(sphere.emission);
+        s.material_index = sphere.material_index;
+
+        if (hit.instance < 0) {
+            s.normal = glm::normalize(s.point - xyz(sphere.center_r));
+        } else {
+            const serialize::InstanceGpu& inst = scene.instances[hit.instance];
+            glm::vec3 n = transform_point(inst.world_to_object, s.point) - xyz(sphere.center_r);
+            s.normal = glm::normalize(xyz(inst.world_to_object[0]) * n.x + xyz(inst.world_to_object[1]) * n.y +
+                                      xyz(inst.world_to_object[2]) * n.z);
+        }
+        return s;
+    }
+
+    inline glm::vec3 reflect(glm::vec3 direction, glm::vec3 normal) {
+        float n = glm::dot(direction, normal);
+        return direction - 2.0f * n * normal;
+    }
+
+    inline float reflectance(float cosine, float ri) {
+        float r0 = (1.0f - ri) / (1.0f + ri);
+        r0 = r0 * r0;
+        return r0 + (1.0f - r0) * std::pow(1.0f - cosine, 5.0f);
+    }
+
+    inline glm::vec3 refract_dir(glm::vec3 in, glm::vec3 n, float eta) {
+        float cosi  = clampf(-glm::dot(in, n), 0.0f, 1.0f);
+        float sint2 = std::fmax(0.0f, 1.0f - cosi*cosi);
+        float k = 1.0f - eta*eta * sint2;
+        if (k < 0.0f) return glm::vec3(0.0f, 0.0f, 0.0f); // TIR flag (caller should reflect)
+        return glm::normalize(eta*in + (eta*cosi - std::sqrt(k))*n);
+    }
+
+    inline void lambert_scatter(const SurfaceHit& hit, Ray& ray, const serialize::MaterialGpu& mat,
+                                float xi1, float xi2, glm::vec3& accum_color, glm::vec3& mask) {
+        glm::vec3 hitpoint = hit.point;
+
+        glm::vec3 normal = hit.normal;
+        glm::vec3 w = glm::dot(normal, ray.direction) < 0.0f ? normal : normal * (-1.0f);
+
+        float phi = 2.0f * PI * xi1;
+        float r2  = xi2;
+        float r2s = std::sqrt(r2);
+
+        glm::vec3 axis = std::fabs(w.x) > 0.1f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 u = glm::normalize(glm::cross(axis, w));
+        glm::vec3 v = glm::cross(w, u);
+
+        glm::vec3 newdir = glm::normalize(u * std::cos(phi)*r2s + v*std::sin(phi)*r2s + w*std::sqrt(1.0f - r2));
+
+        ray.origin    = hitpoint + w * EPSILON;
+        ray.direction = newdir;
+
+        accum_color += mask * hit.emission;
+        mask *= xyz(mat.albedo_fuzz);
+        mask *= std::fmax(glm::dot(newdir, w), 0.0f);
+    }
+
+    inline void metal_scatter(const SurfaceHit& hit, Ray& ray, const serialize::MaterialGpu& mat,
+                              glm::vec3& accum_color, glm::vec3& mask, const glm::vec3& jitter) {
+        glm::vec3 hitpoint = hit.point;
+        glm::vec3 n = hit.normal;
+        glm::vec3 w = glm::dot(n, ray.direction) < 0.0f ? n : -n;
+
+        glm::vec3 reflected = reflect(ray.direction, w);
+
+        glm::vec3 newdir = glm::normalize(reflected + mat.albedo_fuzz.s[3] * jitter);
+
+        ray.origin    = offset_along_normal(hitpoint, w, newdir);
+        ray.direction = newdir;
+
+        accum_color += mask * hit.emission;
+        mask *= xyz(mat.albedo_fuzz);
+    }
+
+    inline void dielectric_scatter(const SurfaceHit& surface, Ray& ray, const serialize::MaterialGpu& mat,
+                                   glm::vec3& accum_color, glm::vec3& mask, float xi) {
+        glm::vec3 hit = surface.point;
+        glm::vec3 n   = surface.normal;
+        bool front = glm::dot(ray.direction, n) < 0.0f;
+        glm::vec3 w = front ? n : -n;
+
+        float eta = front ? (1.0f / mat.ref_idx) : mat.ref_idx;
+        glm::vec3 in = glm::normalize(ray.direction);
+
+        float cos_theta = clampf(-glm::dot(in, w), 0.0f, 1.0f);
+
+        float R;
+        if (!front) {
+            float tmp = 1.0f - eta*eta * (1.0f - cos_theta * cos_theta);
+            float cos_trans = tmp > 0.0f ? std::sqrt(tmp) : 0.0f;
+            R = reflectance(cos_trans, mat.ref_idx);
+        } else {
+            R = reflectance(cos_theta, mat.ref_idx);
+        }
+
+        glm::vec3 dir;
+        glm::vec3 tdir = refract_dir(in, w, eta);
+        bool tir = (tdir.x == 0.0f && tdir.y == 0.0f && tdir.z == 0.0f);
+        if (tir || xi < R) {
+            dir = reflect(in, w);
+        } else {
+            dir = tdir;
+        }
+
+        ray.origin    = offset_along_normal(hit, w, dir);
+        ray.direction = glm::normalize(dir);
+
+        // dielectric typically doesn't attenuate (no change to mask)
+        accum_color += mask * surface.emission;
+    }
+
+    // *steps counts the bounces traced, like the kernel's lane statistics
+    inline glm::vec3 trace(const SceneView& scene, const Ray& camray, const Sampler& sampler, uint32_t* steps) {
+        Ray ray = camray;
+
+        glm::vec3 accum_color(0.0f, 0.0f, 0.0f);
+        glm::vec3 mask(1.0f, 1.0f, 1.0f);
+
+        for (int bounces = 0; bounces < scene.max_bounces; bounces++) {
+            ++(*steps);
+            Hit hit;
+
+            if (!intersect_scene(scene, ray, hit)) {
+                glm::vec3 d = glm::normalize(ray.direction);
+                float tbg = 0.5f*(d.y + 1.0f);
+                glm::vec3 sky = glm::mix(glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.8f, 0.8f, 1.0f), tbg);
+                return accum_color + mask * sky;
+            }
+
+            const SurfaceHit surface = surface_at(scene, ray, hit);
+            const serialize::MaterialGpu& material = scene.materials[surface.material_index];
+
+            switch (material.type) {
+                case MAT_LAMBERTIAN : {
+                    glm::vec2 xi = sample_2d(sampler, sample_scatter(bounces));
+                    lambert_scatter(surface, ray, material, xi.x, xi.y, accum_color, mask);
+                    break;
+                }
+                case MAT_METAL : {
+                    glm::vec2 xy = sample_2d(sampler, sample_scatter(bounces));
+                    float z = sample_2d(sampler, sample_scatter_aux(bounces)).x;
+                    metal_scatter(surface, ray, material, accum_color, mask, glm::vec3(xy.x, xy.y, z) - glm::vec3(0.5f));
+                    break;
+                }
+                case MAT_DIELECTRIC : {
+                    float xi1 = sample_2d(sampler, sample_scatter(bounces)).x;
+                    dielectric_scatter(surface, ray, material, accum_color, mask, xi1);
+                    break;
+                }
+            }
+        }
+
+        return accum_color;
+    }
+
+    inline float luminance(const glm::vec3& c) {
+        return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+    }
+
+    // Same retirement test as the kernel's pixel_converged
+    inline bool pixel_converged(const glm::vec4& acc, float lum_sq, float threshold, int min_spp) {
+        const float n = acc.w;
+        if (n < (float)min_spp) return false;
+        const float mean = luminance(glm::vec3(acc.x, acc.y, acc.z)) / n;
+        const float var  = std::max(lum_sq / n - mean * mean, 0.0f);
+        return std::sqrt(var / n) <= threshold * std::max(mean, 0.01f);
+    }
+
+    // Body of the `render` kernel for a single pixel (index y * width + x): radiance sum of samples
+    // sample_index .. sample_index + spp - 1 (one progressive pass); the squared luminance of those
+    // samples is added to *lum_sq, their bounces to *steps
+    inline glm::vec3 accumulate_pixel(const SceneView& scene, int x, int y, int width, uint32_t sample_index, int spp,
+                                      float* lum_sq, uint32_t* steps) {
+        const uint32_t pixel = (uint32_t)y * (uint32_t)width + (uint32_t)x;
+
+        glm::vec3 sum(0.0f, 0.0f, 0.0f);
+        float sq = 0.0f;
+        for (int s = 0; s < spp; ++s) {
+            Sampler sampler = make_sampler(pixel, sample_index + (uint32_t)s, scene.frame_seed, scene.sobol);
+            Ray camray = create_ray(x, y, *scene.camera, sample_square(sampler));
+            glm::vec3 c = trace(scene, camray, sampler, steps);
+            float l = luminance(c);
+            sum += c;
+            sq  += l * l;
+        }
+        *lum_sq += sq;
+        return sum;
+    }
+
+    // average of the accumulated samples (rgb: sum, w: count), gamma corrected like the tonemap kernel
+    inline cl_uchar4 tonemap(const glm::vec4& acc) {
+        glm::vec3 avg = acc.w > 0.0f ? glm::vec3(acc.x, acc.y, acc.z) / acc.w : glm::vec3(0.0f);
+
+        glm::vec3 mapped(std::pow(avg.x, 1.0f/2.2f),
+                         std::pow(avg.y, 1.0f/2.2f),
+                         std::pow(avg.z, 1.0f/2.2f));
+
+        cl_uchar4 out;
+        out.s[0] = (cl_uchar)(clampf(mapped.x, 0.0f, 1.0f) * 255.0f);
+        out.s[1] = (cl_uchar)(clampf(mapped.y, 0.0f, 1.0f) * 255.0f);
+        out.s[2] = (cl_uchar)(clampf(mapped.z, 0.0f, 1.0f) * 255.0f);
+        out.s[3] = 255;
+        return out;
+    }
+
+}
+
+#endif // CPUTRACE_HPP
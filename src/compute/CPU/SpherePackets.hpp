@@ -0,0 +1,258 @@
+#ifndef SPHEREPACKETS_HPP
+#define SPHEREPACKETS_HPP
+
+#include <vector>
+#include "CPUTrace.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+// GCC fuses intrinsic mul/add pairs into FMA wherever the target has it (AVX-512 does), which
+// rounds differently from intersect_sphere(); Clang keeps them apart on its own
+#ifdef __clang__
+#define RT_NO_FP_CONTRACT
+#else
+#define RT_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#endif
+#endif
+
+namespace compute::cpu {
+
+    /*
+    *   Ray-stream sphere intersection for the native CPU path. Spheres are kept as separate
+    *   arrays (center x/y/z, radius^2, material) instead of SphereGpu records, and rays as a
+    *   stream of the same shape; a kernel takes 4, 8 or 16 rays per step (SSE2, AVX2, AVX-512)
+    *   and tests each against every sphere. The arithmetic is intersect_sphere()'s, operation for
+    *   operation and without FMA contraction, so every ISA finds the same hits and distances as
+    *   the scalar loop. The widest ISA the CPU supports is picked at run time.
+    */
+
+    struct SphereSoA {
+        std::vector<float> cx, cy, cz, r2;
+        std::vector<cl_int> material;
+
+        size_t size() const { return cx.size(); }
+
+        static SphereSoA from(const serialize::SphereGpu* spheres, size_t count) {
+            SphereSoA s;
+            s.cx.resize(count); s.cy.resize(count); s.cz.resize(count); s.r2.resize(count);
+            s.material.resize(count);
+            for (size_t i = 0; i < count; ++i) {
+                const cl_float4& c = spheres[i].center_r;
+                s.cx[i] = c.s[0];
+                s.cy[i] = c.s[1];
+                s.cz[i] = c.s[2];
+                s.r2[i] = c.s[3] * c.s[3];
+                s.material[i] = spheres[i].material_index;
+            }
+            return s;
+        }
+    };
+
+    // t: the closest hit so far on input (1e20f for none), the closest overall on output;
+    // hit: that sphere, or unchanged when none is closer
+    struct RayStream {
+        std::vector<float> ox, oy, oz, dx, dy, dz, t;
+        std::vector<cl_int> hit;
+
+        size_t size() const { return ox.size(); }
+
+        void resize(size_t n) {
+            for (auto* v : { &ox, &oy, &oz, &dx, &dy, &dz }) v->resize(n);
+            t.assign(n, 1e20f);
+            hit.assign(n, -1);
+        }
+
+        void set(size_t i, const Ray& ray) {
+            ox[i] = ray.origin.x;    oy[i] = ray.origin.y;    oz[i] = ray.origin.z;
+            dx[i] = ray.direction.x; dy[i] = ray.direction.y; dz[i] = ray.direction.z;
+        }
+    };
+
+    enum class SimdIsa { Scalar, SSE2, AVX2, AVX512 };
+
+    inline const char* isa_name(SimdIsa isa) {
+        switch (isa) {
+            case SimdIsa::SSE2:   return "sse2";
+            case SimdIsa::AVX2:   return "avx2";
+            case SimdIsa::AVX512: return "avx512";
+            default:              return "scalar";
+        }
+    }
+
+    inline int packet_width(SimdIsa isa) {
+        switch (isa) {
+            case SimdIsa::SSE2:   return 4;
+            case SimdIsa::AVX2:   return 8;
+            case SimdIsa::AVX512: return 16;
+            default:              return 1;
+        }
+    }
+
+    inline bool isa_supported(SimdIsa isa) {
+#ifdef RT_SIMD_X86
+        __builtin_cpu_init();
+        switch (isa) {
+            case SimdIsa::SSE2:   return __builtin_cpu_supports("sse2");
+            case SimdIsa::AVX2:   return __builtin_cpu_supports("avx2");
+            case SimdIsa::AVX512: return __builtin_cpu_supports("avx512f");
+            default:              return true;
+        }
+#else
+        return isa == SimdIsa::Scalar;
+#endif
+    }
+
+    inline SimdIsa best_isa() {
+        static const SimdIsa best = [] {
+            for (SimdIsa isa : { SimdIsa::AVX512, SimdIsa::AVX2, SimdIsa::SSE2 }) {
+                if (isa_supported(isa)) return isa;
+            }
+            return SimdIsa::Scalar;
+        }();
+        return best;
+    }
+
+    namespace packets {
+
+        // rays [begin, end) one at a time; also the tail of the vector kernels
+        inline void intersect_scalar(const SphereSoA& s, RayStream& r, size_t begin, size_t end) {
+            const size_t n = s.size();
+            for (size_t i = begin; i < end; ++i) {
+                float best = r.t[i];
+                cl_int id = r.hit[i];
+                for (size_t j = 0; j < n; ++j) {
+                    const float ocx = s.cx[j] - r.ox[i], ocy = s.cy[j] - r.oy[i], ocz = s.cz[j] - r.oz[i];
+                    const float b = ocx * r.dx[i] + ocy * r.dy[i] + ocz * r.dz[i];
+                    const float c = (ocx * ocx + ocy * ocy + ocz * ocz) - s.r2[j];
+                    float disc = b * b - c;
+                    if (disc < 0.0f) continue;
+                    disc = std::sqrt(disc);
+                    const float t = (b - disc) > EPSILON ? b - disc : (b + disc) > EPSILON ? b + disc : 0.0f;
+                    if (t != 0.0f && t < best) {
+                        best = t;
+                        id = cl_int(j);
+                    }
+                }
+                r.t[i] = best;
+                r.hit[i] = id;
+            }
+        }
+
+#ifdef RT_SIMD_X86
+        // SSE2 is part of x86-64, so this one needs no target attribute
+        RT_NO_FP_CONTRACT inline size_t intersect_sse2(const SphereSoA& s, RayStream& r) {
+            const size_t n = s.size(), rays = r.size() & ~size_t(3);
+            const __m128 eps = _mm_set1_ps(EPSILON), zero = _mm_setzero_ps();
+            for (size_t i = 0; i < rays; i += 4) {
+                const __m128 ox = _mm_loadu_ps(&r.ox[i]), oy = _mm_loadu_ps(&r.oy[i]), oz = _mm_loadu_ps(&r.oz[i]);
+                const __m128 dx = _mm_loadu_ps(&r.dx[i]), dy = _mm_loadu_ps(&r.dy[i]), dz = _mm_loadu_ps(&r.dz[i]);
+                __m128 best = _mm_loadu_ps(&r.t[i]);
+                __m128i id = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&r.hit[i]));
+                for (size_t j = 0; j < n; ++j) {
+                    const __m128 ocx = _mm_sub_ps(_mm_set1_ps(s.cx[j]), ox);
+                    const __m128 ocy = _mm_sub_ps(_mm_set1_ps(s.cy[j]), oy);
+                    const __m128 ocz = _mm_sub_ps(_mm_set1_ps(s.cz[j]), oz);
+                    const __m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, dx), _mm_mul_ps(ocy, dy)), _mm_mul_ps(ocz, dz));
+                    const __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+                    const __m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_sub_ps(oc2, _mm_set1_ps(s.r2[j])));
+                    const __m128 root = _mm_sqrt_ps(_mm_max_ps(disc, zero));
+                    const __m128 t0 = _mm_sub_ps(b, root), t1 = _mm_add_ps(b, root);
+                    const __m128 near0 = _mm_cmpgt_ps(t0, eps);
+                    const __m128 t = _mm_or_ps(_mm_and_ps(near0, t0), _mm_andnot_ps(near0, t1));
+                    const __m128 take = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(disc, zero), _mm_cmpgt_ps(t, eps)),
+                                                   _mm_cmplt_ps(t, best));
+                    best = _mm_or_ps(_mm_and_ps(take, t), _mm_andnot_ps(take, best));
+                    const __m128i mask = _mm_castps_si128(take);
+                    id = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi32(cl_int(j))), _mm_andnot_si128(mask, id));
+                }
+                _mm_storeu_ps(&r.t[i], best);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&r.hit[i]), id);
+            }
+            return rays;
+        }
+
+        __attribute__((target("avx2"))) RT_NO_FP_CONTRACT
+        inline size_t intersect_avx2(const SphereSoA& s, RayStream& r) {
+            const size_t n = s.size(), rays = r.size() & ~size_t(7);
+            const __m256 eps = _mm256_set1_ps(EPSILON), zero = _mm256_setzero_ps();
+            for (size_t i = 0; i < rays; i += 8) {
+                const __m256 ox = _mm256_loadu_ps(&r.ox[i]), oy = _mm256_loadu_ps(&r.oy[i]), oz = _mm256_loadu_ps(&r.oz[i]);
+                const __m256 dx = _mm256_loadu_ps(&r.dx[i]), dy = _mm256_loadu_ps(&r.dy[i]), dz = _mm256_loadu_ps(&r.dz[i]);
+                __m256 best = _mm256_loadu_ps(&r.t[i]);
+                __m256i id = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&r.hit[i]));
+                for (size_t j = 0; j < n; ++j) {
+                    const __m256 ocx = _mm256_sub_ps(_mm256_set1_ps(s.cx[j]), ox);
+                    const __m256 ocy = _mm256_sub_ps(_mm256_set1_ps(s.cy[j]), oy);
+                    const __m256 ocz = _mm256_sub_ps(_mm256_set1_ps(s.cz[j]), oz);
+                    const __m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, dx), _mm256_mul_ps(ocy, dy)), _mm256_mul_ps(ocz, dz));
+                    const __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+                    const __m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_sub_ps(oc2, _mm256_set1_ps(s.r2[j])));
+                    const __m256 root = _mm256_sqrt_ps(_mm256_max_ps(disc, zero));
+                    const __m256 t0 = _mm256_sub_ps(b, root), t1 = _mm256_add_ps(b, root);
+                    const __m256 t = _mm256_blendv_ps(t1, t0, _mm256_cmp_ps(t0, eps, _CMP_GT_OQ));
+                    const __m256 take = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(disc, zero, _CMP_GE_OQ), _mm256_cmp_ps(t, eps, _CMP_GT_OQ)),
+                                                      _mm256_cmp_ps(t, best, _CMP_LT_OQ));
+                    best = _mm256_blendv_ps(best, t, take);
+                    id = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(id),
+                                                              _mm256_castsi256_ps(_mm256_set1_epi32(cl_int(j))), take));
+                }
+                _mm256_storeu_ps(&r.t[i], best);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(&r.hit[i]), id);
+            }
+            return rays;
+        }
+
+        __attribute__((target("avx512f"))) RT_NO_FP_CONTRACT
+        inline size_t intersect_avx512(const SphereSoA& s, RayStream& r) {
+            const size_t n = s.size(), rays = r.size() & ~size_t(15);
+            const __m512 eps = _mm512_set1_ps(EPSILON), zero = _mm512_setzero_ps();
+            for (size_t i = 0; i < rays; i += 16) {
+                const __m512 ox = _mm512_loadu_ps(&r.ox[i]), oy = _mm512_loadu_ps(&r.oy[i]), oz = _mm512_loadu_ps(&r.oz[i]);
+                const __m512 dx = _mm512_loadu_ps(&r.dx[i]), dy = _mm512_loadu_ps(&r.dy[i]), dz = _mm512_loadu_ps(&r.dz[i]);
+                __m512 best = _mm512_loadu_ps(&r.t[i]);
+                __m512i id = _mm512_loadu_si512(&r.hit[i]);
+                for (size_t j = 0; j < n; ++j) {
+                    const __m512 ocx = _mm512_sub_ps(_mm512_set1_ps(s.cx[j]), ox);
+                    const __m512 ocy = _mm512_sub_ps(_mm512_set1_ps(s.cy[j]), oy);
+                    const __m512 ocz = _mm512_sub_ps(_mm512_set1_ps(s.cz[j]), oz);
+                    const __m512 b = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, dx), _mm512_mul_ps(ocy, dy)), _mm512_mul_ps(ocz, dz));
+                    const __m512 oc2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz));
+                    const __m512 disc = _mm512_sub_ps(_mm512_mul_ps(b, b), _mm512_sub_ps(oc2, _mm512_set1_ps(s.r2[j])));
+                    const __mmask16 hit = _mm512_cmp_ps_mask(disc, zero, _CMP_GE_OQ);
+                    if (!hit) continue;
+                    const __m512 root = _mm512_sqrt_ps(_mm512_max_ps(disc, zero));
+                    const __m512 t0 = _mm512_sub_ps(b, root), t1 = _mm512_add_ps(b, root);
+                    const __m512 t = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(t0, eps, _CMP_GT_OQ), t1, t0);
+                    const __mmask16 take = hit & _mm512_cmp_ps_mask(t, eps, _CMP_GT_OQ) & _mm512_cmp_ps_mask(t, best, _CMP_LT_OQ);
+                    best = _mm512_mask_blend_ps(take, best, t);
+                    id = _mm512_mask_blend_epi32(take, id, _mm512_set1_epi32(cl_int(j)));
+                }
+                _mm512_storeu_ps(&r.t[i], best);
+                _mm512_storeu_si512(&r.hit[i], id);
+            }
+            return rays;
+        }
+#endif
+
+    }
+
+    // Closest sphere of `spheres` for every ray of `rays`, `isa` wide; an ISA the CPU lacks falls back to scalar
+    inline void intersect_stream(const SphereSoA& spheres, RayStream& rays, SimdIsa isa = best_isa()) {
+        size_t done = 0;
+#ifdef RT_SIMD_X86
+        if (isa_supported(isa)) {
+            switch (isa) {
+                case SimdIsa::SSE2:   done = packets::intersect_sse2(spheres, rays); break;
+                case SimdIsa::AVX2:   done = packets::intersect_avx2(spheres, rays); break;
+                case SimdIsa::AVX512: done = packets::intersect_avx512(spheres, rays); break;
+                default: break;
+            }
+        }
+#endif
+        packets::intersect_scalar(spheres, rays, done, rays.size());
+    }
+
+}
+
+#endif // SPHEREPACKETS_HPP
@@ -0,0 +1,92 @@
+#ifndef WORKSTEALING_HPP
+#define WORKSTEALING_HPP
+
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace compute::cpu {
+
+    /*
+    *   Work-stealing scheduler over task indices [0, task_count).
+    *   Every worker starts with a contiguous block of tasks in its own deque and
+    *   pops from the front; once it runs dry it steals from the back of another
+    *   worker's deque, so expensive regions of the image get spread out on demand.
+    */
+    class WorkStealingScheduler {
+    public:
+        explicit WorkStealingScheduler(unsigned worker_count = 0)
+            : worker_count_(worker_count ? worker_count : default_worker_count()) {}
+
+        static unsigned default_worker_count() {
+            unsigned n = std::thread::hardware_concurrency();
+            return n ? n : 1;
+        }
+
+        unsigned worker_count() const { return worker_count_; }
+        size_t   steal_count()  const { return steals_.load(); }
+
+        // Runs fn(task_index, worker_index) for every task; blocks until all are done.
+        template <class Fn>
+        void run(size_t task_count, Fn&& fn) {
+            steals_ = 0;
+            if (task_count == 0) return;
+
+            const unsigned workers = (unsigned)std::min<size_t>(worker_count_, task_count);
+            std::vector<Queue> queues(workers);
+            for (unsigned w = 0; w < workers; ++w) {
+                const size_t begin = task_count * w / workers;
+                const size_t end   = task_count * (w + 1) / workers;
+                for (size_t i = begin; i < end; ++i) queues[w].tasks.push_back(i);
+            }
+
+            auto worker_main = [&](unsigned self) {
+                size_t task;
+                while (pop_own(queues[self], task) || steal(queues, self, task)) {
+                    fn(task, self);
+                }
+            };
+
+            std::vector<std::thread> threads;
+            threads.reserve(workers - 1);
+            for (unsigned w = 1; w < workers; ++w) threads.emplace_back(worker_main, w);
+            worker_main(0); // the calling thread is worker 0
+            for (auto& t : threads) t.join();
+        }
+
+    private:
+        struct Queue {
+            std::mutex         lock;
+            std::deque<size_t> tasks;
+        };
+
+        unsigned            worker_count_;
+        std::atomic<size_t> steals_{0};
+
+        static bool pop_own(Queue& q, size_t& task) {
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (q.tasks.empty()) return false;
+            task = q.tasks.front();
+            q.tasks.pop_front();
+            return true;
+        }
+
+        bool steal(std::vector<Queue>& queues, unsigned self, size_t& task) {
+            const unsigned n = (unsigned)queues.size();
+            for (unsigned k = 1; k < n; ++k) {
+                Queue& victim = queues[(self + k) % n];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.tasks.empty()) continue;
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                steals_.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+    };
+
+}
+
+#endif // WORKSTEALING_HPP
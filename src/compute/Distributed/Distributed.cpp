@@ -0,0 +1,430 @@
+#include "pchray.h"
+
+#include "Distributed.hpp"
+#include "CPUBackend.hpp" // cpu::tonemap
+#include "SceneWire.hpp"
+
+#include <chrono>
+#include <deque>
+
+namespace compute {
+
+    using Clock = std::chrono::steady_clock;
+
+    static double ms_since(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    struct RenderCoordinator::Worker {
+        net::Socket socket;
+        std::string name;         // from HELLO; empty until then
+        uint32_t job = 0;         // last job sent
+        int task = -1;            // in flight, or -1
+        uint32_t task_job = 0;    // job of that task
+        Clock::time_point started;
+        bool dead = false;
+
+        // this render
+        size_t tasks = 0;
+        double busy_ms = 0.0;
+    };
+
+    struct RenderCoordinator::Frame {
+        struct Task {
+            RegionTask region;
+            int tile = 0, range = 0;
+            int copies = 0;       // workers running it
+            bool done = false;
+            Clock::time_point first_start;
+        };
+
+        int width = 0, height = 0, rows = 0, ranges = 1;
+        std::vector<Task> tasks;
+        std::deque<int> queue;
+        size_t remaining = 0;
+
+        // tile t's sample ranges wait here until all have arrived, then add up in range order
+        std::vector<std::vector<std::vector<cl_float4>>> pending;
+        std::vector<int> pending_count;
+        std::vector<cl_float4> accum;
+
+        double task_ms_sum = 0.0;
+        size_t task_ms_count = 0;
+        size_t duplicates = 0, discarded = 0, requeued = 0;
+    };
+
+    RenderCoordinator::RenderCoordinator() = default;
+
+    RenderCoordinator::~RenderCoordinator() {
+        try { shutdown(); } catch (...) {}
+    }
+
+    void RenderCoordinator::initialize(const Config& config, uint16_t port) {
+        config_ = config;
+        if (config_.distributed.tile_rows <= 0 || config_.distributed.sample_ranges <= 0) {
+            throw std::runtime_error("Invalid distributed tile size.");
+        }
+        listener_ = net::listen_on(port);
+        port_ = net::local_port(listener_);
+        timeline_.enable(config_.profile.timeline);
+        writer_.configure(config_.output, timeline_);
+        std::cout << "Coordinator listening on port " << port_ << "\n";
+    }
+
+    size_t RenderCoordinator::ready_workers() const {
+        size_t n = 0;
+        for (const auto& w : workers_) n += !w->name.empty() && !w->dead;
+        return n;
+    }
+
+    void RenderCoordinator::wait_for_workers(size_t count) {
+        if (!listener_.valid()) throw std::runtime_error("Coordinator not initialized.");
+        while (ready_workers() < count) pump(100);
+    }
+
+    void RenderCoordinator::shutdown() {
+        for (auto& w : workers_) {
+            if (w->dead) continue;
+            try { net::send_message(w->socket, net::MessageType::Done, {}); } catch (const std::exception&) {}
+        }
+        workers_.clear();
+    }
+
+    void RenderCoordinator::send_job(Worker& w) {
+        net::send_message(w.socket, net::MessageType::Job, job_payload_);
+        w.job = job_;
+    }
+
+    void RenderCoordinator::pump(int timeout_ms) {
+        std::vector<pollfd> fds;
+        fds.push_back({ listener_.fd(), POLLIN, 0 });
+        for (const auto& w : workers_) fds.push_back({ w->socket.fd(), POLLIN, 0 });
+        if (::poll(fds.data(), fds.size(), timeout_ms) < 0) {
+            if (errno == EINTR) return;
+            throw std::runtime_error(std::string("poll() failed: ") + std::strerror(errno));
+        }
+
+        // workers first: fds[i + 1] is workers_[i], and accepting below appends to workers_
+        for (size_t i = 0; i + 1 < fds.size(); ++i) {
+            Worker& w = *workers_[i];
+            if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            try {
+                // a readable worker socket holds the start of a message, whose rest follows right behind
+                net::Message m;
+                if (!net::recv_message(w.socket, m)) drop(w, "disconnected");
+                else on_message(w, m);
+            } catch (const std::exception& e) {
+                drop(w, e.what());
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            auto w = std::make_unique<Worker>();
+            w->socket = net::accept_from(listener_);
+            workers_.push_back(std::move(w));
+        }
+
+        workers_.erase(std::remove_if(workers_.begin(), workers_.end(),
+                                      [](const std::unique_ptr<Worker>& w) { return w->dead; }), workers_.end());
+    }
+
+    void RenderCoordinator::on_message(Worker& w, const net::Message& m) {
+        switch (m.type) {
+            case net::MessageType::Hello: {
+                net::Unpacker u(m.payload);
+                w.name = u.get_string();
+                std::cout << "Worker joined: " << w.name << "\n";
+                if (frame_) send_job(w); // joins the render in progress
+                break;
+            }
+            case net::MessageType::Result:
+                on_result(w, m);
+                break;
+            default:
+                throw std::runtime_error("Unexpected message from a worker");
+        }
+    }
+
+    void RenderCoordinator::on_result(Worker& w, const net::Message& m) {
+        net::Unpacker u(m.payload);
+        const uint32_t job = u.get<uint32_t>();
+        const uint32_t id  = u.get<uint32_t>();
+        if (!frame_ || job != job_ || w.task != int(id)) {
+            if (w.task == int(id) && w.task_job == job) w.task = -1; // a copy that outlived its render
+            return;
+        }
+        Frame& f = *frame_;
+        Frame::Task& t = f.tasks[id];
+
+        // a bad result throws before the task is released, so drop() queues it again
+        std::vector<cl_float4> tile;
+        u.get_vector(tile);
+        const size_t expected = size_t(t.region.y1 - t.region.y0) * size_t(f.width);
+        if (tile.size() != expected) throw std::runtime_error("Result tile has the wrong size");
+
+        const double ms = ms_since(w.started);
+        w.task = -1;
+        w.busy_ms += ms;
+        --t.copies;
+        if (t.done) {
+            ++f.discarded; // a duplicate lost the race
+            return;
+        }
+        t.done = true;
+        --f.remaining;
+        ++w.tasks;
+        f.task_ms_sum += ms;
+        ++f.task_ms_count;
+
+        const size_t first = size_t(t.region.y0) * size_t(f.width);
+        if (f.ranges == 1) {
+            std::copy(tile.begin(), tile.end(), f.accum.begin() + first);
+            return;
+        }
+        f.pending[t.tile][t.range] = std::move(tile);
+        if (++f.pending_count[t.tile] < f.ranges) return;
+        for (auto& part : f.pending[t.tile]) {
+            for (size_t i = 0; i < expected; ++i) {
+                cl_float4& a = f.accum[first + i];
+                for (int c = 0; c < 4; ++c) a.s[c] += part[i].s[c];
+            }
+            std::vector<cl_float4>().swap(part);
+        }
+    }
+
+    void RenderCoordinator::drop(Worker& w, const std::string& reason) {
+        if (w.dead) return;
+        w.dead = true;
+        std::cout << "Worker " << (w.name.empty() ? "(unnamed)" : w.name) << " dropped: " << reason << "\n";
+        if (frame_ && w.task >= 0) {
+            Frame::Task& t = frame_->tasks[w.task];
+            if (--t.copies == 0 && !t.done) {
+                frame_->queue.push_front(w.task);
+                ++frame_->requeued;
+            }
+        }
+        w.task = -1;
+    }
+
+    void RenderCoordinator::assign_tasks() {
+        Frame& f = *frame_;
+        for (auto& wp : workers_) {
+            Worker& w = *wp;
+            if (w.dead || w.name.empty() || w.task >= 0 || w.job != job_) continue;
+
+            int id = -1;
+            if (!f.queue.empty()) {
+                id = f.queue.front();
+                f.queue.pop_front();
+            } else if (f.task_ms_count > 0) {
+                // straggler: the oldest lone task well past the mean
+                const double limit = config_.distributed.straggler_factor * f.task_ms_sum / double(f.task_ms_count);
+                double oldest = limit;
+                for (size_t i = 0; i < f.tasks.size(); ++i) {
+                    const Frame::Task& t = f.tasks[i];
+                    if (t.done || t.copies != 1) continue;
+                    const double age = ms_since(t.first_start);
+                    if (age > oldest) { oldest = age; id = int(i); }
+                }
+                if (id < 0) continue;
+                ++f.duplicates;
+            } else {
+                continue;
+            }
+
+            Frame::Task& t = f.tasks[id];
+            net::Packer p;
+            p.put(job_);
+            p.put(uint32_t(id));
+            p.put(t.region);
+            try {
+                net::send_message(w.socket, net::MessageType::Task, p.bytes());
+            } catch (const std::exception& e) {
+                if (t.copies == 0) f.queue.push_front(id);
+                drop(w, e.what());
+                continue;
+            }
+            if (t.copies++ == 0) t.first_start = Clock::now();
+            w.task = id;
+            w.task_job = job_;
+            w.started = Clock::now();
+        }
+    }
+
+    void RenderCoordinator::end_frame() {
+        frame_.reset();
+        for (auto& w : workers_) w->task = -1;
+    }
+
+    void RenderCoordinator::render(const Camera& cam, const Scene& scene, const std::string& image_name) {
+        if (!listener_.valid()) throw std::runtime_error("Coordinator not initialized.");
+        const int W = cam.get_image_width();
+        const int H = cam.get_image_height();
+        if (W <= 0 || H <= 0) return;
+        const auto start = Clock::now();
+
+        // host BVH and plain spheres: every backend traces those without special build options
+        serialize::BvhBuildOptions bvh_opt;
+        bvh_opt.sah_bins      = config_.bvh.sah_bins;
+        bvh_opt.max_leaf_size = config_.bvh.max_leaf_size;
+        serialize::PackedScene ps = [&]() {
+            ScopedPhase phase(timeline_, "pack_scene");
+            return serialize::pack_scene(scene, cam, bvh_opt, false);
+        }();
+
+        // one seed for the whole job, so a task traces the same samples on whichever worker gets it
+        const uint32_t job_id = ++job_;
+        RegionTask base;
+        base.scene_id     = job_id;
+        base.width        = W;
+        base.height       = H;
+        base.pass_spp     = std::max(1, config_.render.samples_per_pass);
+        base.max_bounces  = std::max(0, cam.get_max_depth());
+        base.frame_seed   = config_.render.seed;
+        base.sampler      = config_.render.sampler;
+        const int total_spp = std::max(1, cam.get_samples_per_pixel());
+
+        auto frame = std::make_unique<Frame>();
+        Frame& f = *frame;
+        f.width  = W;
+        f.height = H;
+        f.rows   = config_.distributed.tile_rows;
+        // sample ranges start on pass boundaries, as the passes of a local render do
+        const int passes = (total_spp + base.pass_spp - 1) / base.pass_spp;
+        f.ranges = std::min(config_.distributed.sample_ranges, passes);
+        const int tiles = (H + f.rows - 1) / f.rows;
+        for (int tile = 0; tile < tiles; ++tile) {
+            for (int r = 0; r < f.ranges; ++r) {
+                Frame::Task t;
+                t.tile  = tile;
+                t.range = r;
+                t.region = base;
+                t.region.y0 = tile * f.rows;
+                t.region.y1 = std::min(H, (tile + 1) * f.rows);
+                const int p0 = r * passes / f.ranges, p1 = (r + 1) * passes / f.ranges;
+                t.region.first_sample = p0 * base.pass_spp;
+                t.region.sample_count = std::min(total_spp, p1 * base.pass_spp) - t.region.first_sample;
+                f.queue.push_back(int(f.tasks.size()));
+                f.tasks.push_back(t);
+            }
+        }
+        f.remaining = f.tasks.size();
+        f.accum.assign(size_t(W) * size_t(H), cl_float4{{0.0f, 0.0f, 0.0f, 0.0f}});
+        if (f.ranges > 1) {
+            f.pending.assign(tiles, std::vector<std::vector<cl_float4>>(f.ranges));
+            f.pending_count.assign(tiles, 0);
+        }
+
+        net::Packer p;
+        p.put(job_id);
+        net::put_scene(p, ps);
+        job_payload_ = std::move(p.bytes());
+        frame_ = std::move(frame);
+        for (auto& w : workers_) { w->task = -1; w->tasks = 0; w->busy_ms = 0.0; }
+        {
+            ScopedPhase phase(timeline_, "ship_scene");
+            for (auto& w : workers_) {
+                if (w->dead || w->name.empty()) continue;
+                try { send_job(*w); } catch (const std::exception& e) { drop(*w, e.what()); }
+            }
+        }
+
+        try {
+            ScopedPhase phase(timeline_, "tiles");
+            while (f.remaining > 0) {
+                assign_tasks();
+                if (ready_workers() == 0) throw std::runtime_error("No workers left to render on");
+                pump(50); // also the period of the straggler check
+            }
+        } catch (...) {
+            end_frame();
+            throw;
+        }
+        const double render_ms = ms_since(start);
+
+        image::ImageJob job;
+        job.name   = image_name;
+        job.width  = W;
+        job.height = H;
+        job.ldr.resize(f.accum.size());
+        {
+            ScopedPhase phase(timeline_, "tonemap");
+            for (size_t i = 0; i < f.accum.size(); ++i) {
+                const cl_float4& a = f.accum[i];
+                job.ldr[i] = cpu::tonemap(glm::vec4(a.s[0], a.s[1], a.s[2], a.s[3]));
+            }
+        }
+        if (writer_.wants_hdr()) job.hdr = std::move(f.accum);
+        writer_.submit(std::move(job));
+
+        std::cout << "Distributed render: " << f.tasks.size() << " tasks (" << tiles << " tiles of " << f.rows << " rows x "
+                  << f.ranges << " sample ranges) on " << ready_workers() << " workers, " << render_ms << " ms; "
+                  << f.duplicates << " straggler copies, " << f.discarded << " results discarded, "
+                  << f.requeued << " tasks requeued\n";
+        for (const auto& w : workers_) {
+            if (w->dead || w->name.empty()) continue;
+            std::cout << "  " << w->name << ": " << w->tasks << " tasks, busy " << w->busy_ms << " ms\n";
+        }
+        end_frame();
+        writer_.flush();
+        if (timeline_.enabled()) {
+            timeline_.write_chrome_trace(config_.profile.trace_file);
+            timeline_.print_summary(std::cout);
+            std::cout << "Timeline written to " << config_.profile.trace_file << "\n";
+        }
+    }
+
+    size_t RenderWorker::serve(const std::string& host, uint16_t port) {
+        net::Socket socket = net::connect_to(host, port);
+
+        char hostname[256] = {};
+        ::gethostname(hostname, sizeof(hostname) - 1);
+        net::Packer hello;
+        hello.put_string(std::string(hostname) + ":" + std::to_string(::getpid()) +
+                         (backend_.type() == BackendType::CPU ? " (cpu)" : " (opencl)"));
+        net::send_message(socket, net::MessageType::Hello, hello.bytes());
+
+        std::unique_ptr<serialize::PackedScene> scene;
+        uint32_t job = 0;
+        size_t rendered = 0;
+        std::vector<cl_float4> accum;
+        net::Message m;
+        while (net::recv_message(socket, m)) {
+            net::Unpacker u(m.payload);
+            switch (m.type) {
+                case net::MessageType::Job: {
+                    // backends recognise the new scene by the job id its tasks carry (RegionTask::scene_id)
+                    auto next = std::make_unique<serialize::PackedScene>();
+                    job = u.get<uint32_t>();
+                    net::get_scene(u, *next);
+                    scene = std::move(next);
+                    break;
+                }
+                case net::MessageType::Task: {
+                    const uint32_t task_job = u.get<uint32_t>();
+                    const uint32_t id = u.get<uint32_t>();
+                    const RegionTask task = u.get<RegionTask>();
+                    if (!scene || task_job != job) throw std::runtime_error("Task for a scene this worker does not have");
+                    backend_.render_region(*scene, task, accum);
+
+                    net::Packer result;
+                    result.put(job);
+                    result.put(id);
+                    result.put_vector(accum);
+                    try {
+                        net::send_message(socket, net::MessageType::Result, result.bytes());
+                    } catch (const std::runtime_error&) {
+                        return rendered; // the coordinator finished without this straggler copy
+                    }
+                    ++rendered;
+                    break;
+                }
+                case net::MessageType::Done:
+                    return rendered;
+                default:
+                    throw std::runtime_error("Unexpected message from the coordinator");
+            }
+        }
+        return rendered; // the coordinator hung up
+    }
+
+}
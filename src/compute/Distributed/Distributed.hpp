@@ -0,0 +1,92 @@
+#ifndef DISTRIBUTED_HPP
+#define DISTRIBUTED_HPP
+
+#include "CLHeaders.hpp"
+#include <fstream>
+#include "CLUtils.hpp"
+#include "Backend.hpp"
+#include "Serialize.hpp"
+#include "ImageIO.hpp"
+#include "Socket.hpp"
+
+namespace compute {
+
+    /*
+    *   Coordinator of a render spread over worker processes (RenderWorker), on this machine or
+    *   others. Each render packs the scene once and ships it to every worker; the image is then
+    *   cut into bands of Config::distributed.tile_rows rows, optionally split again into sample
+    *   ranges, and each idle worker gets the next task. Workers send back float accumulation
+    *   tiles, which are merged in a fixed order, so the image does not depend on who rendered
+    *   what. When the queue runs dry, an idle worker duplicates the oldest task that has run
+    *   longer than straggler_factor times the mean task time; the first result wins. A worker
+    *   that disconnects has its task queued again, and late workers join the running render.
+    */
+    class RenderCoordinator {
+    public:
+        RenderCoordinator();
+        ~RenderCoordinator(); // sends DONE to the workers still connected
+
+        // Listens on `port` (0: any free port, see port())
+        void initialize(const Config& config, uint16_t port);
+        uint16_t port() const { return port_; }
+
+        // Accepts connections until `count` workers have introduced themselves
+        void wait_for_workers(size_t count);
+
+        // Renders `cam` on the workers and writes the image (and HDR image) as `image_name`
+        void render(const Camera& cam, const Scene& scene, const std::string& image_name);
+
+        // Tells every worker to exit
+        void shutdown();
+
+        const Timeline& timeline() const { return timeline_; }
+
+    private:
+        struct Worker; // connection and current task, in Distributed.cpp
+        struct Frame;  // task queue and partial tiles of the render in progress
+
+        // Waits up to `timeout_ms` for connections and messages and handles them
+        void pump(int timeout_ms);
+        void on_message(Worker& w, const net::Message& m);
+        void on_result(Worker& w, const net::Message& m);
+        // Requeues the worker's task; the worker is removed by pump()
+        void drop(Worker& w, const std::string& reason);
+        // Hands each idle worker the next task, or a straggler's once the queue is empty
+        void assign_tasks();
+        void send_job(Worker& w);
+        // Drops the render in progress; straggler copies still running no longer hold their workers
+        void end_frame();
+        size_t ready_workers() const;
+
+        Config config_;
+        net::Socket listener_;
+        uint16_t port_ = 0;
+        std::vector<std::unique_ptr<Worker>> workers_;
+
+        uint32_t job_ = 0;
+        std::vector<uint8_t> job_payload_; // the current scene, for workers that connect mid-render
+        std::unique_ptr<Frame> frame_;
+
+        Timeline timeline_;
+        image::ImageWriter writer_;
+    };
+
+    /*
+    *   Worker process of a distributed render: connects to a RenderCoordinator and traces the
+    *   tasks it is sent with `backend` (any compute::Backend, already initialized) until the
+    *   coordinator says DONE or hangs up.
+    */
+    class RenderWorker {
+    public:
+        explicit RenderWorker(Backend& backend) : backend_(backend) {}
+
+        // Returns the number of tasks rendered
+        size_t serve(const std::string& host, uint16_t port);
+
+    private:
+        Backend& backend_;
+    };
+
+}
+
+#endif // DISTRIBUTED_HPP
@@ -0,0 +1,56 @@
+#ifndef SCENEWIRE_HPP
+#define SCENEWIRE_HPP
+
+#include "Socket.hpp"
+#include "DTOs.hpp"
+
+namespace compute::net {
+
+    // The device-facing arrays of a PackedScene; build statistics and the host source pointers
+    // (material_sources, mesh_sources) stay behind, so a received scene cannot be repacked incrementally
+    inline void put_scene(Packer& p, const serialize::PackedScene& ps) {
+        p.put(ps.camera);
+        p.put_vector(ps.spheres);
+        p.put(ps.world_sphere_count);
+        p.put_vector(ps.materials);
+        p.put_vector(ps.bvh_nodes);
+        p.put_vector(ps.bvh_prims);
+        p.put_vector(ps.meshes);
+        p.put_vector(ps.mesh_nodes);
+        p.put_vector(ps.triangles);
+        p.put_vector(ps.mesh_positions);
+        p.put_vector(ps.planes);
+        p.put_vector(ps.boxes);
+        p.put_vector(ps.spheres_q);
+        p.put_vector(ps.sphere_palette);
+        p.put_vector(ps.instances);
+        p.put_vector(ps.inst_nodes);
+        p.put_vector(ps.inst_prims);
+    }
+
+    inline void get_scene(Unpacker& u, serialize::PackedScene& ps) {
+        ps.camera = u.get<serialize::CameraGpu>();
+        u.get_vector(ps.spheres);
+        ps.world_sphere_count = u.get<cl_int>();
+        u.get_vector(ps.materials);
+        u.get_vector(ps.bvh_nodes);
+        u.get_vector(ps.bvh_prims);
+        u.get_vector(ps.meshes);
+        u.get_vector(ps.mesh_nodes);
+        u.get_vector(ps.triangles);
+        u.get_vector(ps.mesh_positions);
+        u.get_vector(ps.planes);
+        u.get_vector(ps.boxes);
+        u.get_vector(ps.spheres_q);
+        u.get_vector(ps.sphere_palette);
+        u.get_vector(ps.instances);
+        u.get_vector(ps.inst_nodes);
+        u.get_vector(ps.inst_prims);
+        if (ps.world_sphere_count < 0 || size_t(ps.world_sphere_count) > ps.spheres.size()) {
+            throw std::runtime_error("Malformed scene");
+        }
+    }
+
+}
+
+#endif // SCENEWIRE_HPP
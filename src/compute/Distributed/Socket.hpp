@@ -0,0 +1,233 @@
+#ifndef SOCKET_HPP
+#define SOCKET_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace compute::net {
+
+    // Blocking POSIX TCP socket; closes on destruction
+    class Socket {
+    public:
+        Socket() = default;
+        explicit Socket(int fd) : fd_(fd) {}
+        Socket(Socket&& other) noexcept : fd_(other.fd_) { other.fd_ = -1; }
+        Socket& operator=(Socket&& other) noexcept {
+            if (this != &other) { close(); fd_ = other.fd_; other.fd_ = -1; }
+            return *this;
+        }
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+        ~Socket() { close(); }
+
+        int fd() const { return fd_; }
+        bool valid() const { return fd_ >= 0; }
+        void close() { if (fd_ >= 0) ::close(fd_); fd_ = -1; }
+
+        void send_all(const void* data, size_t size) {
+            const char* p = static_cast<const char*>(data);
+            while (size > 0) {
+                const ssize_t n = ::send(fd_, p, size, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) throw std::runtime_error(std::string("Socket send failed: ") + std::strerror(errno));
+                p += n;
+                size -= size_t(n);
+            }
+        }
+
+        // False when the peer closed the connection before the first byte
+        bool recv_all(void* data, size_t size) {
+            char* p = static_cast<char*>(data);
+            const size_t total = size;
+            while (size > 0) {
+                const ssize_t n = ::recv(fd_, p, size, 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n == 0 && size == total) return false;
+                if (n <= 0) throw std::runtime_error("Connection lost in the middle of a message");
+                p += n;
+                size -= size_t(n);
+            }
+            return true;
+        }
+
+    private:
+        int fd_ = -1;
+    };
+
+    inline void set_no_delay(Socket& s) {
+        int one = 1;
+        ::setsockopt(s.fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // small task messages go out at once
+    }
+
+    // Listens on every interface; port 0 picks a free one (see local_port)
+    inline Socket listen_on(uint16_t port, int backlog = 16) {
+        Socket s(::socket(AF_INET, SOCK_STREAM, 0));
+        if (!s.valid()) throw std::runtime_error(std::string("socket() failed: ") + std::strerror(errno));
+        int one = 1;
+        ::setsockopt(s.fd(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        if (::bind(s.fd(), reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(s.fd(), backlog) != 0) {
+            throw std::runtime_error("Cannot listen on port " + std::to_string(port) + ": " + std::strerror(errno));
+        }
+        return s;
+    }
+
+    inline uint16_t local_port(const Socket& s) {
+        sockaddr_in addr{};
+        socklen_t len = sizeof(addr);
+        ::getsockname(s.fd(), reinterpret_cast<sockaddr*>(&addr), &len);
+        return ntohs(addr.sin_port);
+    }
+
+    inline Socket accept_from(Socket& listener) {
+        Socket s(::accept(listener.fd(), nullptr, nullptr));
+        if (!s.valid()) throw std::runtime_error(std::string("accept() failed: ") + std::strerror(errno));
+        set_no_delay(s);
+        return s;
+    }
+
+    inline Socket connect_to(const std::string& host, uint16_t port) {
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found) {
+            throw std::runtime_error("Cannot resolve " + host);
+        }
+        Socket s;
+        for (addrinfo* a = found; a && !s.valid(); a = a->ai_next) {
+            Socket attempt(::socket(a->ai_family, a->ai_socktype, a->ai_protocol));
+            if (attempt.valid() && ::connect(attempt.fd(), a->ai_addr, a->ai_addrlen) == 0) s = std::move(attempt);
+        }
+        ::freeaddrinfo(found);
+        if (!s.valid()) throw std::runtime_error("Cannot connect to " + host + ":" + std::to_string(port));
+        set_no_delay(s);
+        return s;
+    }
+
+    // Framing: u32 type, u64 payload size, payload. Both ends are assumed to share byte order and
+    // struct layout (the packed scene DTOs go over as they are in memory)
+    enum class MessageType : uint32_t { Hello = 1, Job, Task, Result, Done };
+
+    struct Message {
+        MessageType type = MessageType::Done;
+        std::vector<uint8_t> payload;
+    };
+
+    inline void send_message(Socket& s, MessageType type, const std::vector<uint8_t>& payload) {
+        uint8_t header[12];
+        const uint32_t t = uint32_t(type);
+        const uint64_t size = payload.size();
+        std::memcpy(header, &t, 4);
+        std::memcpy(header + 4, &size, 8);
+        s.send_all(header, sizeof(header));
+        s.send_all(payload.data(), payload.size());
+    }
+
+    // False when the peer closed the connection between messages
+    inline bool recv_message(Socket& s, Message& m) {
+        uint8_t header[12];
+        if (!s.recv_all(header, sizeof(header))) return false;
+        uint32_t t;
+        uint64_t size;
+        std::memcpy(&t, header, 4);
+        std::memcpy(&size, header + 4, 8);
+        if (t < uint32_t(MessageType::Hello) || t > uint32_t(MessageType::Done) || size > (uint64_t(1) << 36)) {
+            throw std::runtime_error("Malformed message");
+        }
+        m.type = MessageType(t);
+        m.payload.resize(size_t(size));
+        if (size > 0 && !s.recv_all(m.payload.data(), m.payload.size())) {
+            throw std::runtime_error("Connection lost in the middle of a message");
+        }
+        return true;
+    }
+
+    // Appends trivially copyable values and arrays to a payload
+    class Packer {
+    public:
+        template <typename T>
+        void put(const T& value) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain data goes over the wire");
+            const auto* p = reinterpret_cast<const uint8_t*>(&value);
+            bytes_.insert(bytes_.end(), p, p + sizeof(T));
+        }
+
+        template <typename T>
+        void put_array(const T* data, size_t count) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain data goes over the wire");
+            put(uint64_t(count));
+            const auto* p = reinterpret_cast<const uint8_t*>(data);
+            bytes_.insert(bytes_.end(), p, p + count * sizeof(T));
+        }
+
+        template <typename T>
+        void put_vector(const std::vector<T>& v) { put_array(v.data(), v.size()); }
+
+        void put_string(const std::string& s) { put_array(s.data(), s.size()); }
+
+        std::vector<uint8_t>& bytes() { return bytes_; }
+
+    private:
+        std::vector<uint8_t> bytes_;
+    };
+
+    // Reads what a Packer wrote, in the same order; throws on a short payload
+    class Unpacker {
+    public:
+        explicit Unpacker(const std::vector<uint8_t>& bytes) : bytes_(bytes) {}
+
+        template <typename T>
+        T get() {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain data goes over the wire");
+            T value;
+            std::memcpy(&value, take(sizeof(T)), sizeof(T));
+            return value;
+        }
+
+        template <typename T>
+        void get_vector(std::vector<T>& v) {
+            static_assert(std::is_trivially_copyable_v<T>, "only plain data goes over the wire");
+            const uint64_t count = get<uint64_t>();
+            if (count > (bytes_.size() - pos_) / sizeof(T)) throw std::runtime_error("Truncated message");
+            v.resize(size_t(count));
+            if (count > 0) std::memcpy(v.data(), take(size_t(count) * sizeof(T)), size_t(count) * sizeof(T));
+        }
+
+        std::string get_string() {
+            std::vector<char> chars;
+            get_vector(chars);
+            return std::string(chars.begin(), chars.end());
+        }
+
+    private:
+        const uint8_t* take(size_t size) {
+            if (size > bytes_.size() - pos_) throw std::runtime_error("Truncated message");
+            const uint8_t* p = bytes_.data() + pos_;
+            pos_ += size;
+            return p;
+        }
+
+        const std::vector<uint8_t>& bytes_;
+        size_t pos_ = 0;
+    };
+
+}
+
+#endif // SOCKET_HPP
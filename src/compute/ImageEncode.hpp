@@ -0,0 +1,439 @@
+#ifndef IMAGEENCODE_HPP
+#define IMAGEENCODE_HPP
+
+#include <array>
+#include <cstring>
+#include <future>
+#include <thread>
+
+namespace compute::image {
+
+    /*
+    *   In-memory encoders behind ImageWriter. 8-bit formats take the tone-mapped RGBA framebuffer
+    *   (alpha dropped); the float formats take the raw accumulation (rgb: radiance sum, w: sample
+    *   count) and store its average as linear RGB. PNG and QOI split the rows into bands that are
+    *   encoded on `threads` threads (0 = every core) and concatenated into one file.
+    */
+
+    using Bytes = std::vector<uint8_t>;
+
+    namespace detail {
+
+        inline void put_be32(Bytes& out, uint32_t v) {
+            const uint8_t b[4] = { uint8_t(v >> 24), uint8_t(v >> 16), uint8_t(v >> 8), uint8_t(v) };
+            out.insert(out.end(), b, b + 4);
+        }
+
+        template <typename T>
+        inline void put_le(Bytes& out, T v) {
+            uint8_t b[sizeof(T)];
+            std::memcpy(b, &v, sizeof(T)); // every supported host is little-endian
+            out.insert(out.end(), b, b + sizeof(T));
+        }
+
+        inline void put_str(Bytes& out, const char* s, bool terminate = true) {
+            out.insert(out.end(), s, s + std::strlen(s) + (terminate ? 1 : 0));
+        }
+
+        inline unsigned thread_count(unsigned threads) {
+            return threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        // Runs encode(first_row, end_row) for `bands` row bands in parallel, results in band order
+        template <typename F>
+        auto encode_bands(int height, unsigned threads, F encode) {
+            using Result = decltype(encode(0, 0));
+            const int bands = std::max(1, std::min<int>(height, (int)thread_count(threads)));
+            std::vector<std::future<Result>> jobs;
+            for (int b = 0; b < bands; ++b) {
+                const int y0 = int(int64_t(height) * b / bands), y1 = int(int64_t(height) * (b + 1) / bands);
+                jobs.push_back(std::async(b + 1 < bands ? std::launch::async : std::launch::deferred, encode, y0, y1));
+            }
+            std::vector<Result> out;
+            for (auto& j : jobs) out.push_back(j.get());
+            return out;
+        }
+
+        inline uint32_t crc32(const uint8_t* data, size_t n, uint32_t crc = 0) {
+            static const auto table = []() {
+                std::array<uint32_t, 256> t{};
+                for (uint32_t i = 0; i < 256; ++i) {
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    t[i] = c;
+                }
+                return t;
+            }();
+            crc = ~crc;
+            for (size_t i = 0; i < n; ++i) crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            return ~crc;
+        }
+
+        // LSB-first bit stream, as deflate packs it
+        class BitWriter {
+        public:
+            explicit BitWriter(Bytes& out) : out_(out) {}
+            void put(uint32_t bits, int count) {
+                acc_ |= uint64_t(bits) << filled_;
+                filled_ += count;
+                while (filled_ >= 8) {
+                    out_.push_back(uint8_t(acc_));
+                    acc_ >>= 8;
+                    filled_ -= 8;
+                }
+            }
+            // Huffman codes are defined MSB-first
+            void put_code(uint32_t code, int count) {
+                uint32_t rev = 0;
+                for (int i = 0; i < count; ++i) rev |= ((code >> i) & 1u) << (count - 1 - i);
+                put(rev, count);
+            }
+            void align() { if (filled_ > 0) put(0, 8 - filled_); }
+
+        private:
+            Bytes& out_;
+            uint64_t acc_ = 0;
+            int filled_ = 0;
+        };
+
+        inline void put_literal(BitWriter& bw, int v) {
+            if (v < 144)      bw.put_code(0x30 + v, 8);
+            else if (v < 256) bw.put_code(0x190 + (v - 144), 9);
+            else if (v < 280) bw.put_code(v - 256, 7);
+            else              bw.put_code(0xC0 + (v - 280), 8);
+        }
+
+        inline void put_match(BitWriter& bw, int length, int distance) {
+            static const int len_base[29]  = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+            static const int len_extra[29] = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+            static const int dist_base[30]  = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+                                                1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+            static const int dist_extra[30] = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+
+            int l = 28;
+            while (len_base[l] > length) --l;
+            put_literal(bw, 257 + l);
+            if (len_extra[l]) bw.put(uint32_t(length - len_base[l]), len_extra[l]);
+
+            int d = 29;
+            while (dist_base[d] > distance) --d;
+            bw.put_code(uint32_t(d), 5);
+            if (dist_extra[d]) bw.put(uint32_t(distance - dist_base[d]), dist_extra[d]);
+        }
+
+        /* One non-final fixed-Huffman deflate block followed by an empty stored block, so the
+           result is byte aligned and independent streams can simply be concatenated (as pigz
+           does). Greedy LZ77 with a single-entry hash table over a 32 KiB window. */
+        inline Bytes deflate_band(const uint8_t* data, size_t n) {
+            constexpr int HASH_BITS = 15, MIN_MATCH = 3, MAX_MATCH = 258, WINDOW = 32768;
+            Bytes out;
+            out.reserve(n / 2 + 16);
+            BitWriter bw(out);
+            bw.put(0, 1); // BFINAL
+            bw.put(1, 2); // BTYPE = fixed Huffman
+
+            std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+            auto hash = [&](size_t i) {
+                const uint32_t v = uint32_t(data[i]) | uint32_t(data[i + 1]) << 8 | uint32_t(data[i + 2]) << 16;
+                return (v * 2654435761u) >> (32 - HASH_BITS);
+            };
+
+            size_t i = 0;
+            while (i < n) {
+                int best = 0;
+                size_t dist = 0;
+                if (i + MIN_MATCH <= n) {
+                    const uint32_t h = hash(i);
+                    const int32_t cand = head[h];
+                    head[h] = (int32_t)i;
+                    if (cand >= 0 && i - size_t(cand) <= WINDOW) {
+                        const size_t limit = std::min<size_t>(MAX_MATCH, n - i);
+                        size_t len = 0;
+                        while (len < limit && data[size_t(cand) + len] == data[i + len]) ++len;
+                        if (len >= MIN_MATCH) {
+                            best = (int)len;
+                            dist = i - size_t(cand);
+                        }
+                    }
+                }
+                if (best == 0) {
+                    put_literal(bw, data[i]);
+                    ++i;
+                    continue;
+                }
+                put_match(bw, best, (int)dist);
+                // keep the table current inside the match so later data can refer into it
+                const size_t end = i + size_t(best);
+                for (++i; i < end; ++i) {
+                    if (i + MIN_MATCH <= n) head[hash(i)] = (int32_t)i;
+                }
+            }
+            put_literal(bw, 256); // end of block
+
+            bw.put(0, 3); // empty stored block: BFINAL 0, BTYPE 00
+            bw.align();
+            const uint8_t sync[4] = { 0x00, 0x00, 0xFF, 0xFF };
+            out.insert(out.end(), sync, sync + 4);
+            return out;
+        }
+
+        inline uint8_t paeth(int a, int b, int c) {
+            const int p = a + b - c;
+            const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+            return uint8_t(pa <= pb && pa <= pc ? a : (pb <= pc ? b : c));
+        }
+
+        // Filter byte + filtered RGB row, picking the filter with the smallest sum of |signed byte|
+        inline void filter_row(const cl_uchar4* row, const cl_uchar4* prev, int width, Bytes& out) {
+            const size_t stride = size_t(width) * 3;
+            std::vector<uint8_t> raw(stride), up(stride, 0);
+            for (int x = 0; x < width; ++x) {
+                for (int k = 0; k < 3; ++k) {
+                    raw[size_t(x) * 3 + k] = row[x].s[k];
+                    if (prev) up[size_t(x) * 3 + k] = prev[x].s[k];
+                }
+            }
+
+            std::array<std::vector<uint8_t>, 5> candidates;
+            uint64_t best_cost = ~0ull;
+            int best = 0;
+            for (int f = 0; f < 5; ++f) {
+                auto& c = candidates[f];
+                c.resize(stride);
+                uint64_t cost = 0;
+                for (size_t i = 0; i < stride; ++i) {
+                    const int a = i >= 3 ? raw[i - 3] : 0, b = up[i], d = i >= 3 ? up[i - 3] : 0;
+                    uint8_t pred = 0;
+                    switch (f) {
+                        case 1: pred = uint8_t(a); break;
+                        case 2: pred = uint8_t(b); break;
+                        case 3: pred = uint8_t((a + b) / 2); break;
+                        case 4: pred = paeth(a, b, d); break;
+                    }
+                    c[i] = uint8_t(raw[i] - pred);
+                    cost += (uint64_t)std::abs((int)(int8_t)c[i]);
+                }
+                if (cost < best_cost) { best_cost = cost; best = f; }
+            }
+            out.push_back(uint8_t(best));
+            out.insert(out.end(), candidates[best].begin(), candidates[best].end());
+        }
+
+        inline uint32_t qoi_hash(const cl_uchar4& p) {
+            return (uint32_t(p.s[0]) * 3 + uint32_t(p.s[1]) * 5 + uint32_t(p.s[2]) * 7 + 255u * 11) % 64;
+        }
+
+        /* QOI ops for rows [y0, y1). The decoder's running state at the band start is the previous
+           pixel, which is known, and a 64-entry index holding the latest pixel of each hash, which
+           is not: the band only uses index slots it has written itself, which then hold the same
+           pixel in the decoder. Runs stop at the band end. */
+        inline Bytes qoi_band(const cl_uchar4* image, int width, int y0, int y1) {
+            Bytes out;
+            out.reserve(size_t(width) * size_t(y1 - y0) * 2);
+            std::array<cl_uchar4, 64> index{};
+            std::array<bool, 64> known{};
+            cl_uchar4 prev;
+            if (y0 == 0) { prev.s[0] = prev.s[1] = prev.s[2] = 0; }
+            else         { prev = image[size_t(y0) * width - 1]; }
+            prev.s[3] = 255;
+
+            int run = 0;
+            const size_t begin = size_t(y0) * width, end = size_t(y1) * width;
+            for (size_t i = begin; i < end; ++i) {
+                cl_uchar4 px = image[i];
+                px.s[3] = 255;
+                const bool same = px.s[0] == prev.s[0] && px.s[1] == prev.s[1] && px.s[2] == prev.s[2];
+                if (same) {
+                    if (++run == 62) { out.push_back(uint8_t(0xC0 | (run - 1))); run = 0; }
+                    continue;
+                }
+                if (run > 0) { out.push_back(uint8_t(0xC0 | (run - 1))); run = 0; }
+
+                const uint32_t h = qoi_hash(px);
+                if (known[h] && index[h].s[0] == px.s[0] && index[h].s[1] == px.s[1] && index[h].s[2] == px.s[2]) {
+                    out.push_back(uint8_t(h)); // QOI_OP_INDEX
+                } else {
+                    const int dr = int8_t(px.s[0] - prev.s[0]), dg = int8_t(px.s[1] - prev.s[1]), db = int8_t(px.s[2] - prev.s[2]);
+                    const int dr_dg = dr - dg, db_dg = db - dg;
+                    if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                        out.push_back(uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                    } else if (dg >= -32 && dg <= 31 && dr_dg >= -8 && dr_dg <= 7 && db_dg >= -8 && db_dg <= 7) {
+                        out.push_back(uint8_t(0x80 | (dg + 32)));
+                        out.push_back(uint8_t((dr_dg + 8) << 4 | (db_dg + 8)));
+                    } else {
+                        const uint8_t rgb[4] = { 0xFE, px.s[0], px.s[1], px.s[2] };
+                        out.insert(out.end(), rgb, rgb + 4);
+                    }
+                }
+                index[h] = px;
+                known[h] = true;
+                prev = px;
+            }
+            if (run > 0) out.push_back(uint8_t(0xC0 | (run - 1)));
+            return out;
+        }
+
+        // linear radiance of one accumulated pixel
+        inline void average(const cl_float4& acc, float rgb[3]) {
+            const float inv = acc.s[3] > 0.0f ? 1.0f / acc.s[3] : 0.0f;
+            for (int k = 0; k < 3; ++k) rgb[k] = acc.s[k] * inv;
+        }
+
+    }
+
+    inline Bytes encode_ppm(const cl_uchar4* image, int width, int height) {
+        const std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+        const size_t pixels = size_t(width) * size_t(height);
+        Bytes out(header.begin(), header.end());
+        out.resize(header.size() + pixels * 3);
+        uint8_t* dst = out.data() + header.size();
+        for (size_t i = 0; i < pixels; ++i) {
+            dst[3 * i + 0] = image[i].s[0];
+            dst[3 * i + 1] = image[i].s[1];
+            dst[3 * i + 2] = image[i].s[2];
+        }
+        return out;
+    }
+
+    // 8-bit RGB PNG; each band is filtered and deflated on its own thread
+    inline Bytes encode_png(const cl_uchar4* image, int width, int height, unsigned threads = 0) {
+        struct Band { Bytes filtered, deflated; };
+        const std::vector<Band> bands = detail::encode_bands(height, threads, [&](int y0, int y1) {
+            Band band;
+            band.filtered.reserve(size_t(y1 - y0) * (size_t(width) * 3 + 1));
+            for (int y = y0; y < y1; ++y) {
+                detail::filter_row(image + size_t(y) * width, y > 0 ? image + size_t(y - 1) * width : nullptr,
+                                   width, band.filtered);
+            }
+            band.deflated = detail::deflate_band(band.filtered.data(), band.filtered.size());
+            return band;
+        });
+
+        // zlib stream: header, the concatenated bands, a final empty block, Adler-32 of the filtered data
+        Bytes zlib = { 0x78, 0x01 };
+        uint32_t s1 = 1, s2 = 0;
+        for (const auto& b : bands) {
+            zlib.insert(zlib.end(), b.deflated.begin(), b.deflated.end());
+            for (size_t i = 0; i < b.filtered.size(); ) {
+                const size_t chunk = std::min<size_t>(b.filtered.size() - i, 5552); // no uint32 overflow before the modulo
+                for (size_t k = 0; k < chunk; ++k) { s1 += b.filtered[i + k]; s2 += s1; }
+                s1 %= 65521; s2 %= 65521;
+                i += chunk;
+            }
+        }
+        zlib.push_back(0x03); // BFINAL 1, fixed Huffman, end of block
+        zlib.push_back(0x00);
+        detail::put_be32(zlib, s2 << 16 | s1);
+
+        Bytes out = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        auto chunk = [&](const char* type, const Bytes& data) {
+            detail::put_be32(out, (uint32_t)data.size());
+            const size_t start = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data.begin(), data.end());
+            detail::put_be32(out, detail::crc32(out.data() + start, out.size() - start));
+        };
+        Bytes ihdr;
+        detail::put_be32(ihdr, (uint32_t)width);
+        detail::put_be32(ihdr, (uint32_t)height);
+        ihdr.insert(ihdr.end(), { 8, 2, 0, 0, 0 }); // 8 bits, RGB, deflate, adaptive filters, no interlace
+        chunk("IHDR", ihdr);
+        chunk("IDAT", zlib);
+        chunk("IEND", {});
+        return out;
+    }
+
+    // QOI (RGB); bands are encoded in parallel and concatenated into one valid stream
+    inline Bytes encode_qoi(const cl_uchar4* image, int width, int height, unsigned threads = 0) {
+        Bytes out = { 'q', 'o', 'i', 'f' };
+        detail::put_be32(out, (uint32_t)width);
+        detail::put_be32(out, (uint32_t)height);
+        out.push_back(3); // channels
+        out.push_back(0); // sRGB with linear alpha
+        for (const auto& b : detail::encode_bands(height, threads, [&](int y0, int y1) {
+                 return detail::qoi_band(image, width, y0, y1);
+             })) {
+            out.insert(out.end(), b.begin(), b.end());
+        }
+        out.insert(out.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+        return out;
+    }
+
+    // Portable float map: linear RGB, little-endian, rows bottom to top
+    inline Bytes encode_pfm(const cl_float4* accum, int width, int height) {
+        const std::string header = "PF\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+        Bytes out(header.begin(), header.end());
+        out.reserve(out.size() + size_t(width) * size_t(height) * 12);
+        for (int y = height - 1; y >= 0; --y) {
+            for (int x = 0; x < width; ++x) {
+                float rgb[3];
+                detail::average(accum[size_t(y) * width + x], rgb);
+                for (float v : rgb) detail::put_le(out, v);
+            }
+        }
+        return out;
+    }
+
+    // OpenEXR scanline image, uncompressed 32-bit float R, G, B
+    inline Bytes encode_exr(const cl_float4* accum, int width, int height) {
+        using detail::put_le;
+        using detail::put_str;
+        Bytes out;
+        put_le<uint32_t>(out, 20000630u); // magic
+        put_le<uint32_t>(out, 2u);        // version 2, single-part scanline
+
+        auto attribute = [&](const char* name, const char* type, const Bytes& value) {
+            put_str(out, name);
+            put_str(out, type);
+            put_le<int32_t>(out, (int32_t)value.size());
+            out.insert(out.end(), value.begin(), value.end());
+        };
+        Bytes channels;
+        for (const char* c : { "B", "G", "R" }) { // channel list is sorted by name
+            put_str(channels, c);
+            put_le<int32_t>(channels, 2);           // FLOAT
+            put_le<uint32_t>(channels, 0);          // pLinear + reserved
+            put_le<int32_t>(channels, 1);           // x sampling
+            put_le<int32_t>(channels, 1);           // y sampling
+        }
+        channels.push_back(0);
+        Bytes box;
+        for (int32_t v : { 0, 0, width - 1, height - 1 }) put_le(box, v);
+        Bytes center, aspect, screen_width;
+        put_le(center, 0.0f);
+        put_le(center, 0.0f);
+        put_le(aspect, 1.0f);
+        put_le(screen_width, 1.0f);
+
+        attribute("channels", "chlist", channels);
+        attribute("compression", "compression", Bytes{ 0 });  // NO_COMPRESSION
+        attribute("dataWindow", "box2i", box);
+        attribute("displayWindow", "box2i", box);
+        attribute("lineOrder", "lineOrder", Bytes{ 0 });      // INCREASING_Y
+        attribute("pixelAspectRatio", "float", aspect);
+        attribute("screenWindowCenter", "v2f", center);
+        attribute("screenWindowWidth", "float", screen_width);
+        out.push_back(0); // end of header
+
+        // offset table, then one scanline per chunk: y, byte count, B row, G row, R row
+        const size_t line_bytes = size_t(width) * 3 * sizeof(float);
+        const uint64_t first = out.size() + size_t(height) * sizeof(uint64_t);
+        for (int y = 0; y < height; ++y) put_le<uint64_t>(out, first + uint64_t(y) * (8 + line_bytes));
+        out.reserve(out.size() + size_t(height) * (8 + line_bytes));
+        for (int y = 0; y < height; ++y) {
+            put_le<int32_t>(out, y);
+            put_le<int32_t>(out, (int32_t)line_bytes);
+            for (int k = 2; k >= 0; --k) {
+                for (int x = 0; x < width; ++x) {
+                    float rgb[3];
+                    detail::average(accum[size_t(y) * width + x], rgb);
+                    put_le(out, rgb[k]);
+                }
+            }
+        }
+        return out;
+    }
+
+}
+
+#endif // IMAGEENCODE_HPP
@@ -0,0 +1,194 @@
+#ifndef IMAGEIO_HPP
+#define IMAGEIO_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include "Backend.hpp"
+#include "ImageEncode.hpp"
+
+namespace compute::image {
+
+    // "<name>_0042" for frame 42 of a sequence; the writer appends the format's extension
+    inline std::string frame_filename(const std::string& name, size_t frame) {
+        std::ostringstream ss;
+        ss << name << '_' << std::setw(4) << std::setfill('0') << frame;
+        return ss.str();
+    }
+
+    inline const char* extension(ImageFormat format) {
+        switch (format) {
+            case ImageFormat::PPM: return ".ppm";
+            case ImageFormat::PNG: return ".png";
+            case ImageFormat::QOI: return ".qoi";
+            case ImageFormat::PFM: return ".pfm";
+            case ImageFormat::EXR: return ".exr";
+            default:               return "";
+        }
+    }
+
+    // "ppm", "png", "qoi", "pfm", "exr" or "none"
+    inline ImageFormat parse_format(const std::string& name) {
+        for (ImageFormat f : { ImageFormat::PPM, ImageFormat::PNG, ImageFormat::QOI, ImageFormat::PFM, ImageFormat::EXR }) {
+            if (name == extension(f) + 1) return f;
+        }
+        if (name == "none") return ImageFormat::None;
+        throw std::runtime_error("Unknown image format: " + name);
+    }
+
+    // One image to write; `name` has no extension
+    struct ImageJob {
+        std::string name;
+        int width = 0, height = 0;
+        std::vector<cl_uchar4> ldr; // tone-mapped display image
+        std::vector<cl_float4> hdr; // accumulation (rgb: sum, w: samples); empty = no HDR file
+    };
+
+    /*
+    *   Encodes and writes images on a background thread. submit() hands a job over and returns
+    *   at once unless `queue_depth` jobs are already waiting, which bounds the memory held by
+    *   frames a fast renderer produces faster than the disk takes them. PNG/QOI encoding is
+    *   itself spread over `encode_threads`. A failed write is rethrown by the next submit() or
+    *   flush(); the destructor writes whatever is still queued.
+    */
+    class ImageWriter {
+    public:
+        ~ImageWriter() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                closing_ = true;
+            }
+            wake_.notify_all();
+            if (thread_.joinable()) thread_.join();
+            if (error_) {
+                try { std::rethrow_exception(error_); }
+                catch (const std::exception& e) { std::cerr << "Image writer: " << e.what() << "\n"; }
+            }
+        }
+
+        void configure(const Config::Output& output, Timeline& timeline) {
+            flush();
+            if (output.format != ImageFormat::PPM && output.format != ImageFormat::PNG && output.format != ImageFormat::QOI)
+                throw std::runtime_error("Display images must be PPM, PNG or QOI");
+            if (output.hdr_format != ImageFormat::None && output.hdr_format != ImageFormat::PFM &&
+                output.hdr_format != ImageFormat::EXR)
+                throw std::runtime_error("HDR images must be PFM or EXR");
+            output_ = output;
+            output_.queue_depth = std::max<size_t>(1, output.queue_depth);
+            timeline_ = &timeline;
+
+            // resolved once, so a later change of working directory does not scatter the files
+            if (output_.directory.empty()) {
+                directory_ = clutils::find_directory("images");
+            } else {
+                directory_ = output_.directory;
+                std::filesystem::create_directories(directory_);
+            }
+        }
+
+        bool wants_hdr() const { return output_.hdr_format != ImageFormat::None; }
+
+        // Queues the job, blocking while the queue is full
+        void submit(ImageJob job) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            rethrow_error();
+            if (!thread_.joinable()) thread_ = std::thread(&ImageWriter::run, this);
+            idle_.wait(lock, [&] { return queue_.size() < output_.queue_depth; });
+            queue_.push_back(std::move(job));
+            wake_.notify_one();
+        }
+
+        // Waits until every queued image is on disk
+        void flush() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            idle_.wait(lock, [&] { return queue_.empty() && !busy_; });
+            rethrow_error();
+        }
+
+    private:
+        void rethrow_error() {
+            if (!error_) return;
+            std::exception_ptr e = error_;
+            error_ = nullptr;
+            std::rethrow_exception(e);
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                wake_.wait(lock, [&] { return closing_ || !queue_.empty(); });
+                if (queue_.empty()) return; // closing and drained
+                ImageJob job = std::move(queue_.front());
+                queue_.pop_front();
+                busy_ = true;
+                idle_.notify_all(); // a slot is free
+                lock.unlock();
+                try {
+                    write(job);
+                } catch (...) {
+                    lock.lock();
+                    if (!error_) error_ = std::current_exception();
+                    lock.unlock();
+                }
+                lock.lock();
+                busy_ = false;
+                idle_.notify_all();
+            }
+        }
+
+        void write(const ImageJob& job) {
+            std::ostringstream saved;
+            {
+                Bytes bytes;
+                {
+                    ScopedPhase phase(*timeline_, "encode_image");
+                    switch (output_.format) {
+                        case ImageFormat::PNG: bytes = encode_png(job.ldr.data(), job.width, job.height, output_.encode_threads); break;
+                        case ImageFormat::QOI: bytes = encode_qoi(job.ldr.data(), job.width, job.height, output_.encode_threads); break;
+                        default:               bytes = encode_ppm(job.ldr.data(), job.width, job.height); break;
+                    }
+                }
+                saved << "Image saved to " << save(job.name + extension(output_.format), bytes);
+            }
+            if (wants_hdr() && !job.hdr.empty()) {
+                Bytes bytes;
+                {
+                    ScopedPhase phase(*timeline_, "encode_hdr");
+                    bytes = output_.hdr_format == ImageFormat::EXR ? encode_exr(job.hdr.data(), job.width, job.height)
+                                                                  : encode_pfm(job.hdr.data(), job.width, job.height);
+                }
+                saved << ", " << save(job.name + extension(output_.hdr_format), bytes).filename();
+            }
+            saved << "\n";
+            std::cout << saved.str(); // one write, so lines from the render thread do not split it
+        }
+
+        std::filesystem::path save(const std::string& filename, const Bytes& bytes) {
+            ScopedPhase phase(*timeline_, "write_file");
+            const std::filesystem::path filepath = directory_ / filename;
+            std::ofstream ofs(filepath, std::ios::binary);
+            if (!ofs) throw std::runtime_error("Failed to open file for writing: " + filepath.string());
+            ofs.write(reinterpret_cast<const char*>(bytes.data()), (std::streamsize)bytes.size());
+            if (!ofs) throw std::runtime_error("Failed to write " + filepath.string());
+            return filepath;
+        }
+
+        Config::Output output_;
+        std::filesystem::path directory_;
+        Timeline* timeline_ = nullptr;
+
+        std::mutex mutex_;
+        std::condition_variable wake_; // writer: a job arrived or closing
+        std::condition_variable idle_; // producers: a slot freed or the queue drained
+        std::deque<ImageJob> queue_;
+        bool busy_ = false, closing_ = false;
+        std::exception_ptr error_;
+        std::thread thread_; // started by the first submit()
+    };
+
+}
+
+#endif // IMAGEIO_HPP
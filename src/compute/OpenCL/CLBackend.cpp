@@ -3,6 +3,10 @@
 #include "CLBackend.hpp"
 #include "CLUtils.hpp"
 
+#include <chrono>
+#include <cstring>
+#include <numeric>
+
 namespace compute {
 
     void CLBackend::initialize(const Config& config) {
@@ -11,22 +15,96 @@ namespace compute {
             select_platform(config_.cl.platform_index); // Select the first platform
             print_platform_info();
 
-            select_device(config_.cl.device_index, CL_DEVICE_TYPE_GPU); // Select the first GPU device
+            // Select the first GPU device; with multi_device any device may hold the framebuffer
+            select_device(config_.cl.device_index, config_.cl.multi_device ? CL_DEVICE_TYPE_ALL : CL_DEVICE_TYPE_GPU);
             print_device_info();
 
             context_ = cl::Context(device_);
-            queue_ = cl::CommandQueue(context_, device_);
+            // profiling can slow some drivers' enqueues, so the queue only has it with the timeline on
+            timeline_.enable(config_.profile.timeline);
+            events_.enable(config_.profile.timeline ? &timeline_ : nullptr);
+            queue_ = cl::CommandQueue(context_, device_, config_.profile.timeline ? CL_QUEUE_PROFILING_ENABLE : 0);
+            writer_.configure(config_.output, timeline_);
+
+            const bool shared_memory = device_.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() ||
+                                       (device_.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU);
+            gpu_scene_.host_flags = shared_memory ? CL_MEM_ALLOC_HOST_PTR : 0;
 
             std::string kernel_dir = clutils::find_directory("kernels");
-            std::vector<std::string> src = clutils::read_kernel_sources_from_dir(kernel_dir);
+            kernel_sources_ = clutils::read_kernel_sources_from_dir(kernel_dir);
 
-            for (const auto& k : src) {
+            for (const auto& k : kernel_sources_) {
                 if (k.empty()) {
                     throw std::runtime_error("Failed to read kernel: " + k);
                 }
             }
 
-            build_program(src, config_.cl.build_options);
+            std::string build_options = config_.cl.build_options;
+            if (config_.geometry.compressed_spheres) {
+                if (config_.bvh.builder == BvhBuilder::DeviceLBVH) {
+                    throw std::runtime_error("Compressed spheres need the host-built BVH.");
+                }
+                build_options += " -D COMPRESSED_SPHERES";
+            }
+            if (config_.render.lane_stats) {
+                build_options += " -D LANE_STATS";
+            }
+            if (config_.render.ray_stats) {
+                build_options += " -D RAY_STATS";
+            }
+            build_options_ = build_options;
+            variants_.clear();
+
+            if (config_.cl.multi_device) {
+                if (config_.bvh.builder == BvhBuilder::DeviceLBVH) {
+                    throw std::runtime_error("Multi-device rendering needs the host-built BVH.");
+                }
+                multi_device_.initialize(MultiDeviceTracer::select_devices(platform_, config_.cl), kernel_sources_,
+                                         config_.cl.program_cache_dir);
+            }
+            packed_source_ = nullptr;
+            // Compile (or load the cached binary) off the calling thread: the caller builds its scene
+            // meanwhile, and render() only waits for whatever compile time is left
+            kernels_ready_ = false;
+            program_future_ = std::async(std::launch::async, [this, build_options]() {
+                ScopedPhase phase(timeline_, "build_program");
+                return load_or_build_program(kernel_sources_, build_options);
+            });
+
+        } catch (const cl::Error& e) {
+            std::cerr << "OpenCL Error: " << e.what() << " : " << e.err() << "\n";
+            throw;
+        } catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            throw;
+        }
+    }
+
+    void CLBackend::finish_initialize() {
+        if (kernels_ready_) return;
+        if (!program_future_.valid()) {
+            throw std::runtime_error("OpenCL backend not initialized.");
+        }
+
+        try {
+            auto start = std::chrono::high_resolution_clock::now();
+            program_ = program_future_.get();
+            auto end = std::chrono::high_resolution_clock::now();
+            std::cout << program_status_ << ", waited "
+                      << std::chrono::duration<double, std::milli>(end - start).count() << " ms for it\n";
+
+            if (config_.bvh.builder == BvhBuilder::DeviceLBVH) {
+                lbvh_.initialize(context_, device_, program_, events_);
+            }
+
+            kernel_ = cl::Kernel(program_, "render");
+            persistent_kernel_ = cl::Kernel(program_, "render_persistent");
+            compact_kernel_ = cl::Kernel(program_, "compact_active");
+            tonemap_kernel_ = cl::Kernel(program_, "tonemap");
+            wavefront_.initialize(context_, program_, events_, variant_material_mask(std::string()));
+            variants_[""] = program_;
+            variant_key_.clear();
+            kernels_ready_ = true;
 
         } catch (const cl::Error& e) {
             std::cerr << "OpenCL Error: " << e.what() << " : " << e.err() << "\n";
@@ -38,48 +116,654 @@ namespace compute {
     }
 
     void CLBackend::render(const Camera& cam, const Scene& scene) {
+        stop_requested_ = false;
+        if (trace_frame(cam, scene, config_.render.seed, "rednerer4", gpu_scene_.out_rgb)) {
+            const auto start = std::chrono::high_resolution_clock::now();
+            resolve_image(cam.get_image_width(), cam.get_image_height(), "rednerer4", gpu_scene_.out_rgb);
+            frame_stats_.readback_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        events_.flush();
+        export_timeline(config_.profile.trace_file);
+    }
+
+    void CLBackend::render_sequence(const std::vector<Camera>& cameras, const Scene& scene, const std::string& name) {
+        stop_requested_ = false;
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // Two display images alternate: while frame N traces, frame N-1 is mapped and copied out on a worker
+        // thread and queued on writer_. The worker is joined before its image is tone mapped into again,
+        // two frames later. Frame N's previews use frame N's image, never the one the worker has mapped.
+        // Packing is not run ahead as on the CPU backend: the scene is fixed for the sequence, so after the
+        // first frame trace_frame only repacks the camera into packed_ (repack_edits), which the
+        // in-flight uploads of the previous frame would otherwise race with.
+        cl::Buffer* images[2] = { &gpu_scene_.out_rgb, &gpu_scene_.out_rgb_back };
+        std::future<void> writer;
+        size_t frames = 0;
+        for (size_t i = 0; i < cameras.size() && !stop_requested_; ++i) {
+            const size_t W = cameras[i].get_image_width();
+            const size_t H = cameras[i].get_image_height();
+            const std::string filename = image::frame_filename(name, i);
+            cl::Buffer& out = *images[i % 2];
+            if (W > 0 && H > 0) {
+                ensure(context_, gpu_scene_.out_rgb_back, W * H * sizeof(cl_uchar4), CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
+                       gpu_scene_.out_rgb_back_bytes);
+            }
+            if (!trace_frame(cameras[i], scene, config_.render.seed + uint32_t(i), filename, out)) continue;
+
+            // the accumulation is read before the next frame's passes overwrite it (in-order queue)
+            std::vector<cl_float4> hdr;
+            cl::Event hdr_read;
+            if (writer_.wants_hdr()) {
+                hdr.resize(W * H);
+                queue_.enqueueReadBuffer(gpu_scene_.accum, CL_FALSE, 0, W * H * sizeof(cl_float4), hdr.data(), nullptr, &hdr_read);
+                events_.record("read_accum", hdr_read);
+            }
+            cl::Event mapped;
+            const cl_uchar4* pixels = map_image(W, H, out, mapped);
+
+            if (writer.valid()) writer.get(); // frame N-1, which used the other image
+            // the worker holds its own handle: a later resize may replace the member, not this mapping
+            writer = std::async(std::launch::async, [this, out, mapped, pixels, hdr_read, hdr = std::move(hdr),
+                                                     filename, W, H]() mutable {
+                image::ImageJob job{ filename, (int)W, (int)H, {}, std::move(hdr) };
+                mapped.wait();
+                job.ldr.assign(pixels, pixels + W * H);
+                queue_.enqueueUnmapMemObject(out, const_cast<cl_uchar4*>(pixels));
+                if (hdr_read()) hdr_read.wait();
+                writer_.submit(std::move(job));
+            });
+            ++frames;
+        }
+        if (writer.valid()) writer.get();
+        writer_.flush(); // the frame rate includes getting every frame to disk
+        events_.flush();
+
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "Sequence: " << frames << " of " << cameras.size() << " frames in " << seconds << " s, "
+                  << (seconds > 0.0 ? double(frames) / seconds : 0.0) << " frames/s\n";
+        export_timeline(config_.profile.trace_file);
+    }
+
+    bool CLBackend::trace_frame(const Camera& cam, const Scene& scene, uint32_t frame_seed, const std::string& image_name,
+                                cl::Buffer& preview_image) {
         const size_t W = static_cast<size_t>(cam.get_image_width());
         const size_t H = static_cast<size_t>(cam.get_image_height());
         const size_t N = W * H;
 
-        if (W <= 0 || H <= 0) return;
-        if (N > (std::numeric_limits<size_t>::max() / sizeof(cl_uchar4)))
+        if (W <= 0 || H <= 0) return false;
+        if (N > (std::numeric_limits<size_t>::max() / sizeof(cl_float4)))
             throw std::runtime_error("Image too large");
 
-        serialize::PackedScene pscene = serialize::pack_scene(scene, cam);
-        upload_scene(context_, queue_, pscene, gpu_scene_);
-        ensure_output(context_, gpu_scene_, W, H);
+        const bool device_bvh = config_.bvh.builder == BvhBuilder::DeviceLBVH;
+
+        serialize::BvhBuildOptions bvh_opt;
+        bvh_opt.sah_bins      = config_.bvh.sah_bins;
+        bvh_opt.max_leaf_size = config_.bvh.max_leaf_size;
+        bvh_opt.enabled       = !device_bvh;
+
+        // each stage runs from the end of the previous one; it also becomes a timeline phase
+        frame_stats_ = FrameStats{};
+        auto stage_start = std::chrono::high_resolution_clock::now();
+        auto stage_ms = [this, &stage_start](const char* phase) {
+            const auto now = std::chrono::high_resolution_clock::now();
+            const double ms = std::chrono::duration<double, std::milli>(now - stage_start).count();
+            stage_start = now;
+            if (timeline_.enabled()) {
+                const double end_us = timeline_.now_us();
+                timeline_.add_host(phase, end_us - ms * 1e3, end_us);
+            }
+            return ms;
+        };
+
+        // the same Scene with only element edits since the last render: repack and upload just those.
+        // Multi-device renders send every device the whole scene, so they always repack it
+        serialize::SceneEdits edits;
+        const bool multi_device = multi_device_.active();
+        region_scene_id_ = 0; // the device buffers are about to hold this scene instead
+        const bool incremental = !multi_device && can_update_incrementally(scene);
+        if (incremental) {
+            edits = serialize::repack_edits(packed_, scene, cam);
+        } else {
+            packed_ = serialize::pack_scene(scene, cam, bvh_opt, config_.geometry.compressed_spheres);
+            packed_source_ = &scene;
+            serialize::print_compression_stats(packed_);
+            serialize::print_instance_stats(packed_);
+            serialize::print_mesh_stats(packed_);
+        }
+        const serialize::PackedScene& pscene = packed_;
+        frame_stats_.pack_ms = stage_ms("pack_scene");
+        finish_initialize(); // the program build has been overlapping everything up to here
+
+        const int total_spp = std::max(1, cam.get_samples_per_pixel());
+        const int pass_spp  = std::max(1, config_.render.samples_per_pass);
+        const cl_int max_bounces = std::max(0, cam.get_max_depth());
+        const std::string defines = specialization_defines(max_bounces, pscene, total_spp, pass_spp, config_.render.sampler);
+        if (multi_device) {
+            // the wavefront, persistent and adaptive paths are single-device; tiles use the megakernel
+            multi_device_.use_variant(build_options_ + defines);
+            stage_ms("compile");
+            multi_device_.upload(pscene);
+            ensure_output(context_, gpu_scene_, W, H);
+            frame_stats_.upload_ms = stage_ms("upload");
+
+            std::vector<cl_float4> accum;
+            const auto result = multi_device_.trace_frame(W, H, pscene, scene.get_materials_count(), total_spp, pass_spp,
+                                                          max_bounces, (cl_uint)frame_seed, config_.cl.tile_rows,
+                                                          stop_requested_, timeline_, accum);
+            // the merged framebuffer goes to device_, which tone maps it like a single-device render
+            queue_.enqueueWriteBuffer(gpu_scene_.accum, CL_TRUE, 0, N * sizeof(cl_float4), accum.data(), nullptr,
+                                      events_.next("write"));
+            frame_stats_.kernel_ms = stage_ms("passes");
+            frame_stats_.samples   = result.samples;
+            if (config_.render.ray_stats) {
+                frame_stats_.rays = result.ray_stats.c[clutils::RayStatsCounters::SEGMENTS];
+                result.ray_stats.print(std::cout, frame_stats_.kernel_ms, max_bounces, sphere_test_bytes(defines));
+            }
+            return true;
+        }
+        use_variant(defines);
+        stage_ms("compile"); // build waits are not upload time
+
+        // every upload below is asynchronous and reads packed_ and all_pixels in place; the queue is
+        // drained after the passes, so both outlive the writes even when no pass runs
+        std::vector<cl::Event> upload_events;
+        if (incremental) {
+            upload_edits(edits, bvh_opt, upload_events);
+        } else if (device_bvh) {
+            update_scene_lbvh(pscene, upload_events);
+        } else {
+            serialize::print_bvh_stats("Sphere BVH", pscene.bvh_stats);
+            upload_scene(context_, queue_, pscene, gpu_scene_, upload_events);
+        }
 
-        // get real rundom number
-        cl_float randomseed = clutils::get_random();
+        if (pscene.mesh_sources != resident_meshes_) {
+            upload_meshes(context_, queue_, pscene, gpu_scene_, upload_events);
+            resident_meshes_ = pscene.mesh_sources;
+        } else if (!incremental) {
+            // geometry is resident; material indices may still have moved
+            write_async(queue_, gpu_scene_.meshes, pscene.meshes, upload_events);
+        }
+        ensure_output(context_, gpu_scene_, W, H);
 
-        cl_int s_count = scene.get_spheres_count();
         cl_int m_count = scene.get_materials_count();
 
-        // Kernel: __kernel void render(const int height, const int width, __global uchar4* C)
-        kernel_ = cl::Kernel(program_, "render");
-        kernel_.setArg(0, W);
-        kernel_.setArg(1, H);
-        kernel_.setArg(2, gpu_scene_.camera);
-        kernel_.setArg(3, gpu_scene_.spheres); 
-        kernel_.setArg(4, s_count);
-        kernel_.setArg(5, gpu_scene_.materials);
-        kernel_.setArg(6, m_count);
-        kernel_.setArg(7, randomseed);
-        kernel_.setArg(8, gpu_scene_.out_rgb);
-
-        // One work-item per pixel (x = 0..W-1, y = 0..H-1)
-        cl::NDRange global(W, H);
-        queue_.enqueueNDRangeKernel(kernel_, cl::NullRange, global, cl::NullRange);
+        // Kernel: __kernel void render(int width, int height, camera, spheres, sphere_geom, sphere_count, bvh_nodes, bvh_prims,
+        //                             spheres_q, sphere_palette, planes, plane_count, boxes, box_count,
+        //                             meshes, mesh_count, mesh_nodes, triangles, mesh_positions,
+        //                             instances, instance_count, inst_nodes, inst_prims, materials, material_count,
+        //                             frame_seed, sample_index, pass_spp, accum, lum_sq, active_pixels, active_count,
+        //                             lane_stats, max_bounces, ray_stats)
+        // render_persistent takes the same arguments with work_counter before max_bounces
+        // scene arguments 0..24 are shared by both megakernels and the wavefront extend stage
+        for (cl::Kernel* k : { &kernel_, &persistent_kernel_, &wavefront_.extend_kernel() }) {
+            bind_scene_args(*k, gpu_scene_, pscene, W, H, m_count);
+        }
+        for (cl::Kernel* k : { &kernel_, &persistent_kernel_ }) {
+            k->setArg(25, (cl_uint)frame_seed);
+            k->setArg(28, gpu_scene_.accum);
+            k->setArg(29, gpu_scene_.lum_sq);
+            k->setArg(32, gpu_scene_.lane_stats);
+        }
+        kernel_.setArg(33, max_bounces);
+        kernel_.setArg(34, gpu_scene_.ray_stats);
+        persistent_kernel_.setArg(33, gpu_scene_.work_counter);
+        persistent_kernel_.setArg(34, max_bounces);
+        persistent_kernel_.setArg(35, gpu_scene_.ray_stats);
+        wavefront_.extend_kernel().setArg(WavefrontTracer::RAY_STATS_ARG, gpu_scene_.ray_stats);
+
+        const cl_float4 zero = {{0.0f, 0.0f, 0.0f, 0.0f}};
+        queue_.enqueueFillBuffer(gpu_scene_.accum, zero, 0, N * sizeof(cl_float4), nullptr, events_.next("fill"));
+        queue_.enqueueFillBuffer(gpu_scene_.lum_sq, 0.0f, 0, N * sizeof(cl_float), nullptr, events_.next("fill"));
+        if (config_.render.ray_stats) {
+            const cl_uint zero_count = 0;
+            queue_.enqueueFillBuffer(gpu_scene_.ray_stats, zero_count, 0, 2 * clutils::RayStatsCounters::COUNT * sizeof(cl_uint),
+                                     nullptr, events_.next("fill"));
+        }
+
+        // every pixel starts active; adaptive sampling shrinks the list as pixels converge
+        std::vector<cl_uint> all_pixels(N);
+        std::iota(all_pixels.begin(), all_pixels.end(), 0u);
+        write_async(queue_, gpu_scene_.active, all_pixels, upload_events);
+
+        // the first pass depends on the whole upload; the host does not wait for it here
+        events_.record("write", upload_events);
+        queue_.enqueueBarrierWithWaitList(&upload_events);
+        if (config_.render.stage_timing) queue_.finish();
+        frame_stats_.upload_ms = stage_ms("upload");
+
+        // Progressive passes: each launch adds a few samples per pixel, so no single launch runs long
+        // enough to trip a driver watchdog and a stop request is honoured between passes
+        const bool adaptive = config_.render.adaptive_threshold > 0.0f;
+        const bool wavefront = config_.render.trace_mode == TraceMode::Wavefront;
+        const bool persistent = config_.render.trace_mode == TraceMode::Persistent;
+        const bool lane_stats = config_.render.lane_stats && !wavefront;
+        cl_ulong lane_steps = 0, lane_slots = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        double converged_ms = -1.0;
+
+        int done = 0, passes = 0;
+        cl_uint active = (cl_uint)N;
+        size_t traced = 0;
+        while (done < total_spp && active > 0 && !stop_requested_) {
+            const int spp = std::min(pass_spp, total_spp - done);
+            if (wavefront) {
+                wavefront_.trace_pass(queue_, (int)W, gpu_scene_.camera, gpu_scene_.materials, (cl_uint)frame_seed,
+                                      gpu_scene_.active, active, (cl_uint)done, spp, max_bounces, gpu_scene_.accum, gpu_scene_.lum_sq);
+            } else {
+                cl::Kernel& k = persistent ? persistent_kernel_ : kernel_;
+                k.setArg(26, (cl_uint)done);
+                k.setArg(27, (cl_int)spp);
+                k.setArg(30, gpu_scene_.active);
+                k.setArg(31, (cl_int)active);
+                if (lane_stats) {
+                    const cl_uint zero = 0;
+                    queue_.enqueueFillBuffer(gpu_scene_.lane_stats, zero, 0, 2 * sizeof(cl_uint), nullptr, events_.next("fill"));
+                }
+                if (persistent) {
+                    const cl_uint zero = 0;
+                    queue_.enqueueFillBuffer(gpu_scene_.work_counter, zero, 0, sizeof(cl_uint), nullptr, events_.next("fill"));
+                    size_t local = 0;
+                    const size_t items = persistent_items(active, local);
+                    queue_.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange(items), cl::NDRange(local),
+                                                nullptr, events_.next("render_persistent"));
+                } else {
+                    // one work-item per active pixel; with adaptive sampling off that is every pixel, every pass
+                    queue_.enqueueNDRangeKernel(k, cl::NullRange, cl::NDRange(active), cl::NullRange, nullptr, events_.next("render"));
+                }
+                if (lane_stats) {
+                    // per-pass uint counters cannot overflow; the totals are kept in 64 bits
+                    cl_uint counts[2] = {0, 0};
+                    queue_.enqueueReadBuffer(gpu_scene_.lane_stats, CL_TRUE, 0, sizeof(counts), counts, nullptr, events_.next("read"));
+                    lane_steps += counts[0];
+                    lane_slots += counts[1];
+                }
+            }
+            traced += size_t(active) * size_t(spp);
+            done += spp;
+            ++passes;
+
+            if (adaptive && done >= config_.render.adaptive_min_spp) {
+                active = compact_active(active);
+                if (active == 0) {
+                    converged_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                }
+            }
+            queue_.finish();
+
+            if (config_.render.preview_interval > 0 && passes % config_.render.preview_interval == 0 && done < total_spp && active > 0) {
+                resolve_image(W, H, image_name, preview_image);
+            }
+        }
+        // a stop requested before the first pass leaves the uploads in flight: all_pixels is about to
+        // go out of scope, and the next frame's repack would overwrite packed_ under them
         queue_.finish();
 
-        // Read back
-        std::vector<cl_uchar4> output(N);
-        queue_.enqueueReadBuffer(gpu_scene_.out_rgb, CL_TRUE, 0, N*sizeof(cl_uchar4), output.data());
+        const double render_ms = stage_ms("passes");
+        events_.flush();
+        frame_stats_.kernel_ms = render_ms;
+        frame_stats_.samples   = traced;
+        frame_stats_.rays      = lane_stats ? lane_steps : 0;
+        if (config_.render.ray_stats) {
+            // 64-bit on the device, so one read after the last pass covers the whole render
+            std::vector<cl_uint> words(2 * clutils::RayStatsCounters::COUNT);
+            queue_.enqueueReadBuffer(gpu_scene_.ray_stats, CL_TRUE, 0, words.size() * sizeof(cl_uint), words.data(),
+                                     nullptr, events_.next("read"));
+            const auto ray_stats = clutils::RayStatsCounters::from_words(words);
+            frame_stats_.rays = ray_stats.c[clutils::RayStatsCounters::SEGMENTS];
+            ray_stats.print(std::cout, render_ms, max_bounces, sphere_test_bytes(variant_key_));
+        }
+        const char* mode = wavefront ? "wavefront" : persistent ? "persistent" : "megakernel";
+        std::cout << "Progressive render (" << mode << "): " << done << " of " << total_spp << " spp in " << passes
+                  << " passes, " << render_ms << " ms, " << double(traced) / (render_ms * 1e3) << " Msamples/s\n";
+        if (lane_stats && lane_slots > 0) {
+            std::cout << "Lane utilization (" << mode << "): " << 100.0 * double(lane_steps) / double(lane_slots)
+                      << "% of lane slots busy, " << double(lane_steps) / (render_ms * 1e3) << " M bounces/s\n";
+        }
+        if (adaptive) {
+            const size_t budget = N * size_t(total_spp);
+            std::cout << "Adaptive sampling: " << traced << " of " << budget << " samples traced ("
+                      << 100.0 * double(budget - traced) / double(budget) << "% saved), ";
+            if (converged_ms >= 0.0) std::cout << "all pixels below threshold after " << converged_ms << " ms\n";
+            else                     std::cout << active << " pixels still above threshold\n";
+        }
+        return true;
+    }
 
-        // Save / use output (example loop)
-        save_image("rednerer4.ppm", output, W, H);
+    void CLBackend::render_region(const serialize::PackedScene& ps, const RegionTask& task, std::vector<cl_float4>& accum) {
+        if (task.width <= 0 || task.y0 < 0 || task.y1 > task.height || task.y0 >= task.y1) {
+            throw std::runtime_error("Invalid render region.");
+        }
+        finish_initialize();
+
+        // always the megakernel on device_, also with multi_device: a worker process is one unit of the
+        // distributed render, and the coordinator spreads tiles over processes instead
+        const int pass_spp = std::max(1, task.pass_spp);
+        const cl_int max_bounces = std::max(0, task.max_bounces);
+        use_variant(specialization_defines(max_bounces, ps, task.sample_count, pass_spp, task.sampler));
+
+        std::vector<cl::Event> upload_events;
+        if (task.scene_id == 0 || task.scene_id != region_scene_id_) {
+            // a shipped scene: host BVH, no source objects to track edits or meshes by
+            upload_scene(context_, queue_, ps, gpu_scene_, upload_events);
+            upload_meshes(context_, queue_, ps, gpu_scene_, upload_events);
+            packed_source_ = nullptr;
+            resident_meshes_.clear();
+            scene_resident_ = false;
+            region_scene_id_ = task.scene_id;
+        }
 
+        // full-size buffers and an identity pixel list, so the band is a global-offset launch over its rows
+        const size_t W = size_t(task.width), H = size_t(task.height);
+        const size_t first = size_t(task.y0) * W;
+        const size_t end   = size_t(task.y1) * W;
+        ensure_output(context_, gpu_scene_, (int)W, (int)H);
+        std::vector<cl_uint> pixels(end - first);
+        std::iota(pixels.begin(), pixels.end(), cl_uint(first));
+        queue_.enqueueWriteBuffer(gpu_scene_.active, CL_FALSE, first * sizeof(cl_uint), pixels.size() * sizeof(cl_uint),
+                                  pixels.data(), nullptr, events_.next("write"));
+        const cl_float4 zero = {{0.0f, 0.0f, 0.0f, 0.0f}};
+        queue_.enqueueFillBuffer(gpu_scene_.accum, zero, first * sizeof(cl_float4), (end - first) * sizeof(cl_float4),
+                                 nullptr, events_.next("fill"));
+        queue_.enqueueFillBuffer(gpu_scene_.lum_sq, 0.0f, first * sizeof(cl_float), (end - first) * sizeof(cl_float),
+                                 nullptr, events_.next("fill"));
+        events_.record("write", upload_events);
+        queue_.enqueueBarrierWithWaitList(&upload_events);
+
+        bind_scene_args(kernel_, gpu_scene_, ps, W, H, (cl_int)ps.materials.size());
+        kernel_.setArg(25, (cl_uint)task.frame_seed);
+        kernel_.setArg(28, gpu_scene_.accum);
+        kernel_.setArg(29, gpu_scene_.lum_sq);
+        kernel_.setArg(30, gpu_scene_.active);
+        kernel_.setArg(31, (cl_int)end); // active_count: gid runs from `first` up to here
+        kernel_.setArg(32, gpu_scene_.lane_stats);
+        kernel_.setArg(33, max_bounces);
+        kernel_.setArg(34, gpu_scene_.ray_stats);
+
+        for (int done = 0; done < task.sample_count; ) {
+            const int spp = std::min(pass_spp, task.sample_count - done);
+            kernel_.setArg(26, (cl_uint)(task.first_sample + done));
+            kernel_.setArg(27, (cl_int)spp);
+            queue_.enqueueNDRangeKernel(kernel_, cl::NDRange(first), cl::NDRange(end - first), cl::NullRange,
+                                        nullptr, events_.next("render"));
+            queue_.finish();
+            done += spp;
+        }
+
+        accum.resize(end - first);
+        queue_.enqueueReadBuffer(gpu_scene_.accum, CL_TRUE, first * sizeof(cl_float4), accum.size() * sizeof(cl_float4),
+                                 accum.data(), nullptr, events_.next("read"));
+        events_.flush();
+    }
+
+    std::string CLBackend::specialization_defines(int max_bounces, const serialize::PackedScene& ps,
+                                                  int total_spp, int pass_spp, SamplerType sampler) const {
+        // camera and materials live in __constant memory unless the materials outgrow it; this one
+        // is not an optimization but a limit, so it applies to generic programs too. The sampler
+        // changes the image, so it is not optional either. Multi-device variants are built for every
+        // device, so the smallest constant buffer decides
+        size_t constant_bytes = device_.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>();
+        if (multi_device_.active()) constant_bytes = std::min(constant_bytes, multi_device_.min_constant_buffer_size());
+        const bool materials_in_global = ps.materials.size() * sizeof(serialize::MaterialGpu) > constant_bytes;
+        std::string required;
+        if (materials_in_global) required += " -D MATERIALS_IN_GLOBAL";
+        if (sampler == SamplerType::Sobol) required += " -D SAMPLER_SOBOL";
+        if (!config_.cl.specialize_kernels) return required;
+
+        constexpr int SMALL_SCENE_SPHERES = 32; // above this the sphere BVH wins over testing every sphere
+
+        unsigned material_mask = 0;
+        for (const auto& m : ps.materials) {
+            if (m.type >= 0 && m.type < MAT_TYPE_COUNT) material_mask |= 1u << m.type;
+        }
+
+        std::ostringstream defines;
+        defines << required << " -D MAX_BOUNCES=" << std::max(0, max_bounces)
+                << " -D MATERIAL_MASK=" << material_mask;
+        // only when every pass has the same length; otherwise the last one would be short
+        if (total_spp % pass_spp == 0) {
+            defines << " -D PASS_SPP=" << pass_spp;
+        }
+        if (!config_.geometry.compressed_spheres && ps.world_sphere_count <= SMALL_SCENE_SPHERES) {
+            defines << " -D SMALL_SCENE_SPHERES=" << ps.world_sphere_count;
+        }
+        return defines.str();
+    }
+
+    size_t CLBackend::sphere_test_bytes(const std::string& defines) const {
+        if (defines.find(" -D SMALL_SCENE_SPHERES=") != std::string::npos) return 0; // staged in local memory
+        return config_.geometry.compressed_spheres ? sizeof(serialize::SphereQGpu) : sizeof(cl_float4);
+    }
+
+    unsigned CLBackend::variant_material_mask(const std::string& defines) {
+        static const std::string key = " -D MATERIAL_MASK=";
+        const size_t at = defines.find(key);
+        if (at == std::string::npos) return (1u << MAT_TYPE_COUNT) - 1;
+        return (unsigned)std::stoul(defines.substr(at + key.size()));
+    }
+
+    void CLBackend::use_variant(const std::string& defines) {
+        if (defines == variant_key_) return;
+
+        auto it = variants_.find(defines);
+        if (it == variants_.end()) {
+            // synchronous: the render needs it now; the disk cache still makes repeats cheap
+            ScopedPhase phase(timeline_, "build_variant");
+            cl::Program program = load_or_build_program(kernel_sources_, build_options_ + defines);
+            std::cout << "Kernel variant" << (defines.empty() ? " (generic)" : defines) << "\n  "
+                      << program_status_ << "\n";
+            it = variants_.emplace(defines, std::move(program)).first;
+        } else {
+            std::cout << "Kernel variant" << (defines.empty() ? " (generic)" : defines) << ": reused\n";
+        }
+
+        kernel_ = cl::Kernel(it->second, "render");
+        persistent_kernel_ = cl::Kernel(it->second, "render_persistent");
+        wavefront_.initialize(context_, it->second, events_, variant_material_mask(defines));
+        variant_key_ = defines;
+    }
+
+    size_t CLBackend::persistent_items(cl_uint active_count, size_t& local) const {
+        const size_t max_local = persistent_kernel_.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device_);
+        const size_t multiple  = persistent_kernel_.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device_);
+        local = std::max<size_t>(1, std::min(max_local, multiple * 2)); // a couple of SIMD widths per group
+
+        const size_t units  = device_.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        const size_t groups = std::max<size_t>(1, units * size_t(std::max(1, config_.render.persistent_groups_per_cu)));
+        // no point launching more groups than there are pixels to hand out
+        const size_t needed = (size_t(active_count) + local - 1) / local;
+        return std::min(groups, needed) * local;
+    }
+
+    cl_uint CLBackend::compact_active(cl_uint active_count) {
+        const cl_uint zero = 0;
+        queue_.enqueueWriteBuffer(gpu_scene_.active_count, CL_FALSE, 0, sizeof(cl_uint), &zero, nullptr, events_.next("write"));
+
+        compact_kernel_.setArg(0, gpu_scene_.accum);
+        compact_kernel_.setArg(1, gpu_scene_.lum_sq);
+        compact_kernel_.setArg(2, gpu_scene_.active);
+        compact_kernel_.setArg(3, (cl_int)active_count);
+        compact_kernel_.setArg(4, (cl_float)config_.render.adaptive_threshold);
+        compact_kernel_.setArg(5, (cl_int)config_.render.adaptive_min_spp);
+        compact_kernel_.setArg(6, gpu_scene_.active_next);
+        compact_kernel_.setArg(7, gpu_scene_.active_count);
+        queue_.enqueueNDRangeKernel(compact_kernel_, cl::NullRange, cl::NDRange(active_count), cl::NullRange,
+                                    nullptr, events_.next("compact_active"));
+
+        cl_uint remaining = 0;
+        queue_.enqueueReadBuffer(gpu_scene_.active_count, CL_TRUE, 0, sizeof(cl_uint), &remaining, nullptr, events_.next("read"));
+        std::swap(gpu_scene_.active, gpu_scene_.active_next);
+        std::swap(gpu_scene_.active_bytes, gpu_scene_.active_next_bytes);
+        return remaining;
+    }
+
+    const cl_uchar4* CLBackend::map_image(size_t width, size_t height, cl::Buffer& out, cl::Event& mapped) {
+        const size_t N = width * height;
+        tonemap_kernel_.setArg(0, (cl_int)width);
+        tonemap_kernel_.setArg(1, (cl_int)height);
+        tonemap_kernel_.setArg(2, gpu_scene_.accum);
+        tonemap_kernel_.setArg(3, out);
+        cl::Event tonemapped;
+        queue_.enqueueNDRangeKernel(tonemap_kernel_, cl::NullRange, cl::NDRange(width, height), cl::NullRange,
+                                    nullptr, &tonemapped);
+
+        // Map the pinned image instead of reading it into a copy: on shared-memory devices this is the
+        // kernel's own output, on discrete GPUs one DMA transfer
+        const std::vector<cl::Event> deps = { tonemapped };
+        const void* pixels = queue_.enqueueMapBuffer(out, CL_FALSE, CL_MAP_READ, 0, N * sizeof(cl_uchar4), &deps, &mapped);
+        events_.record("tonemap", tonemapped);
+        events_.record("map", mapped);
+        return static_cast<const cl_uchar4*>(pixels);
+    }
+
+    void CLBackend::resolve_image(size_t width, size_t height, const std::string& filename, cl::Buffer& out) {
+        const size_t N = width * height;
+        image::ImageJob job{ filename, (int)width, (int)height, {}, {} };
+        {
+            ScopedPhase phase(timeline_, "readback");
+            cl::Event hdr_read;
+            if (writer_.wants_hdr()) {
+                job.hdr.resize(N);
+                queue_.enqueueReadBuffer(gpu_scene_.accum, CL_FALSE, 0, N * sizeof(cl_float4), job.hdr.data(), nullptr, &hdr_read);
+                events_.record("read_accum", hdr_read);
+            }
+            cl::Event mapped;
+            const cl_uchar4* pixels = map_image(width, height, out, mapped);
+            mapped.wait();
+            // the writer owns its copy, so the image can be tone mapped into again right away
+            job.ldr.assign(pixels, pixels + N);
+            queue_.enqueueUnmapMemObject(out, const_cast<cl_uchar4*>(pixels));
+            if (hdr_read()) hdr_read.wait();
+        }
+        writer_.submit(std::move(job));
+    }
+
+    bool CLBackend::can_update_incrementally(const Scene& scene) const {
+        if (packed_source_ != &scene || scene.structure_revision() > packed_.revision) return false;
+        // compression moves the world spheres into spheres_q and zeroes world_sphere_count
+        const size_t world_spheres = config_.geometry.compressed_spheres ? packed_.spheres_q.size()
+                                                                          : size_t(packed_.world_sphere_count);
+        if (size_t(scene.get_spheres_count()) != world_spheres) return false; // edited without mark_changed()
+        if (config_.geometry.compressed_spheres) {
+            // quantization and palette depend on every sphere; any sphere edit needs the full packer
+            const auto& rev = scene.sphere_revisions();
+            if (std::any_of(rev.begin(), rev.end(), [&](uint64_t r) { return r > packed_.revision; })) return false;
+        }
+        return true;
+    }
+
+    void CLBackend::upload_edits(const serialize::SceneEdits& edits, const serialize::BvhBuildOptions& bvh_opt,
+                                 std::vector<cl::Event>& upload_events) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        if (edits.camera) {
+            write_async(queue_, gpu_scene_.camera, 0, sizeof(serialize::CameraGpu), &packed_.camera, upload_events);
+        }
+        size_t materials = 0;
+        for (const auto& [first, end] : edits.materials) {
+            write_async(queue_, gpu_scene_.materials, first * sizeof(serialize::MaterialGpu),
+                        (end - first) * sizeof(serialize::MaterialGpu), &packed_.materials[first], upload_events);
+            materials += end - first;
+        }
+        size_t spheres = 0;
+        for (const auto& [first, end] : edits.spheres) {
+            write_spheres(queue_, gpu_scene_, first, end - first, &packed_.spheres[first], upload_events);
+            spheres += end - first;
+        }
+
+        std::string bvh;
+        if (!edits.spheres.empty()) {
+            if (config_.bvh.builder == BvhBuilder::DeviceLBVH) {
+                for (const auto& [first, end] : edits.spheres) {
+                    std::copy(packed_.spheres.begin() + first, packed_.spheres.begin() + end, resident_spheres_.begin() + first);
+                }
+                queue_.enqueueBarrierWithWaitList(&upload_events); // the LBVH kernels read the new spheres
+                bvh = std::string(", LBVH ") + refresh_lbvh(packed_.world_sphere_count);
+            } else {
+                // the SAH leaf rule makes the node count depend on the positions; render rebinds the
+                // scene arguments after this, so regrown buffers reach the kernels
+                serialize::build_sphere_bvh(packed_, bvh_opt);
+                const cl_mem_flags rw = CL_MEM_READ_WRITE | gpu_scene_.host_flags;
+                ensure(context_, gpu_scene_.bvh_nodes, packed_.bvh_nodes.size() * sizeof(serialize::BvhNodeGpu), rw,
+                       gpu_scene_.bvh_nodes_bytes);
+                ensure(context_, gpu_scene_.bvh_prims, packed_.bvh_prims.size() * sizeof(cl_int), rw,
+                       gpu_scene_.bvh_prims_bytes);
+                write_async(queue_, gpu_scene_.bvh_nodes, packed_.bvh_nodes, upload_events);
+                write_async(queue_, gpu_scene_.bvh_prims, packed_.bvh_prims, upload_events);
+                bvh = ", BVH rebuilt";
+            }
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Scene update (incremental): " << spheres << " spheres, " << materials << " materials"
+                  << (edits.camera ? ", camera" : "") << bvh << " in "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
+    }
+
+    const char* CLBackend::refresh_lbvh(int n) {
+        // refitting keeps the old Morton order; rebuild once it has drifted for long enough
+        if (++frames_since_build_ > config_.bvh.lbvh_refit_frames) {
+            lbvh_.build(queue_, gpu_scene_.sphere_geom, n, gpu_scene_.bvh_nodes, gpu_scene_.bvh_prims);
+            frames_since_build_ = 0;
+            return "rebuilt";
+        }
+        lbvh_.refit(queue_, gpu_scene_.sphere_geom, n, gpu_scene_.bvh_nodes, gpu_scene_.bvh_prims);
+        return "refit";
+    }
+
+    void CLBackend::update_scene_lbvh(const serialize::PackedScene& ps, std::vector<cl::Event>& upload_events) {
+        // the device tree covers the world spheres; instanced groups keep their host-built BVHs
+        const int n = ps.world_sphere_count;
+        const int total = (int)ps.spheres.size();
+        auto start = std::chrono::high_resolution_clock::now();
+
+        const char* action = "unchanged";
+        if (!scene_resident_ || !lbvh_.built_for(n) || total != (int)resident_spheres_.size()) {
+            // topology changed (or first frame): full upload and rebuild
+            upload_scene(context_, queue_, ps, gpu_scene_, upload_events);
+            ensure(context_, gpu_scene_.bvh_nodes, size_t(std::max(2 * n - 1, 1)) * sizeof(serialize::BvhNodeGpu),
+                   CL_MEM_READ_WRITE, gpu_scene_.bvh_nodes_bytes);
+            ensure(context_, gpu_scene_.bvh_prims, size_t(std::max(n, 1)) * sizeof(cl_int),
+                   CL_MEM_READ_WRITE, gpu_scene_.bvh_prims_bytes);
+
+            lbvh_.build(queue_, gpu_scene_.sphere_geom, n, gpu_scene_.bvh_nodes, gpu_scene_.bvh_prims);
+            resident_spheres_ = ps.spheres;
+            scene_resident_ = true;
+            frames_since_build_ = 0;
+            action = "built";
+        } else {
+            if (!ps.materials.empty()) {
+                ensure(context_, gpu_scene_.materials, ps.materials.size() * sizeof(serialize::MaterialGpu),
+                       CL_MEM_READ_ONLY | gpu_scene_.host_flags, gpu_scene_.materials_bytes);
+                write_async(queue_, gpu_scene_.materials, ps.materials, upload_events);
+            }
+            write_async(queue_, gpu_scene_.camera, 0, sizeof(serialize::CameraGpu), &ps.camera, upload_events);
+            upload_analytic(context_, queue_, ps, gpu_scene_, upload_events);
+            upload_instances(context_, queue_, ps, gpu_scene_, upload_events);
+
+            // upload only the sphere records that moved, coalesced into contiguous ranges
+            size_t changed = 0;
+            size_t changed_world = 0;
+            for (int i = 0; i < total; ) {
+                if (std::memcmp(&ps.spheres[i], &resident_spheres_[i], sizeof(serialize::SphereGpu)) == 0) { ++i; continue; }
+                int end = i + 1;
+                while (end < total && std::memcmp(&ps.spheres[end], &resident_spheres_[end], sizeof(serialize::SphereGpu)) != 0) ++end;
+                write_spheres(queue_, gpu_scene_, i, end - i, &ps.spheres[i], upload_events);
+                std::copy(ps.spheres.begin() + i, ps.spheres.begin() + end, resident_spheres_.begin() + i);
+                changed += end - i;
+                changed_world += std::max(0, std::min(end, n) - i);
+                i = end;
+            }
+
+            if (changed_world > 0) {
+                action = refresh_lbvh(n);
+            }
+            std::cout << "Scene update: " << changed << " of " << total << " spheres uploaded\n";
+        }
+        queue_.finish();
+
+        auto end = std::chrono::high_resolution_clock::now();
+        std::cout << "Device LBVH: " << action << " for " << n << " spheres in "
+                  << std::chrono::duration<double, std::milli>(end - start).count() << " ms\n";
     }
 
     void CLBackend::select_platform(int platform_index) {
@@ -109,29 +793,18 @@ namespace compute {
         device_ = devices[device_index];
     }
 
-    std::string CLBackend::build_log() {
-        return program_.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device_);
+    std::string CLBackend::build_log(const cl::Program& program) {
+        return program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device_);
     }
 
-    void CLBackend::build_program(
-                              const std::vector<std::string>& kernel_sources, 
-                              const std::string& build_options = "") {
-        cl::Program::Sources sources;
-        for (const auto& src : kernel_sources) {
-            sources.push_back({ src.c_str(), src.length() });
-        }
-        cl::Program program(context_, sources);
-        cl_int err = program.build({device_}, build_options.c_str());
-        if (err != CL_SUCCESS) {
-            std::cerr << "Build log:\n" << build_log() << "\n";
-            throw std::runtime_error("No OpenCL platforms");
-        }
-        program_ = program;
+    cl::Program CLBackend::load_or_build_program(const std::vector<std::string>& kernel_sources,
+                                                 const std::string& build_options) {
+        return clutils::load_or_build_program(context_, device_, kernel_sources, build_options,
+                                              config_.cl.program_cache_dir, program_status_);
     }
 
 
 
-
     void CLBackend::print_platform_info() {
         if (!platform_()) {
             throw std::runtime_error("Invalid platform.");
@@ -164,27 +837,4 @@ namespace compute {
         std::cout << "|| Max memory allocation size: " << device_.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>() / (1024 * 1024) << " MB\n";
         std::cout << "//============================================\n" << std::endl;
     }
-
-
-    void CLBackend::save_image(const std::string& filename, const std::vector<cl_uchar4>& image, int width, int height) {
-        auto image_dir = clutils::find_directory("images");
-        std::filesystem::path filepath = image_dir / filename;
-        std::ofstream ofs(filepath);
-        if (!ofs) {
-            throw std::runtime_error("Failed to open file for writing: " + filepath.string());
-        }
-
-        ofs << "P6\n" << width << " " << height << "\n255\n";
-
-        // write RGB bytes
-        for (int y = 0; y < height; ++y) {
-            for (int x = 0; x < width; ++x) {
-                const cl_uchar4& p = image[y * width + x];
-                unsigned char rgb[3] = { p.s[0], p.s[1], p.s[2] };
-                ofs.write(reinterpret_cast<char*>(rgb), 3);
-            }
-        }
-        ofs.close();
-        std::cout << "Image saved to " << filepath << "\n";
-    }
 }
\ No newline at end of file
@@ -2,23 +2,21 @@
 #define CLBACKEND_HPP
 
 
-#define CL_HPP_TARGET_OPENCL_VERSION  120
-#define CL_HPP_MINIMUM_OPENCL_VERSION 120
-
-
-#define CL_HPP_ENABLE_EXCEPTIONS
-
-
-#ifdef __APPLE__
-#define CL_SILENCE_DEPRECATION
-#endif
-
-#include <CL/opencl.hpp> 
+#include "CLHeaders.hpp"
 #include <fstream>
+#include <future>
 #include <sstream>
+#include <unordered_map>
 #include "CLUtils.hpp"
+#include "CLProgramCache.hpp"
 #include "Backend.hpp"
 #include "Serialize.hpp"
+#include "ImageIO.hpp"
+#include "CLEventLog.hpp"
+#include "CLRayStats.hpp"
+#include "CLLbvh.hpp"
+#include "CLWavefront.hpp"
+#include "CLMultiDevice.hpp"
 
 
 
@@ -26,12 +24,32 @@ namespace compute {
 
     struct GpuSceneBuffers {
     // device buffers (owned, grown on demand)
-    cl::Buffer spheres, materials, camera;
-    cl::Buffer out_rgb;
+    cl::Buffer spheres, sphere_geom, materials, camera; // sphere_geom: center_r of each sphere record
+    cl::Buffer bvh_nodes, bvh_prims;
+    cl::Buffer spheres_q, sphere_palette;
+    cl::Buffer planes, boxes;
+    cl::Buffer meshes, mesh_nodes, triangles, mesh_positions;
+    cl::Buffer instances, inst_nodes, inst_prims;
+    cl::Buffer accum, out_rgb, out_rgb_back; // out_rgb_back: second display image while a sequence writes the first
+    cl::Buffer lum_sq, active, active_next, active_count;
+    cl::Buffer lane_stats, work_counter, ray_stats;
 
     // sizes cached for ensure()
-    size_t spheres_bytes = 0, materials_bytes = 0,
-           camera_bytes = 0, out_rgb_bytes = 0;
+    size_t spheres_bytes = 0, sphere_geom_bytes = 0, materials_bytes = 0,
+           camera_bytes = 0, accum_bytes = 0, out_rgb_bytes = 0, out_rgb_back_bytes = 0,
+           bvh_nodes_bytes = 0, bvh_prims_bytes = 0,
+           spheres_q_bytes = 0, sphere_palette_bytes = 0,
+           planes_bytes = 0, boxes_bytes = 0,
+           meshes_bytes = 0, mesh_nodes_bytes = 0, triangles_bytes = 0, mesh_positions_bytes = 0,
+           instances_bytes = 0, inst_nodes_bytes = 0, inst_prims_bytes = 0,
+           lum_sq_bytes = 0, active_bytes = 0, active_next_bytes = 0, active_count_bytes = 0,
+           lane_stats_bytes = 0, work_counter_bytes = 0, ray_stats_bytes = 0;
+
+    // CL_MEM_ALLOC_HOST_PTR on devices that share host memory (CPU devices, integrated GPUs), so the
+    // driver keeps no device-side copy of its own. Scene data is still written from the PackedScene
+    // with one memcpy per upload; only the display image is read back without a copy (map_image).
+    // Zero on discrete GPUs, where kernels must read device memory.
+    cl_mem_flags host_flags = 0;
     };
 
     inline void ensure(cl::Context& ctx, cl::Buffer& b, size_t needBytes, cl_mem_flags flags, size_t& cachedSize) {
@@ -42,24 +60,159 @@ namespace compute {
         }
     }
 
+    /*
+    *   Scene uploads are non-blocking: each write's completion event is appended to `events` and the
+    *   caller makes the kernels wait on them (CLBackend::render puts a barrier on the whole list).
+    *   The source vectors therefore have to outlive the writes; the PackedScene of a render does.
+    */
+    inline void write_async(cl::CommandQueue& q, cl::Buffer& b, size_t offset, size_t bytes, const void* src,
+                            std::vector<cl::Event>& events) {
+        if (bytes == 0) return;
+        cl::Event done;
+        q.enqueueWriteBuffer(b, CL_FALSE, offset, bytes, src, nullptr, &done);
+        events.push_back(done);
+    }
+
+    template <class T>
+    inline void write_async(cl::CommandQueue& q, cl::Buffer& b, const std::vector<T>& v, std::vector<cl::Event>& events) {
+        write_async(q, b, 0, v.size() * sizeof(T), v.data(), events);
+    }
+
+    /*
+    *   Sphere records [first, first + count) from `src`, plus their center_r in the sphere_geom stream.
+    *   Ray tests read only the 16-byte stream and shading fetches the 48-byte record of the hit, so a
+    *   BVH leaf costs a third of the memory traffic. A strided rect write gathers the stream straight
+    *   out of the records; center_r is their first member.
+    */
+    inline void write_spheres(cl::CommandQueue& q, GpuSceneBuffers& gpu, size_t first, size_t count,
+                              const serialize::SphereGpu* src, std::vector<cl::Event>& events) {
+        static_assert(offsetof(serialize::SphereGpu, center_r) == 0, "sphere_geom gathers the leading center_r");
+        if (count == 0) return;
+        write_async(q, gpu.spheres, first * sizeof(serialize::SphereGpu), count * sizeof(serialize::SphereGpu), src, events);
+        cl::Event done;
+        q.enqueueWriteBufferRect(gpu.sphere_geom, CL_FALSE, { 0, first, 0 }, { 0, 0, 0 }, { sizeof(cl_float4), count, 1 },
+                                 sizeof(cl_float4), 0, sizeof(serialize::SphereGpu), 0, src, nullptr, &done);
+        events.push_back(done);
+    }
+
+    // Planes and boxes; a handful of records, re-sent whole on every scene update
+    inline void upload_analytic(cl::Context& ctx, cl::CommandQueue& q,
+                                const serialize::PackedScene& ps, GpuSceneBuffers& gpu, std::vector<cl::Event>& events)
+    {
+        const cl_mem_flags ro = CL_MEM_READ_ONLY | gpu.host_flags;
+        ensure(ctx, gpu.planes, ps.planes.size()*sizeof(serialize::PlaneGpu), ro, gpu.planes_bytes);
+        ensure(ctx, gpu.boxes,  ps.boxes.size()*sizeof(serialize::BoxGpu),    ro, gpu.boxes_bytes);
+
+        write_async(q, gpu.planes, ps.planes, events);
+        write_async(q, gpu.boxes,  ps.boxes,  events);
+    }
+
+    // Mesh geometry and BVHs; the bulk of a CAD-scale scene, so callers upload it only when it changed
+    inline void upload_meshes(cl::Context& ctx, cl::CommandQueue& q,
+                              const serialize::PackedScene& ps, GpuSceneBuffers& gpu, std::vector<cl::Event>& events)
+    {
+        const cl_mem_flags ro = CL_MEM_READ_ONLY | gpu.host_flags;
+        ensure(ctx, gpu.meshes,         ps.meshes.size()*sizeof(serialize::MeshGpu),       ro, gpu.meshes_bytes);
+        ensure(ctx, gpu.mesh_nodes,     ps.mesh_nodes.size()*sizeof(serialize::BvhNodeGpu), ro, gpu.mesh_nodes_bytes);
+        ensure(ctx, gpu.triangles,      ps.triangles.size()*sizeof(serialize::TriGpu),      ro, gpu.triangles_bytes);
+        ensure(ctx, gpu.mesh_positions, ps.mesh_positions.size()*sizeof(cl_float4),         ro, gpu.mesh_positions_bytes);
+
+        write_async(q, gpu.meshes,         ps.meshes,         events);
+        write_async(q, gpu.mesh_nodes,     ps.mesh_nodes,     events);
+        write_async(q, gpu.triangles,      ps.triangles,      events);
+        write_async(q, gpu.mesh_positions, ps.mesh_positions, events);
+    }
+
+    // Instance table plus the two-level BVH; small, so it is re-sent whole on every scene update
+    inline void upload_instances(cl::Context& ctx, cl::CommandQueue& q,
+                                 const serialize::PackedScene& ps, GpuSceneBuffers& gpu, std::vector<cl::Event>& events)
+    {
+        const cl_mem_flags ro = CL_MEM_READ_ONLY | gpu.host_flags;
+        ensure(ctx, gpu.instances,  ps.instances.size()*sizeof(serialize::InstanceGpu), ro, gpu.instances_bytes);
+        ensure(ctx, gpu.inst_nodes, ps.inst_nodes.size()*sizeof(serialize::BvhNodeGpu), ro, gpu.inst_nodes_bytes);
+        ensure(ctx, gpu.inst_prims, ps.inst_prims.size()*sizeof(cl_int),                ro, gpu.inst_prims_bytes);
+
+        write_async(q, gpu.instances,  ps.instances,  events);
+        write_async(q, gpu.inst_nodes, ps.inst_nodes, events);
+        write_async(q, gpu.inst_prims, ps.inst_prims, events);
+    }
+
     inline void upload_scene(cl::Context& ctx, cl::CommandQueue& q,
-                         const serialize::PackedScene& ps, GpuSceneBuffers& gpu)
+                         const serialize::PackedScene& ps, GpuSceneBuffers& gpu, std::vector<cl::Event>& events)
     {
         // Ensure buffers
-        ensure(ctx, gpu.spheres,    ps.spheres.size()*sizeof(serialize::SphereGpu),     CL_MEM_READ_ONLY, gpu.spheres_bytes);
-        ensure(ctx, gpu.materials,  ps.materials.size()*sizeof(serialize::MaterialGpu), CL_MEM_READ_ONLY, gpu.materials_bytes);
-        ensure(ctx, gpu.camera,     sizeof(serialize::CameraGpu),                       CL_MEM_READ_ONLY, gpu.camera_bytes);
+        const cl_mem_flags ro = CL_MEM_READ_ONLY  | gpu.host_flags;
+        const cl_mem_flags rw = CL_MEM_READ_WRITE | gpu.host_flags;
+        ensure(ctx, gpu.spheres,    ps.spheres.size()*sizeof(serialize::SphereGpu),     ro, gpu.spheres_bytes);
+        ensure(ctx, gpu.sphere_geom, ps.spheres.size()*sizeof(cl_float4),               ro, gpu.sphere_geom_bytes);
+        ensure(ctx, gpu.materials,  ps.materials.size()*sizeof(serialize::MaterialGpu), ro, gpu.materials_bytes);
+        ensure(ctx, gpu.camera,     sizeof(serialize::CameraGpu),                       ro, gpu.camera_bytes);
+        ensure(ctx, gpu.bvh_nodes,  ps.bvh_nodes.size()*sizeof(serialize::BvhNodeGpu),  rw, gpu.bvh_nodes_bytes);
+        ensure(ctx, gpu.bvh_prims,  ps.bvh_prims.size()*sizeof(cl_int),                 rw, gpu.bvh_prims_bytes);
+        ensure(ctx, gpu.spheres_q,      ps.spheres_q.size()*sizeof(serialize::SphereQGpu),            ro, gpu.spheres_q_bytes);
+        ensure(ctx, gpu.sphere_palette, ps.sphere_palette.size()*sizeof(serialize::SpherePaletteGpu), ro, gpu.sphere_palette_bytes);
 
         // Upload
-        if (!ps.spheres.empty())    q.enqueueWriteBuffer(gpu.spheres,    CL_TRUE, 0, ps.spheres.size()*sizeof(serialize::SphereGpu),     ps.spheres.data());
-        if (!ps.materials.empty())  q.enqueueWriteBuffer(gpu.materials,  CL_TRUE, 0, ps.materials.size()*sizeof(serialize::MaterialGpu), ps.materials.data());
-
-        q.enqueueWriteBuffer(gpu.camera, CL_TRUE, 0, sizeof(serialize::CameraGpu), &ps.camera);
+        write_spheres(q, gpu, 0, ps.spheres.size(), ps.spheres.data(), events);
+        write_async(q, gpu.materials,      ps.materials,      events);
+        write_async(q, gpu.bvh_nodes,      ps.bvh_nodes,      events);
+        write_async(q, gpu.bvh_prims,      ps.bvh_prims,      events);
+        write_async(q, gpu.spheres_q,      ps.spheres_q,      events);
+        write_async(q, gpu.sphere_palette, ps.sphere_palette, events);
+        write_async(q, gpu.camera, 0, sizeof(serialize::CameraGpu), &ps.camera, events);
+
+        upload_analytic(ctx, q, ps, gpu, events);
+        upload_instances(ctx, q, ps, gpu, events);
     }
 
     inline void ensure_output(cl::Context& ctx, GpuSceneBuffers& gpu, int W, int H) {
-        const size_t bytes = size_t(W) * size_t(H) * sizeof(cl_uchar4);
-        ensure(ctx, gpu.out_rgb, bytes, CL_MEM_WRITE_ONLY, gpu.out_rgb_bytes);
+        const size_t pixels = size_t(W) * size_t(H);
+        ensure(ctx, gpu.accum,   pixels * sizeof(cl_float4), CL_MEM_READ_WRITE, gpu.accum_bytes);
+        // pinned on every device: the display image is mapped for reading instead of copied out
+        ensure(ctx, gpu.out_rgb, pixels * sizeof(cl_uchar4), CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, gpu.out_rgb_bytes);
+
+        // adaptive sampling: per-pixel luminance second moment and the ping-ponged active pixel lists
+        ensure(ctx, gpu.lum_sq,       pixels * sizeof(cl_float), CL_MEM_READ_WRITE, gpu.lum_sq_bytes);
+        ensure(ctx, gpu.active,       pixels * sizeof(cl_uint),  CL_MEM_READ_WRITE, gpu.active_bytes);
+        ensure(ctx, gpu.active_next,  pixels * sizeof(cl_uint),  CL_MEM_READ_WRITE, gpu.active_next_bytes);
+        ensure(ctx, gpu.active_count, sizeof(cl_uint),           CL_MEM_READ_WRITE, gpu.active_count_bytes);
+
+        // persistent threads: next active-list entry to hand out; lane statistics: bounce steps, lane slots
+        ensure(ctx, gpu.work_counter, sizeof(cl_uint),     CL_MEM_READ_WRITE, gpu.work_counter_bytes);
+        ensure(ctx, gpu.lane_stats,   2 * sizeof(cl_uint), CL_MEM_READ_WRITE, gpu.lane_stats_bytes);
+        // ray statistics: 64-bit counters as uint pairs
+        ensure(ctx, gpu.ray_stats, 2 * clutils::RayStatsCounters::COUNT * sizeof(cl_uint), CL_MEM_READ_WRITE,
+               gpu.ray_stats_bytes);
+    }
+
+    // Arguments 0..24 of render, render_persistent and wf_extend: image size and the scene
+    inline void bind_scene_args(cl::Kernel& k, const GpuSceneBuffers& gpu, const serialize::PackedScene& ps,
+                                size_t width, size_t height, cl_int material_count) {
+        k.setArg(0, (cl_int)width);
+        k.setArg(1, (cl_int)height);
+        k.setArg(2, gpu.camera);
+        k.setArg(3, gpu.spheres);
+        k.setArg(4, gpu.sphere_geom);
+        k.setArg(5, (cl_int)ps.world_sphere_count);
+        k.setArg(6, gpu.bvh_nodes);
+        k.setArg(7, gpu.bvh_prims);
+        k.setArg(8, gpu.spheres_q);
+        k.setArg(9, gpu.sphere_palette);
+        k.setArg(10, gpu.planes);
+        k.setArg(11, (cl_int)ps.planes.size());
+        k.setArg(12, gpu.boxes);
+        k.setArg(13, (cl_int)ps.boxes.size());
+        k.setArg(14, gpu.meshes);
+        k.setArg(15, (cl_int)ps.meshes.size());
+        k.setArg(16, gpu.mesh_nodes);
+        k.setArg(17, gpu.triangles);
+        k.setArg(18, gpu.mesh_positions);
+        k.setArg(19, gpu.instances);
+        k.setArg(20, (cl_int)ps.instances.size());
+        k.setArg(21, gpu.inst_nodes);
+        k.setArg(22, gpu.inst_prims);
+        k.setArg(23, gpu.materials);
+        k.setArg(24, material_count);
     }
 
 
@@ -69,6 +222,9 @@ namespace compute {
         
         void initialize(const Config& config) override;
         void render(const Camera& cam, const Scene& scene) override;
+        void render_sequence(const std::vector<Camera>& cameras, const Scene& scene, const std::string& name) override;
+        // The device keeps `ps` between calls with the same object; a render() in between replaces it
+        void render_region(const serialize::PackedScene& ps, const RegionTask& task, std::vector<cl_float4>& accum) override;
         // void shutdown() override;
 
     private:
@@ -82,26 +238,121 @@ namespace compute {
         cl::CommandQueue queue_;
         cl::Program program_;
 
-        // OpenCL kernel
+        // initialize() starts the program build on a worker thread; render() collects it
+        std::future<cl::Program> program_future_;
+        std::string program_status_; // how the program was obtained, written by the build thread
+        bool kernels_ready_ = false;
+
+        // Sources and base options, kept to compile specialized variants later
+        std::vector<std::string> kernel_sources_;
+        std::string build_options_;
+
+        // Programs keyed by their specialization defines; "" is the generic program_.
+        // kernel_, persistent_kernel_ and wavefront_ belong to variants_[variant_key_]
+        std::unordered_map<std::string, cl::Program> variants_;
+        std::string variant_key_;
+
+        // OpenCL kernels: one progressive pass (per-pixel or persistent), active pixel compaction,
+        // and the accumulation -> display image resolve
         cl::Kernel kernel_;
+        cl::Kernel persistent_kernel_;
+        cl::Kernel compact_kernel_;
+        cl::Kernel tonemap_kernel_;
+
+        // Stage kernels and path state for Config::Render::trace_mode == Wavefront
+        WavefrontTracer wavefront_;
+
+        // Tile rendering on several devices when Config::cl.multi_device; device_ then only tone maps
+        MultiDeviceTracer multi_device_;
+
+        // Profiled enqueues on their way to timeline_; inert unless Config::profile.timeline
+        clutils::EventLog events_;
+
+        // Background encoder and writer for every image a render produces
+        image::ImageWriter writer_;
 
         // Buffers
         GpuSceneBuffers gpu_scene_;
 
+        // Device LBVH: the spheres stay resident between renders so only edits are uploaded
+        LbvhBuilder lbvh_;
+        std::vector<serialize::SphereGpu> resident_spheres_;
+        bool scene_resident_ = false;
+        int frames_since_build_ = 0;
+
+        // Meshes are immutable once added to a Scene, so the same sources mean the device copy is current
+        std::vector<std::shared_ptr<const Mesh>> resident_meshes_;
+
+        // Packed copy of the last rendered Scene; later renders of the same Scene repack and upload
+        // only what its change tracking reports (see Scene::revision())
+        serialize::PackedScene packed_;
+        const Scene* packed_source_ = nullptr;
+
+        // RegionTask::scene_id of the shipped scene the device buffers hold; 0 once a render() replaced it.
+        // Not the scene's address: the next job's scene may be allocated where a freed one was
+        uint32_t region_scene_id_ = 0;
+
         // Helper functions for initialization
         void select_platform(int platform_index);
         void select_device(int device_index, cl_device_type type);
-        void build_program(const std::vector<std::string>& kernel_sources, const std::string& build_options);
+
+        // Cached binary when one matches sources, options and device; otherwise compiles and caches
+        cl::Program load_or_build_program(const std::vector<std::string>& kernel_sources, const std::string& build_options);
+
+        // Waits for the background build and creates the kernels; a no-op once done
+        void finish_initialize();
+
+        // -D constants that pin this scene and path length into the render kernels. When disabled, only
+        // MATERIALS_IN_GLOBAL for material tables too big for __constant memory and SAMPLER_SOBOL
+        std::string specialization_defines(int max_bounces, const serialize::PackedScene& ps,
+                                           int total_spp, int pass_spp, SamplerType sampler) const;
+
+        // Global memory a sphere test reads in the variant built with `defines`, for the ray statistics
+        size_t sphere_test_bytes(const std::string& defines) const;
+        // MATERIAL_MASK of the variant built with `defines`; every type when it is not specialized
+        static unsigned variant_material_mask(const std::string& defines);
+
+        // Points the render kernels at the program for `defines`, building it on first use
+        void use_variant(const std::string& defines);
+
+        // Work-items for one persistent launch: enough groups to keep every compute unit busy
+        size_t persistent_items(cl_uint active_count, size_t& local) const;
+
+        // Retires converged pixels from gpu_scene_.active; returns how many remain
+        cl_uint compact_active(cl_uint active_count);
+
+        // Brings the scene up to date on the device and runs the progressive passes into gpu_scene_.accum.
+        // Intermediate previews are tone mapped into `preview_image` and saved as `image_name`. False for an
+        // empty image.
+        bool trace_frame(const Camera& cam, const Scene& scene, uint32_t frame_seed, const std::string& image_name,
+                         cl::Buffer& preview_image);
+
+        // Tone maps the accumulation buffer into `out` and maps it for reading without waiting; the image
+        // is valid once `mapped` completes and must be handed back with enqueueUnmapMemObject
+        const cl_uchar4* map_image(size_t width, size_t height, cl::Buffer& out, cl::Event& mapped);
+
+        // Tone maps the accumulation buffer into `out`, reads it back and queues it on writer_
+        void resolve_image(size_t width, size_t height, const std::string& filename, cl::Buffer& out);
+
+        // Uploads the scene and brings the device LBVH up to date (rebuild or refit)
+        void update_scene_lbvh(const serialize::PackedScene& ps, std::vector<cl::Event>& upload_events);
+
+        // True when packed_ came from `scene` and only spheres, materials or the camera changed since
+        bool can_update_incrementally(const Scene& scene) const;
+
+        // Sub-range uploads of what repack_edits() changed in packed_, plus the sphere BVH update they need
+        void upload_edits(const serialize::SceneEdits& edits, const serialize::BvhBuildOptions& bvh_opt,
+                          std::vector<cl::Event>& upload_events);
+
+        // Refits the device LBVH after sphere edits, or rebuilds it every lbvh_refit_frames; returns which
+        const char* refresh_lbvh(int n);
 
 
         // Platform and device info
         void print_platform_info();
         void print_device_info();
 
-        // Image saving utility
-        void save_image(const std::string& filename, const std::vector<cl_uchar4>& image, int width, int height);
-
-        std::string build_log();
+        std::string build_log(const cl::Program& program);
 
     public:
         BackendType type() const override { return BackendType::OpenCL; }
@@ -0,0 +1,75 @@
+#ifndef CLEVENTLOG_HPP
+#define CLEVENTLOG_HPP
+
+#include <deque>
+#include "Timeline.hpp"
+
+namespace compute::clutils {
+
+    /*
+    *   Collects the events of profiled enqueues and moves their queued/submit/start/end times
+    *   onto a Timeline once they complete. The queue must be created with
+    *   CL_QUEUE_PROFILING_ENABLE. Device timestamps are shifted onto the host clock by the
+    *   first command's enqueue time, which is close enough to line up phases in a trace.
+    *   Disabled, next() returns nullptr, so enqueues pass no event at all.
+    */
+    class EventLog {
+    public:
+        void enable(Timeline* timeline) { timeline_ = timeline; }
+        bool enabled() const { return timeline_ != nullptr; }
+
+        // Event for the next enqueue, or nullptr when off; `name` must be a literal
+        cl::Event* next(const char* name) {
+            if (!timeline_) return nullptr;
+            pending_.push_back({ name, cl::Event(), timeline_->now_us() });
+            return &pending_.back().event;
+        }
+
+        // Commands that already return an event (non-blocking writes, maps)
+        void record(const char* name, const cl::Event& event) {
+            if (timeline_) pending_.push_back({ name, event, timeline_->now_us() });
+        }
+        void record(const char* name, const std::vector<cl::Event>& events) {
+            for (const auto& e : events) record(name, e);
+        }
+
+        // Hands every completed command to the timeline; call after the queue has drained
+        void flush() {
+            if (!timeline_) return;
+            std::deque<Pending> waiting;
+            for (auto& p : pending_) {
+                if (p.event() == nullptr) continue;
+                if (p.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) {
+                    waiting.push_back(std::move(p));
+                    continue;
+                }
+                const double queued = double(p.event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>()) * 1e-3;
+                const double submit = double(p.event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>()) * 1e-3;
+                const double start  = double(p.event.getProfilingInfo<CL_PROFILING_COMMAND_START>()) * 1e-3;
+                const double end    = double(p.event.getProfilingInfo<CL_PROFILING_COMMAND_END>()) * 1e-3;
+                if (!aligned_) {
+                    offset_us_ = p.host_us - queued;
+                    aligned_ = true;
+                }
+                timeline_->add_device(p.name, queued + offset_us_, submit + offset_us_,
+                                      start + offset_us_, end + offset_us_);
+            }
+            pending_.swap(waiting);
+        }
+
+    private:
+        struct Pending {
+            const char* name;
+            cl::Event event;
+            double host_us; // when it was enqueued
+        };
+
+        Timeline* timeline_ = nullptr;
+        std::deque<Pending> pending_;
+        bool aligned_ = false;
+        double offset_us_ = 0.0;
+    };
+
+}
+
+#endif // CLEVENTLOG_HPP
@@ -0,0 +1,18 @@
+#ifndef CLHEADERS_HPP
+#define CLHEADERS_HPP
+
+
+#define CL_HPP_TARGET_OPENCL_VERSION  120
+#define CL_HPP_MINIMUM_OPENCL_VERSION 120
+
+
+#define CL_HPP_ENABLE_EXCEPTIONS
+
+
+#ifdef __APPLE__
+#define CL_SILENCE_DEPRECATION
+#endif
+
+#include <CL/opencl.hpp> 
+
+#endif // CLHEADERS_HPP
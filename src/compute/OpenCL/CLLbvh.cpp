@@ -0,0 +1,158 @@
+#include "pchray.h"
+
+#include "CLBackend.hpp"
+
+namespace compute {
+
+    namespace {
+        size_t round_up(size_t n, size_t multiple) {
+            return ((n + multiple - 1) / multiple) * multiple;
+        }
+
+        size_t block_count(int n) {
+            return (size_t(n) + LbvhBuilder::GROUP_SIZE - 1) / LbvhBuilder::GROUP_SIZE;
+        }
+
+        constexpr int    RADIX_PASSES     = 8;  // 4 bits per pass over 32-bit keys
+        constexpr int    RADIX_BUCKETS    = 16;
+        constexpr size_t MAX_BOUNDS_GROUPS = 64;
+    }
+
+    void LbvhBuilder::initialize(const cl::Context& context, const cl::Device& device, const cl::Program& program,
+                                 clutils::EventLog& events) {
+        context_ = context;
+        events_ = &events;
+
+        bounds_reduce_  = cl::Kernel(program, "lbvh_bounds_reduce");
+        bounds_final_   = cl::Kernel(program, "lbvh_bounds_final");
+        morton_         = cl::Kernel(program, "lbvh_morton");
+        histogram_      = cl::Kernel(program, "radix_histogram");
+        scan_           = cl::Kernel(program, "radix_scan");
+        scatter_        = cl::Kernel(program, "radix_scatter");
+        init_leaves_    = cl::Kernel(program, "lbvh_init_leaves");
+        build_internal_ = cl::Kernel(program, "lbvh_build_internal");
+        refit_          = cl::Kernel(program, "lbvh_refit");
+
+        // The reductions and the local sort use fixed-size __local arrays
+        for (const cl::Kernel* k : { &bounds_reduce_, &bounds_final_, &scan_, &scatter_ }) {
+            if (k->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device) < GROUP_SIZE) {
+                throw std::runtime_error("Device LBVH needs work-groups of " + std::to_string(GROUP_SIZE) + " items.");
+            }
+        }
+        built_count_ = -1;
+    }
+
+    void LbvhBuilder::ensure_scratch(int n) {
+        const size_t blocks = block_count(n);
+        ensure(context_, partial_bounds_, 2 * MAX_BOUNDS_GROUPS * sizeof(cl_float4), CL_MEM_READ_WRITE, partial_bytes_);
+        ensure(context_, bounds_, 2 * sizeof(cl_float4), CL_MEM_READ_WRITE, bounds_bytes_);
+        for (int i = 0; i < 2; ++i) {
+            ensure(context_, keys_[i],   size_t(n) * sizeof(cl_uint), CL_MEM_READ_WRITE, keys_bytes_[i]);
+            ensure(context_, values_[i], size_t(n) * sizeof(cl_int),  CL_MEM_READ_WRITE, values_bytes_[i]);
+        }
+        ensure(context_, hist_,  RADIX_BUCKETS * blocks * sizeof(cl_uint), CL_MEM_READ_WRITE, hist_bytes_);
+        ensure(context_, flags_, std::max(n - 1, 1) * sizeof(cl_int),      CL_MEM_READ_WRITE, flags_bytes_);
+    }
+
+    void LbvhBuilder::build(cl::CommandQueue& q, const cl::Buffer& sphere_geom, int n,
+                            cl::Buffer& nodes, cl::Buffer& prims) {
+        if (n <= 0) {
+            // same empty root the host builder emits
+            serialize::Aabb origin;
+            origin.grow(glm::vec3(0.0f));
+            serialize::BvhNodeGpu root = serialize::make_bvh_node(origin, -1);
+            root.count = 0;
+            q.enqueueWriteBuffer(nodes, CL_TRUE, 0, sizeof(root), &root, nullptr, events_->next("write"));
+            built_count_ = 0;
+            return;
+        }
+
+        ensure_scratch(n);
+        const cl::NDRange local(GROUP_SIZE);
+        const cl::NDRange items(round_up(n, GROUP_SIZE));
+        const size_t blocks = block_count(n);
+
+        // 1. scene bounds of the sphere centers
+        const size_t groups = std::min(blocks, MAX_BOUNDS_GROUPS);
+        bounds_reduce_.setArg(0, sphere_geom);
+        bounds_reduce_.setArg(1, (cl_int)n);
+        bounds_reduce_.setArg(2, partial_bounds_);
+        q.enqueueNDRangeKernel(bounds_reduce_, cl::NullRange, cl::NDRange(groups * GROUP_SIZE), local, nullptr, events_->next("lbvh_bounds_reduce"));
+
+        bounds_final_.setArg(0, partial_bounds_);
+        bounds_final_.setArg(1, (cl_int)groups);
+        bounds_final_.setArg(2, bounds_);
+        q.enqueueNDRangeKernel(bounds_final_, cl::NullRange, local, local, nullptr, events_->next("lbvh_bounds_final"));
+
+        // 2. Morton codes
+        morton_.setArg(0, sphere_geom);
+        morton_.setArg(1, (cl_int)n);
+        morton_.setArg(2, bounds_);
+        morton_.setArg(3, keys_[0]);
+        morton_.setArg(4, values_[0]);
+        q.enqueueNDRangeKernel(morton_, cl::NullRange, items, local, nullptr, events_->next("lbvh_morton"));
+
+        // 3. radix sort; an even pass count leaves the result in keys_[0]/values_[0]
+        for (int pass = 0; pass < RADIX_PASSES; ++pass) {
+            const int src = pass & 1, dst = src ^ 1;
+            const cl_int shift = pass * 4;
+
+            histogram_.setArg(0, keys_[src]);
+            histogram_.setArg(1, (cl_int)n);
+            histogram_.setArg(2, shift);
+            histogram_.setArg(3, hist_);
+            q.enqueueNDRangeKernel(histogram_, cl::NullRange, items, local, nullptr, events_->next("radix_histogram"));
+
+            scan_.setArg(0, hist_);
+            scan_.setArg(1, (cl_int)(RADIX_BUCKETS * blocks));
+            q.enqueueNDRangeKernel(scan_, cl::NullRange, local, local, nullptr, events_->next("radix_scan"));
+
+            scatter_.setArg(0, keys_[src]);
+            scatter_.setArg(1, values_[src]);
+            scatter_.setArg(2, (cl_int)n);
+            scatter_.setArg(3, shift);
+            scatter_.setArg(4, hist_);
+            scatter_.setArg(5, keys_[dst]);
+            scatter_.setArg(6, values_[dst]);
+            q.enqueueNDRangeKernel(scatter_, cl::NullRange, items, local, nullptr, events_->next("radix_scatter"));
+        }
+
+        // 4. leaves, then internal nodes
+        init_leaves_.setArg(0, values_[0]);
+        init_leaves_.setArg(1, (cl_int)n);
+        init_leaves_.setArg(2, nodes);
+        init_leaves_.setArg(3, prims);
+        q.enqueueNDRangeKernel(init_leaves_, cl::NullRange, items, local, nullptr, events_->next("lbvh_init_leaves"));
+
+        if (n > 1) {
+            build_internal_.setArg(0, keys_[0]);
+            build_internal_.setArg(1, (cl_int)n);
+            build_internal_.setArg(2, nodes);
+            q.enqueueNDRangeKernel(build_internal_, cl::NullRange, cl::NDRange(round_up(n - 1, GROUP_SIZE)), local, nullptr, events_->next("lbvh_build_internal"));
+        }
+
+        built_count_ = n;
+
+        // 5. bounds
+        refit(q, sphere_geom, n, nodes, prims);
+    }
+
+    void LbvhBuilder::refit(cl::CommandQueue& q, const cl::Buffer& sphere_geom, int n,
+                            cl::Buffer& nodes, cl::Buffer& prims) {
+        if (!built_for(n)) {
+            throw std::runtime_error("LBVH refit without a matching build.");
+        }
+        if (n <= 0) return;
+
+        if (n > 1) {
+            q.enqueueFillBuffer(flags_, (cl_int)0, 0, size_t(n - 1) * sizeof(cl_int), nullptr, events_->next("fill"));
+        }
+        refit_.setArg(0, sphere_geom);
+        refit_.setArg(1, prims);
+        refit_.setArg(2, (cl_int)n);
+        refit_.setArg(3, nodes);
+        refit_.setArg(4, flags_);
+        q.enqueueNDRangeKernel(refit_, cl::NullRange, cl::NDRange(round_up(n, GROUP_SIZE)), cl::NDRange(GROUP_SIZE), nullptr, events_->next("lbvh_refit"));
+    }
+
+}
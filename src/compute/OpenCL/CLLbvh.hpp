@@ -0,0 +1,53 @@
+#ifndef CLLBVH_HPP
+#define CLLBVH_HPP
+
+
+namespace compute {
+
+    /*
+    *   Host driver for the device-side LBVH in kernels/lbvh.cl.
+    *   Works on the resident sphere buffer, writes the same BvhNode layout the render
+    *   kernel traverses, and owns all of its scratch buffers.
+    */
+    class LbvhBuilder {
+    public:
+        static constexpr size_t GROUP_SIZE = 256; // must match LBVH_GROUP_SIZE in lbvh.cl
+
+        // `events` is kept and gets every enqueue, for the timeline
+        void initialize(const cl::Context& context, const cl::Device& device, const cl::Program& program,
+                        clutils::EventLog& events);
+
+        // Morton codes + radix sort + hierarchy emission + bounds. `nodes` must hold 2n-1 nodes, `prims` n ints.
+        void build(cl::CommandQueue& q, const cl::Buffer& sphere_geom, int sphere_count,
+                   cl::Buffer& nodes, cl::Buffer& prims);
+
+        // Bounds-only update of the last built hierarchy; valid while the sphere count is unchanged.
+        void refit(cl::CommandQueue& q, const cl::Buffer& sphere_geom, int sphere_count,
+                   cl::Buffer& nodes, cl::Buffer& prims);
+
+        bool built_for(int sphere_count) const { return built_count_ == sphere_count; }
+
+    private:
+        cl::Context context_;
+        clutils::EventLog* events_ = nullptr;
+
+        cl::Kernel bounds_reduce_, bounds_final_, morton_;
+        cl::Kernel histogram_, scan_, scatter_;
+        cl::Kernel init_leaves_, build_internal_, refit_;
+
+        // scratch, grown on demand
+        cl::Buffer partial_bounds_, bounds_;
+        cl::Buffer keys_[2], values_[2];
+        cl::Buffer hist_, flags_;
+        size_t partial_bytes_ = 0, bounds_bytes_ = 0,
+               keys_bytes_[2] = {0, 0}, values_bytes_[2] = {0, 0},
+               hist_bytes_ = 0, flags_bytes_ = 0;
+
+        int built_count_ = -1;
+
+        void ensure_scratch(int sphere_count);
+    };
+
+}
+
+#endif // CLLBVH_HPP
@@ -0,0 +1,250 @@
+#include "pchray.h"
+
+#include "CLBackend.hpp"
+
+#include <chrono>
+#include <numeric>
+
+namespace compute {
+
+    struct MultiDeviceTracer::Worker {
+        cl::Device device;
+        std::string label; // device name and its position in the list, for the report
+        cl::Context context;
+        cl::CommandQueue queue;
+
+        // programs keyed by their full build options; kernel belongs to programs[variant_]
+        std::unordered_map<std::string, cl::Program> programs;
+        cl::Kernel kernel;
+
+        GpuSceneBuffers gpu;
+        std::vector<std::shared_ptr<const Mesh>> resident_meshes; // held, so a new mesh cannot reuse an address
+
+        // last frame
+        size_t tiles = 0;
+        uint64_t samples = 0;
+        double busy_ms = 0.0;
+    };
+
+    MultiDeviceTracer::MultiDeviceTracer() = default;
+    MultiDeviceTracer::~MultiDeviceTracer() = default;
+
+    std::vector<cl::Device> MultiDeviceTracer::select_devices(const cl::Platform& platform, const Config::OpenCl& config) {
+        std::vector<cl::Device> all;
+        platform.getDevices(CL_DEVICE_TYPE_ALL, &all);
+        if (all.empty()) {
+            throw std::runtime_error("No OpenCL devices found for the selected platform.");
+        }
+
+        std::vector<cl::Device> chosen;
+        if (config.device_indices.empty()) {
+            chosen = all;
+        } else {
+            for (int i : config.device_indices) {
+                if (i < 0 || i >= (int)all.size()) throw std::runtime_error("Invalid multi-device index.");
+                chosen.push_back(all[i]);
+            }
+        }
+        if (config.partition == DevicePartition::None) return chosen;
+
+        std::vector<cl_device_partition_property> properties;
+        if (config.partition == DevicePartition::NumaNode) {
+            properties = { CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN, CL_DEVICE_AFFINITY_DOMAIN_NUMA, 0 };
+        } else {
+            if (config.partition_units <= 0) throw std::runtime_error("Equal partitioning needs partition_units > 0.");
+            properties = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)config.partition_units, 0 };
+        }
+
+        std::vector<cl::Device> devices;
+        for (cl::Device& device : chosen) {
+            std::vector<cl::Device> sub_devices;
+            try {
+                device.createSubDevices(properties.data(), &sub_devices);
+            } catch (const cl::Error&) {
+                // GPUs and single-node CPUs usually refuse (CL_DEVICE_PARTITION_FAILED / CL_INVALID_VALUE)
+                sub_devices.clear();
+            }
+            if (sub_devices.empty()) {
+                std::cout << "Multi-device: " << device.getInfo<CL_DEVICE_NAME>() << " cannot be partitioned, using it whole\n";
+                devices.push_back(device);
+            } else {
+                devices.insert(devices.end(), sub_devices.begin(), sub_devices.end());
+            }
+        }
+        return devices;
+    }
+
+    void MultiDeviceTracer::initialize(const std::vector<cl::Device>& devices, const std::vector<std::string>& kernel_sources,
+                                       const std::string& program_cache_dir) {
+        workers_.clear();
+        kernel_sources_ = kernel_sources;
+        program_cache_dir_ = program_cache_dir;
+        variant_set_ = false;
+
+        std::cout << "//=========== Multi-device ===================\n";
+        for (const cl::Device& device : devices) {
+            auto w = std::make_unique<Worker>();
+            w->device = device;
+            w->context = cl::Context(device);
+            w->queue = cl::CommandQueue(w->context, device);
+            const bool shared_memory = device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>() ||
+                                       (device.getInfo<CL_DEVICE_TYPE>() & CL_DEVICE_TYPE_CPU);
+            w->gpu.host_flags = shared_memory ? CL_MEM_ALLOC_HOST_PTR : 0;
+
+            std::ostringstream label;
+            label << device.getInfo<CL_DEVICE_NAME>() << " [" << workers_.size() << "]";
+            w->label = label.str();
+            std::cout << "|| " << w->label << ": " << device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>() << " compute units\n";
+            workers_.push_back(std::move(w));
+        }
+        std::cout << "//============================================\n" << std::endl;
+    }
+
+    size_t MultiDeviceTracer::min_constant_buffer_size() const {
+        size_t bytes = std::numeric_limits<size_t>::max();
+        for (const auto& w : workers_) {
+            bytes = std::min(bytes, size_t(w->device.getInfo<CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE>()));
+        }
+        return bytes;
+    }
+
+    void MultiDeviceTracer::use_variant(const std::string& build_options) {
+        if (variant_set_ && build_options == variant_) return;
+
+        // one device after another: identical (sub-)devices then load the first one's cached binary
+        // instead of compiling the same program again
+        for (auto& w : workers_) {
+            auto it = w->programs.find(build_options);
+            if (it == w->programs.end()) {
+                std::string status;
+                cl::Program program = clutils::load_or_build_program(w->context, w->device, kernel_sources_,
+                                                                      build_options, program_cache_dir_, status);
+                std::cout << w->label << ": " << status << "\n";
+                it = w->programs.emplace(build_options, std::move(program)).first;
+            }
+            w->kernel = cl::Kernel(it->second, "render");
+        }
+        variant_ = build_options;
+        variant_set_ = true;
+    }
+
+    void MultiDeviceTracer::upload(const serialize::PackedScene& ps) {
+        for (auto& w : workers_) {
+            // in-order queues: the first tile's kernels run after these writes
+            std::vector<cl::Event> events;
+            upload_scene(w->context, w->queue, ps, w->gpu, events);
+            if (ps.mesh_sources != w->resident_meshes) {
+                upload_meshes(w->context, w->queue, ps, w->gpu, events);
+                w->resident_meshes = ps.mesh_sources;
+            } else {
+                write_async(w->queue, w->gpu.meshes, ps.meshes, events); // material indices may have moved
+            }
+        }
+    }
+
+    MultiDeviceTracer::FrameResult MultiDeviceTracer::trace_frame(
+            size_t width, size_t height, const serialize::PackedScene& ps, cl_int material_count,
+            int total_spp, int pass_spp, cl_int max_bounces, cl_uint frame_seed, int tile_rows,
+            const std::atomic<bool>& stop, Timeline& timeline, std::vector<cl_float4>& accum) {
+        const size_t N = width * height;
+        const size_t rows = size_t(std::max(1, tile_rows));
+        const size_t tiles = (height + rows - 1) / rows;
+        accum.assign(N, cl_float4{{0.0f, 0.0f, 0.0f, 0.0f}});
+
+        // Every device keeps a full-size accumulation buffer and an identity pixel list, so a tile is
+        // just a range of both: launched with a global offset, read back as one contiguous block
+        std::vector<cl_uint> all_pixels(N);
+        std::iota(all_pixels.begin(), all_pixels.end(), 0u);
+        for (auto& w : workers_) {
+            ensure_output(w->context, w->gpu, (int)width, (int)height);
+            std::vector<cl::Event> events;
+            write_async(w->queue, w->gpu.active, all_pixels, events);
+            const cl_float4 zero = {{0.0f, 0.0f, 0.0f, 0.0f}};
+            w->queue.enqueueFillBuffer(w->gpu.accum, zero, 0, N * sizeof(cl_float4));
+            w->queue.enqueueFillBuffer(w->gpu.lum_sq, 0.0f, 0, N * sizeof(cl_float));
+            const cl_uint zero_count = 0;
+            w->queue.enqueueFillBuffer(w->gpu.ray_stats, zero_count, 0, 2 * clutils::RayStatsCounters::COUNT * sizeof(cl_uint));
+
+            cl::Kernel& k = w->kernel;
+            bind_scene_args(k, w->gpu, ps, width, height, material_count);
+            k.setArg(25, frame_seed);
+            k.setArg(28, w->gpu.accum);
+            k.setArg(29, w->gpu.lum_sq);
+            k.setArg(30, w->gpu.active);
+            k.setArg(32, w->gpu.lane_stats);
+            k.setArg(33, max_bounces);
+            k.setArg(34, w->gpu.ray_stats);
+
+            w->tiles = 0;
+            w->samples = 0;
+            w->busy_ms = 0.0;
+        }
+
+        std::atomic<size_t> next_tile{0};
+        std::atomic<bool> failed{false};
+        auto run = [&](Worker& w) {
+            try {
+                for (size_t t; !stop && !failed && (t = next_tile.fetch_add(1)) < tiles; ) {
+                    ScopedPhase phase(timeline, "tile");
+                    const auto start = std::chrono::high_resolution_clock::now();
+                    const size_t first = t * rows * width;
+                    const size_t end = std::min(height, (t + 1) * rows) * width;
+                    w.kernel.setArg(31, (cl_int)end); // active_count: gid runs from `first` up to here
+
+                    // the same pass structure as a single-device render, so stop requests land between passes
+                    for (int done = 0; done < total_spp && !stop; ) {
+                        const int spp = std::min(pass_spp, total_spp - done);
+                        w.kernel.setArg(26, (cl_uint)done);
+                        w.kernel.setArg(27, (cl_int)spp);
+                        w.queue.enqueueNDRangeKernel(w.kernel, cl::NDRange(first), cl::NDRange(end - first), cl::NullRange);
+                        w.queue.finish();
+                        w.samples += uint64_t(end - first) * uint64_t(spp);
+                        done += spp;
+                    }
+                    // tiles are disjoint, so the devices write the framebuffer without locking
+                    w.queue.enqueueReadBuffer(w.gpu.accum, CL_TRUE, first * sizeof(cl_float4),
+                                              (end - first) * sizeof(cl_float4), accum.data() + first);
+                    ++w.tiles;
+                    w.busy_ms += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+                }
+            } catch (...) {
+                failed = true;
+                throw;
+            }
+        };
+
+        // one host thread per device; the calling thread drives the first
+        const auto start = std::chrono::high_resolution_clock::now();
+        std::vector<std::future<void>> threads;
+        for (size_t i = 1; i < workers_.size(); ++i) {
+            threads.push_back(std::async(std::launch::async, run, std::ref(*workers_[i])));
+        }
+        std::exception_ptr error;
+        try { run(*workers_[0]); } catch (...) { error = std::current_exception(); }
+        for (auto& t : threads) {
+            try { t.get(); } catch (...) { if (!error) error = std::current_exception(); }
+        }
+        if (error) std::rethrow_exception(error);
+        const double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        FrameResult result;
+        for (auto& w : workers_) {
+            result.samples += w->samples;
+            std::vector<cl_uint> words(2 * clutils::RayStatsCounters::COUNT);
+            w->queue.enqueueReadBuffer(w->gpu.ray_stats, CL_TRUE, 0, words.size() * sizeof(cl_uint), words.data());
+            const auto counters = clutils::RayStatsCounters::from_words(words);
+            for (int i = 0; i < clutils::RayStatsCounters::COUNT; ++i) result.ray_stats.c[i] += counters.c[i];
+        }
+
+        std::cout << "Multi-device render: " << tiles << " tiles of " << rows << " rows on " << workers_.size()
+                  << " devices, " << ms << " ms, " << double(result.samples) / (ms * 1e3) << " Msamples/s\n";
+        for (const auto& w : workers_) {
+            std::cout << "  " << w->label << ": " << w->tiles << " tiles ("
+                      << (tiles > 0 ? 100.0 * double(w->tiles) / double(tiles) : 0.0) << "%), "
+                      << (w->busy_ms > 0.0 ? double(w->samples) / (w->busy_ms * 1e3) : 0.0) << " Msamples/s, busy "
+                      << w->busy_ms << " ms\n";
+        }
+        return result;
+    }
+
+}
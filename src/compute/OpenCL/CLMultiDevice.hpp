@@ -0,0 +1,66 @@
+#ifndef CLMULTIDEVICE_HPP
+#define CLMULTIDEVICE_HPP
+
+
+namespace compute {
+
+    /*
+    *   Renders one image on several OpenCL devices: whole devices of a platform and/or their
+    *   sub-devices (clCreateSubDevices, e.g. one per NUMA node of a multi-socket CPU). Every
+    *   device gets its own context, queue, program and copy of the scene. The image is cut into
+    *   bands of rows that one thread per device takes from a shared counter, so a faster device
+    *   simply takes more of them. A band gets all of its samples on one device and is then read
+    *   straight into the shared framebuffer; pixels keep their random sequences, so the image
+    *   does not depend on which device traced which band.
+    */
+    class MultiDeviceTracer {
+    public:
+        struct FrameResult {
+            uint64_t samples = 0;
+            clutils::RayStatsCounters ray_stats; // summed over the devices; zero without RAY_STATS
+        };
+
+        MultiDeviceTracer();
+        ~MultiDeviceTracer();
+
+        // The devices of `config.device_indices` (every device of the platform when empty), each split
+        // into sub-devices by `config.partition`; a device the driver cannot split is used whole
+        static std::vector<cl::Device> select_devices(const cl::Platform& platform, const Config::OpenCl& config);
+
+        // One context and queue per device; programs are built by use_variant()
+        void initialize(const std::vector<cl::Device>& devices, const std::vector<std::string>& kernel_sources,
+                        const std::string& program_cache_dir);
+
+        bool active() const { return !workers_.empty(); }
+        size_t device_count() const { return workers_.size(); }
+
+        // Smallest CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE of the devices; one program variant serves them all
+        size_t min_constant_buffer_size() const;
+
+        // Points every device at the program for `build_options`, building it where missing
+        void use_variant(const std::string& build_options);
+
+        // Enqueues the whole packed scene on every device; `ps` must stay alive until trace_frame() returns.
+        // Mesh geometry is only sent when it changed.
+        void upload(const serialize::PackedScene& ps);
+
+        // Traces `total_spp` samples of every pixel, in passes of `pass_spp`, into `accum` (width * height,
+        // rgb: radiance sum, w: samples). A stop request ends each device's tile after its current pass;
+        // tiles nobody started stay empty. Prints each device's share and throughput.
+        FrameResult trace_frame(size_t width, size_t height, const serialize::PackedScene& ps, cl_int material_count,
+                                int total_spp, int pass_spp, cl_int max_bounces, cl_uint frame_seed, int tile_rows,
+                                const std::atomic<bool>& stop, Timeline& timeline, std::vector<cl_float4>& accum);
+
+    private:
+        struct Worker; // per-device state, in CLMultiDevice.cpp
+
+        std::vector<std::unique_ptr<Worker>> workers_;
+        std::vector<std::string> kernel_sources_;
+        std::string program_cache_dir_;
+        std::string variant_;
+        bool variant_set_ = false;
+    };
+
+}
+
+#endif // CLMULTIDEVICE_HPP
@@ -0,0 +1,133 @@
+#ifndef CLPROGRAMCACHE_HPP
+#define CLPROGRAMCACHE_HPP
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace compute::clutils {
+
+    /*
+    *   On-disk cache of built program binaries.
+    *   Entries are named by a hash of everything that changes the compiled code: the kernel
+    *   sources, the build options and the device/driver identity. A stale or unreadable entry is
+    *   simply rebuilt from source and overwritten, so the directory can be deleted at any time.
+    */
+
+    constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+    // 64-bit FNV-1a; stable across runs and platforms, unlike std::hash
+    inline uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET_BASIS) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= bytes[i];
+            hash *= 0x100000001b3ull;
+        }
+        return hash;
+    }
+
+    inline std::string program_cache_key(const std::vector<std::string>& kernel_sources,
+                                         const cl::Device& device, const std::string& build_options) {
+        const cl::Platform platform(device.getInfo<CL_DEVICE_PLATFORM>());
+        const std::string identity[] = {
+            platform.getInfo<CL_PLATFORM_NAME>(), platform.getInfo<CL_PLATFORM_VERSION>(),
+            device.getInfo<CL_DEVICE_NAME>(),     device.getInfo<CL_DEVICE_VENDOR>(),
+            device.getInfo<CL_DEVICE_VERSION>(),  device.getInfo<CL_DRIVER_VERSION>(),
+            build_options
+        };
+
+        // every field is followed by its length, so moving text between fields changes the key
+        uint64_t hash = FNV_OFFSET_BASIS;
+        auto add = [&](const std::string& s) {
+            const uint64_t n = s.size();
+            hash = fnv1a(s.data(), s.size(), hash);
+            hash = fnv1a(&n, sizeof(n), hash);
+        };
+        for (const auto& src : kernel_sources) add(src);
+        for (const auto& field : identity) add(field);
+
+        std::ostringstream key;
+        key << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return key.str();
+    }
+
+    inline std::filesystem::path program_cache_path(const std::filesystem::path& dir, const std::string& key) {
+        return dir / (key + ".bin");
+    }
+
+    // Empty when there is no usable entry
+    inline std::vector<unsigned char> read_program_binary(const std::filesystem::path& dir, const std::string& key) {
+        std::ifstream ifs(program_cache_path(dir, key), std::ios::binary);
+        if (!ifs) return {};
+        return std::vector<unsigned char>(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+
+    // Best effort: a failed write only costs the next start a compile
+    inline bool write_program_binary(const std::filesystem::path& dir, const std::string& key,
+                                     const cl::Program& program) {
+        const auto binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+        if (binaries.size() != 1 || binaries[0].empty()) return false;
+
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) return false;
+
+        // write then rename, so a concurrent reader never sees half a file
+        const std::filesystem::path final_path = program_cache_path(dir, key);
+        std::filesystem::path tmp_path = final_path;
+        tmp_path += ".tmp";
+        {
+            std::ofstream ofs(tmp_path, std::ios::binary | std::ios::trunc);
+            if (!ofs) return false;
+            ofs.write(reinterpret_cast<const char*>(binaries[0].data()), (std::streamsize)binaries[0].size());
+            if (!ofs) return false;
+        }
+        std::filesystem::rename(tmp_path, final_path, ec);
+        return !ec;
+    }
+
+    // The cached binary for `device` when one matches, otherwise compiled from source and cached
+    // (no caching with an empty `cache_dir`); `status` describes which, with the time taken
+    inline cl::Program load_or_build_program(cl::Context& context, const cl::Device& device,
+                                             const std::vector<std::string>& kernel_sources,
+                                             const std::string& build_options,
+                                             const std::filesystem::path& cache_dir, std::string& status) {
+        auto start = std::chrono::high_resolution_clock::now();
+        auto elapsed_ms = [&]() {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        };
+
+        std::string key;
+        if (!cache_dir.empty()) {
+            key = program_cache_key(kernel_sources, device, build_options);
+            std::vector<unsigned char> binary = read_program_binary(cache_dir, key);
+            if (!binary.empty()) {
+                try {
+                    std::vector<cl_int> binary_status;
+                    cl::Program program(context, {device}, cl::Program::Binaries{ std::move(binary) }, &binary_status);
+                    program.build({device}, build_options.c_str());
+                    std::ostringstream msg;
+                    msg << "Kernel program: cached binary " << key << " loaded in " << elapsed_ms() << " ms";
+                    status = msg.str();
+                    return program;
+                } catch (const cl::Error&) {
+                    // the driver rejected the entry; fall through, rebuild and overwrite it
+                }
+            }
+        }
+
+        cl::Program program = BuildProgram(context, device, kernel_sources, build_options);
+        std::ostringstream msg;
+        msg << "Kernel program: compiled from source in " << elapsed_ms() << " ms";
+        if (!cache_dir.empty()) {
+            msg << (write_program_binary(cache_dir, key, program) ? ", cached as " : ", could not cache as ")
+                << program_cache_path(cache_dir, key).string();
+        }
+        status = msg.str();
+        return program;
+    }
+
+}
+
+#endif // CLPROGRAMCACHE_HPP
@@ -0,0 +1,70 @@
+#ifndef CLRAYSTATS_HPP
+#define CLRAYSTATS_HPP
+
+#include <array>
+#include <iomanip>
+
+#include "DTOs.hpp"
+
+namespace compute::clutils {
+
+    // Totals of the ray_stats buffer written by kernels built with -D RAY_STATS; the indices
+    // must match RS_* in common.cl
+    struct RayStatsCounters {
+        static constexpr int PATHS = 0, SEGMENTS = 1, SKY = 2, NODE_TESTS = 3, SPHERE_TESTS = 4,
+                             TRIANGLE_TESTS = 5, FLAT_TESTS = 6, MATERIAL_HITS = 7, MATERIAL_TYPES = MAT_TYPE_COUNT,
+                             ESCAPE_DEPTH = MATERIAL_HITS + MATERIAL_TYPES, DEPTH_BINS = 16,
+                             COUNT = ESCAPE_DEPTH + DEPTH_BINS;
+
+        std::array<uint64_t, COUNT> c{};
+
+        // The device keeps each counter as a (low, high) uint pair
+        static RayStatsCounters from_words(const std::vector<cl_uint>& words) {
+            RayStatsCounters s;
+            for (int i = 0; i < COUNT && 2 * i + 1 < (int)words.size(); ++i) {
+                s.c[i] = uint64_t(words[2 * i]) | (uint64_t(words[2 * i + 1]) << 32);
+            }
+            return s;
+        }
+
+        // `sphere_test_bytes`: global memory one sphere test reads; 16 for a sphere_geom entry,
+        // 0 when the kernel staged the spheres in local memory
+        void print(std::ostream& os, double render_ms, int max_bounces, size_t sphere_test_bytes) const {
+            auto ratio = [](uint64_t a, uint64_t b) { return b > 0 ? double(a) / double(b) : 0.0; };
+            const uint64_t paths = c[PATHS], rays = c[SEGMENTS];
+            const auto flags = os.flags();
+            const auto precision = os.precision();
+            os << std::fixed << std::setprecision(2);
+
+            os << "Ray stats: " << paths << " paths, " << rays << " rays (" << ratio(rays, paths) << " per path), "
+               << (render_ms > 0.0 ? double(rays) / (render_ms * 1e3) : 0.0) << " Mrays/s\n";
+            os << "  tests per ray: " << ratio(c[NODE_TESTS], rays) << " BVH boxes, " << ratio(c[SPHERE_TESTS], rays)
+               << " spheres, " << ratio(c[TRIANGLE_TESTS], rays) << " triangles, " << ratio(c[FLAT_TESTS], rays)
+               << " planes/boxes\n";
+            // against whole 48-byte Sphere records, which is what a test read before the hot/cold split
+            constexpr double RECORD_BYTES = 48.0, MB = 1024.0 * 1024.0;
+            os << "  sphere test traffic: " << double(c[SPHERE_TESTS] * sphere_test_bytes) / MB << " MB from global memory ("
+               << sphere_test_bytes << " B per test; " << double(c[SPHERE_TESTS]) * RECORD_BYTES / MB
+               << " MB as whole records)\n";
+
+            static const char* const names[MATERIAL_TYPES] = { "lambertian", "metal", "dielectric" };
+            os << "  hits:";
+            for (int t = 0; t < MATERIAL_TYPES; ++t) os << " " << names[t] << " " << c[MATERIAL_HITS + t];
+            os << ", sky " << c[SKY] << " (" << 100.0 * ratio(c[SKY], paths) << "% of paths)\n";
+
+            // paths that never escape ran into the bounce limit
+            os << "  paths escaping after N hits:";
+            for (int b = 0; b < DEPTH_BINS; ++b) {
+                if (c[ESCAPE_DEPTH + b] == 0) continue;
+                os << " " << b << (b == DEPTH_BINS - 1 ? "+" : "") << ": " << 100.0 * ratio(c[ESCAPE_DEPTH + b], paths) << "%";
+            }
+            os << "; depth limit (" << max_bounces << "): " << 100.0 * ratio(paths - std::min(paths, c[SKY]), paths) << "%\n";
+
+            os.flags(flags);
+            os.precision(precision);
+        }
+    };
+
+}
+
+#endif // CLRAYSTATS_HPP
@@ -113,7 +113,7 @@ namespace compute::clutils {
 
     inline cl::Program BuildProgram( cl::Context& context ,
                               const cl::Device& device, 
-                              const std::vector<const std::string>& kernel_sources, 
+                              const std::vector<std::string>& kernel_sources, 
                               const std::string build_options = "") {
         cl::Program::Sources sources;
         for (const auto& src : kernel_sources) {
@@ -133,12 +133,13 @@ namespace compute::clutils {
     inline std::filesystem::path find_directory(std::string dir_name = "kernels") {
         const std::filesystem::path start = std::filesystem::current_path();
 
-        // Walk up: start, parent, grandparent, ... until root
+        // Walk up: start, parent, grandparent, ... until root (its own parent)
         for (std::filesystem::path cur = start; !cur.empty(); cur = cur.parent_path()) {
             std::filesystem::path candidate = cur / dir_name;
             if (std::filesystem::exists(candidate) && std::filesystem::is_directory(candidate)) {
                 return std::filesystem::canonical(candidate);
             }
+            if (cur == cur.parent_path()) break;
         }
         throw std::runtime_error(
             "Couldn't find '" + dir_name + "' directory starting from: " + start.string());
@@ -0,0 +1,122 @@
+#include "pchray.h"
+
+#include "CLBackend.hpp"
+
+namespace compute {
+
+    void WavefrontTracer::initialize(const cl::Context& context, const cl::Program& program, clutils::EventLog& events,
+                                     unsigned material_mask) {
+        context_ = context;
+        events_ = &events;
+        material_mask_ = material_mask;
+
+        generate_   = cl::Kernel(program, "wf_generate");
+        extend_     = cl::Kernel(program, "wf_extend");
+        shade_      = cl::Kernel(program, "wf_shade");
+        accumulate_ = cl::Kernel(program, "wf_accumulate");
+    }
+
+    void WavefrontTracer::ensure_paths(size_t n) {
+        ensure(context_, seeds_,        n * sizeof(cl_uint2),  CL_MEM_READ_WRITE, seeds_bytes_);
+        ensure(context_, ray_o_,        n * sizeof(cl_float4), CL_MEM_READ_WRITE, ray_o_bytes_);
+        ensure(context_, ray_d_,        n * sizeof(cl_float4), CL_MEM_READ_WRITE, ray_d_bytes_);
+        ensure(context_, throughput_,   n * sizeof(cl_float4), CL_MEM_READ_WRITE, throughput_bytes_);
+        ensure(context_, radiance_,     n * sizeof(cl_float4), CL_MEM_READ_WRITE, radiance_bytes_);
+        ensure(context_, path_sum_,     n * sizeof(cl_float4), CL_MEM_READ_WRITE, path_sum_bytes_);
+        ensure(context_, hit_point_,    n * sizeof(cl_float4), CL_MEM_READ_WRITE, hit_point_bytes_);
+        ensure(context_, hit_normal_,   n * sizeof(cl_float4), CL_MEM_READ_WRITE, hit_normal_bytes_);
+        ensure(context_, hit_emission_, n * sizeof(cl_float4), CL_MEM_READ_WRITE, hit_emission_bytes_);
+        ensure(context_, hit_material_, n * sizeof(cl_int),    CL_MEM_READ_WRITE, hit_material_bytes_);
+        ensure(context_, ray_queue_,    n * sizeof(cl_uint),   CL_MEM_READ_WRITE, ray_queue_bytes_);
+        ensure(context_, shade_queue_,  MAT_TYPE_COUNT * n * sizeof(cl_uint), CL_MEM_READ_WRITE, shade_queue_bytes_);
+        ensure(context_, counts_,       (1 + MAT_TYPE_COUNT) * sizeof(cl_uint), CL_MEM_READ_WRITE, counts_bytes_);
+    }
+
+    void WavefrontTracer::trace_pass(cl::CommandQueue& q, int width, const cl::Buffer& camera, const cl::Buffer& materials,
+                                     cl_uint frame_seed, const cl::Buffer& active, cl_uint active_count,
+                                     cl_uint sample_index, int pass_spp, int max_bounces, cl::Buffer& accum, cl::Buffer& lum_sq) {
+        if (active_count == 0) return;
+        ensure_paths(active_count);
+
+        const cl_int paths = (cl_int)active_count;
+        const cl::NDRange items(active_count);
+        const cl_uint zero = 0;
+
+        generate_.setArg(0, (cl_int)width);
+        generate_.setArg(1, camera);
+        generate_.setArg(2, frame_seed);
+        generate_.setArg(3, active);
+        generate_.setArg(4, paths);
+        generate_.setArg(6, seeds_);
+        generate_.setArg(7, ray_o_);
+        generate_.setArg(8, ray_d_);
+        generate_.setArg(9, throughput_);
+        generate_.setArg(10, radiance_);
+        generate_.setArg(11, ray_queue_);
+
+        // scene arguments 0..24 are already bound by the backend
+        cl_uint a = SCENE_ARG_COUNT;
+        extend_.setArg(a++, ray_queue_);
+        extend_.setArg(a++, counts_);
+        extend_.setArg(a++, paths);
+        extend_.setArg(a++, ray_o_);
+        extend_.setArg(a++, ray_d_);
+        extend_.setArg(a++, throughput_);
+        extend_.setArg(a++, radiance_);
+        extend_.setArg(a++, hit_point_);
+        extend_.setArg(a++, hit_normal_);
+        extend_.setArg(a++, hit_emission_);
+        extend_.setArg(a++, hit_material_);
+        extend_.setArg(a++, shade_queue_);
+        const cl_uint bounce_arg = a; // then the caller's ray_stats
+
+        shade_.setArg(2, materials);
+        shade_.setArg(3, counts_);
+        shade_.setArg(4, paths);
+        shade_.setArg(5, shade_queue_);
+        shade_.setArg(6, ray_queue_);
+        shade_.setArg(7, seeds_);
+        shade_.setArg(8, ray_o_);
+        shade_.setArg(9, ray_d_);
+        shade_.setArg(10, throughput_);
+        shade_.setArg(11, radiance_);
+        shade_.setArg(12, hit_point_);
+        shade_.setArg(13, hit_normal_);
+        shade_.setArg(14, hit_emission_);
+        shade_.setArg(15, hit_material_);
+
+        accumulate_.setArg(0, active);
+        accumulate_.setArg(1, paths);
+        accumulate_.setArg(4, (cl_int)pass_spp);
+        accumulate_.setArg(5, radiance_);
+        accumulate_.setArg(6, path_sum_);
+        accumulate_.setArg(7, accum);
+        accumulate_.setArg(8, lum_sq);
+
+        // one wave per sample: every path is regenerated together, so a bounce index is uniform per launch
+        for (int s = 0; s < pass_spp; ++s) {
+            generate_.setArg(5, (cl_uint)(sample_index + s));
+            q.enqueueNDRangeKernel(generate_, cl::NullRange, items, cl::NullRange, nullptr, events_->next("wf_generate"));
+            q.enqueueFillBuffer(counts_, active_count, 0, sizeof(cl_uint), nullptr, events_->next("fill"));
+
+            for (int bounce = 0; bounce < max_bounces; ++bounce) {
+                q.enqueueFillBuffer(counts_, zero, sizeof(cl_uint), MAT_TYPE_COUNT * sizeof(cl_uint), nullptr, events_->next("fill"));
+                extend_.setArg(bounce_arg, (cl_int)bounce);
+                q.enqueueNDRangeKernel(extend_, cl::NullRange, items, cl::NullRange, nullptr, events_->next("wf_extend"));
+
+                // the shade stages refill the extend queue for the next bounce
+                q.enqueueFillBuffer(counts_, zero, 0, sizeof(cl_uint), nullptr, events_->next("fill"));
+                shade_.setArg(1, (cl_int)bounce);
+                for (int type = 0; type < MAT_TYPE_COUNT; ++type) {
+                    if (!(material_mask_ & (1u << type))) continue; // compiled out, its queue stays empty
+                    shade_.setArg(0, (cl_int)type);
+                    q.enqueueNDRangeKernel(shade_, cl::NullRange, items, cl::NullRange, nullptr, events_->next("wf_shade"));
+                }
+            }
+
+            accumulate_.setArg(2, (cl_int)(s == 0));
+            accumulate_.setArg(3, (cl_int)(s == pass_spp - 1));
+            q.enqueueNDRangeKernel(accumulate_, cl::NullRange, items, cl::NullRange, nullptr, events_->next("wf_accumulate"));
+        }
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef CLWAVEFRONT_HPP
+#define CLWAVEFRONT_HPP
+
+
+namespace compute {
+
+    /*
+    *   Host driver for the wavefront path tracer in kernels/wavefront.cl.
+    *   Runs one progressive pass as a sequence of stage kernels over SoA path state it owns;
+    *   the scene arguments of wf_extend are bound by the caller, in the render kernel's order.
+    */
+    class WavefrontTracer {
+    public:
+        static constexpr cl_uint SCENE_ARG_COUNT = 25; // leading wf_extend args, same as render's 0..24
+        static constexpr cl_uint RAY_STATS_ARG = SCENE_ARG_COUNT + 13; // last wf_extend arg, also bound by the caller
+
+        // Also rebinds the stage kernels to another program variant; path state is kept.
+        // `events` is kept and gets every enqueue, for the timeline; `material_mask` is the variant's
+        // MATERIAL_MASK (bit per material type), wf_shade is only launched for the types in it
+        void initialize(const cl::Context& context, const cl::Program& program, clutils::EventLog& events,
+                        unsigned material_mask);
+
+        cl::Kernel& extend_kernel() { return extend_; }
+
+        // Adds `pass_spp` samples, starting at sample `sample_index`, to every pixel in `active`;
+        // paths end after `max_bounces` extend/shade rounds
+        void trace_pass(cl::CommandQueue& q, int width, const cl::Buffer& camera, const cl::Buffer& materials,
+                        cl_uint frame_seed, const cl::Buffer& active, cl_uint active_count,
+                        cl_uint sample_index, int pass_spp, int max_bounces, cl::Buffer& accum, cl::Buffer& lum_sq);
+
+    private:
+        cl::Context context_;
+        clutils::EventLog* events_ = nullptr;
+
+        cl::Kernel generate_, extend_, shade_, accumulate_;
+        unsigned material_mask_ = 0;
+
+        // path state, one entry per active pixel, grown on demand
+        cl::Buffer seeds_, ray_o_, ray_d_, throughput_, radiance_, path_sum_;
+        cl::Buffer hit_point_, hit_normal_, hit_emission_, hit_material_;
+        cl::Buffer ray_queue_, shade_queue_, counts_;
+        size_t seeds_bytes_ = 0, ray_o_bytes_ = 0, ray_d_bytes_ = 0, throughput_bytes_ = 0,
+               radiance_bytes_ = 0, path_sum_bytes_ = 0,
+               hit_point_bytes_ = 0, hit_normal_bytes_ = 0, hit_emission_bytes_ = 0, hit_material_bytes_ = 0,
+               ray_queue_bytes_ = 0, shade_queue_bytes_ = 0, counts_bytes_ = 0;
+
+        void ensure_paths(size_t path_count);
+    };
+
+}
+
+#endif // CLWAVEFRONT_HPP
@@ -0,0 +1,227 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <chrono>
+#include "DTOs.hpp"
+
+
+
+namespace compute::serialize {
+
+    // Must match BVH_MAX_DEPTH in the kernel: the traversal stack holds at most one entry per level
+    constexpr int BVH_MAX_DEPTH = 64;
+
+    struct Aabb {
+        glm::vec3 min{ std::numeric_limits<float>::max()};
+        glm::vec3 max{-std::numeric_limits<float>::max()};
+
+        void grow(const glm::vec3& p)  { min = glm::min(min, p);     max = glm::max(max, p); }
+        void grow(const Aabb& b)       { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+        bool empty() const             { return min.x > max.x; }
+        glm::vec3 center() const       { return (min + max) * 0.5f; }
+
+        float surface_area() const {
+            if (empty()) return 0.0f;
+            glm::vec3 e = max - min;
+            return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+    };
+
+    struct BvhBuildOptions {
+        int sah_bins      = 16;  // quality knob: more bins find better splits but build slower
+        int max_leaf_size = 4;   // leaves may hold more only when no split is possible
+        float traversal_cost = 1.0f;  // SAH cost of visiting an inner node ...
+        float intersect_cost = 1.0f;  // ... relative to one primitive test
+        bool enabled = true;  // false when the hierarchy is built elsewhere (device LBVH)
+    };
+
+    // Flattened BVH: nodes[0] is the root, leaves index into prims
+    struct Bvh {
+        std::vector<BvhNodeGpu> nodes;
+        std::vector<cl_int>     prims;
+        BvhBuildStats           stats;
+    };
+
+    inline BvhNodeGpu make_bvh_node(const Aabb& b, int parent) {
+        BvhNodeGpu n{};
+        n.bbox_min   = cl_float4{{b.min.x, b.min.y, b.min.z, 0.0f}};
+        n.bbox_max   = cl_float4{{b.max.x, b.max.y, b.max.z, 0.0f}};
+        n.left_first = 0;
+        n.count      = 0;
+        n.right      = -1;
+        n.parent     = parent;
+        return n;
+    }
+
+    /*
+    *   Top-down binned SAH builder over arbitrary primitive bounds.
+    *   Every node evaluates `sah_bins` candidate planes per axis on the centroid bounds and
+    *   keeps the cheapest; a node becomes a leaf when no split beats intersecting all of its
+    *   primitives (and it is small enough), or when the depth limit is reached.
+    */
+    inline Bvh build_bvh(const std::vector<Aabb>& prim_bounds, const BvhBuildOptions& opt = {}) {
+        auto start = std::chrono::high_resolution_clock::now();
+
+        const int bins = std::max(2, opt.sah_bins);
+        const int max_leaf = std::max(1, opt.max_leaf_size);
+        const int n = (int)prim_bounds.size();
+
+        Bvh bvh;
+        bvh.prims.resize(n);
+        for (int i = 0; i < n; ++i) bvh.prims[i] = i;
+
+        std::vector<glm::vec3> centroids(n);
+        for (int i = 0; i < n; ++i) centroids[i] = prim_bounds[i].center();
+
+        bvh.nodes.reserve(n > 0 ? 2 * n - 1 : 1);
+        bvh.nodes.push_back(make_bvh_node(Aabb{}, -1));
+        if (n == 0) {
+            // empty leaf with a degenerate box at the origin keeps the traversal branch-free
+            Aabb origin; origin.grow(glm::vec3(0.0f));
+            bvh.nodes[0] = make_bvh_node(origin, -1);
+            bvh.stats.node_count = bvh.stats.leaf_count = 1;
+            return bvh;
+        }
+
+        struct Task { int node, begin, end, depth; };
+        std::vector<Task> stack;
+        stack.push_back({0, 0, n, 0});
+
+        struct Bin { Aabb bounds; int count = 0; };
+        std::vector<Bin> bin_data(bins);
+        std::vector<float> right_area(bins), right_count(bins);
+
+        float root_area = 0.0f;
+
+        while (!stack.empty()) {
+            Task task = stack.back();
+            stack.pop_back();
+
+            Aabb bounds, centroid_bounds;
+            for (int i = task.begin; i < task.end; ++i) {
+                bounds.grow(prim_bounds[bvh.prims[i]]);
+                centroid_bounds.grow(centroids[bvh.prims[i]]);
+            }
+
+            BvhNodeGpu& node = bvh.nodes[task.node];
+            node.bbox_min = cl_float4{{bounds.min.x, bounds.min.y, bounds.min.z, 0.0f}};
+            node.bbox_max = cl_float4{{bounds.max.x, bounds.max.y, bounds.max.z, 0.0f}};
+
+            const int count = task.end - task.begin;
+            const float area = bounds.surface_area();
+            if (task.node == 0) root_area = area > 0.0f ? area : 1.0f;
+
+            bvh.stats.max_depth = std::max(bvh.stats.max_depth, task.depth);
+
+            auto make_leaf = [&]() {
+                node.left_first = task.begin;
+                node.count      = count;
+                bvh.stats.leaf_count++;
+                bvh.stats.sah_cost += opt.intersect_cost * count * area / root_area;
+            };
+
+            if (count <= 1 || task.depth + 1 >= BVH_MAX_DEPTH) {
+                make_leaf();
+                continue;
+            }
+
+            // Binned SAH sweep over all three axes
+            int   best_axis = -1, best_split = 0;
+            float best_cost = std::numeric_limits<float>::max();
+            const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+            for (int axis = 0; axis < 3; ++axis) {
+                if (extent[axis] <= 0.0f) continue;
+                const float scale = bins / extent[axis];
+
+                for (auto& b : bin_data) b = Bin{};
+                for (int i = task.begin; i < task.end; ++i) {
+                    int prim = bvh.prims[i];
+                    int b = std::min(bins - 1, (int)((centroids[prim][axis] - centroid_bounds.min[axis]) * scale));
+                    bin_data[b].count++;
+                    bin_data[b].bounds.grow(prim_bounds[prim]);
+                }
+
+                // right-to-left prefix of bounds/counts, then one left-to-right sweep
+                Aabb acc; int acc_count = 0;
+                for (int b = bins - 1; b > 0; --b) {
+                    acc.grow(bin_data[b].bounds);
+                    acc_count += bin_data[b].count;
+                    right_area[b]  = acc.surface_area();
+                    right_count[b] = (float)acc_count;
+                }
+                acc = Aabb{}; acc_count = 0;
+                for (int b = 0; b < bins - 1; ++b) {
+                    acc.grow(bin_data[b].bounds);
+                    acc_count += bin_data[b].count;
+                    if (acc_count == 0 || acc_count == count) continue;
+                    float cost = acc.surface_area() * acc_count + right_area[b + 1] * right_count[b + 1];
+                    if (cost < best_cost) {
+                        best_cost  = cost;
+                        best_axis  = axis;
+                        best_split = b;
+                    }
+                }
+            }
+
+            const float leaf_cost = opt.intersect_cost * count;
+            const float split_cost = best_axis < 0 ? std::numeric_limits<float>::max()
+                                   : opt.traversal_cost + opt.intersect_cost * best_cost / (area > 0.0f ? area : 1.0f);
+
+            if (split_cost >= leaf_cost && count <= max_leaf) {
+                make_leaf();
+                continue;
+            }
+
+            int mid;
+            if (best_axis >= 0) {
+                const float scale = bins / extent[best_axis];
+                const float cmin  = centroid_bounds.min[best_axis];
+                auto it = std::partition(bvh.prims.begin() + task.begin, bvh.prims.begin() + task.end,
+                    [&](cl_int prim) {
+                        int b = std::min(bins - 1, (int)((centroids[prim][best_axis] - cmin) * scale));
+                        return b <= best_split;
+                    });
+                mid = (int)(it - bvh.prims.begin());
+            } else {
+                // all centroids coincide: no plane separates them, split the range in half
+                mid = task.begin + count / 2;
+            }
+
+            const int left = (int)bvh.nodes.size();
+            bvh.nodes.push_back(make_bvh_node(Aabb{}, task.node));
+            bvh.nodes.push_back(make_bvh_node(Aabb{}, task.node));
+
+            BvhNodeGpu& parent = bvh.nodes[task.node]; // re-fetch: push_back may reallocate
+            parent.left_first = left;
+            parent.right      = left + 1;
+            parent.count      = 0;
+            bvh.stats.sah_cost += opt.traversal_cost * area / root_area;
+
+            stack.push_back({left + 1, mid, task.end, task.depth + 1});
+            stack.push_back({left,     task.begin, mid, task.depth + 1});
+        }
+
+        bvh.stats.node_count = (int)bvh.nodes.size();
+        auto end = std::chrono::high_resolution_clock::now();
+        bvh.stats.build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+        return bvh;
+    }
+
+    inline Aabb sphere_bounds(const SphereGpu& s) {
+        glm::vec3 c(s.center_r.s[0], s.center_r.s[1], s.center_r.s[2]);
+        float r = std::fabs(s.center_r.s[3]);
+        Aabb b;
+        b.grow(c - glm::vec3(r));
+        b.grow(c + glm::vec3(r));
+        return b;
+    }
+
+    inline void print_bvh_stats(const char* label, const BvhBuildStats& st) {
+        std::cout << label << ": " << st.node_count << " nodes, " << st.leaf_count << " leaves, depth "
+                  << st.max_depth << ", SAH cost " << st.sah_cost << ", built in " << st.build_ms << " ms\n";
+    }
+
+}
+
+#endif // BVH_HPP
@@ -7,6 +7,7 @@ namespace compute::serialize {
     #define MAT_LAMBERTIAN 0
     #define MAT_METAL 1
     #define MAT_DIELECTRIC 2
+    #define MAT_TYPE_COUNT 3 // sizes the per-type tables and wavefront queues; keep in step with common.cl
 
 
     struct CameraGpu {
@@ -35,30 +36,117 @@ namespace compute::serialize {
         cl_int _pad0,_pad1,_pad2;
     };
 
-    // Triangels and meshes will be support in future versions
-    // struct TriGpu { uint32_t i0,i1,i2, material_index; };
+    // Infinite plane; kept out of the BVH since it has no finite bounds
+    struct PlaneGpu {
+        cl_float4 normal_d;     // xyz unit normal, w = dot(normal, point on plane)
+        cl_float4 emission;
+        cl_int    material_index;
+        cl_int    _pad0, _pad1, _pad2;
+    };
+
+    // Axis-aligned box
+    struct BoxGpu {
+        cl_float4 bmin;         // xyz used
+        cl_float4 bmax;         // xyz used
+        cl_float4 emission;
+        cl_int    material_index;
+        cl_int    _pad0, _pad1, _pad2;
+    };
+
+    // Compressed world sphere, 8 bytes instead of 48; stored in BVH leaf order so leaves need no bvh_prims lookup
+    struct SphereQGpu {
+        cl_ushort4 qpos_palette; // xyz: center quantized to 16 bits inside its leaf's box, w: sphere_palette entry
+    };
+
+    // Everything a compressed sphere does not store itself; shared by all spheres that agree on it
+    struct SpherePaletteGpu {
+        cl_float4 emission;
+        cl_float  radius;
+        cl_int    material_index;
+        cl_int    _pad0, _pad1;
+    };
+
+    struct BvhNodeGpu {
+        cl_float4 bbox_min;     // xyz used
+        cl_float4 bbox_max;     // xyz used
+        cl_int    left_first;   // inner: left child node; leaf: first entry in bvh_prims
+        cl_int    count;        // leaf: primitive count; inner: 0
+        cl_int    right;        // inner: right child node; leaf: -1
+        cl_int    parent;       // -1 for the root
+    };
+
+    // One placement of a sphere group; rays are moved into object space instead of the spheres into world space
+    struct InstanceGpu {
+        cl_float4 world_to_object[3]; // rows of the inverse affine transform (xyz linear, w translation)
+        cl_int    blas_root;          // root of the group's BVH in PackedScene::inst_nodes
+        cl_int    _pad0, _pad1, _pad2;
+    };
+
+    // Host-side summary of the last BVH build (not uploaded)
+    struct BvhBuildStats {
+        double build_ms   = 0.0;
+        int    node_count = 0;
+        int    leaf_count = 0;
+        int    max_depth  = 0;
+        float  sah_cost   = 0.0f;  // expected cost per ray, in primitive tests
+    };
+
+    // Triangle of a packed mesh; indices point into PackedScene::mesh_positions
+    struct TriGpu {
+        cl_uint i0, i1, i2;
+        cl_int  mesh;           // entry in PackedScene::meshes (material, emission)
+    };
 
-    // struct MeshGpu {
-    //     uint32_t index_offset, index_count;   // indices slice (triangles)
-    //     uint32_t vert_offset,  vert_count;    // vertices slice
-    //     int32_t  material_index; int32_t _pad[3];
-    // };
+    struct MeshGpu {
+        cl_float4 emission;
+        cl_int    bvh_root;     // root of the mesh's BVH in PackedScene::mesh_nodes
+        cl_int    material_index;
+        cl_int    _pad0, _pad1;
+    };
 
     // A fully flattened scene ready to upload
     struct PackedScene {
         CameraGpu camera;
 
-        // // Mesh SoA
-        // std::vector<cl_float4> positions4;  // xyz used
-        // std::vector<cl_float4> normals4;    // optional (may be empty)
-        // std::vector<cl_float4> uvs4;        // xy used
-
-        // std::vector<TriGpu>    triangles;
-        // std::vector<MeshGpu>   meshes;
-
-        // Spheres & materials
+        // Spheres & materials; spheres of instanced groups follow the first world_sphere_count
         std::vector<SphereGpu>   spheres;
+        cl_int                   world_sphere_count = 0;
         std::vector<MaterialGpu> materials;
+        std::vector<const Material*> material_sources; // host material of each entry, for incremental repacks
+        uint64_t                 revision = 0;           // Scene::revision() this packing reflects
+
+        // Sphere BVH: nodes[0] is the root, leaves index spheres through bvh_prims
+        std::vector<BvhNodeGpu>  bvh_nodes;
+        std::vector<cl_int>      bvh_prims;
+        BvhBuildStats            bvh_stats;
+
+        // Meshes: one BVH per mesh in mesh_nodes, whose leaves index triangles directly (they are
+        // stored in leaf order); positions and triangles are separate arrays
+        std::vector<MeshGpu>     meshes;
+        std::vector<BvhNodeGpu>  mesh_nodes;
+        std::vector<TriGpu>      triangles;
+        std::vector<cl_float4>   mesh_positions; // xyz used
+        BvhBuildStats            mesh_stats;     // summed over all meshes; build_ms is wall time
+        // identifies the packed geometry so uploads can be skipped; holding the meshes keeps a freed
+        // mesh's address from being reused by a new one while it is compared
+        std::vector<std::shared_ptr<const Mesh>> mesh_sources;
+
+        // Analytic primitives, tested as flat lists next to the sphere BVH
+        std::vector<PlaneGpu>    planes;
+        std::vector<BoxGpu>      boxes;
+
+        // Compressed world spheres (replace spheres[0, world_sphere_count) and bvh_prims when enabled)
+        std::vector<SphereQGpu>       spheres_q;
+        std::vector<SpherePaletteGpu> sphere_palette;
+
+        // Instancing: the top-level BVH over instances starts at inst_nodes[0] and its leaves index
+        // instances; every unique group's bottom-level BVH follows, with leaves indexing spheres
+        std::vector<InstanceGpu> instances;
+        std::vector<BvhNodeGpu>  inst_nodes;
+        std::vector<cl_int>      inst_prims;
+        BvhBuildStats            tlas_stats;
+        int                      group_count = 0;
+        size_t                   flattened_sphere_count = 0; // world spheres + every instanced copy
     };
 }
 
@@ -1,8 +1,13 @@
 #ifndef SERIALIZE_HPP
 #define SERIALIZE_HPP
 
+#include <array>
+#include <cstring>
+#include <map>
 #include <unordered_map>
 #include "DTOs.hpp"
+#include "BVH.hpp"
+#include "WorkStealing.hpp"
 
 
 
@@ -21,6 +26,32 @@ namespace compute::serialize {
         return g;
     }
 
+    inline SphereGpu to_gpu(const Sphere& s, int material_index) {
+        SphereGpu g = to_gpu(s);
+        g.material_index = material_index;
+        return g;
+    }
+
+    inline MaterialGpu to_gpu(const Material& m) {
+        MaterialGpu mg{}; // zero-init padding too
+        if (auto* lam = dynamic_cast<const Lambertian*>(&m); lam != nullptr) {
+            mg.type          = MAT_LAMBERTIAN;
+            mg.albedo_fuzz   = to_f4(lam->albedo, 0.0f);
+            mg.ref_idx       = 1.0f;
+        } else if (auto* met = dynamic_cast<const Metal*>(&m); met != nullptr) {
+            mg.type          = MAT_METAL;
+            mg.albedo_fuzz   = to_f4(met->albedo, met->fuzz);
+            mg.ref_idx       = 1.0f;
+        } else if (auto* die = dynamic_cast<const Dielectric*>(&m); die != nullptr) {
+            mg.type          = MAT_DIELECTRIC;
+            mg.albedo_fuzz   = to_f4({1,1,1}, 0.0f); // unused; keep sane default
+            mg.ref_idx       = die->ref_idx;
+        } else {
+            throw std::runtime_error("Unknown material subtype");
+        }
+        return mg;
+    }
+
     inline std::vector<SphereGpu> to_gpu(std::vector<Sphere>& in) {
         std::vector<SphereGpu> out;
         out.reserve(in.size());
@@ -38,8 +69,283 @@ namespace compute::serialize {
         return g;
     }
 
+    // Builds the sphere BVH of an already packed scene (world spheres only; groups get their own)
+    inline void build_sphere_bvh(PackedScene& ps, const BvhBuildOptions& opt = {}) {
+        std::vector<Aabb> bounds;
+        bounds.reserve(ps.world_sphere_count);
+        for (int i = 0; i < ps.world_sphere_count; ++i) bounds.push_back(sphere_bounds(ps.spheres[i]));
+
+        Bvh bvh = build_bvh(bounds, opt);
+        ps.bvh_nodes = std::move(bvh.nodes);
+        ps.bvh_prims = std::move(bvh.prims);
+        ps.bvh_stats = bvh.stats;
+    }
+
+    constexpr int SPHERE_PALETTE_MAX = 65536; // palette index is 16 bits
+
+    /*
+    *   Replaces the world spheres with 8-byte SphereQGpu records in BVH leaf order.
+    *   Each leaf box becomes the quantization frame of its spheres; it is widened by one
+    *   quantization step per side first, so every decoded sphere still lies inside it.
+    *   Inner boxes are refit afterwards. Needs the world BVH, and must run before any
+    *   group spheres are appended (those stay uncompressed).
+    */
+    inline void compress_world_spheres(PackedScene& ps) {
+        const int n = ps.world_sphere_count;
+        if ((int)ps.spheres.size() != n || (n > 0 && ps.bvh_nodes.empty())) {
+            throw std::runtime_error("Sphere compression needs the world BVH and only world spheres packed");
+        }
+
+        std::map<std::array<uint32_t, 5>, int> palette_index;
+        auto bits = [](float f) { uint32_t u; std::memcpy(&u, &f, sizeof u); return u; };
+
+        ps.spheres_q.assign(n, SphereQGpu{});
+        ps.sphere_palette.clear();
+
+        for (BvhNodeGpu& node : ps.bvh_nodes) {
+            if (node.right >= 0 || node.count == 0) continue;
+
+            glm::vec3 lo(node.bbox_min.s[0], node.bbox_min.s[1], node.bbox_min.s[2]);
+            glm::vec3 hi(node.bbox_max.s[0], node.bbox_max.s[1], node.bbox_max.s[2]);
+            const glm::vec3 pad = (hi - lo) / 65534.0f;
+            lo -= pad;
+            hi += pad;
+            node.bbox_min = cl_float4{{lo.x, lo.y, lo.z, 0.0f}};
+            node.bbox_max = cl_float4{{hi.x, hi.y, hi.z, 0.0f}};
+            const glm::vec3 step = (hi - lo) * (1.0f / 65535.0f);
+
+            for (int i = node.left_first; i < node.left_first + node.count; ++i) {
+                const SphereGpu& sphere = ps.spheres[ps.bvh_prims[i]];
+
+                std::array<uint32_t, 5> key = { bits(sphere.center_r.s[3]), (uint32_t)sphere.material_index,
+                    bits(sphere.emission.s[0]), bits(sphere.emission.s[1]), bits(sphere.emission.s[2]) };
+                auto it = palette_index.find(key);
+                if (it == palette_index.end()) {
+                    if ((int)ps.sphere_palette.size() == SPHERE_PALETTE_MAX) {
+                        throw std::runtime_error("Sphere compression: more than 65536 distinct radius/material/emission combinations");
+                    }
+                    SpherePaletteGpu entry{};
+                    entry.emission       = sphere.emission;
+                    entry.radius         = sphere.center_r.s[3];
+                    entry.material_index = sphere.material_index;
+                    it = palette_index.emplace(key, (int)ps.sphere_palette.size()).first;
+                    ps.sphere_palette.push_back(entry);
+                }
+
+                SphereQGpu& q = ps.spheres_q[i];
+                for (int axis = 0; axis < 3; ++axis) {
+                    float cell = step[axis] > 0.0f ? (sphere.center_r.s[axis] - lo[axis]) / step[axis] : 0.0f;
+                    q.qpos_palette.s[axis] = (cl_ushort)std::clamp(std::lround(cell), 0L, 65535L);
+                }
+                q.qpos_palette.s[3] = (cl_ushort)it->second;
+            }
+        }
+
+        // children always sit after their parent, so a reverse sweep refits bottom-up
+        for (int i = (int)ps.bvh_nodes.size() - 1; i >= 0; --i) {
+            BvhNodeGpu& node = ps.bvh_nodes[i];
+            if (node.right < 0) continue;
+            const BvhNodeGpu& l = ps.bvh_nodes[node.left_first];
+            const BvhNodeGpu& r = ps.bvh_nodes[node.right];
+            for (int axis = 0; axis < 3; ++axis) {
+                node.bbox_min.s[axis] = std::min(l.bbox_min.s[axis], r.bbox_min.s[axis]);
+                node.bbox_max.s[axis] = std::max(l.bbox_max.s[axis], r.bbox_max.s[axis]);
+            }
+        }
+
+        ps.spheres.clear();
+        ps.bvh_prims.clear();
+        ps.world_sphere_count = 0;
+    }
+
+    inline void print_compression_stats(const PackedScene& ps) {
+        if (ps.spheres_q.empty()) return;
+        const size_t packed = ps.spheres_q.size() * sizeof(SphereQGpu) + ps.sphere_palette.size() * sizeof(SpherePaletteGpu);
+        const size_t full   = ps.spheres_q.size() * (sizeof(SphereGpu) + sizeof(cl_int)); // spheres + bvh_prims
+        std::cout << "Compressed spheres: " << ps.spheres_q.size() << " x " << sizeof(SphereQGpu) << " B + "
+                  << ps.sphere_palette.size() << " palette entries = " << packed / 1024.0 << " KiB (uncompressed "
+                  << full / 1024.0 << " KiB)\n";
+    }
+
+    // Range of PackedScene::spheres holding one unique sphere group
+    struct GroupRange { int first, count; };
+
+    inline Aabb transform_bounds(const Aabb& b, const glm::mat4& m) {
+        Aabb out;
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec3 p((corner & 1) ? b.max.x : b.min.x,
+                        (corner & 2) ? b.max.y : b.min.y,
+                        (corner & 4) ? b.max.z : b.min.z);
+            out.grow(glm::vec3(m * glm::vec4(p, 1.0f)));
+        }
+        return out;
+    }
+
+    /*
+    *   Two-level acceleration structure: one bottom-level BVH per unique group (sphere indices
+    *   are global), and a top-level BVH over the world-space bounds of every instance.
+    *   `group_of[i]` maps instance i to its entry in `groups`.
+    */
+    inline void build_instance_bvhs(PackedScene& ps, const std::vector<GroupRange>& groups,
+                                    const std::vector<Instance>& instances, const std::vector<int>& group_of,
+                                    const BvhBuildOptions& opt = {}) {
+        ps.inst_nodes.clear();
+        ps.inst_prims.clear();
+        ps.instances.clear();
+        ps.group_count = (int)groups.size();
+
+        std::vector<Aabb> instance_bounds;
+        instance_bounds.reserve(instances.size());
+
+        std::vector<int>  blas_root(groups.size());
+        std::vector<Aabb> blas_bounds(groups.size());
+        std::vector<Bvh>  blas(groups.size());
+        for (size_t g = 0; g < groups.size(); ++g) {
+            std::vector<Aabb> bounds;
+            bounds.reserve(groups[g].count);
+            for (int i = 0; i < groups[g].count; ++i) bounds.push_back(sphere_bounds(ps.spheres[groups[g].first + i]));
+            blas[g] = build_bvh(bounds, opt);
+            for (const auto& b : bounds) blas_bounds[g].grow(b);
+        }
+
+        for (size_t i = 0; i < instances.size(); ++i) {
+            const int g = group_of[i];
+            instance_bounds.push_back(blas_bounds[g].empty() ? blas_bounds[g]
+                                      : transform_bounds(blas_bounds[g], instances[i].get_transform()));
+        }
+
+        // top level first so its root is inst_nodes[0]
+        Bvh tlas = build_bvh(instance_bounds, opt);
+        ps.inst_nodes = std::move(tlas.nodes);
+        ps.inst_prims = std::move(tlas.prims);
+        ps.tlas_stats = tlas.stats;
+
+        // bottom levels appended with node, prim and sphere offsets applied
+        for (size_t g = 0; g < groups.size(); ++g) {
+            const int node_base = (int)ps.inst_nodes.size();
+            const int prim_base = (int)ps.inst_prims.size();
+            blas_root[g] = node_base;
+            for (BvhNodeGpu n : blas[g].nodes) {
+                if (n.right >= 0) { n.left_first += node_base; n.right += node_base; }
+                else              { n.left_first += prim_base; }
+                if (n.parent >= 0) n.parent += node_base;
+                ps.inst_nodes.push_back(n);
+            }
+            for (cl_int prim : blas[g].prims) ps.inst_prims.push_back(groups[g].first + prim);
+        }
+
+        ps.instances.reserve(instances.size());
+        for (size_t i = 0; i < instances.size(); ++i) {
+            const glm::mat4 inv = glm::inverse(instances[i].get_transform());
+            InstanceGpu gi{};
+            for (int r = 0; r < 3; ++r) {
+                gi.world_to_object[r] = cl_float4{{inv[0][r], inv[1][r], inv[2][r], inv[3][r]}};
+            }
+            gi.blas_root = blas_root[group_of[i]];
+            ps.instances.push_back(gi);
+            ps.flattened_sphere_count += groups[group_of[i]].count;
+        }
+    }
+
+    inline void print_instance_stats(const PackedScene& ps) {
+        if (ps.instances.empty()) return;
+        std::cout << "Instancing: " << ps.instances.size() << " instances of " << ps.group_count << " groups, "
+                  << ps.spheres.size() << " spheres resident (" << ps.flattened_sphere_count << " if flattened)\n";
+        print_bvh_stats("Instance TLAS", ps.tlas_stats);
+    }
+
+    /*
+    *   Flattens every mesh into the shared position/triangle arrays and builds one BVH per mesh.
+    *   Meshes are independent, so their BVHs are built in parallel; each mesh's triangles are then
+    *   stored in leaf order, which lets a leaf address them directly instead of through a prims table.
+    */
+    inline void pack_meshes(PackedScene& ps, const std::vector<std::shared_ptr<const Mesh>>& meshes,
+                            const std::vector<int>& material_of, const BvhBuildOptions& opt = {}) {
+        auto start = std::chrono::high_resolution_clock::now();
+        const size_t count = meshes.size();
+
+        std::vector<size_t> vertex_base(count), tri_base(count);
+        size_t vertex_count = 0, tri_count = 0;
+        for (size_t m = 0; m < count; ++m) {
+            vertex_base[m] = vertex_count;
+            tri_base[m]    = tri_count;
+            vertex_count  += meshes[m]->get_positions().size();
+            tri_count     += meshes[m]->get_triangle_count();
+        }
+        if (vertex_count > std::numeric_limits<cl_uint>::max() || tri_count > (size_t)std::numeric_limits<cl_int>::max()) {
+            throw std::runtime_error("Meshes too large for 32-bit vertex and triangle indices");
+        }
+
+        ps.mesh_positions.resize(vertex_count);
+        ps.triangles.resize(tri_count);
+        ps.meshes.assign(count, MeshGpu{});
+        ps.mesh_sources.clear();
+        std::vector<Bvh> bvh(count);
+
+        cpu::WorkStealingScheduler scheduler;
+        scheduler.run(count, [&](size_t m, unsigned) {
+            const std::vector<glm::vec3>& pos = meshes[m]->get_positions();
+            const std::vector<uint32_t>&  idx = meshes[m]->get_indices();
+            const size_t n = meshes[m]->get_triangle_count();
+
+            for (size_t v = 0; v < pos.size(); ++v) ps.mesh_positions[vertex_base[m] + v] = to_f4(pos[v]);
+
+            std::vector<Aabb> bounds(n);
+            for (size_t t = 0; t < n; ++t) {
+                bounds[t].grow(pos[idx[3 * t + 0]]);
+                bounds[t].grow(pos[idx[3 * t + 1]]);
+                bounds[t].grow(pos[idx[3 * t + 2]]);
+            }
+            bvh[m] = build_bvh(bounds, opt);
+
+            for (size_t k = 0; k < n; ++k) {
+                const size_t t = (size_t)bvh[m].prims[k];
+                TriGpu& tri = ps.triangles[tri_base[m] + k];
+                tri.i0   = (cl_uint)(vertex_base[m] + idx[3 * t + 0]);
+                tri.i1   = (cl_uint)(vertex_base[m] + idx[3 * t + 1]);
+                tri.i2   = (cl_uint)(vertex_base[m] + idx[3 * t + 2]);
+                tri.mesh = (cl_int)m;
+            }
+        });
+
+        // concatenate the trees with node and triangle offsets applied
+        ps.mesh_nodes.clear();
+        ps.mesh_stats = BvhBuildStats{};
+        for (size_t m = 0; m < count; ++m) {
+            const int node_base = (int)ps.mesh_nodes.size();
+            for (BvhNodeGpu n : bvh[m].nodes) {
+                if (n.right >= 0) { n.left_first += node_base; n.right += node_base; }
+                else              { n.left_first += (cl_int)tri_base[m]; }
+                if (n.parent >= 0) n.parent += node_base;
+                ps.mesh_nodes.push_back(n);
+            }
+
+            MeshGpu& mg = ps.meshes[m];
+            mg.emission       = to_f4(meshes[m]->get_emission());
+            mg.bvh_root       = node_base;
+            mg.material_index = material_of[m];
+            ps.mesh_sources.push_back(meshes[m]);
+
+            ps.mesh_stats.node_count += bvh[m].stats.node_count;
+            ps.mesh_stats.leaf_count += bvh[m].stats.leaf_count;
+            ps.mesh_stats.max_depth   = std::max(ps.mesh_stats.max_depth, bvh[m].stats.max_depth);
+        }
+
+        auto end = std::chrono::high_resolution_clock::now();
+        ps.mesh_stats.build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    inline void print_mesh_stats(const PackedScene& ps) {
+        if (ps.meshes.empty()) return;
+        const BvhBuildStats& st = ps.mesh_stats;
+        std::cout << "Meshes: " << ps.meshes.size() << " meshes, " << ps.triangles.size() << " triangles, "
+                  << ps.mesh_positions.size() << " vertices; BVHs " << st.node_count << " nodes, " << st.leaf_count
+                  << " leaves, depth " << st.max_depth << ", packed in " << st.build_ms << " ms\n";
+    }
+
     // Main packer: builds a PackedScene from a host Scene + Camera
-    inline PackedScene pack_scene(const Scene& src, const Camera& cam)
+    inline PackedScene pack_scene(const Scene& src, const Camera& cam, const BvhBuildOptions& bvh_opt = {},
+                                  bool compress_spheres = false)
     {
         PackedScene out{};
         out.camera = to_gpu(cam);
@@ -53,26 +359,12 @@ namespace compute::serialize {
         auto* key = mptr.get();
         if (auto it = mat_index.find(key); it != mat_index.end())
             return it->second;
-        MaterialGpu mg{}; // zero-init padding too
-        if (auto* lam = dynamic_cast<Lambertian*>(key); lam != nullptr) {
-            mg.type          = MAT_LAMBERTIAN;
-            mg.albedo_fuzz   = to_f4(lam->albedo, 0.0f);
-            mg.ref_idx       = 1.0f;
-        } else if (auto* met = dynamic_cast<Metal*>(key); met != nullptr) {
-            mg.type          = MAT_METAL;
-            mg.albedo_fuzz   = to_f4(met->albedo, met->fuzz);
-            mg.ref_idx       = 1.0f;
-        } else if (auto* die = dynamic_cast<Dielectric*>(key); die != nullptr) {
-            mg.type          = MAT_DIELECTRIC;
-            mg.albedo_fuzz   = to_f4({1,1,1}, 0.0f); // unused; keep sane default
-            mg.ref_idx       = die->ref_idx;
-        } else {
-            throw std::runtime_error("Unknown material subtype");
-        }
+        if (!key) throw std::runtime_error("Object without a material");
 
         int idx = (int)out.materials.size();
         mat_index.emplace(key, idx);
-        out.materials.push_back(mg);
+        out.materials.push_back(to_gpu(*key));
+        out.material_sources.push_back(key);
         return idx;
 
         };
@@ -81,54 +373,134 @@ namespace compute::serialize {
         // Spheres
         out.spheres.reserve(src.spheres.size());
         for (auto& s : src.spheres) {
-            SphereGpu gs{};
-            gs.center_r        = to_f4(s.get_center_pos(), s.get_radius());
-            gs.emission        = to_f4(s.get_emission());
-            gs.material_index  = add_material(s.get_material_ptr()); // reuses index if already added
-            out.spheres.push_back(gs);
-        }
-
-        // // Meshes: flatten into SoA + concatenated triangle list
-        // out.positions4.clear(); out.normals4.clear(); out.uvs4.clear();
-        // out.triangles.clear();  out.meshes.clear();
-        // for (const auto& m : src.meshes) {
-        //     MeshGpu mg{};
-        //     mg.vert_offset  = (uint32_t)out.positions4.size();
-        //     mg.vert_count   = (uint32_t)m.positions.size();
-        //     mg.index_offset = (uint32_t)out.triangles.size();
-        //     mg.index_count  = (uint32_t)m.indices.size();
-        //     mg.material_index = m.material_index;
-        //     // positions
-        //     out.positions4.reserve(out.positions4.size() + m.positions.size());
-        //     for (auto& p : m.positions) out.positions4.push_back(to_f4(p));
-        //     // normals (optional)
-        //     if (!m.normals.empty()) {
-        //         out.normals4.reserve(out.normals4.size() + m.normals.size());
-        //         for (auto& n : m.normals) out.normals4.push_back(to_f4(n));
-        //     }
-        //     // uvs (optional)
-        //     if (!m.uvs.empty()) {
-        //         out.uvs4.reserve(out.uvs4.size() + m.uvs.size());
-        //         for (auto& t : m.uvs) out.uvs4.push_back(cl_float4{t.x, t.y, 0.f, 0.f});
-        //     }
-        //     // triangles
-        //     for (size_t i = 0; i + 2 < m.indices.size(); i += 3) {
-        //         TriGpu tri{};
-        //         tri.i0 = (uint32_t)(m.indices[i+0] + mg.vert_offset);
-        //         tri.i1 = (uint32_t)(m.indices[i+1] + mg.vert_offset);
-        //         tri.i2 = (uint32_t)(m.indices[i+2] + mg.vert_offset);
-        //         tri.material_index = m.material_index;
-        //         out.triangles.push_back(tri);
-        //     }
-        //     out.meshes.push_back(mg);
-        // }
+            out.spheres.push_back(to_gpu(s, add_material(s.get_material_ptr()))); // reuses index if already added
+        }
+        out.world_sphere_count = (cl_int)out.spheres.size();
+        out.flattened_sphere_count = out.spheres.size();
+
+        if (compress_spheres) {
+            if (!bvh_opt.enabled) throw std::runtime_error("Sphere compression needs the host-built BVH");
+            build_sphere_bvh(out, bvh_opt);
+            compress_world_spheres(out);
+        }
+
+        // Planes and boxes
+        out.planes.reserve(src.planes.size());
+        for (const auto& p : src.planes) {
+            PlaneGpu gp{};
+            gp.normal_d       = to_f4(p.get_normal(), glm::dot(p.get_normal(), p.get_point()));
+            gp.emission       = to_f4(p.get_emission());
+            gp.material_index = add_material(p.get_material_ptr());
+            out.planes.push_back(gp);
+        }
+        out.boxes.reserve(src.boxes.size());
+        for (const auto& b : src.boxes) {
+            BoxGpu gb{};
+            gb.bmin           = to_f4(b.get_min());
+            gb.bmax           = to_f4(b.get_max());
+            gb.emission       = to_f4(b.get_emission());
+            gb.material_index = add_material(b.get_material_ptr());
+            out.boxes.push_back(gb);
+        }
+
+        // Instanced groups: each unique group's spheres are packed once, after the world spheres
+        std::unordered_map<const SphereGroup*, int> group_index;
+        std::vector<GroupRange> groups;
+        std::vector<int> group_of;
+        group_of.reserve(src.instances.size());
+        for (const auto& inst : src.instances) {
+            const SphereGroup* key = inst.get_group().get();
+            if (!key) throw std::runtime_error("Instance without a sphere group");
+            auto it = group_index.find(key);
+            if (it == group_index.end()) {
+                GroupRange range{ (int)out.spheres.size(), key->get_spheres_count() };
+                for (const auto& s : key->spheres) {
+                    out.spheres.push_back(to_gpu(s, add_material(s.get_material_ptr())));
+                }
+                it = group_index.emplace(key, (int)groups.size()).first;
+                groups.push_back(range);
+            }
+            group_of.push_back(it->second);
+        }
+
+        if (bvh_opt.enabled && !compress_spheres) build_sphere_bvh(out, bvh_opt);
+        build_instance_bvhs(out, groups, src.instances, group_of, bvh_opt);
 
+        // Meshes
+        std::vector<int> mesh_material;
+        mesh_material.reserve(src.meshes.size());
+        for (const auto& m : src.meshes) mesh_material.push_back(add_material(m->get_material_ptr()));
+        pack_meshes(out, src.meshes, mesh_material, bvh_opt);
+
+        out.revision = src.revision();
         return out;
     }
 
+    // [first, end) index ranges, sorted and with adjacent indices merged
+    using IndexRanges = std::vector<std::pair<size_t, size_t>>;
+
+    inline IndexRanges merge_indices(std::vector<size_t> indices) {
+        std::sort(indices.begin(), indices.end());
+        IndexRanges ranges;
+        for (size_t i : indices) {
+            if (!ranges.empty() && i <= ranges.back().second) ranges.back().second = std::max(ranges.back().second, i + 1);
+            else ranges.push_back({ i, i + 1 });
+        }
+        return ranges;
+    }
 
+    // What repack_edits() changed in a PackedScene, as ranges of ps.spheres / ps.materials
+    struct SceneEdits {
+        IndexRanges spheres;
+        IndexRanges materials;
+        bool camera = false;
 
-    
+        bool empty() const { return spheres.empty() && materials.empty() && !camera; }
+    };
+
+    /*
+    *   Incremental alternative to pack_scene: repacks only the world spheres and materials edited
+    *   since `ps` was packed from `src`, and the camera if it moved. The caller guarantees that
+    *   `src` had no structural change since (Scene::structure_revision() <= ps.revision). The sphere
+    *   BVH is left alone; callers rebuild or refit it when `spheres` is not empty.
+    */
+    inline SceneEdits repack_edits(PackedScene& ps, const Scene& src, const Camera& cam) {
+        SceneEdits edits;
+
+        const CameraGpu camera = to_gpu(cam);
+        if (std::memcmp(&camera, &ps.camera, sizeof(CameraGpu)) != 0) {
+            ps.camera = camera;
+            edits.camera = true;
+        }
+
+        // world spheres are packed first and in order, so scene and packed indices agree
+        std::vector<size_t> dirty;
+        const auto& sphere_rev = src.sphere_revisions();
+        for (size_t i = 0; i < sphere_rev.size(); ++i) {
+            if (sphere_rev[i] <= ps.revision) continue;
+            const Sphere& s = src.spheres[i];
+            ps.spheres[i] = to_gpu(s, ps.spheres[i].material_index); // same material pointer, same index
+            dirty.push_back(i);
+        }
+        edits.spheres = merge_indices(std::move(dirty));
+
+        // a material listed twice in Scene::materials is packed once, so map through material_sources
+        dirty.clear();
+        const auto& material_rev = src.material_revisions();
+        for (size_t i = 0; i < material_rev.size(); ++i) {
+            if (material_rev[i] <= ps.revision) continue;
+            const Material* m = src.materials[i].get();
+            auto it = std::find(ps.material_sources.begin(), ps.material_sources.end(), m);
+            if (it == ps.material_sources.end()) continue; // not referenced by anything packed
+            const size_t idx = size_t(it - ps.material_sources.begin());
+            ps.materials[idx] = to_gpu(*m);
+            dirty.push_back(idx);
+        }
+        edits.materials = merge_indices(std::move(dirty));
+
+        ps.revision = src.revision();
+        return edits;
+    }
 }
 
 
@@ -0,0 +1,140 @@
+#ifndef TIMELINE_HPP
+#define TIMELINE_HPP
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace compute {
+
+    /*
+    *   Run timeline: host phases (scoped timers on any thread) and device commands (OpenCL event
+    *   profiling, see clutils::EventLog), exported as Chrome trace-event JSON for chrome://tracing
+    *   or Perfetto and as a per-phase summary table. Times are microseconds since enable().
+    *   Disabled, a phase costs one branch and nothing is recorded.
+    */
+    class Timeline {
+    public:
+        void enable(bool on) {
+            enabled_ = on;
+            origin_ = std::chrono::steady_clock::now();
+        }
+        bool enabled() const { return enabled_; }
+
+        double now_us() const {
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin_).count();
+        }
+
+        void add_host(const char* name, double start_us, double end_us) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto [it, added] = threads_.emplace(std::this_thread::get_id(), (int)threads_.size() + 1);
+            spans_.push_back({ name, HOST_PID, it->second, start_us, end_us, 0.0, 0.0 });
+        }
+
+        // queued -> submit -> start -> end of one device command, already on the host clock
+        void add_device(std::string name, double queued_us, double submit_us, double start_us, double end_us) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            spans_.push_back({ std::move(name), DEVICE_PID, 1, start_us, end_us, queued_us, submit_us });
+        }
+
+        void write_chrome_trace(const std::string& path) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::ofstream ofs(path);
+            if (!ofs) throw std::runtime_error("Cannot write timeline " + path);
+
+            ofs << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+                << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << HOST_PID << ", \"args\": {\"name\": \"host\"}},\n"
+                << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << DEVICE_PID << ", \"args\": {\"name\": \"device\"}},\n"
+                << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << DEVICE_PID << ", \"tid\": 1, \"args\": {\"name\": \"execute\"}},\n"
+                << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << DEVICE_PID << ", \"tid\": 2, \"args\": {\"name\": \"queued\"}}";
+            for (const Span& s : spans_) {
+                ofs << ",\n{\"name\": \"" << s.name << "\", \"ph\": \"X\", \"pid\": " << s.pid << ", \"tid\": " << s.tid
+                    << ", \"ts\": " << s.start_us << ", \"dur\": " << s.end_us - s.start_us;
+                if (s.pid == DEVICE_PID) {
+                    ofs << ", \"args\": {\"queued_us\": " << s.queued_us << ", \"submit_us\": " << s.submit_us << "}}";
+                    // time between enqueue and execution, on its own track so it does not hide the kernels
+                    ofs << ",\n{\"name\": \"" << s.name << "\", \"ph\": \"X\", \"pid\": " << s.pid << ", \"tid\": 2"
+                        << ", \"ts\": " << s.queued_us << ", \"dur\": " << s.start_us - s.queued_us << "}";
+                } else {
+                    ofs << "}";
+                }
+            }
+            ofs << "\n]}\n";
+        }
+
+        // Totals per phase, host phases first, each sorted by time spent
+        void print_summary(std::ostream& os) const {
+            struct Total { size_t count = 0; double us = 0.0, max_us = 0.0, wait_us = 0.0; };
+            std::map<std::pair<int, std::string>, Total> totals;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (const Span& s : spans_) {
+                    Total& t = totals[{ s.pid, s.name }];
+                    ++t.count;
+                    t.us += s.end_us - s.start_us;
+                    t.max_us = std::max(t.max_us, s.end_us - s.start_us);
+                    if (s.pid == DEVICE_PID) t.wait_us += s.start_us - s.queued_us;
+                }
+            }
+            std::vector<std::pair<std::pair<int, std::string>, Total>> rows(totals.begin(), totals.end());
+            std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {
+                return a.first.first != b.first.first ? a.first.first < b.first.first : a.second.us > b.second.us;
+            });
+
+            const auto flags = os.flags();
+            os << "Timeline summary (ms)\n" << std::left << std::setw(8) << "where" << std::setw(24) << "phase" << std::right
+               << std::setw(8) << "count" << std::setw(12) << "total" << std::setw(10) << "mean"
+               << std::setw(10) << "max" << std::setw(12) << "queued" << "\n";
+            os << std::fixed << std::setprecision(3);
+            for (const auto& [key, t] : rows) {
+                os << std::left << std::setw(8) << (key.first == HOST_PID ? "host" : "device") << std::setw(24) << key.second
+                   << std::right << std::setw(8) << t.count << std::setw(12) << t.us * 1e-3
+                   << std::setw(10) << t.us * 1e-3 / double(t.count) << std::setw(10) << t.max_us * 1e-3;
+                if (key.first == DEVICE_PID) os << std::setw(12) << t.wait_us * 1e-3;
+                os << "\n";
+            }
+            os.flags(flags);
+        }
+
+    private:
+        static constexpr int HOST_PID = 1, DEVICE_PID = 2;
+
+        struct Span {
+            std::string name;
+            int pid, tid;
+            double start_us, end_us;
+            double queued_us, submit_us; // device commands only
+        };
+
+        bool enabled_ = false;
+        std::chrono::steady_clock::time_point origin_ = std::chrono::steady_clock::now();
+        mutable std::mutex mutex_;
+        std::vector<Span> spans_;
+        std::map<std::thread::id, int> threads_;
+    };
+
+    // Records the enclosing scope as a host phase; `name` must outlive the timeline (a literal)
+    class ScopedPhase {
+    public:
+        ScopedPhase(Timeline& timeline, const char* name)
+            : timeline_(timeline.enabled() ? &timeline : nullptr), name_(name),
+              start_us_(timeline_ ? timeline_->now_us() : 0.0) {}
+        ~ScopedPhase() {
+            if (timeline_) timeline_->add_host(name_, start_us_, timeline_->now_us());
+        }
+
+        ScopedPhase(const ScopedPhase&) = delete;
+        ScopedPhase& operator=(const ScopedPhase&) = delete;
+
+    private:
+        Timeline* timeline_;
+        const char* name_;
+        double start_us_;
+    };
+
+}
+
+#endif // TIMELINE_HPP
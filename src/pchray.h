@@ -1,7 +1,10 @@
 #ifndef PCHRAY_H
 #define PCHRAY_H
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <filesystem>
 #include <random>
 #include <iostream>
 #include <limits>